@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ulog.h"
+
+#include "ad5940.h"
+#include "ad5940_fit.h"
+
+/* Fitting benchmark on synthetic spectra of every model, no hardware needed.
+   usage: example_fit [spectra per model] [points per spectrum] */
+
+#define DEF_SPECTRA 20000
+#define DEF_POINTS 50
+#define NOISE_REL 0.005f
+
+/* True parameters are drawn log-uniform between Lo and Hi */
+static const struct
+{
+    uint32_t Model;
+    const char *Name;
+    float Lo[FIT_PARAM_MAX];
+    float Hi[FIT_PARAM_MAX];
+} models[] = {
+    {FITMODEL_RC_PARALLEL, "R||C", {1e3f, 10e-9f}, {10e3f, 1e-6f}},
+    {FITMODEL_RC_SERIES, "R+C", {100.0f, 100e-9f}, {1e3f, 10e-6f}},
+    {FITMODEL_RANDLES, "Randles", {10.0f, 1e3f, 10e-9f}, {100.0f, 10e3f, 1e-6f}},
+    {FITMODEL_RANDLES_W, "Randles+W", {10.0f, 1e3f, 10e-9f, 1e3f}, {100.0f, 10e3f, 1e-6f, 10e3f}},
+};
+
+static float frand(void)
+{
+    return rand() / (float)RAND_MAX;
+}
+
+static float gauss(void)
+{
+    float u = frand() + 1e-7f, v = frand();
+    return sqrtf(-2.0f * logf(u)) * cosf(2.0f * (float)M_PI * v);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Fit the same spectra with 1, 2, 4... threads up to one per CPU */
+static void bench_model(uint32_t m, const float *freq, uint32_t points, uint32_t spectra,
+                        uint32_t cpus, float (*truth)[FIT_PARAM_MAX], fImpCar_Type *imp,
+                        FitJob_Type *jobs)
+{
+    uint32_t n = ad5940_FitParamCnt(models[m].Model);
+    uint32_t i, k, threads;
+
+    srand(1);
+    for (i = 0; i < spectra; i++)
+    {
+        for (k = 0; k < n; k++)
+            truth[i][k] = models[m].Lo[k] * powf(models[m].Hi[k] / models[m].Lo[k], frand());
+        for (k = 0; k < points; k++)
+        {
+            fImpCar_Type *z = &imp[(size_t)i * points + k];
+            ad5940_FitModelEval(models[m].Model, truth[i], freq[k], z);
+            z->Real *= 1.0f + NOISE_REL * gauss();
+            z->Image *= 1.0f + NOISE_REL * gauss();
+        }
+    }
+
+    for (threads = 1;; threads *= 2)
+    {
+        uint32_t stalled = 0, failed = 0;
+        double t0, t1, err, err_max = 0;
+
+        if (threads > cpus)
+            threads = cpus;
+        for (i = 0; i < spectra; i++)
+        {
+            jobs[i] = (FitJob_Type){
+                .Model = models[m].Model,
+                .pFreq = freq,
+                .pImp = &imp[(size_t)i * points],
+                .Count = points,
+            };
+        }
+
+        t0 = now();
+        ad5940_FitBatch(jobs, spectra, threads);
+        t1 = now();
+
+        for (i = 0; i < spectra; i++)
+        {
+            if (jobs[i].Status < 0 || !(jobs[i].Converged || jobs[i].Stalled))
+            {
+                failed++;
+                continue;
+            }
+            if (jobs[i].Stalled)
+                stalled++;
+            for (k = 0; k < n; k++)
+            {
+                err = fabs(jobs[i].Param[k] / truth[i][k] - 1.0);
+                if (err > err_max)
+                    err_max = err;
+            }
+        }
+        log_info("%-9s threads %2u: %.0f fits/s (%.2fs), %u stalled, %u not converged, max parameter error %.2f%%",
+                 models[m].Name, threads, spectra / (t1 - t0), t1 - t0, stalled, failed, err_max * 100);
+
+        if (threads >= cpus)
+            break;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t spectra = argc > 1 ? (uint32_t)atoi(argv[1]) : DEF_SPECTRA;
+    uint32_t points = argc > 2 ? (uint32_t)atoi(argv[2]) : DEF_POINTS;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    float *freq, (*truth)[FIT_PARAM_MAX];
+    fImpCar_Type *imp;
+    FitJob_Type *jobs;
+    uint32_t k, m;
+
+    ulog_set_level(LOG_INFO);
+    if (cpus < 1)
+        cpus = 1;
+
+    if (spectra == 0 || points < FIT_PARAM_MAX)
+    {
+        fprintf(stderr, "usage: example_fit [spectra per model] [points >= %d]\n", FIT_PARAM_MAX);
+        return 1;
+    }
+
+    freq = malloc(points * sizeof(float));
+    truth = malloc(spectra * sizeof(*truth));
+    imp = malloc((size_t)spectra * points * sizeof(fImpCar_Type));
+    jobs = malloc(spectra * sizeof(FitJob_Type));
+    if (!freq || !truth || !imp || !jobs)
+        return 1;
+
+    /* Log sweep 1Hz..100kHz */
+    for (k = 0; k < points; k++)
+        freq[k] = powf(10.0f, 5.0f * k / (points - 1));
+
+    log_info("%u spectra per model, %u points, %ld CPUs", spectra, points, cpus);
+    for (m = 0; m < sizeof(models) / sizeof(models[0]); m++)
+        bench_model(m, freq, points, spectra, (uint32_t)cpus, truth, imp, jobs);
+
+    free(freq);
+    free(truth);
+    free(imp);
+    free(jobs);
+    return 0;
+}
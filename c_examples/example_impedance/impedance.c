@@ -1,8 +1,32 @@
 #include "impedance.h"
+#include "ad5940_spectrum.h"
+#include "ad5940_multitone.h"
+#include "ad5940_math.h"
+#include "ad5940_stat.h"
+#include "ad5940_adapt.h"
+#include "ad5940_autorange.h"
+#include "ad5940_settle.h"
+#include "ad5940_monitor.h"
+#include "ad5940_timing.h"
+#include "ad5940_seqcache.h"
 #include "ulog.h"
 
 #define ADC_PP_MAX (809)
 #define DFT_LOOP_MAX 10
+#define SPECTRUM_HARMONICS 5
+#define HSDAC_UPDATE_RATE 7
+#define MULTITONE_F0 100.0
+#define MULTITONE_N 1024
+#define MULTITONE_SKIP 16
+#define ADAPT_PILOT_CNT 8
+#define ADAPT_PILOT_DFTNUM DFTNUM_1024
+#define AUTORANGE_PROBE_DFTNUM DFTNUM_1024
+#define RTIA_CACHE_SIZE 32
+#define HP_MODE_FREQ 80000.0
+#define APP_FREQ_MAX 200000.0
+#define ADC_AVG_NUM ADCAVGNUM_16
+#define ADC_BP_NOTCH true
+#define SETTLE_SEQ_CMDS 4 /* SEQ_WAITs for one settling time, each up to 2^30 clocks */
 
 app_impedance_t app_cfg =
     {
@@ -10,6 +34,7 @@ app_impedance_t app_cfg =
         .AdcClkFreq = 16000000.0,
         .RcalVal = 10000.0,
         .HstiaRtiaSel = HSTIARTIA_5K,
+        .ADCPga = ADCPGA_1,
         .CtiaSel = 16,
         .VoutPP = 600,
         .SinFreq = 1000.0,
@@ -17,8 +42,30 @@ app_impedance_t app_cfg =
         .ADCSinc2Osr = ADCSINC2OSR_22,
         .DftNum = DFTNUM_8192,
         .DftSrc = DFTSRC_SINC3,
+        .Profile = APP_PROFILE_NORMAL,
 };
 
+static float adaptNoiseTime; /* worse of the two channels, from app_adapt_pilot */
+static float adaptAmplitude; /* weaker of the two channels at the last point */
+static fImpCar_Type probeCurr, probeVolt; /* last app_autorange probe */
+static app_impedance_t probeCfg;          /* settings of that probe */
+
+static struct
+{
+    uint32_t RtiaSel;
+    float Freq;
+    fImpCar_Type Value;
+    bool Valid;
+} rtiaCache[RTIA_CACHE_SIZE];
+static uint32_t rtiaCacheNext;
+static SettleTime_Type settleTime; /* for the configuration set by app_ad_init */
+
+/* The ADC runs at 1.6MHz only from a 32MHz clock */
+static uint32_t adcRate(void)
+{
+    return app_cfg.AdcClkFreq > 32000000 * 0.8 ? ADCRATE_1P6MHZ : ADCRATE_800KHZ;
+}
+
 int app_get_cfg(void *pCfg)
 {
     if (pCfg)
@@ -29,12 +76,22 @@ int app_get_cfg(void *pCfg)
     return AD5940ERR_PARA;
 }
 
-int measureDft(struct ad5940_dev *dev, fImpCar_Type *pDftResult)
+int measureDft(struct ad5940_dev *dev, const SettleTime_Type *pSettle, fImpCar_Type *pDftResult)
 {
+    struct timespec deadline;
     int ret = ad5940_AFECtrlS(dev, AFECTRL_WG | AFECTRL_ADCPWR, true);
+    ad5940_SettleStart(&deadline, pSettle->Analog);
     ret |= ad5940_WriteReg(dev, REG_AFE_DFTREAL, 0);
     ret |= ad5940_WriteReg(dev, REG_AFE_DFTIMAG, 0);
-    ret |= ad5940_AFECtrlS(dev, AFECTRL_ADCCNV | AFECTRL_DFT, true);
+    if (ret < 0)
+        return ret;
+    ad5940_SettleWait(&deadline);
+    ret = ad5940_AFECtrlS(dev, AFECTRL_ADCCNV, true);
+    ad5940_SettleStart(&deadline, pSettle->Filter);
+    if (ret < 0)
+        return ret;
+    ad5940_SettleWait(&deadline);
+    ret = ad5940_AFECtrlS(dev, AFECTRL_DFT, true);
     if (ret < 0)
         return ret;
     int loopCnt = 0;
@@ -81,18 +138,9 @@ fImpCar_Type computeImpedance(fImpCar_Type *pDftCurr, fImpCar_Type *pDftVolt)
     return res;
 }
 
-int app_ad_init(struct ad5940_dev *dev)
+static uint32_t excitationGain(uint32_t *pExcitBuffGain, uint32_t *pHsDacGain)
 {
-    AFERefCfg_Type aferef_cfg;
-    HSLoopCfg_Type hs_loop;
-    DSPCfg_Type dsp_cfg;
-    bool bADCClk32MHzMode;
-    int ret = 0;
-    uint32_t ExcitBuffGain = EXCITBUFGAIN_2;
-    uint32_t HsDacGain = HSDACGAIN_1;
     uint32_t WgAmpWord;
-    if (app_cfg.AdcClkFreq > (32000000 * 0.8))
-        bADCClk32MHzMode = true;
     uint32_t ExcitVoltMax = 1800 * 0.8;
     if (app_cfg.VoutPP > ExcitVoltMax)
     {
@@ -100,30 +148,79 @@ int app_ad_init(struct ad5940_dev *dev)
     }
     if (app_cfg.VoutPP <= ADC_PP_MAX * 0.05)
     {
-        ExcitBuffGain = EXCITBUFGAIN_0P25;
-        HsDacGain = HSDACGAIN_0P2;
+        *pExcitBuffGain = EXCITBUFGAIN_0P25;
+        *pHsDacGain = HSDACGAIN_0P2;
         WgAmpWord = (uint32_t)((app_cfg.VoutPP * 2047) / (ADC_PP_MAX * 0.05));
     }
     else if (app_cfg.VoutPP <= ADC_PP_MAX * 0.25)
     {
-        ExcitBuffGain = EXCITBUFGAIN_0P25;
-        HsDacGain = HSDACGAIN_1;
+        *pExcitBuffGain = EXCITBUFGAIN_0P25;
+        *pHsDacGain = HSDACGAIN_1;
         WgAmpWord = (uint32_t)((app_cfg.VoutPP * 2047) / (ADC_PP_MAX * 0.25));
     }
     else if (app_cfg.VoutPP <= ADC_PP_MAX * 0.4)
     {
-        ExcitBuffGain = EXCITBUFGAIN_2;
-        HsDacGain = HSDACGAIN_0P2;
+        *pExcitBuffGain = EXCITBUFGAIN_2;
+        *pHsDacGain = HSDACGAIN_0P2;
         WgAmpWord = (uint32_t)((app_cfg.VoutPP * 2047) / (ADC_PP_MAX * 0.4));
     }
     else
     {
-        ExcitBuffGain = EXCITBUFGAIN_2;
-        HsDacGain = HSDACGAIN_1;
+        *pExcitBuffGain = EXCITBUFGAIN_2;
+        *pHsDacGain = HSDACGAIN_1;
         WgAmpWord = (uint32_t)((app_cfg.VoutPP * 2047) / (ADC_PP_MAX * 2));
     }
     if (WgAmpWord > 0x7ff)
         WgAmpWord = 0x7ff;
+    return WgAmpWord;
+}
+
+/* Settling of the path app_ad_config sets up */
+static int app_settle_update(SettleTime_Type *pSettle)
+{
+    SettleCfg_Type settle_cfg = {0};
+    settle_cfg.ADCRate = adcRate();
+    settle_cfg.ADCSinc3Osr = app_cfg.ADCSinc3Osr;
+    settle_cfg.ADCSinc2Osr = app_cfg.ADCSinc2Osr;
+    settle_cfg.ADCAvgNum = ADC_AVG_NUM;
+    settle_cfg.DftSrc = app_cfg.DftSrc;
+    settle_cfg.Sinc2NotchEn = !ADC_BP_NOTCH;
+    settle_cfg.Freq = app_cfg.SinFreq;
+    settle_cfg.Rtia = ad5940_HSRtiaNominal(app_cfg.HstiaRtiaSel);
+    settle_cfg.CtiaPf = app_cfg.CtiaSel;
+    settle_cfg.LoadTau = app_cfg.LoadTau;
+    settle_cfg.TargetRelErr = app_cfg.TargetRelErr;
+    int ret = ad5940_SettleTime(&settle_cfg, pSettle);
+    if (ret < 0)
+        return ret;
+    log_debug("settle %.1fHz: analog %.1fus, filter %.1fus", app_cfg.SinFreq,
+              pSettle->Analog * 1e6f, pSettle->Filter * 1e6f);
+    return ret;
+}
+
+/* The high speed profile stays in high power mode, otherwise only signals above 80kHz need it */
+static bool highPower(void)
+{
+    return app_cfg.Profile == APP_PROFILE_FAST || app_cfg.SinFreq > HP_MODE_FREQ;
+}
+
+static int app_ad_power(struct ad5940_dev *dev, bool HighPower)
+{
+    if (HighPower)
+        return ad5940_AFEPwrBW(dev, AFEPWR_HP, AFEBW_250KHZ);
+    return ad5940_AFEPwrBW(dev, AFEPWR_LP, AFEBW_100KHZ);
+}
+
+/* Everything app_ad_init sets up that the sequencer generator can record */
+static int app_ad_config(struct ad5940_dev *dev)
+{
+    AFERefCfg_Type aferef_cfg;
+    HSLoopCfg_Type hs_loop;
+    DSPCfg_Type dsp_cfg;
+    int ret = 0;
+    uint32_t ExcitBuffGain, HsDacGain;
+    uint32_t WgAmpWord;
+    WgAmpWord = excitationGain(&ExcitBuffGain, &HsDacGain);
     aferef_cfg.HpBandgapEn = true;
     aferef_cfg.Hp1V1BuffEn = true;
     aferef_cfg.Hp1V8BuffEn = true;
@@ -139,7 +236,7 @@ int app_ad_init(struct ad5940_dev *dev)
     ret |= ad5940_REFCfgS(dev, &aferef_cfg);
     hs_loop.HsDacCfg.ExcitBufGain = ExcitBuffGain;
     hs_loop.HsDacCfg.HsDacGain = HsDacGain;
-    hs_loop.HsDacCfg.HsDacUpdateRate = 7;
+    hs_loop.HsDacCfg.HsDacUpdateRate = HSDAC_UPDATE_RATE;
     hs_loop.HsTiaCfg.DiodeClose = false;
     hs_loop.HsTiaCfg.HstiaBias = HSTIABIAS_1P1;
     hs_loop.HsTiaCfg.HstiaCtia = app_cfg.CtiaSel;
@@ -160,14 +257,14 @@ int app_ad_init(struct ad5940_dev *dev)
     ret |= ad5940_HSLoopCfgS(dev, &hs_loop);
     dsp_cfg.ADCBaseCfg.ADCMuxN = ADCMUXN_HSTIA_N;
     dsp_cfg.ADCBaseCfg.ADCMuxP = ADCMUXP_HSTIA_P;
-    dsp_cfg.ADCBaseCfg.ADCPga = ADCPGA_1;
+    dsp_cfg.ADCBaseCfg.ADCPga = app_cfg.ADCPga;
     memset(&dsp_cfg.ADCDigCompCfg, 0, sizeof(dsp_cfg.ADCDigCompCfg));
-    dsp_cfg.ADCFilterCfg.ADCAvgNum = ADCAVGNUM_16;
-    dsp_cfg.ADCFilterCfg.ADCRate = bADCClk32MHzMode ? ADCRATE_1P6MHZ : ADCRATE_800KHZ;
+    dsp_cfg.ADCFilterCfg.ADCAvgNum = ADC_AVG_NUM;
+    dsp_cfg.ADCFilterCfg.ADCRate = adcRate();
     dsp_cfg.ADCFilterCfg.ADCSinc2Osr = app_cfg.ADCSinc2Osr;
     dsp_cfg.ADCFilterCfg.ADCSinc3Osr = app_cfg.ADCSinc3Osr;
     dsp_cfg.ADCFilterCfg.BpSinc3 = false;
-    dsp_cfg.ADCFilterCfg.BpNotch = true;
+    dsp_cfg.ADCFilterCfg.BpNotch = ADC_BP_NOTCH;
     dsp_cfg.ADCFilterCfg.Sinc2NotchEnable = true;
     dsp_cfg.DftCfg.DftNum = app_cfg.DftNum;
     dsp_cfg.DftCfg.DftSrc = app_cfg.DftSrc;
@@ -182,26 +279,45 @@ int app_ad_init(struct ad5940_dev *dev)
     return ret;
 }
 
-int app_measure(struct ad5940_dev *dev, fImpCar_Type *pImpedance)
+int app_ad_init(struct ad5940_dev *dev)
+{
+    int ret = app_ad_power(dev, highPower());
+    ret |= app_ad_config(dev);
+    ret |= app_settle_update(&settleTime);
+    return ret;
+}
+
+/* Load connected, ADC on the current channel */
+static int currentPath(struct ad5940_dev *dev)
 {
-    int ret = 0;
     SWMatrixCfg_Type sw_cfg;
-    fImpCar_Type dftCurr, dftVolt;
     sw_cfg.Dswitch = SWD_CE0;
     sw_cfg.Pswitch = SWP_RE0;
     sw_cfg.Nswitch = SWN_SE0;
     sw_cfg.Tswitch = SWT_SE0LOAD | SWT_TRTIA;
-    ret |= ad5940_SWMatrixCfgS(dev, &sw_cfg);
+    int ret = ad5940_SWMatrixCfgS(dev, &sw_cfg);
     ret |= ad5940_ADCMuxCfgS(dev, ADCMUXP_HSTIA_P, ADCMUXN_HSTIA_N);
+    return ret;
+}
+
+/* Current then voltage DFT. Armed: a plan block already set up the current
+   path, started the excitation and spent the analog settling time in the
+   sequencer. */
+static int measurePair(struct ad5940_dev *dev, const SettleTime_Type *pSettle, bool Armed,
+                       fImpCar_Type *pDftCurr, fImpCar_Type *pDftVolt)
+{
+    SettleTime_Type settled = {.Analog = 0, .Filter = pSettle->Filter};
+    SWMatrixCfg_Type sw_cfg;
+    int ret = Armed ? 0 : currentPath(dev);
     if (ret < 0)
         return ret;
-    ret = measureDft(dev, &dftCurr);
+    ret = measureDft(dev, Armed ? &settled : pSettle, pDftCurr);
     if (ret < 0)
         return ret;
     ret |= ad5940_ADCMuxCfgS(dev, ADCMUXP_VCE0, ADCMUXN_N_NODE);
     if (ret < 0)
         return ret;
-    ret = measureDft(dev, &dftVolt);
+    ret = measureDft(dev, pSettle, pDftVolt);
     if (ret < 0)
         return ret;
     sw_cfg.Dswitch = SWD_OPEN;
@@ -209,10 +325,22 @@ int app_measure(struct ad5940_dev *dev, fImpCar_Type *pImpedance)
     sw_cfg.Nswitch = SWN_NL | SWN_NL2;
     sw_cfg.Tswitch = SWT_TRTIA;
     ret |= ad5940_SWMatrixCfgS(dev, &sw_cfg);
-    dftCurr.Real = -dftCurr.Real;
-    dftCurr.Image = -dftCurr.Image;
-    dftVolt.Real = dftVolt.Real;
-    dftVolt.Image = dftVolt.Image;
+    pDftCurr->Real = -pDftCurr->Real;
+    pDftCurr->Image = -pDftCurr->Image;
+    return ret;
+}
+
+int app_measure_dft(struct ad5940_dev *dev, fImpCar_Type *pDftCurr, fImpCar_Type *pDftVolt)
+{
+    return measurePair(dev, &settleTime, false, pDftCurr, pDftVolt);
+}
+
+int app_measure(struct ad5940_dev *dev, fImpCar_Type *pImpedance)
+{
+    fImpCar_Type dftCurr, dftVolt;
+    int ret = app_measure_dft(dev, &dftCurr, &dftVolt);
+    if (ret < 0)
+        return ret;
     fImpCar_Type impedance = computeImpedance(&dftCurr, &dftVolt);
     float magnitude = ad5940_ComplexMagFloat(&impedance);
     float phase = ad5940_ComplexPhaseFloat(&impedance);
@@ -225,6 +353,12 @@ int app_measure(struct ad5940_dev *dev, fImpCar_Type *pImpedance)
     return ret;
 }
 
+int app_compute_sweep(const fImpCarArray_Type *pCurr, const fImpCarArray_Type *pVolt,
+                      const fImpCarArray_Type *pRtia, fImpPolArray_Type *pImpedance, uint32_t Count)
+{
+    return ad5940_ImpedanceArray(pCurr, pVolt, pRtia, Count, pImpedance, Count);
+}
+
 int app_RTIA_cal(struct ad5940_dev *dev)
 {
     HSRTIACal_Type hsrtia_cal = {0};
@@ -246,3 +380,615 @@ int app_RTIA_cal(struct ad5940_dev *dev)
     hsrtia_cal.fFreq = app_cfg.SinFreq;
     return ad5940_HSRtiaCal(dev, &hsrtia_cal, &app_cfg.RtiaCurrValue);
 }
+
+int app_spectrum(struct ad5940_dev *dev, uint32_t N)
+{
+    FFTPlan_Type plan;
+    SWMatrixCfg_Type sw_cfg;
+    float *samples = NULL, *re = NULL, *im = NULL, *mag = NULL;
+    float fs, bin_hz, harm_pwr = 0;
+    uint32_t h, k, fund_bin = 0;
+    int ret = ad5940_FFTInit(&plan, N);
+    if (ret < 0)
+        return ret;
+    samples = malloc(N * sizeof(float));
+    re = malloc((N / 2 + 1) * sizeof(float));
+    im = malloc((N / 2 + 1) * sizeof(float));
+    mag = malloc((N / 2 + 1) * sizeof(float));
+    if (!samples || !re || !im || !mag)
+    {
+        ret = AD5940ERR_BUFF;
+        goto out;
+    }
+    sw_cfg.Dswitch = SWD_CE0;
+    sw_cfg.Pswitch = SWP_RE0;
+    sw_cfg.Nswitch = SWN_SE0;
+    sw_cfg.Tswitch = SWT_SE0LOAD | SWT_TRTIA;
+    ret |= ad5940_SWMatrixCfgS(dev, &sw_cfg);
+    ret |= ad5940_ADCMuxCfgS(dev, ADCMUXP_HSTIA_P, ADCMUXN_HSTIA_N);
+    ret |= ad5940_AFECtrlS(dev, AFECTRL_WG, true);
+    if (ret < 0)
+        goto out;
+    ret = ad5940_CaptureWaveform(dev, FIFOSRC_SINC2NOTCH, N, samples);
+    ret |= ad5940_AFECtrlS(dev, AFECTRL_WG, false);
+    sw_cfg.Dswitch = SWD_OPEN;
+    sw_cfg.Pswitch = SWP_PL | SWP_PL2;
+    sw_cfg.Nswitch = SWN_NL | SWN_NL2;
+    sw_cfg.Tswitch = SWT_TRTIA;
+    ret |= ad5940_SWMatrixCfgS(dev, &sw_cfg);
+    if (ret < 0)
+        goto out;
+    ad5940_FFTWindow(&plan, samples, samples);
+    ad5940_FFTReal(&plan, samples, re, im);
+    ad5940_FFTMagnitude(&plan, re, im, mag);
+    fs = ad5940_ADCSampleRate(adcRate(),
+                              app_cfg.ADCSinc3Osr, app_cfg.ADCSinc2Osr, true);
+    bin_hz = fs / N;
+    for (k = 1; k <= N / 2; k++)
+    {
+        if (mag[k] > mag[fund_bin])
+            fund_bin = k;
+    }
+    log_info("spectrum fs=%.1fHz bin=%.2fHz fundamental %.1fHz amplitude %.1f LSB",
+             fs, bin_hz, fund_bin * bin_hz, mag[fund_bin]);
+    for (h = 2; h <= SPECTRUM_HARMONICS && h * fund_bin <= N / 2; h++)
+    {
+        log_info("harmonic %u %.1fHz amplitude %.2f LSB", h, h * fund_bin * bin_hz, mag[h * fund_bin]);
+        harm_pwr += mag[h * fund_bin] * mag[h * fund_bin];
+    }
+    if (fund_bin && mag[fund_bin] > 0)
+        log_info("THD %.1fdB", 10 * log10f(harm_pwr / (mag[fund_bin] * mag[fund_bin])));
+out:
+    free(samples);
+    free(re);
+    free(im);
+    free(mag);
+    ad5940_FFTFree(&plan);
+    return ret;
+}
+
+int app_multitone(struct ad5940_dev *dev)
+{
+    static const uint32_t harmonics[] = {1, 2, 3, 5, 8, 13, 21, 34, 55, 89};
+    const uint32_t tone_cnt = sizeof(harmonics) / sizeof(harmonics[0]);
+    MultiToneCfg_Type mt_cfg = {0};
+    MultiToneResult_Type res[sizeof(harmonics) / sizeof(harmonics[0])];
+    WGCfg_Type wg_cfg = {0};
+    SWMatrixCfg_Type sw_cfg;
+    uint32_t ExcitBuffGain, HsDacGain, WgAmpWord, updates, k;
+    float *curr = NULL, *volt = NULL;
+    int ret = 0;
+
+    /* Asymmetric trapezoid (45% low, 55% high) so even harmonics carry energy too */
+    WgAmpWord = excitationGain(&ExcitBuffGain, &HsDacGain);
+    updates = (uint32_t)(app_cfg.SysClkFreq / (HSDAC_UPDATE_RATE * MULTITONE_F0));
+    wg_cfg.WgType = WGTYPE_TRAPZ;
+    wg_cfg.TrapzCfg.WGTrapzDCLevel1 = 0x800 - WgAmpWord;
+    wg_cfg.TrapzCfg.WGTrapzDCLevel2 = 0x800 + WgAmpWord;
+    wg_cfg.TrapzCfg.WGTrapzSlope1 = updates / 20;
+    wg_cfg.TrapzCfg.WGTrapzSlope2 = updates / 20;
+    wg_cfg.TrapzCfg.WGTrapzDelay1 = updates * 4 / 10;
+    wg_cfg.TrapzCfg.WGTrapzDelay2 = updates - wg_cfg.TrapzCfg.WGTrapzDelay1 - 2 * (updates / 20);
+
+    mt_cfg.SysClkFreq = app_cfg.SysClkFreq;
+    mt_cfg.HsDacUpdateRate = HSDAC_UPDATE_RATE;
+    mt_cfg.Trapz = wg_cfg.TrapzCfg;
+    mt_cfg.SampleRate = ad5940_ADCSampleRate(adcRate(),
+                                             app_cfg.ADCSinc3Osr, app_cfg.ADCSinc2Osr, true);
+    mt_cfg.N = MULTITONE_N;
+    mt_cfg.Skip = MULTITONE_SKIP;
+    mt_cfg.pHarmonics = harmonics;
+    mt_cfg.ToneCnt = tone_cnt;
+    mt_cfg.MinRelAmp = 0.01f;
+
+    curr = malloc(MULTITONE_N * sizeof(float));
+    volt = malloc(MULTITONE_N * sizeof(float));
+    if (!curr || !volt)
+    {
+        ret = AD5940ERR_BUFF;
+        goto out;
+    }
+
+    ret |= ad5940_WGCfgS(dev, &wg_cfg);
+    sw_cfg.Dswitch = SWD_CE0;
+    sw_cfg.Pswitch = SWP_RE0;
+    sw_cfg.Nswitch = SWN_SE0;
+    sw_cfg.Tswitch = SWT_SE0LOAD | SWT_TRTIA;
+    ret |= ad5940_SWMatrixCfgS(dev, &sw_cfg);
+    ret |= ad5940_ADCMuxCfgS(dev, ADCMUXP_HSTIA_P, ADCMUXN_HSTIA_N);
+    if (ret < 0)
+        goto out;
+    ret = ad5940_CaptureWaveformSync(dev, FIFOSRC_SINC2NOTCH, MULTITONE_N, AFECTRL_WG, curr);
+    if (ret < 0)
+        goto out;
+    ret |= ad5940_ADCMuxCfgS(dev, ADCMUXP_VCE0, ADCMUXN_N_NODE);
+    if (ret < 0)
+        goto out;
+    ret = ad5940_CaptureWaveformSync(dev, FIFOSRC_SINC2NOTCH, MULTITONE_N, AFECTRL_WG, volt);
+    sw_cfg.Dswitch = SWD_OPEN;
+    sw_cfg.Pswitch = SWP_PL | SWP_PL2;
+    sw_cfg.Nswitch = SWN_NL | SWN_NL2;
+    sw_cfg.Tswitch = SWT_TRTIA;
+    ret |= ad5940_SWMatrixCfgS(dev, &sw_cfg);
+    if (ret < 0)
+        goto out;
+
+    ret = ad5940_MultiToneAnalyze(&mt_cfg, curr, volt, res);
+    if (ret < 0)
+        goto out;
+    for (k = 0; k < tone_cnt; k++)
+    {
+        if (!res[k].Valid)
+        {
+            log_info("tone %.1fHz skipped, too weak or above Nyquist", res[k].Freq);
+            continue;
+        }
+        res[k].Curr.Real = -res[k].Curr.Real;
+        res[k].Curr.Image = -res[k].Curr.Image;
+        fImpCar_Type impedance = computeImpedance(&res[k].Curr, &res[k].Volt);
+        log_info("tone %.1fHz impedance magnitude=%.2f phase=%.2f", res[k].Freq,
+                 ad5940_ComplexMagFloat(&impedance), ad5940_ComplexPhaseFloat(&impedance));
+    }
+out:
+    free(curr);
+    free(volt);
+    return ret;
+}
+
+int app_dc_stat(struct ad5940_dev *dev, uint32_t Samples)
+{
+    StatResult_Type res;
+    int ret = ad5940_ADCMuxCfgS(dev, ADCMUXP_HSTIA_P, ADCMUXN_HSTIA_N);
+    if (ret < 0)
+        return ret;
+    ret = ad5940_StatMeasure(dev, Samples, STATDEV_25, &res);
+    if (ret < 0)
+        return ret;
+    log_info("dc %s: %u samples mean=%.2f LSB noise=%.3f LSB rms", res.OnChip ? "on-chip" : "raw",
+             res.Samples, res.Mean, sqrtf(res.Variance));
+    return ret;
+}
+
+int app_adapt_pilot(struct ad5940_dev *dev)
+{
+    fImpCar_Type curr[ADAPT_PILOT_CNT], volt[ADAPT_PILOT_CNT];
+    uint32_t dftNum = app_cfg.DftNum;
+    float obsTime, noiseCurr, noiseVolt;
+    int ret;
+    app_cfg.DftNum = ADAPT_PILOT_DFTNUM;
+    ret = app_ad_init(dev);
+    for (int i = 0; i < ADAPT_PILOT_CNT && ret >= 0; i++)
+        ret |= app_measure_dft(dev, &curr[i], &volt[i]);
+    app_cfg.DftNum = dftNum;
+    if (ret < 0)
+        return ret;
+    obsTime = ad5940_AdaptObsTime(adcRate(),
+                                  app_cfg.DftSrc, app_cfg.ADCSinc3Osr, app_cfg.ADCSinc2Osr, ADAPT_PILOT_DFTNUM);
+    noiseCurr = ad5940_AdaptNoiseTime(curr, ADAPT_PILOT_CNT, ADAPT_PILOT_DFTNUM, obsTime);
+    noiseVolt = ad5940_AdaptNoiseTime(volt, ADAPT_PILOT_CNT, ADAPT_PILOT_DFTNUM, obsTime);
+    adaptNoiseTime = fmaxf(noiseCurr, noiseVolt);
+    adaptAmplitude = fminf(ad5940_AdaptAmplitude(&curr[0], ADAPT_PILOT_DFTNUM),
+                           ad5940_AdaptAmplitude(&volt[0], ADAPT_PILOT_DFTNUM));
+    log_info("adapt pilot: noise current=%.3g voltage=%.3g, amplitude %.3g", noiseCurr, noiseVolt, adaptAmplitude);
+    return ret;
+}
+
+int app_adapt_select(struct ad5940_dev *dev)
+{
+    AdaptCfg_Type adapt_cfg = {0};
+    AdaptChoice_Type choice;
+    adapt_cfg.SysClkFreq = app_cfg.SysClkFreq;
+    adapt_cfg.AdcClkFreq = app_cfg.AdcClkFreq;
+    adapt_cfg.ADCRate = adcRate();
+    adapt_cfg.TargetRelErr = app_cfg.TargetRelErr;
+    adapt_cfg.NoiseTime = adaptNoiseTime;
+    adapt_cfg.MinDftNum = DFTNUM_64;
+    adapt_cfg.MaxDftNum = DFTNUM_16384;
+    int ret = ad5940_AdaptChoose(dev, &adapt_cfg, app_cfg.SinFreq, adaptAmplitude, &choice);
+    if (ret < 0)
+        return ret;
+    app_cfg.DftSrc = choice.DftSrc;
+    app_cfg.DftNum = choice.DftNum;
+    app_cfg.ADCSinc3Osr = choice.ADCSinc3Osr;
+    app_cfg.ADCSinc2Osr = choice.ADCSinc2Osr;
+    log_debug("adapt %.1fHz: %u point DFT on %s, %.1fms, error %.2e", app_cfg.SinFreq, 4u << choice.DftNum,
+              choice.DftSrc == DFTSRC_SINC3 ? "SINC3" : "SINC2", choice.ConvTime * 1000, choice.RelErr);
+    return ret;
+}
+
+/* Amplitude of a DFT pair taken with the settings in pMeasCfg, scaled to the
+   RTIA, PGA and excitation currently in app_cfg */
+void app_adapt_update(const fImpCar_Type *pDftCurr, const fImpCar_Type *pDftVolt,
+                      const app_impedance_t *pMeasCfg)
+{
+    float gain = ad5940_ADCPgaGain(app_cfg.ADCPga) / ad5940_ADCPgaGain(pMeasCfg->ADCPga) *
+                 app_cfg.VoutPP / pMeasCfg->VoutPP;
+    float curr = ad5940_AdaptAmplitude(pDftCurr, pMeasCfg->DftNum) * gain *
+                 ad5940_HSRtiaNominal(app_cfg.HstiaRtiaSel) / ad5940_HSRtiaNominal(pMeasCfg->HstiaRtiaSel);
+    float volt = ad5940_AdaptAmplitude(pDftVolt, pMeasCfg->DftNum) * gain;
+    adaptAmplitude = fminf(curr, volt);
+}
+
+int app_RTIA_cal_cached(struct ad5940_dev *dev)
+{
+    for (int i = 0; i < RTIA_CACHE_SIZE; i++)
+    {
+        if (rtiaCache[i].Valid && rtiaCache[i].RtiaSel == app_cfg.HstiaRtiaSel &&
+            rtiaCache[i].Freq == app_cfg.SinFreq)
+        {
+            app_cfg.RtiaCurrValue = rtiaCache[i].Value;
+            return AD5940ERR_OK;
+        }
+    }
+    int ret = app_RTIA_cal(dev);
+    if (ret < 0)
+        return ret;
+    rtiaCache[rtiaCacheNext].RtiaSel = app_cfg.HstiaRtiaSel;
+    rtiaCache[rtiaCacheNext].Freq = app_cfg.SinFreq;
+    rtiaCache[rtiaCacheNext].Value = app_cfg.RtiaCurrValue;
+    rtiaCache[rtiaCacheNext].Valid = true;
+    rtiaCacheNext = (rtiaCacheNext + 1) % RTIA_CACHE_SIZE;
+    return ret;
+}
+
+int app_autorange(struct ad5940_dev *dev)
+{
+    AutoRangeCfg_Type range_cfg = {0};
+    AutoRange_Type range;
+    fImpCar_Type dftCurr, dftVolt;
+    uint32_t dftNum = app_cfg.DftNum;
+    int ret;
+
+    /* Probe on the smallest RTIA and PGA 1 so that nothing saturates */
+    app_cfg.HstiaRtiaSel = HSTIARTIA_200;
+    app_cfg.ADCPga = ADCPGA_1;
+    if (app_cfg.DftNum > AUTORANGE_PROBE_DFTNUM)
+        app_cfg.DftNum = AUTORANGE_PROBE_DFTNUM;
+    ret = app_ad_init(dev);
+    if (ret >= 0)
+        ret = app_measure_dft(dev, &dftCurr, &dftVolt);
+    if (ret >= 0)
+        probeCfg = app_cfg;
+    app_cfg.DftNum = dftNum;
+    if (ret < 0)
+        return ret;
+    probeCurr = dftCurr;
+    probeVolt = dftVolt;
+    if (ad5940_ComplexMagFloat(&dftVolt) == 0)
+        return AD5940ERR_APPERROR;
+
+    /* The voltage channel sees the excitation (VoutPP / 2 peak) and sets the
+       scale; both DFTs share it, so the current channel peak follows */
+    range_cfg.ProbeRtiaSel = HSTIARTIA_200;
+    range_cfg.ProbePga = ADCPGA_1;
+    range_cfg.ProbeVoutPP = app_cfg.VoutPP;
+    range_cfg.VoltPeak = app_cfg.VoutPP / 2.0f;
+    range_cfg.CurrPeak = range_cfg.VoltPeak * ad5940_ComplexMagFloat(&dftCurr) / ad5940_ComplexMagFloat(&dftVolt);
+    range_cfg.VoutPPMin = ADC_PP_MAX * 0.01;
+    range_cfg.VoutPPMax = 1800 * 0.8;
+    ret = ad5940_AutoRange(&range_cfg, &range);
+    if (ret < 0)
+        return ret;
+
+    app_cfg.HstiaRtiaSel = range.RtiaSel;
+    app_cfg.ADCPga = range.Pga;
+    app_cfg.VoutPP = (uint32_t)range.VoutPP;
+    log_info("autorange %.1fHz: RTIA %.0f, PGA %.1f, %umVpp (peaks %.0f/%.0fmV)", app_cfg.SinFreq,
+             ad5940_HSRtiaNominal(range.RtiaSel), ad5940_ADCPgaGain(range.Pga), app_cfg.VoutPP,
+             range.CurrPeak, range.VoltPeak);
+    return app_RTIA_cal_cached(dev);
+}
+
+int app_set_profile(struct ad5940_dev *dev, uint32_t Profile)
+{
+    if (Profile > APP_PROFILE_FAST)
+        return AD5940ERR_PARA;
+    int ret = ad5940_HPModeEn(dev, Profile == APP_PROFILE_FAST);
+    if (ret < 0)
+        return ret;
+    /* The system clock is HFOSC / 2 in the fast profile, so WG frequency words stay the same */
+    app_cfg.Profile = Profile;
+    app_cfg.SysClkFreq = 16000000.0;
+    app_cfg.AdcClkFreq = Profile == APP_PROFILE_FAST ? 32000000.0 : 16000000.0;
+    log_info("profile %s: ADC clock %.0fMHz, ADC rate %s", Profile == APP_PROFILE_FAST ? "fast" : "normal",
+             app_cfg.AdcClkFreq / 1e6, adcRate() == ADCRATE_1P6MHZ ? "1.6MHz" : "800kHz");
+    return ret;
+}
+
+int app_bench(struct ad5940_dev *dev, uint32_t Count)
+{
+    static const uint32_t profiles[] = {APP_PROFILE_NORMAL, APP_PROFILE_FAST};
+    fImpCar_Type dftCurr, dftVolt;
+    struct timespec t0, t1;
+    int ret = 0;
+
+    for (uint32_t p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++)
+    {
+        ret = app_set_profile(dev, profiles[p]);
+        if (ret < 0)
+            break;
+        ret = app_ad_init(dev);
+        if (ret < 0)
+            break;
+        float conv = ad5940_AdaptObsTime(adcRate(), app_cfg.DftSrc, app_cfg.ADCSinc3Osr,
+                                         app_cfg.ADCSinc2Osr, app_cfg.DftNum);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (uint32_t i = 0; i < Count && ret >= 0; i++)
+            ret = app_measure_dft(dev, &dftCurr, &dftVolt);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        if (ret < 0)
+            break;
+        double elapsed = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+        log_info("bench %s: %u measurements in %.3fs, %.2f/s (DFT %.2fms per channel on chip)",
+                 profiles[p] == APP_PROFILE_FAST ? "fast" : "normal", Count, elapsed,
+                 Count / elapsed, conv * 1000);
+    }
+    ret |= app_set_profile(dev, APP_PROFILE_NORMAL);
+    return ret;
+}
+
+/* ctx is the magnitude of every cycle */
+static int monitorMeasure(struct ad5940_dev *dev, void *ctx, uint32_t Cycle)
+{
+    float *pMag = ctx;
+    fImpCar_Type impedance;
+    int ret = app_measure(dev, &impedance);
+    if (ret < 0)
+        return ret;
+    pMag[Cycle] = ad5940_ComplexMagFloat(&impedance);
+    return 0;
+}
+
+int app_monitor(struct ad5940_dev *dev, uint32_t Count, float Period)
+{
+    MonitorCfg_Type cfg = {
+        .Period = Period,
+        .Cycles = Count,
+        .Hibernate = true,
+        .Measure = monitorMeasure,
+    };
+    MonitorStat_Type stat = {0};
+    int ret = app_ad_init(dev);
+    if (ret < 0)
+        return ret;
+    float *pMag = malloc(Count * sizeof(float));
+    if (pMag == NULL)
+        return AD5940ERR_BUFF;
+    cfg.pCtx = pMag;
+    ret = ad5940_MonitorRun(dev, &cfg, &stat);
+
+    /* Hibernating in between must not move the result */
+    if (stat.Cycles)
+    {
+        float min = pMag[0], max = pMag[0];
+        for (uint32_t i = 1; i < stat.Cycles; i++)
+        {
+            min = fminf(min, pMag[i]);
+            max = fmaxf(max, pMag[i]);
+        }
+        log_info("monitor: magnitude %.2f..%.2f over %u cycles (%.3f%%)", min, max, stat.Cycles,
+                 (max - min) / max * 100);
+    }
+    free(pMag);
+    return ret;
+}
+
+int app_timing(struct ad5940_dev *dev, const float *pRates, uint32_t Count)
+{
+    TimingCfg_Type cfg = {
+        .CalSeqAddr = 0, /* the sequencer is not in use yet */
+        .SystemClkFreq = app_cfg.SysClkFreq,
+        .InitCount = 3,
+    };
+    struct ad5940_timing timing;
+    uint32_t sleepTime, wakeupTime;
+    float actual;
+    int ret = ad5940_TimingInit(dev, &timing, &cfg);
+    if (ret < 0)
+        return ret;
+
+    for (uint32_t i = 0; i < Count; i++)
+    {
+        ret = ad5940_TimingWupt(&timing, 1.0f / pRates[i], 0, &sleepTime, &wakeupTime, &actual);
+        if (ret < 0)
+        {
+            log_warn("%.1fHz does not fit the wakeup timer", pRates[i]);
+            continue;
+        }
+        log_info("%.1fHz: sleep %u wakeup %u, runs at %.4fHz (%+.0fppm)", pRates[i], sleepTime,
+                 wakeupTime, 1.0f / actual, (1.0f / (pRates[i] * actual) - 1) * 1e6f);
+    }
+    return 0;
+}
+
+/* Sequencer waits for Seconds in the sequence being generated */
+static int seqSettle(struct ad5940_dev *dev, float Seconds)
+{
+    uint32_t cmd[SETTLE_SEQ_CMDS];
+    uint32_t n = ad5940_SettleSeqWait(Seconds, app_cfg.SysClkFreq, cmd, SETTLE_SEQ_CMDS);
+    int ret = 0;
+    for (uint32_t i = 0; i < n && ret >= 0; i++)
+        ret = ad5940_SEQGenInsert(dev, cmd[i]);
+    return ret;
+}
+
+/* Configuration, then the current path with the excitation running until it
+   has settled; ctx is the point's SettleTime_Type */
+static int planPointGen(struct ad5940_dev *dev, void *ctx, uint32_t Point)
+{
+    const SettleTime_Type *pSettle = ctx;
+    (void)Point;
+    int ret = app_ad_config(dev);
+    ret |= currentPath(dev);
+    ret |= ad5940_AFECtrlS(dev, AFECTRL_WG | AFECTRL_ADCPWR, true);
+    if (ret < 0)
+        return ret;
+    return seqSettle(dev, pSettle->Analog);
+}
+
+/* Sequence cache key of a plan point: the chip key, every app_cfg field
+   app_ad_config reads and the settling time planPointGen waits */
+static uint64_t planPointKey(uint64_t ChipKey, const SettleTime_Type *pSettle)
+{
+    struct
+    {
+        float SysClkFreq;
+        float SinFreq;
+        uint32_t AdcRate;
+        uint32_t VoutPP;
+        uint32_t ADCSinc3Osr;
+        uint32_t ADCSinc2Osr;
+        uint32_t HstiaRtiaSel;
+        uint32_t ADCPga;
+        uint32_t CtiaSel;
+        uint32_t DftNum;
+        uint32_t DftSrc;
+        float SettleAnalog;
+    } in;
+    memset(&in, 0, sizeof(in));
+    in.SysClkFreq = app_cfg.SysClkFreq;
+    in.SinFreq = app_cfg.SinFreq;
+    in.AdcRate = adcRate();
+    in.VoutPP = app_cfg.VoutPP;
+    in.ADCSinc3Osr = app_cfg.ADCSinc3Osr;
+    in.ADCSinc2Osr = app_cfg.ADCSinc2Osr;
+    in.HstiaRtiaSel = app_cfg.HstiaRtiaSel;
+    in.ADCPga = app_cfg.ADCPga;
+    in.CtiaSel = app_cfg.CtiaSel;
+    in.DftNum = app_cfg.DftNum;
+    in.DftSrc = app_cfg.DftSrc;
+    in.SettleAnalog = pSettle->Analog;
+    return ad5940_SEQCacheKeyAdd(ChipKey, &in, sizeof(in));
+}
+
+int app_plan_compile(struct ad5940_dev *dev, const SoftSweepCfg_Type *pSweep, app_plan_t *pPlan)
+{
+    SoftSweepCfg_Type sweep;
+    app_impedance_t saved = app_cfg;
+    uint32_t n;
+    int ret;
+
+    if (!pPlan || !pSweep)
+        return AD5940ERR_NULLP;
+    memset(pPlan, 0, sizeof(*pPlan));
+    n = pSweep->SweepPoints;
+    if (n == 0 || pSweep->SweepStart <= 0 || pSweep->SweepStop <= 0 ||
+        pSweep->SweepStart > APP_FREQ_MAX || pSweep->SweepStop > APP_FREQ_MAX ||
+        app_cfg.VoutPP == 0 || app_cfg.VoutPP > 1800 * 0.8 || app_cfg.HstiaRtiaSel > HSTIARTIA_160K)
+        return AD5940ERR_PARA;
+
+    pPlan->Cfg = app_cfg;
+    pPlan->Points = n;
+    pPlan->pFreq = malloc(n * sizeof(float));
+    pPlan->pRtiaRe = malloc(n * sizeof(float));
+    pPlan->pRtiaIm = malloc(n * sizeof(float));
+    pPlan->pHighPower = malloc(n * sizeof(bool));
+    pPlan->pSettle = malloc(n * sizeof(SettleTime_Type));
+    if (!pPlan->pFreq || !pPlan->pRtiaRe || !pPlan->pRtiaIm || !pPlan->pHighPower || !pPlan->pSettle)
+    {
+        ret = AD5940ERR_BUFF;
+        goto out;
+    }
+    ret = ad5940_PlanInit(&pPlan->Seq, app_cfg.SysClkFreq);
+    if (ret < 0)
+        goto out;
+    uint64_t chipKey = ad5940_SEQCacheKeyInit();
+    if (app_cfg.SeqCacheDir)
+    {
+        ret = ad5940_SEQCacheKeyChip(dev, &chipKey);
+        if (ret < 0)
+            goto out;
+    }
+
+    if (app_cfg.TargetRelErr > 0)
+    {
+        ret = app_adapt_pilot(dev);
+        if (ret < 0)
+            goto out;
+    }
+
+    sweep = *pSweep;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        ad5940_SweepNext(dev, &sweep, &app_cfg.SinFreq);
+        pPlan->pFreq[i] = app_cfg.SinFreq;
+        ret = app_cfg.AutoRange ? app_autorange(dev) : app_RTIA_cal_cached(dev);
+        if (ret < 0)
+            goto out;
+        if (app_cfg.TargetRelErr > 0)
+        {
+            /* Autorange changes the gains per point; its probe tells the
+               amplitude at this frequency. Without it the pilot's stands. */
+            if (app_cfg.AutoRange)
+                app_adapt_update(&probeCurr, &probeVolt, &probeCfg);
+            ret = app_adapt_select(dev);
+            if (ret < 0)
+                goto out;
+        }
+        pPlan->pRtiaRe[i] = app_cfg.RtiaCurrValue.Real;
+        pPlan->pRtiaIm[i] = app_cfg.RtiaCurrValue.Image;
+        pPlan->pHighPower[i] = highPower();
+        ret = app_settle_update(&pPlan->pSettle[i]);
+        if (ret < 0)
+            goto out;
+        if (app_cfg.SeqCacheDir)
+            ret = ad5940_PlanAddPointCached(dev, &pPlan->Seq, app_cfg.SeqCacheDir,
+                                            planPointKey(chipKey, &pPlan->pSettle[i]), planPointGen, &pPlan->pSettle[i]);
+        else
+            ret = ad5940_PlanAddPoint(dev, &pPlan->Seq, planPointGen, &pPlan->pSettle[i]);
+        if (ret < 0)
+            goto out;
+    }
+    ret = AD5940ERR_OK;
+    log_info("plan: %u points, %u register writes", n, pPlan->Seq.pStart[n]);
+
+out:
+    app_cfg = saved;
+    if (ret < 0)
+        app_plan_free(pPlan);
+    return ret;
+}
+
+int app_plan_run(struct ad5940_dev *dev, const app_plan_t *pPlan, fImpPolArray_Type *pImpedance)
+{
+    if (!pPlan || !pImpedance || pPlan->Points == 0)
+        return AD5940ERR_PARA;
+
+    uint32_t n = pPlan->Points;
+    float currRe[n], currIm[n], voltRe[n], voltIm[n];
+    fImpCarArray_Type curr = {currRe, currIm}, volt = {voltRe, voltIm};
+    fImpCarArray_Type rtia = {pPlan->pRtiaRe, pPlan->pRtiaIm};
+    fImpCar_Type dftCurr, dftVolt;
+    int ret;
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        ret = app_ad_power(dev, pPlan->pHighPower[i]);
+        if (ret < 0)
+            return ret;
+        ret = ad5940_PlanApply(dev, &pPlan->Seq, i);
+        if (ret < 0)
+            return ret;
+        ret = measurePair(dev, &pPlan->pSettle[i], true, &dftCurr, &dftVolt);
+        if (ret < 0)
+            return ret;
+        currRe[i] = dftCurr.Real;
+        currIm[i] = dftCurr.Image;
+        voltRe[i] = dftVolt.Real;
+        voltIm[i] = dftVolt.Image;
+    }
+    return app_compute_sweep(&curr, &volt, &rtia, pImpedance, n);
+}
+
+void app_plan_free(app_plan_t *pPlan)
+{
+    if (!pPlan)
+        return;
+    free(pPlan->pFreq);
+    free(pPlan->pRtiaRe);
+    free(pPlan->pRtiaIm);
+    free(pPlan->pHighPower);
+    free(pPlan->pSettle);
+    ad5940_PlanFree(&pPlan->Seq);
+    memset(pPlan, 0, sizeof(*pPlan));
+}
@@ -1,7 +1,11 @@
 #ifndef _IMPEDANCE_H_
 #define _IMPEDANCE_H_
 #include "ad5940.h"
+#include "ad5940_math.h"
+#include "ad5940_settle.h"
+#include "ad5940_plan.h"
 #include "stdio.h"
+#include "stdlib.h"
 #include "string.h"
 #include "math.h"
 
@@ -20,6 +24,9 @@
 #define AD5940ERR_APPERROR -100
 #define AD5940ERR_LOOP_OVER -101
 
+#define APP_PROFILE_NORMAL 0 /* 16MHz HFOSC, 800kHz ADC, low power below 80kHz */
+#define APP_PROFILE_FAST 1   /* 32MHz HFOSC for the ADC, 1.6MHz ADC, high power */
+
 typedef struct
 {
     float SysClkFreq;
@@ -30,15 +37,54 @@ typedef struct
     uint8_t ADCSinc3Osr;
     uint8_t ADCSinc2Osr;
     uint32_t HstiaRtiaSel;
+    uint32_t ADCPga;
     uint32_t CtiaSel;
     uint32_t DftNum;
     uint32_t DftSrc;
     fImpCar_Type RtiaCurrValue;
+    float TargetRelErr; /* 0: fixed DftNum, otherwise adapt DFT length per sweep point */
+    bool AutoRange;     /* pick RTIA, PGA and VoutPP per sweep point */
+    float LoadTau;      /* time constant of the load in s for the settling wait, 0: unknown */
+    uint32_t Profile;   /* APP_PROFILE_xxx, change with app_set_profile */
+    const char *SeqCacheDir; /* app_plan_compile keeps the point sequences here, NULL: no cache */
 } app_impedance_t;
 
+/* A sweep compiled by app_plan_compile: every decision is made, every register
+   value computed and every RTIA calibrated once; app_plan_run only executes */
+typedef struct
+{
+    app_impedance_t Cfg; /* configuration the plan was compiled from */
+    uint32_t Points;
+    float *pFreq;
+    float *pRtiaRe; /* RTIA calibration per point */
+    float *pRtiaIm;
+    bool *pHighPower; /* AFE power mode per point, PMBW is out of the sequencer register range */
+    SettleTime_Type *pSettle;
+    struct ad5940_plan Seq; /* register writes per point */
+} app_plan_t;
+
 int app_get_cfg(void *pCfg);
 int app_RTIA_cal(struct ad5940_dev *dev);
 int app_ad_init(struct ad5940_dev *dev);
+int app_measure_dft(struct ad5940_dev *dev, fImpCar_Type *pDftCurr, fImpCar_Type *pDftVolt);
 int app_measure(struct ad5940_dev *dev, fImpCar_Type *pImpedance);
+int app_compute_sweep(const fImpCarArray_Type *pCurr, const fImpCarArray_Type *pVolt,
+                      const fImpCarArray_Type *pRtia, fImpPolArray_Type *pImpedance, uint32_t Count);
+int app_spectrum(struct ad5940_dev *dev, uint32_t N);
+int app_multitone(struct ad5940_dev *dev);
+int app_dc_stat(struct ad5940_dev *dev, uint32_t Samples);
+int app_adapt_pilot(struct ad5940_dev *dev);
+int app_adapt_select(struct ad5940_dev *dev);
+void app_adapt_update(const fImpCar_Type *pDftCurr, const fImpCar_Type *pDftVolt,
+                      const app_impedance_t *pMeasCfg);
+int app_RTIA_cal_cached(struct ad5940_dev *dev);
+int app_autorange(struct ad5940_dev *dev);
+int app_set_profile(struct ad5940_dev *dev, uint32_t Profile);
+int app_bench(struct ad5940_dev *dev, uint32_t Count);
+int app_monitor(struct ad5940_dev *dev, uint32_t Count, float Period);
+int app_timing(struct ad5940_dev *dev, const float *pRates, uint32_t Count);
+int app_plan_compile(struct ad5940_dev *dev, const SoftSweepCfg_Type *pSweep, app_plan_t *pPlan);
+int app_plan_run(struct ad5940_dev *dev, const app_plan_t *pPlan, fImpPolArray_Type *pImpedance);
+void app_plan_free(app_plan_t *pPlan);
 
 #endif
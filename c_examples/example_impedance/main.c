@@ -1,23 +1,48 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 
 #include "ulog.h"
 
 #include "ad5940.h"
+#include "ad5940_log.h"
 #include "impedance.h"
 
+#define BENCH_COUNT 20
+#define MONITOR_SWEEPS 3
+#define MONITOR_CYCLES 10
+#define MONITOR_PERIOD 1.0f /* s, the AFE hibernates between measurements */
+#define SPECTRUM_N 1024
+#define DC_STAT_N 8192 /* more than the data FIFO holds, so the statistics block runs */
+
 struct ad5940_dev ad594x = {0};
 
+static FILE *log_fp;
+
+/* Everything through microlog to the console and log.txt, as before; the
+   request trace is recorded by the log thread into log.txt as well, so its
+   formatting and file I/O stay off the acquisition path */
 void log_init(void)
 {
     ulog_set_level(LOG_TRACE);
-    FILE *fp = fopen("log.txt", "w");
-    if (fp)
+    log_fp = fopen("log.txt", "w");
+    if (log_fp)
     {
-        ulog_add_fp(fp, LOG_TRACE);
+        LogCfg_Type log_cfg = {.fp = log_fp, .Level = AD5940_LOG_LVL_TRACE};
+        ulog_add_fp(log_fp, LOG_TRACE);
+        if (ad5940_LogStart(&log_cfg) < 0)
+            log_warn("log thread not started, the request trace is logged synchronously");
     }
 }
 
+void log_exit(void)
+{
+    ad5940_LogStop();
+    if (log_fp)
+        fclose(log_fp);
+}
+
 void structInit(void)
 {
     app_impedance_t *p_cfg;
@@ -28,11 +53,15 @@ void structInit(void)
     p_cfg->HstiaRtiaSel = HSTIARTIA_5K;
     p_cfg->RtiaCurrValue = (fImpCar_Type){5000, 0};
     p_cfg->RcalVal = 10000.0;
+    p_cfg->TargetRelErr = 1e-3;
+    p_cfg->AutoRange = true;
+    p_cfg->SeqCacheDir = getenv("AD5940_SEQCACHE");
 }
 
 int main(int argc, char *argv[])
 {
     log_init();
+    atexit(log_exit);
 
     log_info("Build Time:%s", __TIME__);
 
@@ -47,6 +76,8 @@ int main(int argc, char *argv[])
     log_info("Connecting to serial port %s", serial_port);
 
     ad594x.serial_port_name = serial_port;
+    /* Restarting against a device that is still configured: skip the reset */
+    ad594x.warm_attach = getenv("AD5940_WARM_ATTACH") != NULL;
     int32_t ret = ad5940_init(&ad594x);
     if (ret < 0)
     {
@@ -56,9 +87,57 @@ int main(int argc, char *argv[])
 
     structInit();
 
-    ret |= app_RTIA_cal(&ad594x);
+    if (argc > 2 && strcmp(argv[2], "bench") == 0)
+    {
+        ret = app_bench(&ad594x, BENCH_COUNT);
+        ad5940_remove(&ad594x);
+        return ret < 0 ? 1 : 0;
+    }
+
+    if (argc > 2 && strcmp(argv[2], "timing") == 0)
+    {
+        static const float rates[] = {0.1f, 1.0f, 10.0f, 100.0f, 1000.0f};
+        ret = app_timing(&ad594x, rates, sizeof(rates) / sizeof(rates[0]));
+        ad5940_remove(&ad594x);
+        return ret < 0 ? 1 : 0;
+    }
 
-    return 0;
+    if (argc > 2 && strcmp(argv[2], "monitor") == 0)
+    {
+        ret = app_monitor(&ad594x, MONITOR_CYCLES, MONITOR_PERIOD);
+        ad5940_remove(&ad594x);
+        return ret < 0 ? 1 : 0;
+    }
+
+    if (argc > 2 && strcmp(argv[2], "spectrum") == 0)
+    {
+        ret = app_ad_init(&ad594x);
+        if (ret >= 0)
+            ret = app_spectrum(&ad594x, SPECTRUM_N);
+        ad5940_remove(&ad594x);
+        return ret < 0 ? 1 : 0;
+    }
+
+    if (argc > 2 && strcmp(argv[2], "dc") == 0)
+    {
+        ret = app_ad_init(&ad594x);
+        if (ret >= 0)
+            ret = app_dc_stat(&ad594x, DC_STAT_N);
+        ad5940_remove(&ad594x);
+        return ret < 0 ? 1 : 0;
+    }
+
+    if (argc > 2 && strcmp(argv[2], "multitone") == 0)
+    {
+        ret = app_RTIA_cal(&ad594x);
+        ret |= app_ad_init(&ad594x);
+        if (ret >= 0)
+            ret = app_multitone(&ad594x);
+        ad5940_remove(&ad594x);
+        return ret < 0 ? 1 : 0;
+    }
+
+    ret = app_RTIA_cal(&ad594x);
 
     fImpCar_Type impedance;
 
@@ -76,18 +155,22 @@ int main(int argc, char *argv[])
         .SweepStart = 1000,
         .SweepStop = 150000};
 
-    app_impedance_t *p_cfg;
-    app_get_cfg(&p_cfg);
+    /* Compile once, then every monitoring sweep only pays for the measurements */
+    app_plan_t plan;
+    ret |= app_plan_compile(&ad594x, &SweepCfg, &plan);
+
+    float mag[SweepCfg.SweepPoints], phase[SweepCfg.SweepPoints];
+    fImpPolArray_Type sweep = {mag, phase};
 
-    for (int i = 0; i < SweepCfg.SweepPoints; i++)
+    for (int r = 0; r < MONITOR_SWEEPS && plan.Points; r++)
     {
-        ad5940_SweepNext(&ad594x, &SweepCfg, &p_cfg->SinFreq);
-        log_info("frequency: %dHz", (int)p_cfg->SinFreq);
-        ret |= app_ad_init(&ad594x);
-        ret |= app_measure(&ad594x, &impedance);
+        ret |= app_plan_run(&ad594x, &plan, &sweep);
+        for (uint32_t i = 0; i < plan.Points; i++)
+            log_info("sweep %d frequency: %dHz impedance magnitude=%.2f phase=%.2f", r, (int)plan.pFreq[i], mag[i], phase[i]);
     }
+    app_plan_free(&plan);
 
-    ret = ad5940_remove(&ad594x);
+    ret |= ad5940_remove(&ad594x);
 
-    return 0;
+    return ret < 0 ? 1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "ulog.h"
+
+#include "ad5940.h"
+#include "ad5940_serial.h"
+#include "ad5940_snapshot.h"
+
+/* Register snapshot of a running device and offline decoding.
+
+   usage: example_snapshot read <serial port> [file]   one transfer, text to file or stdout
+          example_snapshot decode <file>              all bitfields
+          example_snapshot diff <file> <file>         changed registers and bitfields
+
+   "read" does not reset or initialise the AD5940, it records the state left
+   by the last program. */
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: example_snapshot read <serial port> [file]\n"
+                    "       example_snapshot decode <file>\n"
+                    "       example_snapshot diff <file> <file>\n");
+}
+
+static int load(const char *path, Snapshot_Type *pSnap)
+{
+    FILE *fp = fopen(path, "r");
+    int ret;
+
+    if (!fp)
+    {
+        log_error("cannot open %s", path);
+        return -1;
+    }
+    ret = ad5940_SnapshotLoad(fp, pSnap);
+    fclose(fp);
+    return ret;
+}
+
+static int snapshot_read(const char *port, const char *path)
+{
+    struct ad5940_dev dev = {0};
+    Snapshot_Type snap;
+    FILE *fp = stdout;
+    int ret;
+
+    dev.serial_port_name = port;
+    dev.serial_port_handle = open_serial_port(port);
+    if (dev.serial_port_handle < 0)
+        return 1;
+    flush_serial_port(dev.serial_port_handle);
+
+    ret = ad5940_SnapshotRead(&dev, &snap);
+    close_serial_port(dev.serial_port_handle);
+    if (ret < 0)
+        return 1;
+
+    if (path && !(fp = fopen(path, "w")))
+    {
+        log_error("cannot create %s", path);
+        return 1;
+    }
+    ret = ad5940_SnapshotWrite(fp, &snap);
+    if (fp != stdout)
+        fclose(fp);
+    return ret < 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static Snapshot_Type a, b;
+
+    ulog_set_level(LOG_INFO);
+
+    if (argc >= 3 && strcmp(argv[1], "read") == 0)
+        return snapshot_read(argv[2], argc > 3 ? argv[3] : NULL);
+
+    if (argc == 3 && strcmp(argv[1], "decode") == 0)
+    {
+        if (load(argv[2], &a) < 0)
+            return 1;
+        ad5940_SnapshotDecode(stdout, &a);
+        return 0;
+    }
+
+    if (argc == 4 && strcmp(argv[1], "diff") == 0)
+    {
+        if (load(argv[2], &a) < 0 || load(argv[3], &b) < 0)
+            return 1;
+        /* like diff(1): 0 same, 1 different */
+        return ad5940_SnapshotDiff(stdout, &a, &b) > 0;
+    }
+
+    usage();
+    return 2;
+}
@@ -3272,6 +3272,14 @@ enum ad5940_afe_result
 
 /* Helper to calculate sequence length in array */
 #define SEQ_LEN(n) (sizeof(n) / 4) /**< Calculate how many commands are in sepecified array. */
+
+/* Decode a sequencer command */
+#define SEQ_CMD_IS_WR(cmd) (((cmd) & 0x80000000) != 0)                /**< SEQ_WR */
+#define SEQ_CMD_IS_WAIT(cmd) (((cmd) & 0xc0000000) == 0)              /**< SEQ_WAIT */
+#define SEQ_CMD_WR_ADDR(cmd) (((cmd) >> 24) & 0x7f)                   /**< Register address bits [8:2] of a SEQ_WR */
+#define SEQ_CMD_WR_REG(cmd) (0x2000 | (SEQ_CMD_WR_ADDR(cmd) << 2))    /**< Register address of a SEQ_WR */
+#define SEQ_CMD_WR_DATA(cmd) ((cmd) & 0xffffff)                       /**< Data of a SEQ_WR */
+#define SEQ_CMD_WAIT_CLKS(cmd) ((cmd) & 0x3fffffff)                   /**< SEQ_WAIT(n) takes n + 1 clocks */
 /** @} */                          // Sequencer_Helper
 
 /* FIFO */
@@ -3304,6 +3312,7 @@ enum ad5940_afe_result
 #define FIFOSIZE_2KB 1 /**< DATA FIFO use 2kB. The reset 4kB is used for sequencer */
 #define FIFOSIZE_4KB 2 /**< 4kB for Data FIFO. 2kB for sequencer */
 #define FIFOSIZE_6KB 3 /**< All 6kB for Data FIFO. Build in 32Bytes memory for sequencer */
+#define FIFOSIZE_WORDS(size) ((size) == FIFOSIZE_32B ? 8 : (size) * 512) /**< Data FIFO depth in 32bit words */
 /** @} */
 
 /* Wake up timer */
@@ -3529,6 +3538,8 @@ enum ad5940_afe_result
 #define KEY_OSCCON 0xcb14         /**< key of register OSCCON. The key is auto locked after writing to any other register */
 #define KEY_CALDATLOCK 0xde87a5af /**< Calibration key. */
 #define KEY_LPMODEKEY 0xc59d6     /**< LP mode key */
+#define WAKEUP_TRY_MAX 1000       /**< ad5940_WakeUp() reads with TryCount <= 0 */
+#define LFOSC_WAIT_MARGIN_MS 1000 /**< ad5940_LFOSCMeasure() gives up this long after the expected ENDSEQ */
 
 #define PARA_CHECK(n) /** @todo add parameter check, Add DEBUG switch  */
 
@@ -3538,6 +3549,7 @@ enum ad5940_afe_result
  * */
 
 #define SILICON_VER 2 /* 1: initial silicon version. 2: second version silicon. */
+#define AD5940_DRIVER_VERSION 0x00010000 /* Bump when a change alters the generated register/sequencer writes */
 /**
  * #Differences between Si1 and Si2
  * - WGFCW register bit width has been extended from 20bit to 24bit. The equation to calculate frequency is FCW[23:0]/2^30*Sytemclock.
@@ -3963,6 +3975,18 @@ typedef struct
    uint32_t RegValue : 24; /* Reg data is limited to 24bit by sequencer  */
 } SEQGenRegInfo_Type;
 
+/**
+ * Result of the sequence optimizer
+ */
+typedef struct
+{
+   uint32_t OrigLen;         /**< Sequence length before optimization */
+   uint32_t NewLen;          /**< Sequence length after optimization */
+   uint32_t DeadWrites;      /**< Writes overwritten before any wait */
+   uint32_t RedundantWrites; /**< Writes of a value the register already holds */
+   uint32_t WaitsMerged;     /**< SEQ_WAIT commands folded into the previous one */
+} SEQOptInfo_Type;
+
 /**
  * Sequencer generator data base.
  */
@@ -3986,6 +4010,9 @@ struct ad5940_dev
    int serial_port_handle;
    const char *serial_port_name;
    struct SeqGen SeqGenDB;
+   bool no_bulk_seq_write; /* Bridge has no "wr_seq" method, upload SRAM word by word */
+   bool no_bulk_reg_read;  /* Bridge has no "rd_regs" method, read registers one by one */
+   bool warm_attach;       /* ad5940_init() keeps a configured device, resets only if it differs */
 };
 
 /**
@@ -4003,6 +4030,7 @@ int ad5940_remove(struct ad5940_dev *dev);
 /* 1. Basic SPI functions */
 int ad5940_WriteReg(struct ad5940_dev *dev, uint16_t RegAddr, uint32_t RegData);
 int ad5940_ReadReg(struct ad5940_dev *dev, uint16_t RegAddr, uint32_t *RegData);
+int ad5940_ReadRegs(struct ad5940_dev *dev, const uint16_t *pRegAddr, uint32_t RegCount, uint32_t *pRegData);
 int ad5940_WriteReg_mask(struct ad5940_dev *dev, uint16_t RegAddr, uint32_t mask, uint32_t RegData);
 int ad5940_FIFORd(struct ad5940_dev *dev, uint32_t *pBuffer, uint32_t uiReadCount);
 int ad5940_ClrReg_bits(struct ad5940_dev *dev, uint16_t RegAddr, uint32_t RegBits);
@@ -4070,6 +4098,8 @@ int ad5940_SEQMmrTrig(struct ad5940_dev *dev,
 int ad5940_SEQCmdWrite(struct ad5940_dev *dev, uint32_t StartAddr,
                        const uint32_t *pCommand, uint32_t CmdCnt);
 int ad5940_SEQInfoCfg(struct ad5940_dev *dev, SEQInfo_Type *pSeq);
+int ad5940_SEQInfoCfgMulti(struct ad5940_dev *dev, SEQInfo_Type *pSeq,
+                           uint32_t SeqCnt); /* Configure several sequences, coalescing their SRAM upload */
 int ad5940_SEQInfoGet(struct ad5940_dev *dev, uint32_t SeqId,
                       SEQInfo_Type *pSeqInfo);
 int ad5940_SEQGpioCtrlS(struct ad5940_dev *dev,
@@ -4087,6 +4117,7 @@ int ad5940_WUPTTime(struct ad5940_dev *dev, uint32_t SeqId, uint32_t SleepTime,
 /* 7.1 Clock system */
 int ad5940_CLKCfg(struct ad5940_dev *dev, CLKCfg_Type *pClkCfg);
 int ad5940_HFOSC32MHzCtrl(struct ad5940_dev *dev, bool Mode32MHz);
+int ad5940_HPModeEn(struct ad5940_dev *dev, bool Enable); /* 32MHz ADC clock, high power mode */
 
 /* 7.2 AFE Interrupt */
 int ad5940_INTCCfg(struct ad5940_dev *dev, uint32_t AfeIntcSel,
@@ -4125,6 +4156,7 @@ int ad5940_HWReset(struct ad5940_dev
 
 /* Calibration functions */
 /* 8. Calibration */
+float ad5940_HSRtiaNominal(uint32_t RtiaSel); /* Nominal RTIA value in Ohm */
 int ad5940_HSRtiaCal(struct ad5940_dev *dev, HSRTIACal_Type *pCalCfg,
                      void *pResult);
 int ad5940_LPRtiaCal(struct ad5940_dev *dev, LPRTIACal_Type *pCalCfg,
@@ -4143,6 +4175,8 @@ int ad5940_SEQGenInsert(struct ad5940_dev *dev,
                         uint32_t CmdWord); /* Manually insert a sequence command */
 int ad5940_SEQGenFetchSeq(struct ad5940_dev *dev, const uint32_t **ppSeqCmd,
                           uint32_t *pSeqCount); /* Fetch generated sequence and start a new sequence */
+int ad5940_SEQOptimize(uint32_t *pSeqCmd, uint32_t *pSeqLen,
+                       SEQOptInfo_Type *pInfo); /* Remove dead/redundant writes and merge waits */
 int ad5940_ClksCalculate(struct ad5940_dev *dev, ClksCalInfo_Type *pFilterInfo,
                          uint32_t *pClocks); /* @todo add notch filter calculation. Calculate how much clocks to reach n points of data */
 void ad5940_SweepNext(struct ad5940_dev *dev, SoftSweepCfg_Type *pSweepCfg,
@@ -0,0 +1,61 @@
+#ifndef _AD5940_ADAPT_H_
+#define _AD5940_ADAPT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ad5940.h"
+
+/**
+ * DFT length and filter selection for a target precision.
+ *
+ * With white noise at the ADC, the relative error of a DFT magnitude falls
+ * with the square root of the time the DFT observes, whatever mix of OSR
+ * and DFT length makes up that time. One noise constant per channel,
+ * NoiseTime = sigma * sqrt(T) in normalized DFT units (|X| / points), is
+ * enough to predict the error of any setting:
+ *
+ *    RelErr = NoiseTime / (Amplitude * sqrt(T))
+ *
+ * ad5940_AdaptNoiseTime() gets the constant from a few short pilot DFTs. The
+ * amplitude comes from the previous sweep point or the pilot.
+ * ad5940_AdaptChoose() walks every SINC3/SINC2 OSR and DFT length, drops
+ * those that sample the signal too slowly or see too few periods, and
+ * returns the one with the fewest clocks (ad5940_ClksCalculate) that meets
+ * the target.
+ */
+
+typedef struct
+{
+   float SysClkFreq;
+   float AdcClkFreq;
+   uint32_t ADCRate;     /**< ADCRATE_800KHZ or ADCRATE_1P6MHZ */
+   float TargetRelErr;   /**< Wanted relative standard error of each DFT magnitude */
+   float NoiseTime;      /**< From ad5940_AdaptNoiseTime */
+   float NyquistMargin;  /**< Filter output rate must be this many times the signal frequency (0: 4) */
+   float MinCycles;      /**< Signal periods the DFT must cover (0: 4) */
+   uint32_t MinDftNum;   /**< DFTNUM_xxx range to search */
+   uint32_t MaxDftNum;
+} AdaptCfg_Type;
+
+typedef struct
+{
+   uint32_t DftSrc;      /**< DFTSRC_SINC3 or DFTSRC_SINC2NOTCH */
+   uint32_t DftNum;      /**< DFTNUM_xxx */
+   uint32_t ADCSinc3Osr;
+   uint32_t ADCSinc2Osr;
+   float ObsTime;        /**< Seconds of signal the DFT sees */
+   float ConvTime;       /**< Predicted conversion time in seconds */
+   float RelErr;         /**< Predicted relative error */
+   bool TargetMet;       /**< False if even the longest DFT misses the target */
+} AdaptChoice_Type;
+
+float ad5940_AdaptObsTime(uint32_t ADCRate, uint32_t DftSrc, uint32_t Sinc3Osr,
+                          uint32_t Sinc2Osr, uint32_t DftNum);
+float ad5940_AdaptAmplitude(const fImpCar_Type *pDft, uint32_t DftNum);
+float ad5940_AdaptNoiseTime(const fImpCar_Type *pDft, uint32_t Count, uint32_t DftNum,
+                            float ObsTime);
+int ad5940_AdaptChoose(struct ad5940_dev *dev, const AdaptCfg_Type *pCfg, float Freq,
+                       float Amplitude, AdaptChoice_Type *pChoice);
+
+#endif // _AD5940_ADAPT_H_
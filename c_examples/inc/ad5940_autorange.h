@@ -0,0 +1,49 @@
+#ifndef _AD5940_AUTORANGE_H_
+#define _AD5940_AUTORANGE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ad5940.h"
+
+/**
+ * Range selection for an unknown load from one probe measurement.
+ *
+ * The caller runs one short measurement at a known setting (ideally the
+ * smallest RTIA and PGA 1, so nothing saturates) and reports the peak
+ * voltage each channel produced at the ADC input. Both channels scale
+ * linearly with the excitation, the current channel also with RTIA, and
+ * both with the PGA. ad5940_AutoRange() uses that to pick the setting that
+ * fills Headroom of the ADC range:
+ *  - excitation is lowered if even the smallest RTIA would saturate,
+ *  - then the largest RTIA that fits is chosen,
+ *  - excitation is raised (up to VoutPPMax) if the largest RTIA is still
+ *    under a quarter of the range,
+ *  - and finally the largest PGA that both channels fit is chosen.
+ */
+
+typedef struct
+{
+   uint32_t ProbeRtiaSel; /**< HSTIARTIA_xxx used for the probe */
+   uint32_t ProbePga;     /**< ADCPGA_xxx used for the probe */
+   float ProbeVoutPP;     /**< Excitation of the probe, mV peak-peak */
+   float CurrPeak;        /**< Current channel peak at the ADC input during the probe, mV */
+   float VoltPeak;        /**< Voltage channel peak at the ADC input during the probe, mV */
+   float Headroom;        /**< Fraction of the ADC range to use (0: 0.75) */
+   float VoutPPMin;       /**< Excitation limits, mV peak-peak */
+   float VoutPPMax;
+} AutoRangeCfg_Type;
+
+typedef struct
+{
+   uint32_t RtiaSel; /**< HSTIARTIA_xxx */
+   uint32_t Pga;     /**< ADCPGA_xxx */
+   float VoutPP;     /**< Excitation, mV peak-peak */
+   float CurrPeak;   /**< Predicted current channel peak at the ADC input, mV */
+   float VoltPeak;   /**< Predicted voltage channel peak at the ADC input, mV */
+} AutoRange_Type;
+
+float ad5940_ADCPgaGain(uint32_t Pga);
+int ad5940_AutoRange(const AutoRangeCfg_Type *pCfg, AutoRange_Type *pRange);
+
+#endif // _AD5940_AUTORANGE_H_
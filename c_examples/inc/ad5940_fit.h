@@ -0,0 +1,59 @@
+#ifndef _AD5940_FIT_H_
+#define _AD5940_FIT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ad5940.h"
+
+/**
+ * Equivalent circuit fitting of impedance spectra.
+ *
+ * ad5940_FitSpectrum() fits one sweep with Levenberg-Marquardt. The model
+ * Jacobians are analytic. The parameters are fitted as logarithms, so they
+ * stay positive and resistances and capacitances many decades apart are
+ * equally well conditioned. Residuals are weighted by 1/|Z| (modulus
+ * weighting), so every frequency counts about the same.
+ *
+ * A fit ends Converged when a step changes the cost or the parameters by less
+ * than the tolerance. It ends Stalled when the damping has to grow past its
+ * limit before any step lowers the cost: a minimum as far as the solver can
+ * tell, but possibly a flat or badly conditioned one, so check Cost. With
+ * neither set the fit ran out of MaxIter.
+ *
+ * ad5940_FitBatch() fits many sweeps on a thread pool. Each worker starts with
+ * an equal share of the jobs in its own range. A worker that runs out steals
+ * half of what is left in another worker's range. Both ends of a range are
+ * packed in one 64-bit atomic, so popping and stealing are single
+ * compare-and-swaps and no lock is taken.
+ */
+
+#define FITMODEL_RC_PARALLEL 0 /**< R || C: R, C */
+#define FITMODEL_RC_SERIES 1   /**< R + C: R, C */
+#define FITMODEL_RANDLES 2     /**< Rs + (Rct || Cdl): Rs, Rct, Cdl */
+#define FITMODEL_RANDLES_W 3   /**< Rs + (Cdl || (Rct + W)), W = Sigma*(1-j)/sqrt(w): Rs, Rct, Cdl, Sigma */
+
+#define FIT_PARAM_MAX 4
+
+typedef struct
+{
+   uint32_t Model;             /**< FITMODEL_xxx */
+   const float *pFreq;         /**< Count frequencies in Hz */
+   const fImpCar_Type *pImp;   /**< Count measured impedances in Ohm */
+   uint32_t Count;             /**< Number of points, at least the number of parameters */
+   bool InitGiven;             /**< Param holds the start point, otherwise it is estimated from the data */
+   uint32_t MaxIter;           /**< 0: default */
+   float Param[FIT_PARAM_MAX]; /**< Start point (if InitGiven) and result */
+   float Cost;                 /**< RMS relative residual of the result */
+   uint32_t Iter;              /**< Iterations used */
+   bool Converged;             /**< Stopped on a tolerance, not on MaxIter */
+   bool Stalled;               /**< Stopped because no step lowered the cost any more */
+   int Status;                 /**< Return value of ad5940_FitSpectrum */
+} FitJob_Type;
+
+uint32_t ad5940_FitParamCnt(uint32_t Model);
+int ad5940_FitModelEval(uint32_t Model, const float *pParam, float Freq, fImpCar_Type *pZ);
+int ad5940_FitSpectrum(FitJob_Type *pJob);
+int ad5940_FitBatch(FitJob_Type *pJobs, uint32_t JobCnt, uint32_t ThreadCnt);
+
+#endif // _AD5940_FIT_H_
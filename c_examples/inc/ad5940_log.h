@@ -0,0 +1,167 @@
+#ifndef _AD5940_LOG_H_
+#define _AD5940_LOG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include "ulog.h"
+
+/**
+ * Asynchronous logging for the hot path.
+ *
+ * AD5940_LOG_TRACE(fmt, ...) and friends do not format anything. They copy the
+ * level, call site, format pointer and raw arguments (strings by value, up to
+ * LOG_STR_BYTES in total inside the record, longer ones in a heap copy) into a
+ * lock-free ring owned by the calling thread.
+ * A background thread started by ad5940_LogStart() formats the records and
+ * writes them to the sink. A full ring drops the record and counts it, the
+ * caller never waits.
+ *
+ * Before ad5940_LogStart() and after ad5940_LogStop() the macros fall back to
+ * the synchronous microlog calls. Levels below AD5940_LOG_MIN_LEVEL are removed
+ * at compile time; release builds (NDEBUG) drop TRACE.
+ *
+ * The format string must be a literal and at most LOG_MAX_ARGS arguments are
+ * supported. %n is ignored.
+ */
+
+/* Same order as the microlog levels, usable in #if */
+#define AD5940_LOG_LVL_TRACE 0
+#define AD5940_LOG_LVL_DEBUG 1
+#define AD5940_LOG_LVL_INFO 2
+#define AD5940_LOG_LVL_WARN 3
+#define AD5940_LOG_LVL_ERROR 4
+
+#ifndef AD5940_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define AD5940_LOG_MIN_LEVEL AD5940_LOG_LVL_DEBUG
+#else
+#define AD5940_LOG_MIN_LEVEL AD5940_LOG_LVL_TRACE
+#endif
+#endif
+
+#define LOG_MAX_ARGS 8
+#define LOG_STR_BYTES 192
+
+#define LOG_ARG_INT 0
+#define LOG_ARG_UINT 1
+#define LOG_ARG_DOUBLE 2
+#define LOG_ARG_STR 3 /* offset into Str */
+#define LOG_ARG_PTR 4
+#define LOG_ARG_STR_HEAP 5 /* malloc'ed copy, freed by the log thread */
+
+typedef struct
+{
+   FILE *fp;             /**< Sink, written only by the log thread */
+   int Level;            /**< Lowest level recorded, AD5940_LOG_LVL_xxx */
+   uint32_t RingRecords; /**< Records per thread ring, rounded up to a power of two (0: default) */
+} LogCfg_Type;
+
+struct ad5940_log_rec
+{
+   uint64_t Time; /* CLOCK_MONOTONIC ns */
+   const char *Fmt;
+   const char *File;
+   uint32_t Line;
+   uint8_t Level;
+   uint8_t Argc;
+   uint16_t StrLen;
+   uint8_t Type[LOG_MAX_ARGS];
+   union
+   {
+      int64_t i;
+      uint64_t u;
+      double d;
+      const void *p;
+   } Arg[LOG_MAX_ARGS];
+   char Str[LOG_STR_BYTES];
+};
+
+extern _Atomic int ad5940_log_level; /* INT32_MAX while the log thread is not running */
+
+int ad5940_LogStart(const LogCfg_Type *pCfg);
+void ad5940_LogStop(void);
+uint64_t ad5940_LogDropped(void);
+
+struct ad5940_log_rec *ad5940_LogBegin(int Level, const char *File, uint32_t Line, const char *Fmt);
+void ad5940_LogCommit(struct ad5940_log_rec *r);
+
+void ad5940_LogPutInt(struct ad5940_log_rec *r, long long v);
+void ad5940_LogPutUint(struct ad5940_log_rec *r, unsigned long long v);
+void ad5940_LogPutDouble(struct ad5940_log_rec *r, double v);
+void ad5940_LogPutStr(struct ad5940_log_rec *r, const char *v);
+void ad5940_LogPutPtr(struct ad5940_log_rec *r, const void *v);
+
+#define LOG_PUT(r, x) _Generic((x),                              \
+   char *: ad5940_LogPutStr,                                     \
+   const char *: ad5940_LogPutStr,                               \
+   float: ad5940_LogPutDouble,                                   \
+   double: ad5940_LogPutDouble,                                  \
+   _Bool: ad5940_LogPutUint,                                     \
+   char: ad5940_LogPutInt,                                       \
+   signed char: ad5940_LogPutInt,                                \
+   short: ad5940_LogPutInt,                                      \
+   int: ad5940_LogPutInt,                                        \
+   long: ad5940_LogPutInt,                                       \
+   long long: ad5940_LogPutInt,                                  \
+   unsigned char: ad5940_LogPutUint,                             \
+   unsigned short: ad5940_LogPutUint,                            \
+   unsigned int: ad5940_LogPutUint,                              \
+   unsigned long: ad5940_LogPutUint,                             \
+   unsigned long long: ad5940_LogPutUint,                        \
+   default: ad5940_LogPutPtr)(r, x)
+
+/* Argument count of (fmt, ...) minus the format */
+#define LOG_NARGS(...) LOG_NARGS_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0, _)
+#define LOG_NARGS_(f, a1, a2, a3, a4, a5, a6, a7, a8, n, ...) n
+#define LOG_CAT(a, b) LOG_CAT_(a, b)
+#define LOG_CAT_(a, b) a##b
+#define LOG_FMT(f, ...) f
+
+#define LOG_PUT_0(r, f)
+#define LOG_PUT_1(r, f, a) LOG_PUT(r, a);
+#define LOG_PUT_2(r, f, a, ...) LOG_PUT(r, a); LOG_PUT_1(r, f, __VA_ARGS__)
+#define LOG_PUT_3(r, f, a, ...) LOG_PUT(r, a); LOG_PUT_2(r, f, __VA_ARGS__)
+#define LOG_PUT_4(r, f, a, ...) LOG_PUT(r, a); LOG_PUT_3(r, f, __VA_ARGS__)
+#define LOG_PUT_5(r, f, a, ...) LOG_PUT(r, a); LOG_PUT_4(r, f, __VA_ARGS__)
+#define LOG_PUT_6(r, f, a, ...) LOG_PUT(r, a); LOG_PUT_5(r, f, __VA_ARGS__)
+#define LOG_PUT_7(r, f, a, ...) LOG_PUT(r, a); LOG_PUT_6(r, f, __VA_ARGS__)
+#define LOG_PUT_8(r, f, a, ...) LOG_PUT(r, a); LOG_PUT_7(r, f, __VA_ARGS__)
+
+#define AD5940_LOG_AT(level, sync, ...)                                              \
+   do                                                                                \
+   {                                                                                 \
+      int lvl_ = atomic_load_explicit(&ad5940_log_level, memory_order_relaxed);     \
+      if (lvl_ == INT32_MAX)                                                         \
+      {                                                                              \
+         sync(__VA_ARGS__);                                                          \
+      }                                                                              \
+      else if ((level) >= lvl_)                                                      \
+      {                                                                              \
+         struct ad5940_log_rec *r_ = ad5940_LogBegin(level, __FILE__, __LINE__,      \
+                                                     LOG_FMT(__VA_ARGS__, _));       \
+         if (r_)                                                                     \
+         {                                                                           \
+            LOG_CAT(LOG_PUT_, LOG_NARGS(__VA_ARGS__))(r_, __VA_ARGS__)               \
+            ad5940_LogCommit(r_);                                                    \
+         }                                                                           \
+      }                                                                              \
+   } while (0)
+
+#if AD5940_LOG_MIN_LEVEL <= AD5940_LOG_LVL_TRACE
+#define AD5940_LOG_TRACE(...) AD5940_LOG_AT(AD5940_LOG_LVL_TRACE, log_trace, __VA_ARGS__)
+#else
+#define AD5940_LOG_TRACE(...) ((void)0)
+#endif
+
+#if AD5940_LOG_MIN_LEVEL <= AD5940_LOG_LVL_DEBUG
+#define AD5940_LOG_DEBUG(...) AD5940_LOG_AT(AD5940_LOG_LVL_DEBUG, log_debug, __VA_ARGS__)
+#else
+#define AD5940_LOG_DEBUG(...) ((void)0)
+#endif
+
+#define AD5940_LOG_INFO(...) AD5940_LOG_AT(AD5940_LOG_LVL_INFO, log_info, __VA_ARGS__)
+
+#endif // _AD5940_LOG_H_
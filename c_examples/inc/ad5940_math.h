@@ -0,0 +1,41 @@
+#ifndef _AD5940_MATH_H_
+#define _AD5940_MATH_H_
+
+#include <stdint.h>
+
+#include "ad5940.h"
+
+/**
+ * Array versions of the complex helpers in ad5940.h.
+ *
+ * Data is kept as separate real and imaginary arrays (struct of arrays), so a
+ * vector register holds 4 consecutive points. The kernels are written on the
+ * vf4 type of ad5940_simd.h (SSE2 or NEON); other targets, and the tail of
+ * each array, run the scalar code. Output arrays may be the same as input
+ * arrays.
+ *
+ * The vector phase uses a polynomial arctangent, within 1e-6 rad of atan2f.
+ */
+
+typedef struct
+{
+   float *Real;
+   float *Image;
+} fImpCarArray_Type; // Cartesian, struct of arrays
+
+typedef struct
+{
+   float *Magnitude;
+   float *Phase;
+} fImpPolArray_Type; // Polar, struct of arrays
+
+void ad5940_DftToFloatArray(const uint32_t *pRaw, float *pOut, uint32_t Count);
+void ad5940_ComplexDivArray(const fImpCarArray_Type *a, const fImpCarArray_Type *b,
+                            fImpCarArray_Type *res, uint32_t Count);
+void ad5940_ComplexMagArray(const fImpCarArray_Type *a, float *pMag, uint32_t Count);
+void ad5940_ComplexPhaseArray(const fImpCarArray_Type *a, float *pPhase, uint32_t Count);
+int ad5940_ImpedanceArray(const fImpCarArray_Type *pCurr, const fImpCarArray_Type *pVolt,
+                          const fImpCarArray_Type *pRtia, uint32_t RtiaCnt,
+                          fImpPolArray_Type *pRes, uint32_t Count);
+
+#endif // _AD5940_MATH_H_
@@ -0,0 +1,63 @@
+#ifndef _AD5940_MONITOR_H_
+#define _AD5940_MONITOR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ad5940.h"
+
+/**
+ * Duty-cycled monitoring: one measurement per period, the AFE hibernates in
+ * between.
+ *
+ * Before hibernate the register state is saved with one ad5940_SnapshotRead()
+ * transfer. ad5940_ShutDownS() then turns off the LP loop and references and
+ * requests hibernate. After the period the AFE is woken by
+ * ad5940_MonitorWakeUp(): ADIID reads with exponential backoff until a
+ * deadline. A second snapshot is diffed against the saved one and only the
+ * registers that differ are written back, there is no ad5940_init().
+ *
+ * Periods are absolute deadlines on CLOCK_MONOTONIC. A cycle that takes longer
+ * than the period is counted as an overrun, and the next one starts at once
+ * instead of trying to catch up.
+ */
+
+#define MONITOR_WAKE_TIMEOUT_US 50000 /* default deadline to answer after hibernate */
+#define MONITOR_BACKOFF_MIN_US 50     /* first wait after an ADIID read that failed */
+#define MONITOR_BACKOFF_MAX_US 2000   /* the wait doubles up to this */
+
+/**
+ * Called once per cycle with the AFE awake and restored.
+ * @return 0 to continue, negative to stop the monitor with this error.
+ */
+typedef int (*MonitorMeasure_Type)(struct ad5940_dev *dev, void *pCtx, uint32_t Cycle);
+
+typedef struct
+{
+   float Period;                /**< Seconds from the start of one cycle to the next */
+   uint32_t Cycles;             /**< Measurements to take */
+   uint32_t WakeTimeoutUs;      /**< Deadline for the wake (0: MONITOR_WAKE_TIMEOUT_US) */
+   bool Hibernate;              /**< false: the AFE stays on between cycles, for comparison */
+   MonitorMeasure_Type Measure; /**< The measurement */
+   void *pCtx;                  /**< Passed to Measure */
+} MonitorCfg_Type;
+
+typedef struct
+{
+   uint32_t Cycles;    /**< Measurements taken */
+   uint32_t Overruns;  /**< Cycles that took longer than Period */
+   uint32_t Wakes;     /**< Wakes from hibernate */
+   uint32_t WakeReads; /**< ADIID reads over all wakes */
+   uint32_t Restored;  /**< Registers written back after wake, over all cycles */
+   float WakeMin;      /**< Wake latency, s: first ADIID read until it answers */
+   float WakeMax;
+   float WakeMean;
+   float Active;    /**< Seconds from wake until the hibernate request, over all cycles */
+   float Idle;      /**< Seconds between cycles, the AFE hibernates if MonitorCfg_Type.Hibernate */
+   float DutyCycle; /**< Active / (Active + Idle) */
+} MonitorStat_Type;
+
+int ad5940_MonitorWakeUp(struct ad5940_dev *dev, uint32_t TimeoutUs, uint32_t *pReads);
+int ad5940_MonitorRun(struct ad5940_dev *dev, const MonitorCfg_Type *pCfg, MonitorStat_Type *pStat);
+
+#endif // _AD5940_MONITOR_H_
@@ -0,0 +1,58 @@
+#ifndef _AD5940_MULTITONE_H_
+#define _AD5940_MULTITONE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ad5940.h"
+
+/**
+ * Impedance at many frequencies from one capture per channel.
+ *
+ * The waveform generator runs in trapezoid mode. A trapezoid is periodic, so
+ * its energy sits at the harmonics h*f0 of the repetition rate f0, and those
+ * harmonics are the test tones. Current and voltage are each captured once
+ * with ad5940_CaptureWaveformSync(), which starts the generator in the same
+ * write as the ADC, so both records share a time origin. A Goertzel filter
+ * bank then evaluates every tone on the last whole number of periods of the
+ * record.
+ *
+ * Each tone is a generalized Goertzel filter, so tones need not fall on FFT
+ * bins and the record need not be a power of two long. The filters are run
+ * eight at a time in SIMD lanes, one pass over the samples for each group of
+ * eight tones.
+ *
+ * A symmetric trapezoid (Delay1 == Delay2, Slope1 == Slope2) has no even
+ * harmonics; make it asymmetric to use them. Harmonic amplitude falls with
+ * 1/h and, above 1/(pi * slope time), with 1/h^2, so tones far up get noisy.
+ */
+
+typedef struct
+{
+   float SysClkFreq;           /**< Clock of the waveform generator */
+   uint32_t HsDacUpdateRate;   /**< HSDACCfg_Type.HsDacUpdateRate in use */
+   WGTrapzCfg_Type Trapz;      /**< Trapezoid in use */
+   float SampleRate;           /**< Rate of the captured filter output, see ad5940_ADCSampleRate */
+   uint32_t N;                 /**< Samples per capture */
+   uint32_t Skip;              /**< Leading samples dropped while the filters settle */
+   const uint32_t *pHarmonics; /**< Harmonic numbers to evaluate */
+   uint32_t ToneCnt;           /**< Number of entries in pHarmonics */
+   float MinRelAmp;            /**< Tones with less current than this fraction of the strongest are not valid */
+} MultiToneCfg_Type;
+
+typedef struct
+{
+   float Freq;        /**< Tone frequency in Hz */
+   fImpCar_Type Curr; /**< Current channel at Freq, amplitude in ADC codes */
+   fImpCar_Type Volt; /**< Voltage channel at Freq, amplitude in ADC codes */
+   bool Valid;        /**< Below Nyquist and above MinRelAmp */
+} MultiToneResult_Type;
+
+float ad5940_TrapzPeriod(const WGTrapzCfg_Type *pTrapz, float SysClkFreq,
+                         uint32_t HsDacUpdateRate);
+void ad5940_GoertzelBank(const float *pX, uint32_t L, const float *pOmega,
+                         uint32_t ToneCnt, fImpCar_Type *pOut);
+int ad5940_MultiToneAnalyze(const MultiToneCfg_Type *pCfg, const float *pCurr,
+                            const float *pVolt, MultiToneResult_Type *pResult);
+
+#endif // _AD5940_MULTITONE_H_
@@ -0,0 +1,81 @@
+#ifndef _AD5940_PINGPONG_H_
+#define _AD5940_PINGPONG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ad5940.h"
+
+/**
+ * Double-buffered sequencer SRAM.
+ *
+ * Two sequence slots (SEQID_0 = A, SEQID_1 = B) live in separate SRAM ranges.
+ * While one slot runs, the host uploads the next block of commands into the
+ * other one. The manager appends SEQ_INT0() to slot A and SEQ_INT1() to slot B,
+ * so the interrupt flag tells which slot has just finished; the shared
+ * AFEINTSRC_ENDSEQ flag cannot.
+ *
+ * Two trigger modes:
+ * - host (UseWupt false): the host triggers the other slot as soon as it sees
+ *   the end of the running one. The gap is one flag poll over the link.
+ * - wakeup timer (UseWupt true): the timer alternates A/B on its own, so there
+ *   is no gap at all, but the host must upload each block within one period.
+ *   A block the host could not replace in time is reported as an overrun.
+ *
+ * Blocks must not contain SEQ_STOP(), which disables the sequencer.
+ *
+ * ad5940_PingPongRun() sleeps PINGPONG_POLL_US between flag polls. It gives up
+ * with -ETIMEDOUT when no block finishes within TimeoutMs (plus the wakeup
+ * timer period in timer mode), e.g. after the bridge or the sequencer hung.
+ */
+
+#define PINGPONG_SLOT_A 0
+#define PINGPONG_SLOT_B 1
+#define PINGPONG_TIMEOUT_MS 1000 /* default longest run of one block */
+#define PINGPONG_POLL_US 200     /* sleep between two flag polls */
+
+typedef struct
+{
+   uint32_t SlotAddr[2];      /**< SRAM start address of slot A and B */
+   uint32_t SlotSize;         /**< Words available in each slot, including the end marker */
+   bool UseWupt;              /**< Let the wakeup timer alternate the slots */
+   uint32_t WuptSleepTime[2]; /**< Wakeup timer ticks (32kHz) after slot A/B, UseWupt only */
+   uint32_t WuptWakeupTime[2];
+   uint32_t TimeoutMs;        /**< Longest wait for a block to finish (0: PINGPONG_TIMEOUT_MS) */
+} PingPongCfg_Type;
+
+struct ad5940_pingpong
+{
+   PingPongCfg_Type Cfg;
+   uint32_t Active;   /* Slot that is running, or would run next */
+   bool Loaded[2];    /* Slot holds a block that has not run yet */
+   bool Empty[2];     /* Slot holds only the end marker */
+   bool Running;
+   uint32_t BlocksDone;
+   uint32_t Overruns; /* UseWupt: a slot ran again before it was reloaded */
+};
+
+/**
+ * Fill callback: copy at most MaxLen commands of the next block into pBuffer,
+ * set *pLen (0 when there are no more blocks) and return 0 or a negative error.
+ */
+typedef int (*ad5940_pp_fill_fn)(void *ctx, uint32_t Slot, uint32_t *pBuffer,
+                                 uint32_t MaxLen, uint32_t *pLen);
+/**
+ * Done callback: a block finished on Slot, read its results (FIFO) here.
+ */
+typedef int (*ad5940_pp_done_fn)(void *ctx, uint32_t Slot);
+
+int ad5940_PingPongInit(struct ad5940_dev *dev, struct ad5940_pingpong *pp,
+                        const PingPongCfg_Type *pCfg);
+int ad5940_PingPongLoad(struct ad5940_dev *dev, struct ad5940_pingpong *pp,
+                        uint32_t Slot, const uint32_t *pSeqCmd, uint32_t SeqLen);
+int ad5940_PingPongStart(struct ad5940_dev *dev, struct ad5940_pingpong *pp);
+int ad5940_PingPongPoll(struct ad5940_dev *dev, struct ad5940_pingpong *pp,
+                        uint32_t *pDoneSlot);
+int ad5940_PingPongStop(struct ad5940_dev *dev, struct ad5940_pingpong *pp);
+int ad5940_PingPongRun(struct ad5940_dev *dev, struct ad5940_pingpong *pp,
+                       ad5940_pp_fill_fn fill, ad5940_pp_done_fn done,
+                       void *ctx);
+
+#endif // _AD5940_PINGPONG_H_
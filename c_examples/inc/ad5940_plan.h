@@ -0,0 +1,72 @@
+#ifndef _AD5940_PLAN_H_
+#define _AD5940_PLAN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ad5940.h"
+
+/**
+ * Measurement plans: register setups compiled once, applied many times.
+ *
+ * A plan holds one block of register writes per measurement point. Each block
+ * is recorded with the sequencer generator while a callback issues the usual
+ * driver calls for that point (ad5940_HSLoopCfgS, ad5940_DSPCfgS, ...), so the
+ * gain, amplitude, frequency word and filter decisions and the read-modify-
+ * write reads are paid for at compile time only. Blocks are run through
+ * ad5940_SEQOptimize and checked to contain nothing but register writes and
+ * waits.
+ *
+ * Every block writes whole registers, so points can be applied in any order
+ * and a compiled plan can be applied to any device that was initialized the
+ * same way. A plan is not changed after ad5940_PlanAddPoint() returns.
+ *
+ * ad5940_PlanApply() runs a block in the sequencer: the block plus a
+ * SEQ_STOP() is written to SRAM at SeqRamAddr in one bulk transfer, sequence
+ * SeqId is triggered, and the host sleeps through the block's waits before
+ * polling for AFEINTSRC_ENDSEQ. A point costs a handful of requests however
+ * many registers it writes. ad5940_PlanInit() sets SeqId 3 at address 0 with
+ * 512 words (the sequencer's 2kB next to a 4kB data FIFO); change them before
+ * adding points if that SRAM is in use. A block that does not fit is
+ * rejected when it is added.
+ *
+ * ad5940_PlanAddPointCached() keeps the blocks in the sequence cache
+ * (ad5940_seqcache.h), so a later process compiling the same profile loads
+ * them from disk without replaying the driver calls.
+ *
+ * The sequencer command format limits blocks to AFE registers up to 0x21ff
+ * with 24 bit data; anything else (e.g. ad5940_AFEPwrBW) has to be applied by
+ * the caller.
+ */
+
+/**
+ * Point generator. Called with the sequencer generator enabled; it issues the
+ * driver calls that set up Point and returns 0 or a negative error code.
+ */
+typedef int (*ad5940_plan_fn)(struct ad5940_dev *dev, void *ctx, uint32_t Point);
+
+struct ad5940_plan
+{
+   uint32_t PointCnt;
+   uint32_t *pCmd;       /* Blocks back to back */
+   uint32_t *pStart;     /* PointCnt + 1 entries, block i is pCmd[pStart[i]] .. pCmd[pStart[i + 1] - 1] */
+   uint32_t CmdCap;
+   uint32_t PointCap;
+   float SysClkFreq;     /* Times the SEQ_WAIT commands of a block */
+   uint32_t SeqId;       /* SEQID_xxx the blocks run as */
+   uint32_t SeqRamAddr;  /* SRAM word address of the running block */
+   uint32_t SeqRamWords; /* SRAM words available there */
+   uint32_t TimeoutMs;   /* Time for a block to end after its waits */
+};
+
+int ad5940_PlanInit(struct ad5940_plan *pPlan, float SysClkFreq);
+int ad5940_PlanAddPoint(struct ad5940_dev *dev, struct ad5940_plan *pPlan,
+                        ad5940_plan_fn gen, void *ctx);
+int ad5940_PlanAddPointCached(struct ad5940_dev *dev, struct ad5940_plan *pPlan,
+                              const char *CacheDir, uint64_t Key, ad5940_plan_fn gen, void *ctx);
+int ad5940_PlanApply(struct ad5940_dev *dev, const struct ad5940_plan *pPlan,
+                     uint32_t Point);
+uint32_t ad5940_PlanBlockLen(const struct ad5940_plan *pPlan, uint32_t Point);
+void ad5940_PlanFree(struct ad5940_plan *pPlan);
+
+#endif // _AD5940_PLAN_H_
@@ -0,0 +1,57 @@
+#ifndef _AD5940_SEQCACHE_H_
+#define _AD5940_SEQCACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ad5940.h"
+
+/**
+ * On-disk cache of generated sequencer programs.
+ *
+ * A sequence produced by the sequencer generator is a pure function of the
+ * configuration structures passed to the driver calls made while the generator
+ * was running, of the driver itself and of the register defaults read from the
+ * chip on first access. The cache stores the generated command array in a file
+ * named after a 64-bit key built from those inputs, so a known measurement
+ * profile can be loaded straight into SRAM without replaying the driver calls.
+ *
+ * ad5940_SEQCacheKeyInit() covers the driver and the file format only. The
+ * caller builds the rest of the key: every configuration input, and the chip
+ * through ad5940_SEQCacheKeyChip() (one register read) so that a part with
+ * other register defaults does not pick up another part's sequences. Anything
+ * else gen() reads back from the chip that may differ between runs must be
+ * added too, or the cache must not be used.
+ *
+ * A hit does not call gen(): nothing is read from the chip and the register
+ * shadow of the sequencer generator is not updated. Start every generated
+ * sequence with ad5940_SEQGenInit() rather than reusing that shadow.
+ *
+ * Config structures are hashed byte by byte, padding included: memset() them
+ * before filling in the fields, as the examples already do.
+ */
+
+#define AD5940_SEQCACHE_MAGIC 0x51455341 /**< "ASEQ" */
+#define AD5940_SEQCACHE_FORMAT 1         /**< Bump when the file layout changes */
+
+/**
+ * Sequence generator callback. Called with the generator already enabled, it
+ * should issue the driver calls that make up the sequence and return 0 or a
+ * negative error code.
+ */
+typedef int (*ad5940_seqgen_fn)(struct ad5940_dev *dev, void *ctx);
+
+uint64_t ad5940_SEQCacheKeyInit(void);
+uint64_t ad5940_SEQCacheKeyAdd(uint64_t key, const void *pData, size_t len);
+int ad5940_SEQCacheKeyChip(struct ad5940_dev *dev, uint64_t *pKey);
+
+int ad5940_SEQCacheStore(const char *dir, uint64_t key,
+                         const uint32_t *pSeqCmd, uint32_t SeqLen);
+int ad5940_SEQCacheLoad(const char *dir, uint64_t key, uint32_t *pBuffer,
+                        uint32_t BufferSize, uint32_t *pSeqLen);
+int ad5940_SEQCacheGet(struct ad5940_dev *dev, const char *dir, uint64_t key,
+                       ad5940_seqgen_fn gen, void *ctx, uint32_t *pBuffer,
+                       uint32_t BufferSize, const uint32_t **ppSeqCmd,
+                       uint32_t *pSeqLen);
+
+#endif // _AD5940_SEQCACHE_H_
@@ -16,5 +16,7 @@ int ad5940_clr_bits_register(int fd, uint16_t address, uint32_t value);
 
 int ad5940_wr_mask_register(int fd, uint16_t address, uint32_t mask, uint32_t value);
 int ad5940_rd_fifo(int fd, uint32_t readcount, uint32_t *buffer);
+int ad5940_wr_seq(int fd, uint32_t start_addr, const uint32_t *words, uint32_t count);
+int ad5940_rd_regs(int fd, const uint16_t *addresses, uint32_t count, uint32_t *values);
 
 #endif // __AD5940_SERIAL__
\ No newline at end of file
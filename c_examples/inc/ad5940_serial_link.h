@@ -0,0 +1,27 @@
+#ifndef _AD5940_SERIAL_LINK_H_
+#define _AD5940_SERIAL_LINK_H_
+
+#include <stdint.h>
+
+/**
+ * Link to the bridge below the transport of ad5940_serial.h: one request per
+ * call, nothing recorded. ad5940_transport.c puts the trace and the replay on
+ * top of it. ad5940_serial.c implements the link with JSON-RPC on a serial
+ * port, the host checks with a simulated bridge.
+ */
+
+int serial_open_port(const char *device);
+void serial_close_port(int fd);
+int serial_flush_port(int fd);
+
+int serial_reset_hardware(int fd);
+int serial_read_register(int fd, uint16_t address, uint32_t *value);
+int serial_write_register(int fd, uint16_t address, uint32_t value);
+int serial_set_bits_register(int fd, uint16_t address, uint32_t value);
+int serial_clr_bits_register(int fd, uint16_t address, uint32_t value);
+int serial_wr_mask_register(int fd, uint16_t address, uint32_t mask, uint32_t value);
+int serial_rd_fifo(int fd, uint32_t readcount, uint32_t *buffer);
+int serial_wr_seq(int fd, uint32_t start_addr, const uint32_t *words, uint32_t count);
+int serial_rd_regs(int fd, const uint16_t *addresses, uint32_t count, uint32_t *values);
+
+#endif // _AD5940_SERIAL_LINK_H_
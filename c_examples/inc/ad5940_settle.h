@@ -0,0 +1,55 @@
+#ifndef _AD5940_SETTLE_H_
+#define _AD5940_SETTLE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "ad5940.h"
+
+/**
+ * Settling times between a configuration step and the measurement.
+ *
+ * Two things have to settle before a DFT sees a clean signal:
+ *  - the analog path after the switch matrix, the excitation or its frequency
+ *    changed: the TIA (RTIA * CTIA) and, if known, the load itself are first
+ *    order systems that need ln(1 / TargetRelErr) time constants,
+ *  - the digital filters after the ADC starts converting: a SINCn filter
+ *    needs n output samples before its output only depends on the new input,
+ *    the 50/60Hz notch is counted as one more SINC2 sample.
+ *
+ * ad5940_SettleTime() returns both. The time can be spent in the sequencer
+ * (ad5940_SettleSeqWait) or on the host. Host waits are deadlines: the
+ * request latency of the serial link already spent after
+ * ad5940_SettleStart() is not slept again in ad5940_SettleWait().
+ */
+
+typedef struct
+{
+   uint32_t ADCRate;      /**< ADCRATE_800KHZ or ADCRATE_1P6MHZ */
+   uint32_t ADCSinc3Osr;  /**< ADCSINC3OSR_xxx */
+   uint32_t ADCSinc2Osr;  /**< ADCSINC2OSR_xxx */
+   uint32_t ADCAvgNum;    /**< ADCAVGNUM_xxx, used with DFTSRC_AVG */
+   uint32_t DftSrc;       /**< DFTSRC_xxx, the filters in front of it have to settle */
+   bool Sinc2NotchEn;     /**< Notch after SINC2 in the path */
+   float Freq;            /**< Excitation frequency, Hz */
+   float Rtia;            /**< RTIA in Ohm */
+   float CtiaPf;          /**< CTIA in pF */
+   float LoadTau;         /**< Time constant of the load, s (0: unknown, only the TIA counts) */
+   float MinCycles;       /**< Excitation periods to wait at least after a change (0: none) */
+   float TargetRelErr;    /**< Residual of a step response that is acceptable (0: 1e-4) */
+} SettleCfg_Type;
+
+typedef struct
+{
+   float Analog; /**< Seconds after a switch/excitation/frequency change */
+   float Filter; /**< Seconds from ADC start until the DFT source is valid */
+} SettleTime_Type;
+
+int ad5940_SettleTime(const SettleCfg_Type *pCfg, SettleTime_Type *pTime);
+uint32_t ad5940_SettleSeqWait(float Seconds, float SysClkFreq,
+                              uint32_t *pSeqCmd, uint32_t MaxCmd);
+void ad5940_SettleStart(struct timespec *pDeadline, float Seconds);
+void ad5940_SettleWait(const struct timespec *pDeadline);
+
+#endif // _AD5940_SETTLE_H_
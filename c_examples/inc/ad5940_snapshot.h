@@ -0,0 +1,71 @@
+#ifndef _AD5940_SNAPSHOT_H_
+#define _AD5940_SNAPSHOT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "ad5940.h"
+
+/**
+ * Register snapshot for diagnostics.
+ *
+ * ad5940_SnapshotRead() reads every register of ad5940_SnapshotRegs[] (the
+ * configuration, switch and status registers of the AFE, clocks, interrupt
+ * controller, GPIO and wakeup timer) with one batched transfer. None of them
+ * has a read side effect, the FIFO data registers are not in the list.
+ *
+ * The text form written by ad5940_SnapshotWrite() has one "NAME ADDRESS VALUE"
+ * line per register in a fixed order, so two runs can be compared with diff.
+ * ad5940_SnapshotDecode() and ad5940_SnapshotDiff() render the bitfields from
+ * the BITM_/BITP_ definitions of ad5940.h and need no hardware.
+ *
+ * ad5940_SnapshotRestore() writes back what differs from an earlier snapshot,
+ * for example after hibernate. It goes in phases rather than in table order:
+ * oscillators (waiting until they are ready), clock selection, the
+ * configuration of the blocks, and the control registers (AFECON, SEQCON,
+ * FIFOCON, the wakeup timer) last, so nothing is enabled before its clock and
+ * configuration are in place.
+ */
+
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_REG_COUNT 92
+
+#define SNAPSHOT_F_STATUS 0x01 /* read only, or a write has side effects: never restored */
+#define SNAPSHOT_F_KEY 0x02    /* a write needs the unlock key first */
+
+typedef struct
+{
+   const char *Name;
+   uint32_t Mask;
+   uint8_t Pos;
+} RegField_Type;
+
+typedef struct
+{
+   const char *Name;
+   uint16_t Address;
+   uint8_t Flags; /**< SNAPSHOT_F_xxx */
+   uint8_t FieldCount;
+   const RegField_Type *pFields;
+} RegInfo_Type;
+
+typedef struct
+{
+   uint32_t Value[SNAPSHOT_REG_COUNT]; /**< In ad5940_SnapshotRegs[] order */
+   bool Valid[SNAPSHOT_REG_COUNT];     /**< Value was read or loaded */
+} Snapshot_Type;
+
+extern const RegInfo_Type ad5940_SnapshotRegs[SNAPSHOT_REG_COUNT];
+
+int ad5940_SnapshotIndex(uint16_t Address);
+bool ad5940_SnapshotGet(const Snapshot_Type *pSnap, uint16_t Address, uint32_t *pValue);
+
+int ad5940_SnapshotRead(struct ad5940_dev *dev, Snapshot_Type *pSnap);
+int ad5940_SnapshotRestore(struct ad5940_dev *dev, const Snapshot_Type *pRef, const Snapshot_Type *pNow);
+int ad5940_SnapshotWrite(FILE *fp, const Snapshot_Type *pSnap);
+int ad5940_SnapshotLoad(FILE *fp, Snapshot_Type *pSnap);
+void ad5940_SnapshotDecode(FILE *fp, const Snapshot_Type *pSnap);
+int ad5940_SnapshotDiff(FILE *fp, const Snapshot_Type *pA, const Snapshot_Type *pB);
+
+#endif // _AD5940_SNAPSHOT_H_
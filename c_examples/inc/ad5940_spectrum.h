@@ -0,0 +1,49 @@
+#ifndef _AD5940_SPECTRUM_H_
+#define _AD5940_SPECTRUM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ad5940.h"
+
+/**
+ * Raw waveform capture and host side spectrum.
+ *
+ * Instead of one DFT bin per conversion, ad5940_CaptureWaveform() fills the
+ * data FIFO with SINC3 or SINC2 samples in one go and the host computes the
+ * whole spectrum with a real FFT. The FFT works on split real/imaginary arrays
+ * and uses SSE2 or NEON for the butterflies when the compiler targets them.
+ *
+ * The capture length is limited by the data FIFO (1024 words with the 4kB FIFO
+ * set by ad5940_init).
+ */
+
+typedef struct
+{
+   uint32_t N;      /**< Real FFT length, power of two */
+   uint32_t M;      /**< N / 2, length of the complex FFT inside */
+   float *pTwRe;    /**< Per stage twiddles of the M point FFT, stage by stage */
+   float *pTwIm;
+   float *pSplitRe; /**< exp(-2*pi*i*k/N), k < M, for the real split */
+   float *pSplitIm;
+   uint32_t *pBitRev;
+   float *pWorkRe;
+   float *pWorkIm;
+   float *pWindow;  /**< Periodic Hann window, N points */
+} FFTPlan_Type;
+
+int ad5940_FFTInit(FFTPlan_Type *pPlan, uint32_t N);
+void ad5940_FFTFree(FFTPlan_Type *pPlan);
+void ad5940_FFTWindow(const FFTPlan_Type *pPlan, const float *pIn, float *pOut);
+int ad5940_FFTReal(FFTPlan_Type *pPlan, const float *pIn, float *pRe, float *pIm);
+void ad5940_FFTMagnitude(const FFTPlan_Type *pPlan, const float *pRe,
+                         const float *pIm, float *pMag);
+
+float ad5940_ADCSampleRate(uint32_t ADCRate, uint32_t Sinc3Osr,
+                           uint32_t Sinc2Osr, bool Sinc2);
+int ad5940_CaptureWaveform(struct ad5940_dev *dev, uint32_t FifoSrc,
+                           uint32_t N, float *pSamples);
+int ad5940_CaptureWaveformSync(struct ad5940_dev *dev, uint32_t FifoSrc,
+                               uint32_t N, uint32_t SyncCtrl, float *pSamples);
+
+#endif // _AD5940_SPECTRUM_H_
@@ -0,0 +1,42 @@
+#ifndef _AD5940_STAT_H_
+#define _AD5940_STAT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ad5940.h"
+
+/**
+ * Mean and noise of a DC channel.
+ *
+ * The statistics block computes mean and variance over windows of 8 to 128
+ * SINC2+notch samples. ad5940_StatMeasure() runs as many windows as needed and
+ * reads two registers per window instead of every sample; windows are pooled
+ * on the host. Conversions stop while the host reads a window and start again
+ * for the next one, so no window is skipped: the result covers exactly the
+ * requested samples, in bursts of one window with gaps of a few requests.
+ *
+ * If the sample count is below 8 or is not a multiple of 8, no window size
+ * fits, and the samples are captured raw through the data FIFO instead and
+ * reduced with Welford's algorithm. The raw capture is also used when the
+ * largest window that fits is shorter than 32 samples, or when the windows
+ * would take more requests than reading the samples from the FIFO, as long
+ * as the samples fit the FIFO. 1000 samples, for example, only split into
+ * 125 windows of 8.
+ *
+ * Results are in ADC codes (mean) and codes squared (population variance).
+ */
+
+typedef struct
+{
+   float Mean;       /**< Signed ADC codes */
+   float Variance;   /**< Population variance, codes^2 */
+   uint32_t Samples; /**< Samples behind the result */
+   bool OnChip;      /**< Computed by the statistics block */
+} StatResult_Type;
+
+void ad5940_StatWelford(const float *pData, uint32_t Count, StatResult_Type *pResult);
+int ad5940_StatMeasure(struct ad5940_dev *dev, uint32_t Samples, uint32_t StatDev,
+                       StatResult_Type *pResult);
+
+#endif // _AD5940_STAT_H_
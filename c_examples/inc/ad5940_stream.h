@@ -0,0 +1,143 @@
+#ifndef _AD5940_STREAM_H_
+#define _AD5940_STREAM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "ad5940.h"
+
+/**
+ * Continuous acquisition with the data FIFO in stream mode.
+ *
+ * The thread that owns the device calls ad5940_StreamPump() in a loop. Each
+ * call waits until the FIFO holds about one threshold worth of words, drains
+ * it and pushes the words into a lock-free single-producer/single-consumer
+ * ring. A processing thread started by ad5940_StreamStart() pops the ring and
+ * hands the words to the user callback.
+ *
+ * The drain never blocks on the consumer: a stalled consumer is absorbed by the
+ * ring, and only when the ring is full are words dropped (and counted). Losses
+ * on the chip side are detected from the FIFO count reaching the FIFO depth and
+ * confirmed with the DATAFIFOOF flag.
+ *
+ * Timestamps: with ConsumeTime set, every batch comes with the host time
+ * (CLOCK_MONOTONIC) its first word arrived in the FIFO and the time between
+ * words. The device clock is the word index: a fixed-rate source (ADC
+ * filters, or a sequence paced by the wakeup timer) pushes word n at
+ * t0 + n * T. Every FIFO count read brackets the arrival of the newest word:
+ * it arrived before the reply and less than one word time before the request.
+ * A linear fit, weighted by the width of these brackets, over the last
+ * STREAM_TS_POINTS reads gives t0 and T. T is measured against the host
+ * clock, so the error of the nominal WordRate does not add up. ErrBound is
+ * the largest distance from the fit to the far end of a bracket. Words lost
+ * in a FIFO overflow are counted from the fit, timed by the FIFO read since
+ * stream mode keeps dropping the oldest words until then. The count is good
+ * to the words that arrive during that read; the fit starts over after it,
+ * so later times stay right even if their index is off by that much.
+ */
+
+#define STREAM_TS_POINTS 64      /* FIFO count reads in the fit */
+#define STREAM_TS_MIN_POINTS 4   /* below this the nominal WordRate is used for T */
+#define STREAM_BATCH_RECORDS 1024 /* batches in flight to the processing thread */
+
+/**
+ * Consumer callback, runs on the processing thread.
+ */
+typedef void (*ad5940_stream_fn)(void *ctx, const uint32_t *pData, uint32_t Count);
+
+typedef struct
+{
+   uint64_t Index;  /**< Word index of pData[0] since ad5940_StreamStart() */
+   double Time;     /**< Host time of pData[0], CLOCK_MONOTONIC seconds */
+   double Period;   /**< Seconds between words, pData[i] is at Time + i * Period */
+   float ErrBound;  /**< Error bound of Time over the fitted reads, s */
+} StreamTime_Type;
+
+/**
+ * Timestamped consumer callback, runs on the processing thread.
+ */
+typedef void (*ad5940_stream_time_fn)(void *ctx, const uint32_t *pData, uint32_t Count,
+                                      const StreamTime_Type *pTime);
+
+typedef struct
+{
+   uint32_t FIFOSrc;      /**< FIFOSRC_DFT, FIFOSRC_SINC3, ... */
+   uint32_t FIFOSize;     /**< FIFOSIZE_2KB, FIFOSIZE_4KB or FIFOSIZE_6KB */
+   float WordRate;        /**< Words per second the source pushes into the FIFO */
+   float LinkLatency;     /**< Seconds per request round trip (0: default) */
+   float LinkWordTime;    /**< Seconds per transferred FIFO word (0: default) */
+   uint32_t RingWords;    /**< Host ring size, rounded up to a power of two (0: default) */
+   ad5940_stream_fn Consume;
+   ad5940_stream_time_fn ConsumeTime; /**< Used instead of Consume if set */
+   void *ctx;
+} StreamCfg_Type;
+
+typedef struct
+{
+   uint64_t WordsRead;    /**< Words drained from the FIFO */
+   uint64_t WordsDropped; /**< Words lost because the ring was full */
+   uint32_t FifoOverflows; /**< Times the chip FIFO overflowed */
+   uint32_t MaxFifoCnt;   /**< Highest FIFO count seen */
+   uint32_t Threshold;    /**< FIFO threshold in use */
+   uint64_t WordsLost;    /**< Words lost in FIFO overflows, estimated from the time fit */
+   double Period;         /**< Fitted seconds between words */
+   float ErrBound;        /**< Error bound of the fit, s */
+} StreamStat_Type;
+
+struct ad5940_stream_point
+{
+   double Index; /* newest word at the FIFO count read */
+   double Time;  /* middle of its arrival bracket, relative to TimeBase */
+   double Half;  /* half width of the bracket */
+};
+
+struct ad5940_stream_batch
+{
+   size_t RingPos; /* ring position of the first word */
+   uint32_t Count;
+   StreamTime_Type Time;
+};
+
+struct ad5940_stream
+{
+   StreamCfg_Type Cfg;
+   uint32_t FifoDepth; /* words */
+   uint32_t Threshold; /* words */
+   uint32_t *pDrainBuf;
+
+   /* SPSC ring: head written by the producer, tail by the consumer */
+   uint32_t *pRing;
+   size_t RingMask;
+   _Atomic size_t Head;
+   _Atomic size_t Tail;
+
+   /* SPSC batch records for ConsumeTime, same ownership as Head/Tail */
+   struct ad5940_stream_batch *pBatch;
+   _Atomic size_t BatchHead;
+   _Atomic size_t BatchTail;
+
+   /* Host/device time fit, producer side */
+   uint64_t Index;   /* words produced before the current FIFO content */
+   double TimeBase;  /* CLOCK_MONOTONIC seconds of the first read */
+   struct ad5940_stream_point Point[STREAM_TS_POINTS];
+   uint32_t Points;
+   double FitTime;   /* time of word 0 relative to TimeBase */
+   double FitPeriod;
+
+   _Atomic bool Running;
+   pthread_t Consumer;
+   StreamStat_Type Stat;
+};
+
+uint32_t ad5940_StreamThreshold(float WordRate, float LinkLatency,
+                                float LinkWordTime, uint32_t FifoDepth);
+int ad5940_StreamStart(struct ad5940_dev *dev, struct ad5940_stream *s,
+                       const StreamCfg_Type *pCfg);
+int ad5940_StreamPump(struct ad5940_dev *dev, struct ad5940_stream *s);
+int ad5940_StreamStop(struct ad5940_dev *dev, struct ad5940_stream *s);
+void ad5940_StreamGetStat(struct ad5940_stream *s, StreamStat_Type *pStat);
+
+#endif // _AD5940_STREAM_H_
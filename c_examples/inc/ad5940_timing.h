@@ -0,0 +1,72 @@
+#ifndef _AD5940_TIMING_H_
+#define _AD5940_TIMING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "ad5940.h"
+
+/**
+ * Wakeup timer periods in seconds.
+ *
+ * The wakeup timer counts LFOSC ticks. The oscillator is nominally 32kHz, but
+ * the actual frequency differs from part to part and drifts with temperature.
+ * ad5940_TimingInit() measures it against the system clock with
+ * ad5940_LFOSCMeasure(). ad5940_TimingUpdate() measures it again every
+ * RecalInterval seconds. Each new measurement moves the estimate by Alpha
+ * (an exponential moving average), so link jitter in a single measurement
+ * is averaged out while a slow drift is followed. A measurement outside
+ * TIMING_LFOSC_MIN..TIMING_LFOSC_MAX is rejected.
+ *
+ * The measurement uses the sequencer and the wakeup timer itself. Call
+ * ad5940_TimingUpdate() between runs, never while a sequence is paced by
+ * the timer.
+ *
+ * ad5940_TimingWupt() turns a period into SeqxSleepTime/SeqxWakeupTime
+ * register values for WUPTCfg_Type, PingPongCfg_Type or ad5940_WUPTTime().
+ * The time from one trigger to the next is SleepTime + 1 ticks after the
+ * first sequence plus WakeupTime + 1 ticks before the next one, so the
+ * period holds when every sequence in the order gets the same values. A
+ * period is a whole number of ticks. The period that will actually run is
+ * returned, so sample timestamps can use it instead of the requested one.
+ */
+
+#define TIMING_LFOSC_NOMINAL 32000.0f
+#define TIMING_LFOSC_MIN 28000.0f /* a measurement outside this range is rejected */
+#define TIMING_LFOSC_MAX 36000.0f
+#define TIMING_CAL_MS 1000.0f     /* default measurement time, 1ms of link jitter is 0.1% */
+#define TIMING_ALPHA 0.25f        /* default weight of a new measurement */
+#define TIMING_WAKEUP_TICKS 4     /* default wakeup time before the sequence is triggered */
+#define TIMING_WUPT_MAX 0xFFFFFu  /* SeqxSleepTime and SeqxWakeupTime are 20 bits */
+
+typedef struct
+{
+   uint32_t CalSeqAddr;  /**< SRAM address of the 3 commands ad5940_LFOSCMeasure() needs */
+   float CalDuration;    /**< ms per measurement (0: TIMING_CAL_MS) */
+   float SystemClkFreq;  /**< System clock frequency, Hz */
+   uint32_t InitCount;   /**< Measurements averaged by ad5940_TimingInit() (0: 1) */
+   float RecalInterval;  /**< Seconds between measurements in ad5940_TimingUpdate() (0: never) */
+   float Alpha;          /**< Weight of a new measurement, 0..1 (0: TIMING_ALPHA) */
+} TimingCfg_Type;
+
+struct ad5940_timing
+{
+   TimingCfg_Type Cfg;
+   float LFOSCFreq;     /* Filtered estimate, Hz */
+   float LastFreq;      /* Last accepted measurement, Hz */
+   uint32_t Measured;   /* Accepted measurements */
+   uint32_t Rejected;   /* Measurements out of range */
+   struct timespec Due; /* Next measurement of ad5940_TimingUpdate() */
+};
+
+int ad5940_TimingInit(struct ad5940_dev *dev, struct ad5940_timing *t,
+                      const TimingCfg_Type *pCfg);
+int ad5940_TimingUpdate(struct ad5940_dev *dev, struct ad5940_timing *t, bool Force);
+uint32_t ad5940_TimingTicks(const struct ad5940_timing *t, float Seconds);
+int ad5940_TimingWupt(const struct ad5940_timing *t, float Period, uint32_t WakeupTicks,
+                      uint32_t *pSleepTime, uint32_t *pWakeupTime, float *pActual);
+int ad5940_TimingApply(struct ad5940_dev *dev, const struct ad5940_timing *t, uint32_t SeqId,
+                       float Period, uint32_t WakeupTicks, float *pActual);
+
+#endif // _AD5940_TIMING_H_
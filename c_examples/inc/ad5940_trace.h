@@ -0,0 +1,90 @@
+#ifndef _AD5940_TRACE_H_
+#define _AD5940_TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * Binary trace of the serial transport and replay of a recorded session.
+ *
+ * The transport in ad5940_transport.c appends one record per request: what was
+ * asked, what came back and when, on CLOCK_MONOTONIC. Recording starts with
+ * ad5940_TraceRecordStart() or, for any program, by setting AD5940_TRACE to a
+ * file name before the port is opened.
+ *
+ * Opening the port "replay:<file>" instead of a device feeds the recorded
+ * responses back to the driver without hardware. Every request must match the
+ * recorded one, the first divergence fails with -EIO. "replay-rt:<file>" also
+ * answers each request when its response came in the recording, counted from
+ * the open, so the link time and the idle gaps between requests are kept and a
+ * run takes as long as the original session.
+ *
+ * Both sides take a lock per request, threads such as the stream producer can
+ * use the transport next to the main thread.
+ *
+ * File layout, little endian: 16 byte header ("AD5940TR", version, record
+ * size), then per request a TRACE_REC_SIZE byte record followed by Count
+ * payload words.
+ */
+
+#define TRACE_OP_RESET 0
+#define TRACE_OP_RD 1
+#define TRACE_OP_WR 2
+#define TRACE_OP_SET_BITS 3
+#define TRACE_OP_CLR_BITS 4
+#define TRACE_OP_WR_MASK 5
+#define TRACE_OP_RD_FIFO 6
+#define TRACE_OP_WR_SEQ 7
+#define TRACE_OP_RD_REGS 8
+
+#define TRACE_VERSION 1
+#define TRACE_REC_SIZE 32 /* bytes per record on file, without payload */
+
+typedef struct
+{
+   uint64_t Time;     /**< ns since recording started, taken at the request */
+   uint32_t Duration; /**< ns until the response was handled */
+   uint8_t Op;        /**< TRACE_OP_xxx */
+   int8_t Ret;        /**< 0 or the negative return value of the transport call */
+   uint32_t Address;  /**< Register, WR_SEQ: SRAM start address */
+   uint32_t Mask;     /**< WR_MASK only */
+   uint32_t Data;     /**< Written value, RD: value read, RD_FIFO: words requested, RD_REGS: registers */
+   uint32_t Count;    /**< Payload words: RD_FIFO words read, WR_SEQ words written,
+                           RD_REGS addresses followed by the values read */
+} TraceRec_Type;
+
+typedef struct
+{
+   uint32_t Requests;   /**< Requests answered from the trace */
+   uint32_t Mismatches; /**< Requests that differed from the recording */
+   uint64_t RecordedNs; /**< Link time of those requests in the recording */
+   uint64_t ElapsedNs;  /**< Wall time of the replay so far */
+} ReplayStat_Type;
+
+struct ad5940_trace_reader
+{
+   FILE *fp;
+   uint32_t Index; /* records read */
+};
+
+uint64_t ad5940_TraceNow(void);
+
+int ad5940_TraceRecordStart(const char *path);
+void ad5940_TraceRecordStop(void);
+bool ad5940_TraceRecording(void);
+void ad5940_TraceAdd(const TraceRec_Type *pRec, const uint32_t *pPayload);
+
+int ad5940_TraceOpen(struct ad5940_trace_reader *r, const char *path);
+int ad5940_TraceNext(struct ad5940_trace_reader *r, TraceRec_Type *pRec,
+                     uint32_t *pPayload, uint32_t PayloadCap);
+void ad5940_TraceClose(struct ad5940_trace_reader *r);
+
+int ad5940_ReplayOpen(const char *path, bool RealTime);
+bool ad5940_ReplayActive(void);
+int ad5940_ReplayOp(const TraceRec_Type *pReq, const uint32_t *pPayload,
+                    uint32_t *pValue, uint32_t *pWords, uint32_t WordsCap);
+void ad5940_ReplayGetStat(ReplayStat_Type *pStat);
+void ad5940_ReplayClose(void);
+
+#endif // _AD5940_TRACE_H_
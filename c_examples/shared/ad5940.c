@@ -36,6 +36,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include "ad5940.h"
 
@@ -76,12 +77,240 @@ void no_os_udelay(uint32_t usecs) {}
 
 /////////////////// NOOS STUFF END ///////
 
+/* Configuration ad5940_init() leaves the device in, split into blocks. A warm
+   attach reads the signature registers of all blocks at once and reapplies
+   only the blocks whose signature differs. */
+
+static const CLKCfg_Type init_clk_cfg = {
+	.ADCClkDiv = ADCCLKDIV_1,
+	.ADCCLkSrc = ADCCLKSRC_HFOSC,
+	.SysClkDiv = SYSCLKDIV_1,
+	.SysClkSrc = SYSCLKSRC_HFOSC,
+	.HfOSC32MHzMode = false,
+	.HFOSCEn = true,
+	.HFXTALEn = false,
+	.LFOSCEn = true,
+};
+
+static const FIFOCfg_Type init_fifo_cfg = {
+	.FIFOEn = true,
+	.FIFOMode = FIFOMODE_FIFO,
+	.FIFOSize = FIFOSIZE_4KB, /* 4kB for FIFO, The reset 2kB for sequencer */
+	.FIFOSrc = FIFOSRC_DFT,
+	.FIFOThresh = 2, /* DFT result. One pair for RCAL, another for Rz. One DFT
+					  * result have real part and imaginary part */
+};
+
+struct init_sig
+{
+	uint16_t Address;
+	uint32_t Mask;
+	uint32_t Value; /* expected (register & Mask) */
+};
+
+struct init_block
+{
+	const char *Name;
+	int (*Apply)(struct ad5940_dev *dev);
+	const struct init_sig *pSig;
+	uint32_t SigCount;
+};
+
+/* A reset leaves the sequencer and the wakeup timer stopped. A warm attach
+   stops whatever the previous process left running. */
+static int init_idle(struct ad5940_dev *dev)
+{
+	int ret;
+
+	ret = ad5940_WUPTCtrl(dev, false);
+	if (ret < 0)
+		return ret;
+	return ad5940_SEQCtrlS(dev, false);
+}
+
+static int init_clock(struct ad5940_dev *dev)
+{
+	CLKCfg_Type clk_cfg = init_clk_cfg;
+
+	return ad5940_CLKCfg(dev, &clk_cfg);
+}
+
+static int init_fifo(struct ad5940_dev *dev)
+{
+	FIFOCfg_Type fifo_cfg = init_fifo_cfg;
+	int ret;
+
+	fifo_cfg.FIFOEn = false;
+	ret = ad5940_FIFOCfg(dev, &fifo_cfg); /* Disable to reset FIFO. */
+	if (ret < 0)
+		return ret;
+	fifo_cfg.FIFOEn = true;
+	return ad5940_FIFOCfg(dev, &fifo_cfg); /* Enable FIFO here */
+}
+
+static int init_intc(struct ad5940_dev *dev)
+{
+	int ret;
+
+	/* Enable all interrupt in Interrupt Controller 1, so we can check INTC flags */
+	ret = ad5940_INTCCfg(dev, AFEINTC_1, AFEINTSRC_ALLINT, true);
+	if (ret < 0)
+		return ret;
+	/* Interrupt Controller 0 will control GP0 to generate interrupt to MCU */
+	ret = ad5940_INTCCfg(dev, AFEINTC_0, AFEINTSRC_DATAFIFOTHRESH, true);
+	if (ret < 0)
+		return ret;
+	return ad5940_INTCClrFlag(dev, AFEINTSRC_ALLINT);
+}
+
+static const struct init_sig sig_idle[] = {
+	{REG_AFE_SEQCON, BITM_AFE_SEQCON_SEQEN, 0},
+	{REG_WUPTMR_CON, BITM_WUPTMR_CON_EN, 0},
+};
+
+/* Only what AD5940_Initialize() writes and reads back as written */
+static const struct init_sig sig_platform[] = {
+	{REG_AFE_REPEATADCCNV, BITM_AFE_REPEATADCCNV_NUM | BITM_AFE_REPEATADCCNV_EN, 0x10},
+	{REG_AFE_ADCBUFCON, BITM_AFE_ADCBUFCON_AMPDIS | BITM_AFE_ADCBUFCON_CHOPDIS, 0x104},
+	{REG_ALLON_EI2CON, BITM_ALLON_EI2CON_BUSINTEN | BITM_ALLON_EI2CON_BUSINTMDE,
+	 BITM_ALLON_EI2CON_BUSINTEN | (1 << BITP_ALLON_EI2CON_BUSINTMDE)},
+	{REG_ALLON_PWRMOD, BITM_ALLON_PWRMOD_RAMRETEN | BITM_ALLON_PWRMOD_SEQSLPEN,
+	 BITM_ALLON_PWRMOD_RAMRETEN | BITM_ALLON_PWRMOD_SEQSLPEN},
+	{REG_AFE_PMBW, BITM_AFE_PMBW_SYSBW | BITM_AFE_PMBW_SYSHP, 0},
+};
+
+/* init_clk_cfg */
+static const struct init_sig sig_clock[] = {
+	{REG_AFECON_CLKSEL, BITM_AFECON_CLKSEL_SYSCLKSEL | BITM_AFECON_CLKSEL_ADCCLKSEL,
+	 SYSCLKSRC_HFOSC | (ADCCLKSRC_HFOSC << BITP_AFECON_CLKSEL_ADCCLKSEL)},
+	{REG_AFECON_CLKCON0, BITM_AFECON_CLKCON0_SYSCLKDIV | BITM_AFECON_CLKCON0_ADCCLKDIV,
+	 (SYSCLKDIV_1 << BITP_AFECON_CLKCON0_SYSCLKDIV) | (ADCCLKDIV_1 << BITP_AFECON_CLKCON0_ADCCLKDIV)},
+	{REG_ALLON_OSCCON, BITM_ALLON_OSCCON_HFXTALEN | BITM_ALLON_OSCCON_HFOSCEN | BITM_ALLON_OSCCON_LFOSCEN,
+	 BITM_ALLON_OSCCON_HFOSCEN | BITM_ALLON_OSCCON_LFOSCEN},
+	{REG_AFE_HPOSCCON, BITM_AFE_HPOSCCON_CLK32MHZEN, BITM_AFE_HPOSCCON_CLK32MHZEN}, /* 16MHz */
+};
+
+/* init_fifo_cfg */
+static const struct init_sig sig_fifo[] = {
+	{REG_AFE_CMDDATACON, BITM_AFE_CMDDATACON_DATAMEMMDE | BITM_AFE_CMDDATACON_DATA_MEM_SEL,
+	 (FIFOMODE_FIFO << BITP_AFE_CMDDATACON_DATAMEMMDE) | (FIFOSIZE_4KB << BITP_AFE_CMDDATACON_DATA_MEM_SEL)},
+	{REG_AFE_DATAFIFOTHRES, BITM_AFE_DATAFIFOTHRES_HIGHTHRES, 2 << BITP_AFE_DATAFIFOTHRES_HIGHTHRES},
+	{REG_AFE_FIFOCON, BITM_AFE_FIFOCON_DATAFIFOEN | BITM_AFE_FIFOCON_DATAFIFOSRCSEL,
+	 BITM_AFE_FIFOCON_DATAFIFOEN | (FIFOSRC_DFT << BITP_AFE_FIFOCON_DATAFIFOSRCSEL)},
+};
+
+static const struct init_sig sig_intc[] = {
+	{REG_INTC_INTCSEL1, AFEINTSRC_ALLINT, AFEINTSRC_ALLINT},
+	{REG_INTC_INTCSEL0, AFEINTSRC_DATAFIFOTHRESH, AFEINTSRC_DATAFIFOTHRESH},
+};
+
+#define SIG(x) x, sizeof(x) / sizeof(x[0])
+
+/* In the order a full init applies them */
+static const struct init_block init_blocks[] = {
+	{"idle", init_idle, SIG(sig_idle)},
+	{"platform", AD5940_Initialize, SIG(sig_platform)},
+	{"clock", init_clock, SIG(sig_clock)},
+	{"fifo", init_fifo, SIG(sig_fifo)},
+	{"intc", init_intc, SIG(sig_intc)},
+};
+
+#define INIT_BLOCKS (sizeof(init_blocks) / sizeof(init_blocks[0]))
+#define INIT_BLOCK_FIFO 3 /* index of "fifo" */
+#define INIT_SIG_MAX 24
+
+/* Read the signature of every block in one transfer, return a bit per block that differs */
+static int init_check(struct ad5940_dev *dev, uint32_t *pDiffer)
+{
+	uint16_t addr[INIT_SIG_MAX];
+	uint32_t value[INIT_SIG_MAX];
+	uint32_t i, k, n = 0;
+	int ret;
+
+	addr[n++] = REG_AFECON_ADIID;
+	for (i = 0; i < INIT_BLOCKS; i++)
+		for (k = 0; k < init_blocks[i].SigCount; k++)
+			addr[n++] = init_blocks[i].pSig[k].Address;
+
+	ret = ad5940_ReadRegs(dev, addr, n, value);
+	if (ret < 0)
+		return ret;
+	if (value[0] != AD5940_ADIID)
+		return -EFAULT;
+
+	*pDiffer = 0;
+	n = 1;
+	for (i = 0; i < INIT_BLOCKS; i++)
+	{
+		for (k = 0; k < init_blocks[i].SigCount; k++, n++)
+		{
+			const struct init_sig *sig = &init_blocks[i].pSig[k];
+
+			if ((value[n] & sig->Mask) != sig->Value)
+			{
+				log_debug("warm attach: %s 0x%04x is 0x%08x, expected 0x%08x/0x%08x",
+						  init_blocks[i].Name, sig->Address, value[n], sig->Value, sig->Mask);
+				*pDiffer |= 1u << i;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * @brief Take over a device that is already configured: reapply only the
+ *        blocks whose signature differs, then check again.
+ * @return 0 on success, -EAGAIN if the device still differs (a full init is
+ *         needed), negative error code otherwise.
+ */
+static int ad5940_attach(struct ad5940_dev *dev)
+{
+	uint32_t differ, reapplied, i;
+	int ret;
+
+	ret = init_check(dev, &differ);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < INIT_BLOCKS; i++)
+	{
+		if (!(differ & (1u << i)))
+			continue;
+		log_info("warm attach: reapplying %s", init_blocks[i].Name);
+		ret = init_blocks[i].Apply(dev);
+		if (ret < 0)
+			return ret;
+	}
+
+	reapplied = differ;
+	if (reapplied)
+	{
+		ret = init_check(dev, &differ);
+		if (ret < 0)
+			return ret;
+		if (differ)
+			return -EAGAIN;
+	}
+
+	/* Drop stale results of the previous process. init_fifo() already
+	   emptied the FIFO if it ran. */
+	if (!(reapplied & (1u << INIT_BLOCK_FIFO)))
+	{
+		ret = ad5940_FIFOCtrlS(dev, init_fifo_cfg.FIFOSrc, false);
+		if (ret < 0)
+			return ret;
+		ret = ad5940_FIFOCtrlS(dev, init_fifo_cfg.FIFOSrc, true);
+		if (ret < 0)
+			return ret;
+	}
+	return ad5940_INTCClrFlag(dev, AFEINTSRC_ALLINT);
+}
+
 /* Initialize AD5940 basic blocks like clock */
 int ad5940_init(struct ad5940_dev *dev)
 {
 	int ret = 0;
-	CLKCfg_Type clk_cfg;
-	FIFOCfg_Type fifo_cfg;
+	uint32_t i;
 
 	if (!dev)
 		return -EINVAL;
@@ -97,6 +326,14 @@ int ad5940_init(struct ad5940_dev *dev)
 	// flush serial port
 	flush_serial_port(dev->serial_port_handle);
 
+	if (dev->warm_attach)
+	{
+		ret = ad5940_attach(dev);
+		if (ret == 0)
+			return 0;
+		log_info("warm attach failed %d, resetting", ret);
+	}
+
 	// hardware reset AD594X
 	ret = ad5940_reset_hardware(dev->serial_port_handle);
 	if (ret < 0)
@@ -113,53 +350,14 @@ int ad5940_init(struct ad5940_dev *dev)
 		goto error;
 	}
 
-	/* Platform configuration */
-	ret = AD5940_Initialize(dev);
-	if (ret < 0)
-		goto error;
-
-	/* Step1. Configure clock */
-	clk_cfg.ADCClkDiv = ADCCLKDIV_1;
-	clk_cfg.ADCCLkSrc = ADCCLKSRC_HFOSC;
-	clk_cfg.SysClkDiv = SYSCLKDIV_1;
-	clk_cfg.SysClkSrc = SYSCLKSRC_HFOSC;
-	clk_cfg.HfOSC32MHzMode = false;
-	clk_cfg.HFOSCEn = true;
-	clk_cfg.HFXTALEn = false;
-	clk_cfg.LFOSCEn = true;
-	ret = ad5940_CLKCfg(dev, &clk_cfg);
-	if (ret < 0)
-		goto error;
-
-	/* Step2. Configure FIFO and Sequencer*/
-	fifo_cfg.FIFOEn = false;
-	fifo_cfg.FIFOMode = FIFOMODE_FIFO;
-	fifo_cfg.FIFOSize = FIFOSIZE_4KB; /* 4kB for FIFO, The reset 2kB
-									   * for sequencer */
-	fifo_cfg.FIFOSrc = FIFOSRC_DFT;
-	fifo_cfg.FIFOThresh = 2;			  /* DFT result. One pair for RCAL, another for
-										   * Rz. One DFT result have real part and
-										   * imaginary part */
-	ret = ad5940_FIFOCfg(dev, &fifo_cfg); /* Disable to reset FIFO. */
-	if (ret < 0)
-		goto error;
-	fifo_cfg.FIFOEn = true;
-	ret = ad5940_FIFOCfg(dev, &fifo_cfg); /* Enable FIFO here */
-	if (ret < 0)
-		goto error;
-
-	/* Step3. Interrupt controller */
-	/* Enable all interrupt in Interrupt Controller 1, so we can check INTC flags */
-	ret = ad5940_INTCCfg(dev, AFEINTC_1, AFEINTSRC_ALLINT, true);
-	if (ret < 0)
-		goto error;
-	/* Interrupt Controller 0 will control GP0 to generate interrupt to MCU */
-	ret = ad5940_INTCCfg(dev, AFEINTC_0, AFEINTSRC_DATAFIFOTHRESH, true);
-	if (ret < 0)
-		goto error;
-	ret = ad5940_INTCClrFlag(dev, AFEINTSRC_ALLINT);
-	if (ret < 0)
-		goto error;
+	/* Platform configuration, clock, FIFO and sequencer, interrupt controller.
+	   The device is idle after the reset. */
+	for (i = 1; i < INIT_BLOCKS; i++)
+	{
+		ret = init_blocks[i].Apply(dev);
+		if (ret < 0)
+			goto error;
+	}
 
 #ifdef AD_BOARD
 
@@ -373,6 +571,154 @@ int ad5940_SEQGenCtrl(struct ad5940_dev *dev, bool enable)
 	return 0;
 }
 
+#define SEQ_OPT_REMOVED 0xffffffff /* Marker, never produced by SEQ_WR/SEQ_WAIT/SEQ_TOUT of a valid command */
+
+/* Registers where the write itself is the action, where every value written
+   takes effect at once (enables, DAC codes, unlock keys), or whose value
+   hardware changes. Writes to them are never removed and act as a barrier for
+   the optimizer: AFECON off/on toggles inside a wait-free segment stay. */
+static bool AD5940_SEQOptIsVolatile(uint32_t RegIdx)
+{
+	switch (0x2000 | (RegIdx << 2))
+	{
+	case REG_AFE_AFECON:
+	case REG_AFE_SWCON:
+	case REG_AFE_HSDACDAT:
+	case REG_AFE_LPDACDAT0:
+	case REG_AFE_LPMODEKEY:
+	case REG_AFE_LPMODECLKSEL:
+	case REG_AFE_LPMODECON:
+	case REG_AFE_ADCDAT:
+	case REG_AFE_DFTREAL:
+	case REG_AFE_DFTIMAG:
+	case REG_AFE_SINC2DAT:
+	case REG_AFE_TEMPSENSDAT:
+	case REG_AFE_SEQCON:
+	case REG_AFE_FIFOCON:
+	case REG_AFE_SYNCEXTDEVICE:
+	case REG_AFE_SEQCRC:
+	case REG_AFE_SEQCNT:
+	case REG_AFE_SEQTIMEOUT:
+	case REG_AFE_DATAFIFORD:
+	case REG_AFE_CMDFIFOWRITE:
+	case REG_AFE_CMDFIFOWADDR:
+	case REG_AFE_AFEGENINTSTA:
+	case REG_AFE_SEQTRGSLP:
+	case REG_AFE_SEQSLPLOCK:
+	case REG_AFE_SEQ0INFO:
+	case REG_AFE_SEQ1INFO:
+	case REG_AFE_SEQ2INFO:
+	case REG_AFE_SEQ3INFO:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief Peephole optimizer for a generated sequence. Works in place on the
+ *        command array (e.g. the buffer passed to ad5940_SEQGenInit):
+ *        - a write overwritten by a later write to the same register with no
+ *          wait/timeout command in between is removed (dead write);
+ *        - a write of the value the sequence already wrote to that register is
+ *          removed (redundant write);
+ *        - consecutive SEQ_WAIT commands are merged into one.
+ *        Writes to registers with side effects (AFECON, SWCON, DAC data,
+ *        SEQCON, FIFOCON, SYNCEXTDEVICE, AFEGENINTSTA, SEQTRGSLP, ...) are
+ *        kept and act as barriers.
+ *        Every removed command shortens execution by one command slot, i.e. by
+ *        one system clock plus SEQCON.SEQWRTMR; waits are otherwise kept exact.
+ * @param pSeqCmd Sequencer commands, rewritten in place.
+ * @param pSeqLen In: sequence length. Out: optimized length.
+ * @param pInfo Optional statistics, can be NULL.
+ * @return 0 in case of success, negative error code otherwise.
+ */
+int ad5940_SEQOptimize(uint32_t *pSeqCmd, uint32_t *pSeqLen,
+					   SEQOptInfo_Type *pInfo)
+{
+	uint32_t last_wr[128];		 /* Index of the last write in the current wait-free segment */
+	uint32_t known[128];		 /* Value the sequence left in each register */
+	bool known_valid[128] = {false};
+	uint32_t seg_id[128] = {0}; /* Segment in which last_wr was recorded, 0: none */
+	uint32_t seg = 1;
+	uint32_t len, i, n, reg;
+	SEQOptInfo_Type info = {0};
+
+	if (!pSeqCmd || !pSeqLen)
+		return -EINVAL;
+	len = *pSeqLen;
+	info.OrigLen = len;
+
+	/* 1. Dead writes inside wait-free segments */
+	for (i = 0; i < len; i++)
+	{
+		uint32_t cmd = pSeqCmd[i];
+
+		if (!SEQ_CMD_IS_WR(cmd) || AD5940_SEQOptIsVolatile(SEQ_CMD_WR_ADDR(cmd)))
+		{
+			seg++;
+			continue;
+		}
+		reg = SEQ_CMD_WR_ADDR(cmd);
+		if (seg_id[reg] == seg)
+		{
+			pSeqCmd[last_wr[reg]] = SEQ_OPT_REMOVED;
+			info.DeadWrites++;
+		}
+		seg_id[reg] = seg;
+		last_wr[reg] = i;
+	}
+
+	/* 2. Writes of an already written value, 3. merge waits, compact */
+	for (i = 0, n = 0; i < len; i++)
+	{
+		uint32_t cmd = pSeqCmd[i];
+
+		if (cmd == SEQ_OPT_REMOVED)
+			continue;
+
+		if (SEQ_CMD_IS_WR(cmd))
+		{
+			reg = SEQ_CMD_WR_ADDR(cmd);
+			if (!AD5940_SEQOptIsVolatile(reg))
+			{
+				if (known_valid[reg] && known[reg] == SEQ_CMD_WR_DATA(cmd))
+				{
+					info.RedundantWrites++;
+					continue;
+				}
+				known[reg] = SEQ_CMD_WR_DATA(cmd);
+				known_valid[reg] = true;
+			}
+		}
+		else if (SEQ_CMD_IS_WAIT(cmd) && n > 0 && SEQ_CMD_IS_WAIT(pSeqCmd[n - 1]))
+		{
+			/* SEQ_WAIT(a) + SEQ_WAIT(b) occupy a + b + 2 clocks, SEQ_WAIT(a + b + 1) the same */
+			uint64_t clks = (uint64_t)SEQ_CMD_WAIT_CLKS(pSeqCmd[n - 1]) + SEQ_CMD_WAIT_CLKS(cmd) + 1;
+			if (clks <= 0x3fffffff)
+			{
+				pSeqCmd[n - 1] = SEQ_WAIT(clks);
+				info.WaitsMerged++;
+				continue;
+			}
+		}
+		pSeqCmd[n++] = cmd;
+	}
+
+	*pSeqLen = n;
+	info.NewLen = n;
+	if (pInfo)
+		*pInfo = info;
+
+#ifdef AD5940_DEBUG
+	log_debug("SEQ optimize: %u -> %u commands (dead %u, redundant %u, waits %u)",
+			  info.OrigLen, info.NewLen, info.DeadWrites, info.RedundantWrites,
+			  info.WaitsMerged);
+#endif
+
+	return 0;
+}
+
 /**
  * @} Sequencer_Generator_Functions
  */
@@ -680,6 +1026,40 @@ int ad5940_FIFORd(struct ad5940_dev *dev, uint32_t *pBuffer,
 }
 */
 
+/* Words per "rd_fifo" request, keeps the JSON reply well inside the host receive buffer */
+#define FIFORD_CHUNK 512
+
+/**
+  @brief Read specific number of data from FIFO. The bridge reads DATAFIFORD in
+		 a burst, large reads are split into several requests.
+  @param pBuffer: Pointer to a buffer that used to store data read back.
+  @param uiReadCount: Hou much data to be read.
+  @return 0 in case of success, negative error code otherwise.
+ **/
+int ad5940_FIFORd(struct ad5940_dev *dev, uint32_t *pBuffer,
+				  uint32_t uiReadCount)
+{
+	int n;
+
+	if (!dev || !pBuffer)
+		return -EINVAL;
+
+	while (uiReadCount)
+	{
+		n = ad5940_rd_fifo(dev->serial_port_handle,
+						   uiReadCount > FIFORD_CHUNK ? FIFORD_CHUNK : uiReadCount,
+						   pBuffer);
+		if (n < 0)
+			return n;
+		if (n == 0)
+			return -EIO; /* FIFO returned less than it reported */
+		pBuffer += n;
+		uiReadCount -= n;
+	}
+
+	return 0;
+}
+
 /** Write to address @ref RegAddr with data @RegData  */
 int ad5940_WriteReg(struct ad5940_dev *dev, uint16_t RegAddr, uint32_t RegData)
 {
@@ -704,6 +1084,34 @@ int ad5940_ReadReg(struct ad5940_dev *dev, uint16_t RegAddr, uint32_t *RegData)
 		return ad5940_read_register(dev->serial_port_handle, RegAddr, RegData);
 }
 
+/** Read @ref RegCount registers, in one request if the bridge supports it */
+int ad5940_ReadRegs(struct ad5940_dev *dev, const uint16_t *pRegAddr, uint32_t RegCount,
+					uint32_t *pRegData)
+{
+	int ret;
+
+	if (!dev)
+		return -EINVAL;
+
+	if (!dev->SeqGenDB.EngineStart && !dev->no_bulk_reg_read)
+	{
+		ret = ad5940_rd_regs(dev->serial_port_handle, pRegAddr, RegCount, pRegData);
+		if (ret != -ENOSYS)
+			return ret;
+		log_info("Bridge has no bulk register read, falling back to single reads");
+		dev->no_bulk_reg_read = true;
+	}
+
+	while (RegCount--)
+	{
+		ret = ad5940_ReadReg(dev, *pRegAddr++, pRegData++);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
 /** Write only masked bits to address @ref RegAddr with data @RegData  */
 int ad5940_WriteReg_mask(struct ad5940_dev *dev, uint16_t RegAddr,
 						 uint32_t mask, uint32_t RegData)
@@ -2085,6 +2493,17 @@ int ad5940_SEQCmdWrite(struct ad5940_dev *dev, uint32_t StartAddr,
 {
 	int ret;
 
+	/* Bulk path: one RPC per block of words. Not while generating a sequence,
+	   the generator needs to see the individual register writes. */
+	if (!dev->SeqGenDB.EngineStart && !dev->no_bulk_seq_write)
+	{
+		ret = ad5940_wr_seq(dev->serial_port_handle, StartAddr, pCommand, CmdCnt);
+		if (ret != -ENOSYS)
+			return ret;
+		log_info("Bridge has no bulk SRAM write, falling back to register writes");
+		dev->no_bulk_seq_write = true;
+	}
+
 	while (CmdCnt--)
 	{
 		ret = ad5940_WriteReg(dev, REG_AFE_CMDFIFOWADDR, StartAddr++);
@@ -2147,6 +2566,72 @@ int ad5940_SEQInfoCfg(struct ad5940_dev *dev, SEQInfo_Type *pSeq)
 	return 0;
 }
 
+/**
+   @brief Configure several sequences at once. SEQxINFO registers are written for
+		  every entry; SRAM contents of entries with WriteSRAM set are sorted by
+		  address and each run of back-to-back sequences is uploaded as a single
+		  block, so e.g. an init and a measurement sequence placed one after the
+		  other cost one transfer.
+   @param pSeq : Array of sequence info structures.
+   @param SeqCnt : Number of entries in pSeq.
+   @return return 0 in case of success, negative error code otherwise.
+ */
+int ad5940_SEQInfoCfgMulti(struct ad5940_dev *dev, SEQInfo_Type *pSeq,
+						   uint32_t SeqCnt)
+{
+	SEQInfo_Type info;
+	SEQInfo_Type *order[SEQID_3 + 1];
+	uint32_t *pBuff = NULL;
+	uint32_t i, j, n = 0, total = 0;
+	int ret;
+
+	if (!pSeq || SeqCnt == 0 || SeqCnt > SEQID_3 + 1)
+		return -EINVAL;
+
+	for (i = 0; i < SeqCnt; i++)
+	{
+		info = pSeq[i];
+		info.WriteSRAM = false;
+		ret = ad5940_SEQInfoCfg(dev, &info);
+		if (ret < 0)
+			return ret;
+		if (pSeq[i].WriteSRAM && pSeq[i].SeqLen)
+		{
+			/* Insertion sort by SRAM address */
+			for (j = n; j > 0 && order[j - 1]->SeqRamAddr > pSeq[i].SeqRamAddr; j--)
+				order[j] = order[j - 1];
+			order[j] = &pSeq[i];
+			n++;
+			total += pSeq[i].SeqLen;
+		}
+	}
+	if (n == 0)
+		return 0;
+
+	pBuff = malloc(total * sizeof(uint32_t));
+	if (!pBuff)
+		return -ENOMEM;
+
+	for (i = 0; i < n; i = j)
+	{
+		uint32_t start = order[i]->SeqRamAddr;
+		uint32_t len = 0;
+
+		/* Gather sequences that continue exactly where the previous one ends */
+		for (j = i; j < n && order[j]->SeqRamAddr == start + len; j++)
+		{
+			memcpy(pBuff + len, order[j]->pSeqCmd, order[j]->SeqLen * sizeof(uint32_t));
+			len += order[j]->SeqLen;
+		}
+		ret = ad5940_SEQCmdWrite(dev, start, pBuff, len);
+		if (ret < 0)
+			break;
+	}
+
+	free(pBuff);
+	return ret;
+}
+
 /**
    @brief int AD5940_SEQInfoGet(uint32_t SeqId, SEQInfo_Type *pSeqInfo)
 		  ====== Get sequence info: start address and sequence length.
@@ -2615,6 +3100,51 @@ int ad5940_HFOSC32MHzCtrl(struct ad5940_dev *dev, bool Mode32MHz)
 						   RdCLKEN1 & (~BITM_AFECON_CLKEN1_ACLKDIS)); /* Enable ACLK */
 }
 
+/**
+   @brief void AD5940_HPModeEn(bool Enable)
+		  ====== Switch between the 16MHz and the high speed (32MHz HFOSC) clock plan.
+		  In high speed mode the ADC runs from the 32MHz HFOSC (use ADCRATE_1P6MHZ)
+		  and the system clock is HFOSC/2, so it stays at 16MHz. The AFE is put into
+		  the matching power mode and bandwidth. Oscillators that are on stay on.
+   @param Enable : {true, false}
+		  - true: 32MHz ADC clock, AFEPWR_HP, AFEBW_250KHZ.
+		  - false: 16MHz ADC clock, AFEPWR_LP, AFEBW_100KHZ.
+   @return return 0 in case of success, negative error code otherwise.
+ */
+int ad5940_HPModeEn(struct ad5940_dev *dev, bool Enable)
+{
+	CLKCfg_Type clk_cfg;
+	uint32_t reg_osccon;
+	int ret;
+
+	ret = ad5940_ReadReg(dev, REG_ALLON_OSCCON, &reg_osccon);
+	if (ret < 0)
+		return ret;
+
+	clk_cfg.ADCClkDiv = ADCCLKDIV_1;
+	clk_cfg.ADCCLkSrc = ADCCLKSRC_HFOSC;
+	clk_cfg.SysClkSrc = SYSCLKSRC_HFOSC;
+	clk_cfg.HFOSCEn = true;
+	clk_cfg.HFXTALEn = (reg_osccon & BITM_ALLON_OSCCON_HFXTALEN) != 0;
+	clk_cfg.LFOSCEn = (reg_osccon & BITM_ALLON_OSCCON_LFOSCEN) != 0;
+	clk_cfg.SysClkDiv = Enable ? SYSCLKDIV_2 : SYSCLKDIV_1;
+	clk_cfg.HfOSC32MHzMode = Enable;
+
+	/* Raise the power mode before the clock goes up, lower it after the clock went down */
+	if (Enable)
+	{
+		ret = ad5940_AFEPwrBW(dev, AFEPWR_HP, AFEBW_250KHZ);
+		if (ret < 0)
+			return ret;
+	}
+	ret = ad5940_CLKCfg(dev, &clk_cfg);
+	if (ret < 0)
+		return ret;
+	if (!Enable)
+		ret = ad5940_AFEPwrBW(dev, AFEPWR_LP, AFEBW_100KHZ);
+	return ret;
+}
+
 /**
  * @defgroup Interrupt_Controller_Functions
  * @{
@@ -2699,7 +3229,8 @@ int ad5940_INTCCfg(struct ad5940_dev *dev, uint32_t AfeIntcSel,
    @param AfeIntcSel : {AFEINTC_0, AFEINTC_1}
 		  - AFEINTC_0: Configure Interrupt Controller 0
 		  - AFEINTC_1: Configure Interrupt Controller 1
-
+   @param cfg : Returns the enabled interrupt sources, AFEINTSRC_xxx.
+   @return return 0 in case of success, negative error code otherwise.
  */
 int ad5940_INTCGetCfg(struct ad5940_dev *dev, uint32_t AfeIntcSel,
 					  uint32_t *cfg)
@@ -2710,7 +3241,10 @@ int ad5940_INTCGetCfg(struct ad5940_dev *dev, uint32_t AfeIntcSel,
 		ret = ad5940_ReadReg(dev, REG_INTC_INTCSEL0, &tempreg);
 	else
 		ret = ad5940_ReadReg(dev, REG_INTC_INTCSEL1, &tempreg);
-	return ret;
+	if (ret < 0)
+		return ret;
+	*cfg = tempreg;
+	return 0;
 }
 
 /**
@@ -2942,11 +3476,11 @@ int ad5940_ShutDownS(struct ad5940_dev *dev)
 	if (ret < 0)
 		return ret;
 
-	ad5940_LPLoopCfgS(dev, &lp_loop);
+	ret = ad5940_LPLoopCfgS(dev, &lp_loop);
 	if (ret < 0)
 		return ret;
 
-	ad5940_SleepKeyCtrlS(dev, SLPKEY_UNLOCK); /* Unlock the key */
+	ret = ad5940_SleepKeyCtrlS(dev, SLPKEY_UNLOCK); /* Unlock the key */
 	if (ret < 0)
 		return ret;
 
@@ -2956,7 +3490,8 @@ int ad5940_ShutDownS(struct ad5940_dev *dev)
 /**
  * @brief Try to wakeup AD5940 by read register.
  * @details Any SPI operation can wakeup AD5940. AD5940_Initialize must be called to enable this function.
- * @param TryCount Specify how many times we will read register. Zero or negative number means always waiting here.
+ * @param TryCount Specify how many times we will read register. Zero or negative number means
+ *        up to WAKEUP_TRY_MAX reads. ad5940_MonitorWakeUp() bounds the wait by time instead.
  * @return How many times register is read. If returned value is bigger than TryCount, it means wakeup failed.
  */
 int ad5940_WakeUp(struct ad5940_dev *dev, int32_t TryCount)
@@ -2964,6 +3499,9 @@ int ad5940_WakeUp(struct ad5940_dev *dev, int32_t TryCount)
 	int ret;
 	uint32_t tempreg;
 	int32_t count = 0;
+
+	if (TryCount <= 0)
+		TryCount = WAKEUP_TRY_MAX;
 	while (1)
 	{
 		count++;
@@ -2972,8 +3510,6 @@ int ad5940_WakeUp(struct ad5940_dev *dev, int32_t TryCount)
 			return ret;
 		if (tempreg == AD5940_ADIID)
 			break; /* Succeed */
-		if (TryCount <= 0)
-			continue; /* Always try to wakup AFE */
 		if (count > TryCount)
 			break; /* Failed */
 	}
@@ -3018,6 +3554,19 @@ int ad5940_WakeUp(struct ad5940_dev *dev, int32_t TryCount)
  *
  */
 
+/* Nominal HSTIA RTIA in Ohm per HSTIARTIA_xxx, 0 for HSTIARTIA_OPEN */
+static uint32_t const HpRtiaTable[] = {200, 1000, 5000, 10000, 20000, 40000, 80000, 160000, 0};
+
+/**
+ * @brief Nominal value of a high speed TIA resistor.
+ * @param RtiaSel HSTIARTIA_200 to HSTIARTIA_160K.
+ * @return Ohm, 0 for HSTIARTIA_OPEN or an invalid selection.
+ */
+float ad5940_HSRtiaNominal(uint32_t RtiaSel)
+{
+	return RtiaSel <= HSTIARTIA_OPEN ? (float)HpRtiaTable[RtiaSel] : 0;
+}
+
 /**
  * @brief Measure HSTIA internal RTIA impedance.
  * @param pCalCfg: pointer to calibration structure.
@@ -3038,7 +3587,6 @@ int ad5940_HSRtiaCal(struct ad5940_dev *dev, HSRTIACal_Type *pCalCfg,
 
 	float ExcitVolt; /* Excitation voltage, unit is mV */
 	uint32_t RtiaVal;
-	static uint32_t const HpRtiaTable[] = {200, 1000, 5000, 10000, 20000, 40000, 80000, 160000, 0};
 	uint32_t WgAmpWord;
 
 	iImpCar_Type DftRcal, DftRtia;
@@ -3711,6 +4259,36 @@ int ad5940_LPRtiaCal(struct ad5940_dev *dev, LPRTIACal_Type *pCalCfg,
 	return 0;
 }
 
+/* Wait for AFEINTSRC_ENDSEQ on INTC1, read errors are returned instead of polled over */
+static int lfosc_wait_endseq(struct ad5940_dev *dev, float TimeoutMs)
+{
+	struct timespec now, deadline;
+	uint32_t flag;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += (time_t)(TimeoutMs / 1000);
+	deadline.tv_nsec += (long)((TimeoutMs - (time_t)(TimeoutMs / 1000) * 1000) * 1e6f);
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	for (;;)
+	{
+		ret = ad5940_INTCGetFlag(dev, AFEINTC_1, &flag);
+		if (ret < 0)
+			return ret;
+		if (flag & AFEINTSRC_ENDSEQ)
+			return 0;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > deadline.tv_sec ||
+			(now.tv_sec == deadline.tv_sec && now.tv_nsec > deadline.tv_nsec))
+			return -ETIMEDOUT;
+	}
+}
+
 /* Use System clock(16MHz/32MHz or external crystal) to measure LFOSC frequency */
 /**@note this function takes 3 sequencer commands. Start address is specified by parameter */
 int ad5940_LFOSCMeasure(struct ad5940_dev *dev, LFOSCMeasure_Type *pCfg,
@@ -3827,10 +4405,10 @@ int ad5940_LFOSCMeasure(struct ad5940_dev *dev, LFOSCMeasure_Type *pCfg,
 	if (ret < 0)
 		return ret;
 
-	while (ad5940_INTCTestFlag(dev, AFEINTC_1,
-							   AFEINTSRC_ENDSEQ) ==
-		   false)
-		; /* @todo if SPI speed is too slow, it will affect frequency measurement accuracy */
+	/* The link latency between the flag and the read below cancels against TimerCount2 */
+	ret = lfosc_wait_endseq(dev, pCfg->CalDuration * 2 + LFOSC_WAIT_MARGIN_MS);
+	if (ret < 0)
+		return ret;
 	ret = ad5940_SEQTimeOutRd(dev, &TimerCount);
 	if (ret < 0)
 		return ret;
@@ -3865,13 +4443,10 @@ int ad5940_LFOSCMeasure(struct ad5940_dev *dev, LFOSCMeasure_Type *pCfg,
 	if (ret < 0)
 		return ret;
 
-	while (ad5940_INTCTestFlag(dev, AFEINTC_1, AFEINTSRC_ENDSEQ) == false)
-		;
-	ret = ad5940_SEQTimeOutRd(dev, &TimerCount2);
+	ret = lfosc_wait_endseq(dev, LFOSC_WAIT_MARGIN_MS);
 	if (ret < 0)
 		return ret;
-
-	ret = ad5940_INTCTestFlag(dev, AFEINTC_0, AFEINTSRC_ENDSEQ);
+	ret = ad5940_SEQTimeOutRd(dev, &TimerCount2);
 	if (ret < 0)
 		return ret;
 
@@ -3896,6 +4471,8 @@ int ad5940_LFOSCMeasure(struct ad5940_dev *dev, LFOSCMeasure_Type *pCfg,
 #ifdef AD5940_DEBUG
 	log_info("Time duration: %d ", (TimerCount2 - TimerCount));
 #endif
+	if (TimerCount2 <= TimerCount)
+		return -EIO;
 	*pFreq = pCfg->SystemClkFreq * WuptPeriod / (TimerCount2 - TimerCount);
 	return 0;
 }
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "ad5940.h"
+#include "ad5940_adapt.h"
+#include "ad5940_spectrum.h"
+#include "ulog.h"
+
+#define ADAPT_DEF_NYQUIST_MARGIN 4.0f
+#define ADAPT_DEF_MIN_CYCLES 4.0f
+#define ADAPT_NOISE_FLOOR 1e-12f
+
+static const uint32_t adapt_sinc3[] = {ADCSINC3OSR_2, ADCSINC3OSR_4, ADCSINC3OSR_5};
+
+/**
+ * @brief Time of signal one DFT covers.
+ * @param ADCRate ADCRATE_800KHZ or ADCRATE_1P6MHZ.
+ * @param DftSrc DFTSRC_SINC3 or DFTSRC_SINC2NOTCH.
+ * @param Sinc3Osr ADCSINC3OSR_xxx.
+ * @param Sinc2Osr ADCSINC2OSR_xxx.
+ * @param DftNum DFTNUM_xxx.
+ * @return Seconds, 0 for an unsupported combination.
+ */
+float ad5940_AdaptObsTime(uint32_t ADCRate, uint32_t DftSrc, uint32_t Sinc3Osr,
+			  uint32_t Sinc2Osr, uint32_t DftNum)
+{
+	float rate;
+
+	if (DftSrc != DFTSRC_SINC3 && DftSrc != DFTSRC_SINC2NOTCH)
+		return 0;
+	rate = ad5940_ADCSampleRate(ADCRate, Sinc3Osr, Sinc2Osr, DftSrc == DFTSRC_SINC2NOTCH);
+	return rate > 0 ? (4u << DftNum) / rate : 0;
+}
+
+/**
+ * @brief DFT magnitude normalized by the number of points, comparable across
+ *        DFT lengths.
+ * @param pDft DFT result.
+ * @param DftNum DFTNUM_xxx it was taken with.
+ * @return Normalized amplitude.
+ */
+float ad5940_AdaptAmplitude(const fImpCar_Type *pDft, uint32_t DftNum)
+{
+	return hypotf(pDft->Real, pDft->Image) / (4u << DftNum);
+}
+
+/**
+ * @brief Noise constant of a channel from repeated DFTs of the same signal
+ *        with the same settings. Magnitudes are used because successive
+ *        conversions do not share a phase reference.
+ * @param pDft Count DFT results.
+ * @param Count Number of results, at least 2.
+ * @param DftNum DFTNUM_xxx they were taken with.
+ * @param ObsTime ad5940_AdaptObsTime of that setting.
+ * @return sigma * sqrt(ObsTime) of the normalized magnitude, 0 on bad input.
+ */
+float ad5940_AdaptNoiseTime(const fImpCar_Type *pDft, uint32_t Count, uint32_t DftNum,
+			    float ObsTime)
+{
+	double mean = 0, m2 = 0, d, a;
+	uint32_t k;
+
+	if (!pDft || Count < 2 || ObsTime <= 0)
+		return 0;
+	for (k = 0; k < Count; k++)
+	{
+		a = ad5940_AdaptAmplitude(&pDft[k], DftNum);
+		d = a - mean;
+		mean += d / (k + 1);
+		m2 += d * (a - mean);
+	}
+	/* Magnitude noise is half the complex noise power */
+	return fmaxf((float)sqrt(2.0 * m2 / (Count - 1) * ObsTime), ADAPT_NOISE_FLOOR);
+}
+
+/**
+ * @brief Cheapest DFT setting that meets the target at one frequency.
+ * @param dev The device structure.
+ * @param pCfg Policy.
+ * @param Freq Signal frequency in Hz.
+ * @param Amplitude Expected normalized amplitude (ad5940_AdaptAmplitude) of
+ *        the weakest channel.
+ * @param pChoice Result. If no setting meets the target, the most precise
+ *        usable one is returned with TargetMet false.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_AdaptChoose(struct ad5940_dev *dev, const AdaptCfg_Type *pCfg, float Freq,
+		       float Amplitude, AdaptChoice_Type *pChoice)
+{
+	ClksCalInfo_Type clk_info;
+	AdaptChoice_Type cand;
+	float margin, cycles, rate, t_req;
+	uint32_t s3, s2, num, clocks;
+	bool found = false, best_met = false;
+	int ret;
+
+	if (!pCfg || !pChoice || Freq <= 0 || pCfg->TargetRelErr <= 0 ||
+	    pCfg->MinDftNum > pCfg->MaxDftNum || pCfg->MaxDftNum > DFTNUM_16384)
+		return -EINVAL;
+	margin = pCfg->NyquistMargin > 0 ? pCfg->NyquistMargin : ADAPT_DEF_NYQUIST_MARGIN;
+	cycles = pCfg->MinCycles > 0 ? pCfg->MinCycles : ADAPT_DEF_MIN_CYCLES;
+
+	/* Observation time the target needs; no amplitude means no shortcut */
+	t_req = Amplitude > 0 ? powf(pCfg->NoiseTime / (Amplitude * pCfg->TargetRelErr), 2) : INFINITY;
+
+	memset(pChoice, 0, sizeof(*pChoice));
+	for (s3 = 0; s3 < sizeof(adapt_sinc3) / sizeof(adapt_sinc3[0]); s3++)
+	{
+		/* s2 == ADCSINC2OSR_1333 + 1 stands for "DFT on SINC3" */
+		for (s2 = 0; s2 <= ADCSINC2OSR_1333 + 1; s2++)
+		{
+			cand.DftSrc = s2 > ADCSINC2OSR_1333 ? DFTSRC_SINC3 : DFTSRC_SINC2NOTCH;
+			cand.ADCSinc3Osr = adapt_sinc3[s3];
+			cand.ADCSinc2Osr = s2 > ADCSINC2OSR_1333 ? ADCSINC2OSR_22 : s2;
+			rate = ad5940_ADCSampleRate(pCfg->ADCRate, cand.ADCSinc3Osr, cand.ADCSinc2Osr,
+						    cand.DftSrc == DFTSRC_SINC2NOTCH);
+			if (rate < margin * Freq)
+				continue;
+
+			for (num = pCfg->MinDftNum; num <= pCfg->MaxDftNum; num++)
+			{
+				cand.DftNum = num;
+				cand.ObsTime = (4u << num) / rate;
+				if (cand.ObsTime * Freq < cycles)
+					continue;
+
+				clk_info.ADCSinc3Osr = cand.ADCSinc3Osr;
+				clk_info.ADCSinc2Osr = cand.ADCSinc2Osr;
+				clk_info.ADCAvgNum = ADCAVGNUM_16;
+				clk_info.DftSrc = cand.DftSrc;
+				clk_info.DataType = DATATYPE_DFT;
+				clk_info.DataCount = 4u << num;
+				clk_info.RatioSys2AdcClk = pCfg->SysClkFreq / pCfg->AdcClkFreq;
+				ret = ad5940_ClksCalculate(dev, &clk_info, &clocks);
+				if (ret < 0)
+					return ret;
+				cand.ConvTime = clocks / pCfg->SysClkFreq;
+				cand.RelErr = Amplitude > 0 ? pCfg->NoiseTime / (Amplitude * sqrtf(cand.ObsTime)) : INFINITY;
+				cand.TargetMet = cand.ObsTime >= t_req;
+
+				/* Prefer meeting the target, then the fewest clocks; while
+				   nothing meets it, the longest observation */
+				if (!found ||
+				    (cand.TargetMet && (!best_met || cand.ConvTime < pChoice->ConvTime)) ||
+				    (!cand.TargetMet && !best_met && cand.ObsTime > pChoice->ObsTime))
+				{
+					*pChoice = cand;
+					best_met = cand.TargetMet;
+					found = true;
+				}
+				if (cand.TargetMet)
+					break; /* longer DFTs on this filter only cost more */
+			}
+		}
+	}
+
+	if (!found)
+		return -ERANGE;
+	if (!pChoice->TargetMet)
+		log_warn("adapt: %.1fHz best error %.2e misses target %.2e", Freq,
+			 pChoice->RelErr, pCfg->TargetRelErr);
+	return 0;
+}
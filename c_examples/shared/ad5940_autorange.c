@@ -0,0 +1,89 @@
+#include <errno.h>
+
+#include "ad5940.h"
+#include "ad5940_autorange.h"
+#include "ulog.h"
+
+#define AUTORANGE_ADC_PEAK_MV 900.0f /* ADC input range at PGA 1 is +-0.9V */
+#define AUTORANGE_DEF_HEADROOM 0.75f
+#define AUTORANGE_RAISE_BELOW 0.25f /* Raise the excitation below this share of the range */
+
+static const float pga_gain[] = {
+	[ADCPGA_1] = 1.0f,
+	[ADCPGA_1P5] = 1.5f,
+	[ADCPGA_2] = 2.0f,
+	[ADCPGA_4] = 4.0f,
+	[ADCPGA_9] = 9.0f,
+};
+
+/**
+ * @brief Gain of an ADC PGA setting.
+ * @param Pga ADCPGA_xxx.
+ * @return Gain, 0 for an invalid setting.
+ */
+float ad5940_ADCPgaGain(uint32_t Pga)
+{
+	return Pga <= ADCPGA_9 ? pga_gain[Pga] : 0;
+}
+
+/**
+ * @brief Choose RTIA, PGA and excitation from a probe measurement.
+ * @param pCfg Probe setting and result.
+ * @param pRange Chosen setting and the peaks it should produce.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_AutoRange(const AutoRangeCfg_Type *pCfg, AutoRange_Type *pRange)
+{
+	float limit, curr, volt, vout, scale;
+	uint32_t r, g;
+
+	if (!pCfg || !pRange || pCfg->ProbeRtiaSel > HSTIARTIA_160K || pCfg->ProbePga > ADCPGA_9 ||
+	    pCfg->ProbeVoutPP <= 0 || pCfg->VoltPeak <= 0 || pCfg->CurrPeak < 0 ||
+	    pCfg->VoutPPMin > pCfg->VoutPPMax)
+		return -EINVAL;
+	limit = AUTORANGE_ADC_PEAK_MV * (pCfg->Headroom > 0 ? pCfg->Headroom : AUTORANGE_DEF_HEADROOM);
+
+	/* Refer the probe to PGA 1, 1 Ohm of RTIA and 1 mV peak-peak of excitation */
+	curr = pCfg->CurrPeak / pga_gain[pCfg->ProbePga] / ad5940_HSRtiaNominal(pCfg->ProbeRtiaSel) / pCfg->ProbeVoutPP;
+	volt = pCfg->VoltPeak / pga_gain[pCfg->ProbePga] / pCfg->ProbeVoutPP;
+
+	/* Lower the excitation until the smallest RTIA and the voltage channel fit */
+	vout = pCfg->ProbeVoutPP;
+	scale = curr * ad5940_HSRtiaNominal(HSTIARTIA_200) > volt ? curr * ad5940_HSRtiaNominal(HSTIARTIA_200) : volt;
+	if (scale * vout > limit)
+		vout = limit / scale;
+	if (vout > pCfg->VoutPPMax)
+		vout = pCfg->VoutPPMax;
+	if (vout < pCfg->VoutPPMin)
+		vout = pCfg->VoutPPMin;
+
+	for (r = HSTIARTIA_160K; r > HSTIARTIA_200; r--)
+		if (curr * ad5940_HSRtiaNominal(r) * vout <= limit)
+			break;
+
+	/* A small signal even on the largest RTIA: raise the excitation */
+	if (r == HSTIARTIA_160K)
+	{
+		scale = curr * ad5940_HSRtiaNominal(r) > volt ? curr * ad5940_HSRtiaNominal(r) : volt;
+		if (scale * vout < AUTORANGE_RAISE_BELOW * limit)
+		{
+			vout = scale > 0 ? limit / scale : pCfg->VoutPPMax;
+			if (vout > pCfg->VoutPPMax)
+				vout = pCfg->VoutPPMax;
+		}
+	}
+
+	pRange->RtiaSel = r;
+	pRange->VoutPP = vout;
+	scale = curr * ad5940_HSRtiaNominal(r) > volt ? curr * ad5940_HSRtiaNominal(r) : volt;
+	for (g = ADCPGA_9; g > ADCPGA_1; g--)
+		if (scale * vout * pga_gain[g] <= limit)
+			break;
+	pRange->Pga = g;
+	pRange->CurrPeak = curr * ad5940_HSRtiaNominal(r) * vout * pga_gain[g];
+	pRange->VoltPeak = volt * vout * pga_gain[g];
+
+	if (pRange->CurrPeak > AUTORANGE_ADC_PEAK_MV || pRange->VoltPeak > AUTORANGE_ADC_PEAK_MV)
+		log_warn("autorange: signal exceeds the ADC range even at the lowest setting");
+	return 0;
+}
@@ -0,0 +1,506 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <complex.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ad5940.h"
+#include "ad5940_fit.h"
+#include "ulog.h"
+
+#define FIT_DEF_MAX_ITER 200
+#define FIT_LAMBDA_INIT 1e-3
+#define FIT_LAMBDA_MAX 1e12
+#define FIT_TOL_COST 1e-12 /* Relative cost decrease that counts as converged */
+#define FIT_TOL_STEP 1e-9  /* Log parameter step that counts as converged */
+#define FIT_STEP_MAX 5.0   /* Largest log parameter change per step (e^5) */
+#define FIT_POINTS_STACK 256
+#define FIT_CACHE_LINE 64
+
+static const uint32_t fit_param_cnt[] = {
+	[FITMODEL_RC_PARALLEL] = 2,
+	[FITMODEL_RC_SERIES] = 2,
+	[FITMODEL_RANDLES] = 3,
+	[FITMODEL_RANDLES_W] = 4,
+};
+
+/**
+ * @brief Number of parameters of a model.
+ * @param Model FITMODEL_xxx.
+ * @return Parameter count, 0 for an unknown model.
+ */
+uint32_t ad5940_FitParamCnt(uint32_t Model)
+{
+	return Model <= FITMODEL_RANDLES_W ? fit_param_cnt[Model] : 0;
+}
+
+/* Model impedance at angular frequency w and, if pDz is given, dZ/dp */
+static double complex model_eval(uint32_t Model, const double *p, double w, double complex *pDz)
+{
+	double complex d, y, f, z;
+
+	switch (Model)
+	{
+	case FITMODEL_RC_PARALLEL:
+		d = 1 + I * w * p[0] * p[1];
+		z = p[0] / d;
+		if (pDz)
+		{
+			pDz[0] = 1 / (d * d);
+			pDz[1] = -I * w * p[0] * p[0] / (d * d);
+		}
+		return z;
+	case FITMODEL_RC_SERIES:
+		z = p[0] + 1 / (I * w * p[1]);
+		if (pDz)
+		{
+			pDz[0] = 1;
+			pDz[1] = -1 / (I * w * p[1] * p[1]);
+		}
+		return z;
+	case FITMODEL_RANDLES:
+		d = 1 + I * w * p[1] * p[2];
+		z = p[0] + p[1] / d;
+		if (pDz)
+		{
+			pDz[0] = 1;
+			pDz[1] = 1 / (d * d);
+			pDz[2] = -I * w * p[1] * p[1] / (d * d);
+		}
+		return z;
+	default: /* FITMODEL_RANDLES_W */
+		f = p[1] + p[3] * (1 - I) / sqrt(w);
+		y = I * w * p[2] + 1 / f;
+		z = p[0] + 1 / y;
+		if (pDz)
+		{
+			pDz[0] = 1;
+			pDz[1] = 1 / (y * y * f * f);
+			pDz[2] = -I * w / (y * y);
+			pDz[3] = pDz[1] * (1 - I) / sqrt(w);
+		}
+		return z;
+	}
+}
+
+/**
+ * @brief Impedance of a model at one frequency.
+ * @param Model FITMODEL_xxx.
+ * @param pParam Parameters in the order listed with the model.
+ * @param Freq Frequency in Hz.
+ * @param pZ Result.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_FitModelEval(uint32_t Model, const float *pParam, float Freq, fImpCar_Type *pZ)
+{
+	double p[FIT_PARAM_MAX];
+	double complex z;
+	uint32_t k, n = ad5940_FitParamCnt(Model);
+
+	if (!n || !pParam || !pZ || Freq <= 0)
+		return -EINVAL;
+	for (k = 0; k < n; k++)
+		p[k] = pParam[k];
+	z = model_eval(Model, p, 2 * M_PI * Freq, NULL);
+	pZ->Real = (float)creal(z);
+	pZ->Image = (float)cimag(z);
+	return 0;
+}
+
+/* Rough start point from the shape of the sweep */
+static void fit_initial(const FitJob_Type *pJob, double *p)
+{
+	const fImpCar_Type *z = pJob->pImp;
+	uint32_t k, lo = 0, hi = 0, pk = 0;
+	double zmax = 0, r_floor, c_floor = 1e-15;
+
+	for (k = 0; k < pJob->Count; k++)
+	{
+		if (pJob->pFreq[k] < pJob->pFreq[lo])
+			lo = k;
+		if (pJob->pFreq[k] > pJob->pFreq[hi])
+			hi = k;
+		if (-z[k].Image > -z[pk].Image)
+			pk = k;
+		zmax = fmax(zmax, hypot(z[k].Real, z[k].Image));
+	}
+	r_floor = zmax > 0 ? zmax * 1e-3 : 1e-3;
+
+	switch (pJob->Model)
+	{
+	case FITMODEL_RC_PARALLEL:
+		p[0] = fmax(z[lo].Real, r_floor);
+		p[1] = 1 / (2 * M_PI * pJob->pFreq[pk] * p[0]);
+		break;
+	case FITMODEL_RC_SERIES:
+		p[0] = fmax(z[hi].Real, r_floor);
+		p[1] = 1 / (2 * M_PI * pJob->pFreq[lo] * fmax(-z[lo].Image, r_floor));
+		break;
+	default: /* FITMODEL_RANDLES, FITMODEL_RANDLES_W */
+		p[0] = fmax(z[hi].Real, r_floor);
+		p[1] = fmax(z[lo].Real - p[0], r_floor);
+		p[2] = 1 / (2 * M_PI * pJob->pFreq[pk] * p[1]);
+		/* Warburg worth a tenth of Rct at the lowest frequency */
+		p[3] = 0.1 * p[1] * sqrt(2 * M_PI * pJob->pFreq[lo]) / M_SQRT2;
+		break;
+	}
+	for (k = 0; k < fit_param_cnt[pJob->Model]; k++)
+		if (!(p[k] > c_floor) || !isfinite(p[k]))
+			p[k] = r_floor;
+}
+
+/* Weighted residuals (2 per point) and their Jacobian w.r.t. log parameters */
+static double fit_residual(const FitJob_Type *pJob, uint32_t n, const double *q,
+			   double *r, double *J)
+{
+	double p[FIT_PARAM_MAX], cost = 0;
+	double complex dz[FIT_PARAM_MAX], z;
+	uint32_t i, k;
+
+	for (k = 0; k < n; k++)
+		p[k] = exp(q[k]);
+	for (i = 0; i < pJob->Count; i++)
+	{
+		double zr = pJob->pImp[i].Real, zi = pJob->pImp[i].Image;
+		double wt = 1 / fmax(hypot(zr, zi), 1e-30);
+
+		z = model_eval(pJob->Model, p, 2 * M_PI * pJob->pFreq[i], J ? dz : NULL);
+		r[2 * i] = (zr - creal(z)) * wt;
+		r[2 * i + 1] = (zi - cimag(z)) * wt;
+		cost += r[2 * i] * r[2 * i] + r[2 * i + 1] * r[2 * i + 1];
+		if (J)
+		{
+			for (k = 0; k < n; k++)
+			{
+				J[(2 * i) * n + k] = creal(dz[k]) * p[k] * wt;
+				J[(2 * i + 1) * n + k] = cimag(dz[k]) * p[k] * wt;
+			}
+		}
+	}
+	return cost;
+}
+
+/* Solve A x = b for a small symmetric positive definite A (Cholesky) */
+static int fit_solve(double *A, double *b, uint32_t n)
+{
+	uint32_t i, j, k;
+
+	for (j = 0; j < n; j++)
+	{
+		double s = A[j * n + j];
+
+		for (k = 0; k < j; k++)
+			s -= A[j * n + k] * A[j * n + k];
+		if (!(s > 0))
+			return -EDOM;
+		A[j * n + j] = sqrt(s);
+		for (i = j + 1; i < n; i++)
+		{
+			s = A[i * n + j];
+			for (k = 0; k < j; k++)
+				s -= A[i * n + k] * A[j * n + k];
+			A[i * n + j] = s / A[j * n + j];
+		}
+	}
+	for (i = 0; i < n; i++)
+	{
+		for (k = 0; k < i; k++)
+			b[i] -= A[i * n + k] * b[k];
+		b[i] /= A[i * n + i];
+	}
+	for (i = n; i-- > 0;)
+	{
+		for (k = i + 1; k < n; k++)
+			b[i] -= A[k * n + i] * b[k];
+		b[i] /= A[i * n + i];
+	}
+	return 0;
+}
+
+/**
+ * @brief Fit one spectrum. Results go to pJob->Param, Cost, Iter, Converged,
+ *        Stalled and Status.
+ * @param pJob Data, model and options.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_FitSpectrum(FitJob_Type *pJob)
+{
+	double q[FIT_PARAM_MAX], q_new[FIT_PARAM_MAX], p[FIT_PARAM_MAX];
+	double JtJ[FIT_PARAM_MAX * FIT_PARAM_MAX], A[FIT_PARAM_MAX * FIT_PARAM_MAX];
+	double g[FIT_PARAM_MAX], d[FIT_PARAM_MAX];
+	double r_stack[2 * FIT_POINTS_STACK], J_stack[2 * FIT_POINTS_STACK * FIT_PARAM_MAX];
+	double *r = r_stack, *J = J_stack, *r_new = NULL;
+	double cost, cost_new, lambda = FIT_LAMBDA_INIT;
+	uint32_t n, i, j, k, max_iter;
+	int ret = 0;
+
+	if (!pJob)
+		return -EINVAL;
+	n = ad5940_FitParamCnt(pJob->Model);
+	pJob->Iter = 0;
+	pJob->Converged = false;
+	pJob->Stalled = false;
+	if (!n || !pJob->pFreq || !pJob->pImp || pJob->Count < n)
+	{
+		pJob->Status = -EINVAL;
+		return -EINVAL;
+	}
+	max_iter = pJob->MaxIter ? pJob->MaxIter : FIT_DEF_MAX_ITER;
+
+	if (pJob->Count > FIT_POINTS_STACK)
+	{
+		r = malloc(2 * pJob->Count * sizeof(double));
+		J = malloc(2 * pJob->Count * n * sizeof(double));
+		if (!r || !J)
+		{
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+	r_new = malloc(2 * pJob->Count * sizeof(double));
+	if (!r_new)
+	{
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (pJob->InitGiven)
+		for (k = 0; k < n; k++)
+			p[k] = pJob->Param[k];
+	else
+		fit_initial(pJob, p);
+	for (k = 0; k < n; k++)
+	{
+		if (!(p[k] > 0))
+		{
+			ret = -EINVAL;
+			goto out;
+		}
+		q[k] = log(p[k]);
+	}
+
+	cost = fit_residual(pJob, n, q, r, J);
+	while (pJob->Iter < max_iter && !pJob->Converged && !pJob->Stalled)
+	{
+		pJob->Iter++;
+		for (j = 0; j < n; j++)
+		{
+			g[j] = 0;
+			for (k = 0; k < n; k++)
+				JtJ[j * n + k] = 0;
+		}
+		for (i = 0; i < 2 * pJob->Count; i++)
+		{
+			const double *Ji = J + i * n;
+
+			for (j = 0; j < n; j++)
+			{
+				g[j] += Ji[j] * r[i];
+				for (k = 0; k <= j; k++)
+					JtJ[j * n + k] += Ji[j] * Ji[k];
+			}
+		}
+		for (j = 0; j < n; j++)
+			for (k = 0; k < j; k++)
+				JtJ[k * n + j] = JtJ[j * n + k];
+
+		/* Raise lambda until a step lowers the cost */
+		for (;;)
+		{
+			double step = 0;
+
+			memcpy(A, JtJ, n * n * sizeof(double));
+			memcpy(d, g, n * sizeof(double));
+			for (j = 0; j < n; j++)
+				A[j * n + j] += lambda * fmax(JtJ[j * n + j], 1e-30);
+			if (fit_solve(A, d, n) == 0)
+			{
+				for (j = 0; j < n; j++)
+				{
+					d[j] = fmax(fmin(d[j], FIT_STEP_MAX), -FIT_STEP_MAX);
+					q_new[j] = q[j] + d[j];
+					step = fmax(step, fabs(d[j]));
+				}
+				cost_new = fit_residual(pJob, n, q_new, r_new, NULL);
+				if (isfinite(cost_new) && cost_new <= cost)
+				{
+					if (cost - cost_new <= FIT_TOL_COST * cost || step <= FIT_TOL_STEP)
+						pJob->Converged = true;
+					memcpy(q, q_new, n * sizeof(double));
+					cost = fit_residual(pJob, n, q, r, J);
+					lambda = fmax(lambda / 10, 1e-15);
+					break;
+				}
+			}
+			lambda *= 10;
+			if (lambda > FIT_LAMBDA_MAX)
+			{
+				/* No downhill step left, which is not the same as converged */
+				pJob->Stalled = true;
+				break;
+			}
+		}
+	}
+
+	for (k = 0; k < n; k++)
+		pJob->Param[k] = (float)exp(q[k]);
+	pJob->Cost = (float)sqrt(cost / (2 * pJob->Count));
+
+out:
+	if (r != r_stack)
+		free(r);
+	if (J != J_stack)
+		free(J);
+	free(r_new);
+	pJob->Status = ret;
+	return ret;
+}
+
+/* Work stealing pool. A deque is the index range [head, tail) packed as
+   head << 32 | tail. The owner takes from the head, thieves cut from the
+   tail. Job indices are handed out once, so a range value never repeats
+   and a plain compare-and-swap is free of ABA. */
+struct fit_deque
+{
+	_Alignas(FIT_CACHE_LINE) _Atomic uint64_t Range;
+};
+
+struct fit_pool
+{
+	FitJob_Type *pJobs;
+	struct fit_deque *pDeque;
+	uint32_t WorkerCnt;
+};
+
+struct fit_worker
+{
+	struct fit_pool *pPool;
+	uint32_t Id;
+	pthread_t Thread;
+};
+
+#define RANGE(h, t) (((uint64_t)(h) << 32) | (t))
+#define RANGE_HEAD(r) ((uint32_t)((r) >> 32))
+#define RANGE_TAIL(r) ((uint32_t)(r))
+
+static bool pool_pop(struct fit_deque *d, uint32_t *pIdx)
+{
+	uint64_t r = atomic_load(&d->Range);
+
+	while (RANGE_HEAD(r) < RANGE_TAIL(r))
+	{
+		if (atomic_compare_exchange_weak(&d->Range, &r, RANGE(RANGE_HEAD(r) + 1, RANGE_TAIL(r))))
+		{
+			*pIdx = RANGE_HEAD(r);
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Move half of some victim's range into our own (empty) deque */
+static bool pool_steal(struct fit_pool *pool, uint32_t self)
+{
+	uint32_t i, v, h, t, take;
+	uint64_t r;
+
+	for (i = 1; i < pool->WorkerCnt; i++)
+	{
+		v = (self + i) % pool->WorkerCnt;
+		r = atomic_load(&pool->pDeque[v].Range);
+		while ((h = RANGE_HEAD(r)) < (t = RANGE_TAIL(r)))
+		{
+			take = (t - h + 1) / 2;
+			if (atomic_compare_exchange_weak(&pool->pDeque[v].Range, &r, RANGE(h, t - take)))
+			{
+				atomic_store(&pool->pDeque[self].Range, RANGE(t - take, t));
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void *pool_worker(void *arg)
+{
+	struct fit_worker *w = arg;
+	struct fit_pool *pool = w->pPool;
+	uint32_t idx;
+
+	do
+	{
+		while (pool_pop(&pool->pDeque[w->Id], &idx))
+			ad5940_FitSpectrum(&pool->pJobs[idx]);
+	} while (pool_steal(pool, w->Id));
+
+	return NULL;
+}
+
+/**
+ * @brief Fit many spectra in parallel. Each job's Status tells how it went.
+ * @param pJobs Jobs.
+ * @param JobCnt Number of jobs.
+ * @param ThreadCnt Worker threads including the caller, 0: one per online CPU.
+ * @return 0 if every job succeeded, otherwise the first job error or a pool error.
+ */
+int ad5940_FitBatch(FitJob_Type *pJobs, uint32_t JobCnt, uint32_t ThreadCnt)
+{
+	struct fit_pool pool;
+	struct fit_worker *pWorker;
+	uint32_t k, started;
+	int ret = 0;
+
+	if (!pJobs && JobCnt)
+		return -EINVAL;
+	if (ThreadCnt == 0)
+	{
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		ThreadCnt = cpus > 0 ? (uint32_t)cpus : 1;
+	}
+	if (ThreadCnt > JobCnt)
+		ThreadCnt = JobCnt ? JobCnt : 1;
+
+	pool.pJobs = pJobs;
+	pool.WorkerCnt = ThreadCnt;
+	pool.pDeque = aligned_alloc(FIT_CACHE_LINE, ThreadCnt * sizeof(struct fit_deque));
+	pWorker = malloc(ThreadCnt * sizeof(struct fit_worker));
+	if (!pool.pDeque || !pWorker)
+	{
+		free(pool.pDeque);
+		free(pWorker);
+		return -ENOMEM;
+	}
+
+	for (k = 0; k < ThreadCnt; k++)
+	{
+		atomic_init(&pool.pDeque[k].Range,
+			    RANGE((uint64_t)JobCnt * k / ThreadCnt, (uint64_t)JobCnt * (k + 1) / ThreadCnt));
+		pWorker[k].pPool = &pool;
+		pWorker[k].Id = k;
+	}
+
+	/* Worker 0 is the calling thread; a worker that fails to start simply
+	   leaves its share to be stolen */
+	for (started = 1; started < ThreadCnt; started++)
+	{
+		if (pthread_create(&pWorker[started].Thread, NULL, pool_worker, &pWorker[started]) != 0)
+		{
+			log_warn("fit: started %u of %u threads", started, ThreadCnt);
+			break;
+		}
+	}
+	pool_worker(&pWorker[0]);
+	for (k = 1; k < started; k++)
+		pthread_join(pWorker[k].Thread, NULL);
+
+	for (k = 0; k < JobCnt && ret == 0; k++)
+		ret = pJobs[k].Status;
+
+	free(pool.pDeque);
+	free(pWorker);
+	return ret;
+}
@@ -0,0 +1,476 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ad5940.h"
+#include "ad5940_log.h"
+#include "ulog.h"
+
+#define LOG_DEF_RING_RECORDS 4096
+#define LOG_IDLE_NS 1000000L /* Log thread period */
+#define LOG_LINE_BYTES 1024 /* plus the length of the heap strings of a record */
+#define LOG_STR_CUT "..."
+
+static const char *level_name[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+
+/* SPSC ring per thread: head written by the owning thread, tail by the log thread */
+struct log_ring
+{
+	struct ad5940_log_rec *pRec;
+	size_t Mask;
+	struct log_ring *pNext;
+	_Alignas(64) _Atomic size_t Head; /* own cache lines, no false sharing */
+	_Alignas(64) _Atomic size_t Tail;
+};
+
+_Atomic int ad5940_log_level = INT32_MAX;
+
+static _Thread_local struct log_ring *tls_ring;
+static _Thread_local unsigned tls_generation;
+static unsigned generation; /* bumped by every ad5940_LogStart, invalidates old tls_ring */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct log_ring *rings; /* registered rings, the list only grows while running */
+static size_t ring_records;
+static _Atomic uint64_t dropped;
+static _Atomic bool running;
+static pthread_t log_thread;
+static FILE *sink;
+static int64_t realtime_offset; /* CLOCK_REALTIME - CLOCK_MONOTONIC in ns */
+
+static uint64_t now_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* First log call of a thread: allocate and register its ring */
+static struct log_ring *ring_get(void)
+{
+	struct log_ring *ring;
+
+	if (tls_ring && tls_generation == generation)
+		return tls_ring;
+
+	ring = aligned_alloc(64, sizeof(*ring));
+	if (!ring)
+		return NULL;
+	memset(ring, 0, sizeof(*ring));
+	/* calloc would map the pages lazily, fault them in now rather than while logging */
+	ring->pRec = malloc(ring_records * sizeof(struct ad5940_log_rec));
+	if (!ring->pRec)
+	{
+		free(ring);
+		return NULL;
+	}
+	memset(ring->pRec, 0, ring_records * sizeof(struct ad5940_log_rec));
+	ring->Mask = ring_records - 1;
+	atomic_init(&ring->Head, 0);
+	atomic_init(&ring->Tail, 0);
+
+	pthread_mutex_lock(&rings_lock);
+	ring->pNext = rings;
+	rings = ring;
+	pthread_mutex_unlock(&rings_lock);
+
+	tls_ring = ring;
+	tls_generation = generation;
+	return ring;
+}
+
+/**
+ * @brief Claim the next record of the calling thread's ring.
+ * @return The record to fill, NULL if the ring is full (the record is dropped).
+ */
+struct ad5940_log_rec *ad5940_LogBegin(int Level, const char *File, uint32_t Line, const char *Fmt)
+{
+	struct log_ring *ring = ring_get();
+	struct ad5940_log_rec *r;
+	size_t head, tail;
+
+	if (!ring)
+	{
+		atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+		return NULL;
+	}
+	head = atomic_load_explicit(&ring->Head, memory_order_relaxed);
+	tail = atomic_load_explicit(&ring->Tail, memory_order_acquire);
+	if (head - tail > ring->Mask)
+	{
+		atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+		return NULL;
+	}
+
+	r = &ring->pRec[head & ring->Mask];
+	r->Time = now_ns(CLOCK_MONOTONIC);
+	r->Fmt = Fmt;
+	r->File = File;
+	r->Line = Line;
+	r->Level = (uint8_t)Level;
+	r->Argc = 0;
+	r->StrLen = 0;
+	return r;
+}
+
+/**
+ * @brief Publish a record filled after ad5940_LogBegin.
+ */
+void ad5940_LogCommit(struct ad5940_log_rec *r)
+{
+	struct log_ring *ring = tls_ring;
+
+	(void)r;
+	atomic_store_explicit(&ring->Head, atomic_load_explicit(&ring->Head, memory_order_relaxed) + 1,
+			      memory_order_release);
+}
+
+void ad5940_LogPutInt(struct ad5940_log_rec *r, long long v)
+{
+	if (r->Argc >= LOG_MAX_ARGS)
+		return;
+	r->Type[r->Argc] = LOG_ARG_INT;
+	r->Arg[r->Argc++].i = v;
+}
+
+void ad5940_LogPutUint(struct ad5940_log_rec *r, unsigned long long v)
+{
+	if (r->Argc >= LOG_MAX_ARGS)
+		return;
+	r->Type[r->Argc] = LOG_ARG_UINT;
+	r->Arg[r->Argc++].u = v;
+}
+
+void ad5940_LogPutDouble(struct ad5940_log_rec *r, double v)
+{
+	if (r->Argc >= LOG_MAX_ARGS)
+		return;
+	r->Type[r->Argc] = LOG_ARG_DOUBLE;
+	r->Arg[r->Argc++].d = v;
+}
+
+/* Strings are copied, the caller may free them right after the log call.
+   A string that does not fit into what is left of Str gets its own heap
+   copy, freed by the log thread once the record is written. Only if that
+   allocation fails is it cut off, ending in "..." */
+void ad5940_LogPutStr(struct ad5940_log_rec *r, const char *v)
+{
+	size_t n, space;
+	char *p;
+
+	if (r->Argc >= LOG_MAX_ARGS)
+		return;
+	if (!v)
+		v = "(null)";
+	space = LOG_STR_BYTES - r->StrLen;
+	n = strnlen(v, space);
+	if (n == space)
+	{
+		n += strlen(&v[n]);
+		p = malloc(n + 1);
+		if (p)
+		{
+			memcpy(p, v, n + 1);
+			r->Type[r->Argc] = LOG_ARG_STR_HEAP;
+			r->Arg[r->Argc++].p = p;
+			return;
+		}
+		if (space < sizeof(LOG_STR_CUT))
+		{
+			r->Type[r->Argc] = LOG_ARG_STR;
+			r->Arg[r->Argc++].u = LOG_STR_BYTES;
+			return;
+		}
+		n = space - sizeof(LOG_STR_CUT);
+		memcpy(&r->Str[r->StrLen + n], LOG_STR_CUT, sizeof(LOG_STR_CUT));
+		memcpy(&r->Str[r->StrLen], v, n);
+		n += sizeof(LOG_STR_CUT) - 1;
+	}
+	else
+	{
+		memcpy(&r->Str[r->StrLen], v, n + 1);
+	}
+	r->Type[r->Argc] = LOG_ARG_STR;
+	r->Arg[r->Argc++].u = r->StrLen;
+	r->StrLen += n + 1;
+}
+
+void ad5940_LogPutPtr(struct ad5940_log_rec *r, const void *v)
+{
+	if (r->Argc >= LOG_MAX_ARGS)
+		return;
+	r->Type[r->Argc] = LOG_ARG_PTR;
+	r->Arg[r->Argc++].p = v;
+}
+
+/* Format one conversion. spec holds "%[flags][width][.prec]", conv the
+   conversion character; the length modifier is chosen from the stored type. */
+static int format_arg(char *out, size_t len, char *spec, size_t speclen, char conv,
+		      const struct ad5940_log_rec *r, unsigned *argi)
+{
+	unsigned i = *argi;
+
+	if (i >= r->Argc)
+		return snprintf(out, len, "<?>");
+	(*argi)++;
+
+	switch (conv)
+	{
+	case 'd':
+	case 'i':
+		strcpy(&spec[speclen], "lld");
+		return snprintf(out, len, spec, r->Type[i] == LOG_ARG_DOUBLE ? (long long)r->Arg[i].d : r->Arg[i].i);
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+		spec[speclen] = 'l';
+		spec[speclen + 1] = 'l';
+		spec[speclen + 2] = conv;
+		spec[speclen + 3] = '\0';
+		return snprintf(out, len, spec, r->Type[i] == LOG_ARG_DOUBLE ? (unsigned long long)r->Arg[i].d : r->Arg[i].u);
+	case 'c':
+		strcpy(&spec[speclen], "c");
+		return snprintf(out, len, spec, (int)r->Arg[i].i);
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		spec[speclen] = conv;
+		spec[speclen + 1] = '\0';
+		return snprintf(out, len, spec, r->Type[i] == LOG_ARG_DOUBLE ? r->Arg[i].d
+					      : r->Type[i] == LOG_ARG_INT ? (double)r->Arg[i].i
+									   : (double)r->Arg[i].u);
+	case 's':
+		strcpy(&spec[speclen], "s");
+		if (r->Type[i] == LOG_ARG_STR_HEAP)
+			return snprintf(out, len, spec, (const char *)r->Arg[i].p);
+		if (r->Type[i] != LOG_ARG_STR)
+			return snprintf(out, len, "<?>");
+		return snprintf(out, len, spec, r->Arg[i].u < LOG_STR_BYTES ? &r->Str[r->Arg[i].u] : LOG_STR_CUT);
+	case 'p':
+		strcpy(&spec[speclen], "p");
+		return snprintf(out, len, spec, (void *)r->Arg[i].p);
+	default:
+		return 0;
+	}
+}
+
+/* printf for a record, done on the log thread */
+static size_t format_rec(char *out, size_t len, const struct ad5940_log_rec *r)
+{
+	const char *f = r->Fmt;
+	char spec[48];
+	size_t pos = 0, speclen;
+	unsigned argi = 0;
+	int n;
+
+	while (*f && pos + 1 < len)
+	{
+		if (*f != '%')
+		{
+			out[pos++] = *f++;
+			continue;
+		}
+		if (f[1] == '%')
+		{
+			out[pos++] = '%';
+			f += 2;
+			continue;
+		}
+
+		/* %[flags][width][.precision][length]conversion */
+		speclen = 0;
+		spec[speclen++] = *f++;
+		while (*f && strchr("-+ #0", *f) && speclen < 8)
+			spec[speclen++] = *f++;
+		while (*f && (strchr("0123456789.", *f) || *f == '*') && speclen < 20)
+		{
+			if (*f == '*')
+			{
+				/* width or precision from the argument list */
+				long long v = argi < r->Argc ? r->Arg[argi++].i : 0;
+				speclen += snprintf(&spec[speclen], sizeof(spec) - speclen - 4, "%d", (int)v);
+				f++;
+				continue;
+			}
+			spec[speclen++] = *f++;
+		}
+		while (*f && strchr("hlLqjzt", *f))
+			f++;
+		if (!*f)
+			break;
+		spec[speclen] = '\0';
+		n = format_arg(&out[pos], len - pos, spec, speclen, *f++, r, &argi);
+		if (n > 0)
+			pos += (size_t)n < len - pos ? (size_t)n : len - pos - 1;
+	}
+	out[pos] = '\0';
+	return pos;
+}
+
+static void write_rec(const struct ad5940_log_rec *r, char *line)
+{
+	uint64_t t = r->Time + realtime_offset;
+	time_t sec = (time_t)(t / 1000000000ull);
+	struct tm tm;
+	char buf[LOG_LINE_BYTES], *msg = buf;
+	size_t len = sizeof(buf), extra = 0;
+	unsigned i;
+
+	for (i = 0; i < r->Argc; i++)
+	{
+		if (r->Type[i] == LOG_ARG_STR_HEAP)
+			extra += strlen(r->Arg[i].p);
+	}
+	if (extra)
+	{
+		/* Falls back to the stack buffer, cutting the message */
+		msg = malloc(len + extra);
+		if (msg)
+			len += extra;
+		else
+			msg = buf;
+	}
+
+	localtime_r(&sec, &tm);
+	strftime(line, 16, "%H:%M:%S", &tm);
+	format_rec(msg, len, r);
+	fprintf(sink, "%s.%06u %-5s %s:%u: %s\n", line, (unsigned)(t % 1000000000ull / 1000),
+		level_name[r->Level < 6 ? r->Level : 5], r->File, r->Line, msg);
+
+	if (msg != buf)
+		free(msg);
+	for (i = 0; i < r->Argc; i++)
+	{
+		if (r->Type[i] == LOG_ARG_STR_HEAP)
+			free((void *)r->Arg[i].p);
+	}
+}
+
+/* Drain every ring once, returns the number of records written */
+static size_t drain(char *line)
+{
+	struct log_ring *ring;
+	size_t head, tail, n = 0;
+
+	pthread_mutex_lock(&rings_lock);
+	ring = rings;
+	pthread_mutex_unlock(&rings_lock);
+
+	for (; ring; ring = ring->pNext)
+	{
+		tail = atomic_load_explicit(&ring->Tail, memory_order_relaxed);
+		head = atomic_load_explicit(&ring->Head, memory_order_acquire);
+		for (; tail != head; tail++, n++)
+			write_rec(&ring->pRec[tail & ring->Mask], line);
+		atomic_store_explicit(&ring->Tail, tail, memory_order_release);
+	}
+	return n;
+}
+
+static void *log_thread_fn(void *arg)
+{
+	struct timespec idle = {0, LOG_IDLE_NS};
+	char line[16];
+	uint64_t reported = 0, d;
+
+	(void)arg;
+	/* Drain in batches: a thread that keeps polling the rings would compete
+	   with the loggers for the CPU */
+	while (atomic_load(&running))
+	{
+		if (drain(line) == 0)
+			fflush(sink);
+		nanosleep(&idle, NULL);
+		d = atomic_load_explicit(&dropped, memory_order_relaxed);
+		if (d != reported)
+		{
+			fprintf(sink, "log: %llu records dropped\n", (unsigned long long)(d - reported));
+			reported = d;
+		}
+	}
+	drain(line);
+	fflush(sink);
+	return NULL;
+}
+
+/**
+ * @brief Start the log thread. From now on the AD5940_LOG_xxx macros record
+ *        into per-thread rings instead of calling microlog.
+ * @param pCfg Sink and level.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_LogStart(const LogCfg_Type *pCfg)
+{
+	size_t n = 1;
+	int ret;
+
+	if (!pCfg || !pCfg->fp)
+		return -EINVAL;
+	if (atomic_load(&running))
+		return -EBUSY;
+
+	while (n < (pCfg->RingRecords ? pCfg->RingRecords : LOG_DEF_RING_RECORDS))
+		n <<= 1;
+	ring_records = n;
+	sink = pCfg->fp;
+	realtime_offset = (int64_t)(now_ns(CLOCK_REALTIME) - now_ns(CLOCK_MONOTONIC));
+	atomic_store(&dropped, 0);
+	generation++;
+
+	atomic_store(&running, true);
+	ret = pthread_create(&log_thread, NULL, log_thread_fn, NULL);
+	if (ret != 0)
+	{
+		atomic_store(&running, false);
+		return -ret;
+	}
+	/* The starting thread usually is the one that logs, set up its ring now */
+	ring_get();
+	atomic_store(&ad5940_log_level, pCfg->Level);
+	return 0;
+}
+
+/**
+ * @brief Write out what is still queued, stop the log thread and free the
+ *        rings. Other threads must not log concurrently with the stop.
+ */
+void ad5940_LogStop(void)
+{
+	struct log_ring *ring, *next;
+
+	if (!atomic_load(&running))
+		return;
+	atomic_store(&ad5940_log_level, INT32_MAX);
+	atomic_store(&running, false);
+	pthread_join(log_thread, NULL);
+
+	pthread_mutex_lock(&rings_lock);
+	for (ring = rings; ring; ring = next)
+	{
+		next = ring->pNext;
+		free(ring->pRec);
+		free(ring);
+	}
+	rings = NULL;
+	pthread_mutex_unlock(&rings_lock);
+	tls_ring = NULL;
+
+	if (atomic_load(&dropped))
+		log_warn("log: %llu records dropped", (unsigned long long)atomic_load(&dropped));
+}
+
+/**
+ * @brief Records dropped because a ring was full, since ad5940_LogStart.
+ */
+uint64_t ad5940_LogDropped(void)
+{
+	return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
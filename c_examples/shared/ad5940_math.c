@@ -0,0 +1,250 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+
+#include "ad5940.h"
+#include "ad5940_math.h"
+#include "ad5940_simd.h"
+
+#define ATAN_TAN_PI_8 0.41421356f
+
+/* Cephes atanf on [0, 1]: fold at tan(pi/8), odd polynomial of degree 9 */
+#define ATAN_P0 8.05374449538e-2f
+#define ATAN_P1 -1.38776856032e-1f
+#define ATAN_P2 1.99777106478e-1f
+#define ATAN_P3 -3.33329491539e-1f
+
+/* Each kernel handles whole vectors and returns how many points it did */
+
+#if AD5940_SIMD
+static uint32_t dft_to_float_vf4(const uint32_t *pRaw, float *pOut, uint32_t Count)
+{
+	uint32_t i;
+
+	for (i = 0; i + 4 <= Count; i += 4)
+		VF4_ST(pOut + i, VF4_LD_S18(pRaw + i));
+	return i;
+}
+#endif
+
+#if AD5940_SIMD_DIV
+static uint32_t div_vf4(const float *ar, const float *ai, const float *br,
+			const float *bi, float *rr, float *ri, uint32_t Count)
+{
+	uint32_t i;
+
+	for (i = 0; i + 4 <= Count; i += 4)
+	{
+		vf4 a_r = VF4_LD(ar + i), a_i = VF4_LD(ai + i);
+		vf4 b_r = VF4_LD(br + i), b_i = VF4_LD(bi + i);
+		vf4 d = VF4_ADD(VF4_MUL(b_r, b_r), VF4_MUL(b_i, b_i));
+		vf4 re = VF4_ADD(VF4_MUL(a_r, b_r), VF4_MUL(a_i, b_i));
+		vf4 im = VF4_SUB(VF4_MUL(a_i, b_r), VF4_MUL(a_r, b_i));
+
+		VF4_ST(rr + i, VF4_DIV(re, d));
+		VF4_ST(ri + i, VF4_DIV(im, d));
+	}
+	return i;
+}
+
+static uint32_t mag_vf4(const float *re, const float *im, float *pMag, uint32_t Count)
+{
+	uint32_t i;
+
+	for (i = 0; i + 4 <= Count; i += 4)
+	{
+		vf4 r = VF4_LD(re + i), m = VF4_LD(im + i);
+
+		VF4_ST(pMag + i, VF4_SQRT(VF4_ADD(VF4_MUL(r, r), VF4_MUL(m, m))));
+	}
+	return i;
+}
+
+static vf4 atan2_vf4(vf4 y, vf4 x)
+{
+	const vf4 zero = VF4_SET1(0.0f), one = VF4_SET1(1.0f);
+	vf4 ax = VF4_ABS(x), ay = VF4_ABS(y);
+	vf4 mx = VF4_MAX(ax, ay), mn = VF4_MIN(ax, ay);
+	vf4 a = VF4_DIV(mn, mx);
+	vf4 z, p, r;
+	vm4 fold;
+
+	a = VF4_SEL(VF4_GT(mx, zero), a, zero); /* 0/0 -> 0 */
+	fold = VF4_GT(a, VF4_SET1(ATAN_TAN_PI_8));
+	a = VF4_SEL(fold, VF4_DIV(VF4_SUB(a, one), VF4_ADD(a, one)), a);
+	z = VF4_MUL(a, a);
+	p = VF4_ADD(VF4_MUL(VF4_SET1(ATAN_P0), z), VF4_SET1(ATAN_P1));
+	p = VF4_ADD(VF4_MUL(p, z), VF4_SET1(ATAN_P2));
+	p = VF4_ADD(VF4_MUL(p, z), VF4_SET1(ATAN_P3));
+	r = VF4_ADD(VF4_MUL(VF4_MUL(p, z), a), a);
+	r = VF4_SEL(fold, VF4_ADD(r, VF4_SET1((float)M_PI_4)), r);
+
+	/* Back to the full circle */
+	r = VF4_SEL(VF4_GT(ay, ax), VF4_SUB(VF4_SET1((float)M_PI_2), r), r);
+	r = VF4_SEL(VF4_LT(x, zero), VF4_SUB(VF4_SET1((float)M_PI), r), r);
+	return VF4_SETSIGN(r, y);
+}
+
+static uint32_t phase_vf4(const float *re, const float *im, float *pPhase, uint32_t Count)
+{
+	uint32_t i;
+
+	for (i = 0; i + 4 <= Count; i += 4)
+		VF4_ST(pPhase + i, atan2_vf4(VF4_LD(im + i), VF4_LD(re + i)));
+	return i;
+}
+
+static uint32_t impedance_vf4(const fImpCarArray_Type *pCurr, const fImpCarArray_Type *pVolt,
+			      const fImpCarArray_Type *pRtia, uint32_t RtiaCnt,
+			      fImpPolArray_Type *pRes, uint32_t Count)
+{
+	vf4 t_r = VF4_SET1(pRtia->Real[0]), t_i = VF4_SET1(pRtia->Image[0]);
+	uint32_t i;
+
+	for (i = 0; i + 4 <= Count; i += 4)
+	{
+		vf4 c_r = VF4_LD(pCurr->Real + i), c_i = VF4_LD(pCurr->Image + i);
+		vf4 v_r = VF4_LD(pVolt->Real + i), v_i = VF4_LD(pVolt->Image + i);
+		vf4 n_r, n_i, d, z_r, z_i;
+
+		if (RtiaCnt > 1)
+		{
+			t_r = VF4_LD(pRtia->Real + i);
+			t_i = VF4_LD(pRtia->Image + i);
+		}
+		/* Z = V / (I / Rtia) = V * Rtia / I */
+		n_r = VF4_SUB(VF4_MUL(v_r, t_r), VF4_MUL(v_i, t_i));
+		n_i = VF4_ADD(VF4_MUL(v_r, t_i), VF4_MUL(v_i, t_r));
+		d = VF4_ADD(VF4_MUL(c_r, c_r), VF4_MUL(c_i, c_i));
+		z_r = VF4_DIV(VF4_ADD(VF4_MUL(n_r, c_r), VF4_MUL(n_i, c_i)), d);
+		z_i = VF4_DIV(VF4_SUB(VF4_MUL(n_i, c_r), VF4_MUL(n_r, c_i)), d);
+
+		VF4_ST(pRes->Magnitude + i, VF4_SQRT(VF4_ADD(VF4_MUL(z_r, z_r), VF4_MUL(z_i, z_i))));
+		VF4_ST(pRes->Phase + i, atan2_vf4(z_i, z_r));
+	}
+	return i;
+}
+#endif
+
+/**
+ * @brief Sign extend raw DFTREAL/DFTIMAG register values, like
+ *        convertDftToInt, and convert them to float.
+ * @param pRaw Count register values.
+ * @param pOut Count results.
+ * @param Count Number of values.
+ */
+void ad5940_DftToFloatArray(const uint32_t *pRaw, float *pOut, uint32_t Count)
+{
+	uint32_t i = 0;
+
+#if AD5940_SIMD
+	i = dft_to_float_vf4(pRaw, pOut, Count);
+#endif
+	for (; i < Count; i++)
+	{
+		int32_t v = convertDftToInt(pRaw[i]);
+
+		pOut[i] = (float)v;
+	}
+}
+
+/**
+ * @brief res = a / b for Count points, see ad5940_ComplexDivFloat.
+ * @param a Dividends.
+ * @param b Divisors.
+ * @param res Quotients, may be a or b.
+ * @param Count Number of points.
+ */
+void ad5940_ComplexDivArray(const fImpCarArray_Type *a, const fImpCarArray_Type *b,
+			    fImpCarArray_Type *res, uint32_t Count)
+{
+	uint32_t i = 0;
+
+#if AD5940_SIMD_DIV
+	i = div_vf4(a->Real, a->Image, b->Real, b->Image, res->Real, res->Image, Count);
+#endif
+	for (; i < Count; i++)
+	{
+		float d = b->Real[i] * b->Real[i] + b->Image[i] * b->Image[i];
+		float re = (a->Real[i] * b->Real[i] + a->Image[i] * b->Image[i]) / d;
+		float im = (a->Image[i] * b->Real[i] - a->Real[i] * b->Image[i]) / d;
+
+		res->Real[i] = re;
+		res->Image[i] = im;
+	}
+}
+
+/**
+ * @brief Magnitude of Count points, see ad5940_ComplexMagFloat.
+ * @param a Input points.
+ * @param pMag Count magnitudes.
+ * @param Count Number of points.
+ */
+void ad5940_ComplexMagArray(const fImpCarArray_Type *a, float *pMag, uint32_t Count)
+{
+	uint32_t i = 0;
+
+#if AD5940_SIMD_DIV
+	i = mag_vf4(a->Real, a->Image, pMag, Count);
+#endif
+	for (; i < Count; i++)
+		pMag[i] = sqrtf(a->Real[i] * a->Real[i] + a->Image[i] * a->Image[i]);
+}
+
+/**
+ * @brief Phase of Count points in radians, see ad5940_ComplexPhaseFloat.
+ * @param a Input points.
+ * @param pPhase Count phases, -pi to pi.
+ * @param Count Number of points.
+ */
+void ad5940_ComplexPhaseArray(const fImpCarArray_Type *a, float *pPhase, uint32_t Count)
+{
+	uint32_t i = 0;
+
+#if AD5940_SIMD_DIV
+	i = phase_vf4(a->Real, a->Image, pPhase, Count);
+#endif
+	for (; i < Count; i++)
+		pPhase[i] = atan2f(a->Image[i], a->Real[i]);
+}
+
+/**
+ * @brief Impedance of a whole sweep in polar form. Same result as
+ *        computeImpedance in the impedance example followed by magnitude and
+ *        phase: Z = Volt / (Curr / Rtia), in one pass over the data.
+ * @param pCurr Count current DFT results, sign of the TIA already removed.
+ * @param pVolt Count voltage DFT results.
+ * @param pRtia Calibrated RTIA, one value for all points or one per point.
+ * @param RtiaCnt 1 or Count.
+ * @param pRes Count magnitudes and phases (radians).
+ * @param Count Number of points.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_ImpedanceArray(const fImpCarArray_Type *pCurr, const fImpCarArray_Type *pVolt,
+			  const fImpCarArray_Type *pRtia, uint32_t RtiaCnt,
+			  fImpPolArray_Type *pRes, uint32_t Count)
+{
+	uint32_t i = 0;
+
+	if (!pCurr || !pVolt || !pRtia || !pRes || (RtiaCnt != 1 && RtiaCnt != Count))
+		return -EINVAL;
+
+#if AD5940_SIMD_DIV
+	i = impedance_vf4(pCurr, pVolt, pRtia, RtiaCnt, pRes, Count);
+#endif
+	for (; i < Count; i++)
+	{
+		uint32_t t = RtiaCnt > 1 ? i : 0;
+		float t_r = pRtia->Real[t], t_i = pRtia->Image[t];
+		float c_r = pCurr->Real[i], c_i = pCurr->Image[i];
+		float n_r = pVolt->Real[i] * t_r - pVolt->Image[i] * t_i;
+		float n_i = pVolt->Real[i] * t_i + pVolt->Image[i] * t_r;
+		float d = c_r * c_r + c_i * c_i;
+		float z_r = (n_r * c_r + n_i * c_i) / d;
+		float z_i = (n_i * c_r - n_r * c_i) / d;
+
+		pRes->Magnitude[i] = sqrtf(z_r * z_r + z_i * z_i);
+		pRes->Phase[i] = atan2f(z_i, z_r);
+	}
+	return 0;
+}
@@ -0,0 +1,184 @@
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "ad5940.h"
+#include "ad5940_monitor.h"
+#include "ad5940_snapshot.h"
+#include "ad5940_settle.h"
+#include "ulog.h"
+
+static double ts_sec(const struct timespec *ts)
+{
+	return ts->tv_sec + ts->tv_nsec * 1e-9;
+}
+
+static double now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts_sec(&ts);
+}
+
+static void ts_add(struct timespec *ts, double Seconds)
+{
+	long ns = ts->tv_nsec + (long)((Seconds - (time_t)Seconds) * 1e9);
+
+	ts->tv_sec += (time_t)Seconds + ns / 1000000000L;
+	ts->tv_nsec = ns % 1000000000L;
+}
+
+/**
+ * @brief Wake the AFE from hibernate within a deadline. ADIID is read until it
+ *        answers, between reads the wait doubles from MONITOR_BACKOFF_MIN_US
+ *        up to MONITOR_BACKOFF_MAX_US.
+ * @param dev Device.
+ * @param TimeoutUs Deadline from the first read.
+ * @param pReads Returns the number of reads, can be NULL.
+ * @return 0 on success, -ETIMEDOUT if the AFE did not answer in time.
+ */
+int ad5940_MonitorWakeUp(struct ad5940_dev *dev, uint32_t TimeoutUs, uint32_t *pReads)
+{
+	struct timespec wait;
+	uint32_t reads = 0, tempreg, backoff = MONITOR_BACKOFF_MIN_US;
+	double deadline = now_sec() + TimeoutUs * 1e-6, left;
+	int ret;
+
+	for (;;)
+	{
+		reads++;
+		/* A read error while the AFE wakes up is retried like a wrong ADIID */
+		ret = ad5940_ReadReg(dev, REG_AFECON_ADIID, &tempreg);
+		if (ret == 0 && tempreg == AD5940_ADIID)
+			break;
+
+		left = deadline - now_sec();
+		if (left <= 0)
+		{
+			log_warn("monitor: no wake up after %u reads in %uus (last %d)", reads, TimeoutUs, ret);
+			ret = -ETIMEDOUT;
+			break;
+		}
+		ad5940_SettleStart(&wait, left < backoff * 1e-6 ? left : backoff * 1e-6);
+		ad5940_SettleWait(&wait);
+		backoff = backoff * 2 > MONITOR_BACKOFF_MAX_US ? MONITOR_BACKOFF_MAX_US : backoff * 2;
+	}
+
+	if (pReads)
+		*pReads = reads;
+	return ret;
+}
+
+/* Wake, then write back what hibernate changed */
+static int monitor_resume(struct ad5940_dev *dev, const MonitorCfg_Type *pCfg,
+			  const Snapshot_Type *pShadow, MonitorStat_Type *pStat)
+{
+	Snapshot_Type now;
+	uint32_t reads;
+	double t0, latency;
+	int ret;
+
+	t0 = now_sec();
+	ret = ad5940_MonitorWakeUp(dev, pCfg->WakeTimeoutUs ? pCfg->WakeTimeoutUs : MONITOR_WAKE_TIMEOUT_US, &reads);
+	latency = now_sec() - t0;
+	pStat->WakeReads += reads;
+	if (ret < 0)
+		return ret;
+
+	if (pStat->Wakes == 0 || latency < pStat->WakeMin)
+		pStat->WakeMin = latency;
+	if (latency > pStat->WakeMax)
+		pStat->WakeMax = latency;
+	pStat->WakeMean += (latency - pStat->WakeMean) / (pStat->Wakes + 1);
+	pStat->Wakes++;
+
+	ret = ad5940_SnapshotRead(dev, &now);
+	if (ret < 0)
+		return ret;
+	ret = ad5940_SnapshotRestore(dev, pShadow, &now);
+	if (ret < 0)
+		return ret;
+	pStat->Restored += ret;
+	return 0;
+}
+
+/**
+ * @brief Run pCfg->Cycles measurements, one per pCfg->Period, hibernating in between.
+ * @param dev Device, awake and configured for the measurement.
+ * @param pCfg Schedule and measurement.
+ * @param pStat Returns wake latency and duty cycle, also valid after an error.
+ * @return 0 on success, negative error code of the wake, restore or measurement.
+ *         The AFE is awake when the function returns 0.
+ */
+int ad5940_MonitorRun(struct ad5940_dev *dev, const MonitorCfg_Type *pCfg, MonitorStat_Type *pStat)
+{
+	Snapshot_Type shadow;
+	struct timespec next;
+	bool asleep = false;
+	double start, end;
+	int ret = 0;
+
+	if (!dev || !pCfg || !pCfg->Measure || !pStat || pCfg->Period <= 0)
+		return -EINVAL;
+	memset(pStat, 0, sizeof(*pStat));
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (uint32_t cycle = 0; cycle < pCfg->Cycles; cycle++)
+	{
+		start = now_sec();
+		if (asleep)
+		{
+			asleep = false;
+			ret = monitor_resume(dev, pCfg, &shadow, pStat);
+			if (ret < 0)
+				break;
+		}
+
+		ret = pCfg->Measure(dev, pCfg->pCtx, cycle);
+		if (ret < 0)
+			break;
+		pStat->Cycles++;
+
+		/* Stay awake after the last measurement */
+		if (pCfg->Hibernate && cycle + 1 < pCfg->Cycles)
+		{
+			ret = ad5940_SnapshotRead(dev, &shadow);
+			if (ret < 0)
+				break;
+			ret = ad5940_ShutDownS(dev);
+			if (ret < 0)
+				break;
+			asleep = true;
+		}
+		end = now_sec();
+		pStat->Active += end - start;
+
+		if (cycle + 1 == pCfg->Cycles)
+			break;
+		ts_add(&next, pCfg->Period);
+		if (ts_sec(&next) < end)
+		{
+			pStat->Overruns++;
+			clock_gettime(CLOCK_MONOTONIC, &next);
+		}
+		ad5940_SettleWait(&next);
+		pStat->Idle += now_sec() - end;
+	}
+
+	if (pStat->Active + pStat->Idle > 0)
+		pStat->DutyCycle = pStat->Active / (pStat->Active + pStat->Idle);
+	log_info("monitor: %u cycles, %u overruns, duty cycle %.2f%%, wake %.2f/%.2f/%.2fms min/mean/max, "
+		 "%u ADIID reads, %u registers restored",
+		 pStat->Cycles, pStat->Overruns, pStat->DutyCycle * 100, pStat->WakeMin * 1e3,
+		 pStat->WakeMean * 1e3, pStat->WakeMax * 1e3, pStat->WakeReads, pStat->Restored);
+
+	/* Leave the AFE awake and configured, also after an error in the measurement */
+	if (asleep)
+	{
+		int r = monitor_resume(dev, pCfg, &shadow, pStat);
+		if (ret == 0)
+			ret = r;
+	}
+	return ret;
+}
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "ad5940.h"
+#include "ad5940_multitone.h"
+#include "ulog.h"
+
+#include "ad5940_simd.h"
+
+#define GOERTZEL_BLOCK 8 /* Tones per pass, two 4-lane vectors */
+
+/**
+ * @brief Repetition period of the trapezoid generator. Delays and slopes
+ *        count DAC updates, one every HsDacUpdateRate generator clocks.
+ * @param pTrapz Trapezoid configuration.
+ * @param SysClkFreq Clock of the waveform generator.
+ * @param HsDacUpdateRate DAC update divider.
+ * @return Period in seconds.
+ */
+float ad5940_TrapzPeriod(const WGTrapzCfg_Type *pTrapz, float SysClkFreq,
+			 uint32_t HsDacUpdateRate)
+{
+	float updates = (float)pTrapz->WGTrapzDelay1 + pTrapz->WGTrapzSlope1 +
+			pTrapz->WGTrapzDelay2 + pTrapz->WGTrapzSlope2;
+
+	return updates * HsDacUpdateRate / SysClkFreq;
+}
+
+/**
+ * @brief Evaluate the DTFT of L samples at ToneCnt frequencies. A Goertzel
+ *        resonator per tone, s[n] = x[n] + 2cos(w)s[n-1] - s[n-2], and the
+ *        output X(w) = exp(-iw(L-1)) * (s[L-1] - exp(-iw)s[L-2]). Unlike the
+ *        classic form this is exact for w off the DFT grid.
+ * @param pX L samples, windowed by the caller if needed.
+ * @param L Number of samples.
+ * @param pOmega Tone frequencies in radians per sample, 0 to pi.
+ * @param ToneCnt Number of tones.
+ * @param pOut ToneCnt results, sum of x[n]exp(-iwn).
+ */
+void ad5940_GoertzelBank(const float *pX, uint32_t L, const float *pOmega,
+			 uint32_t ToneCnt, fImpCar_Type *pOut)
+{
+	float coef[GOERTZEL_BLOCK], s1[GOERTZEL_BLOCK], s2[GOERTZEL_BLOCK];
+	uint32_t t0, cnt, j, n;
+
+	for (t0 = 0; t0 < ToneCnt; t0 += GOERTZEL_BLOCK)
+	{
+		cnt = ToneCnt - t0 < GOERTZEL_BLOCK ? ToneCnt - t0 : GOERTZEL_BLOCK;
+		for (j = 0; j < GOERTZEL_BLOCK; j++)
+			coef[j] = j < cnt ? 2.0f * cosf(pOmega[t0 + j]) : 0.0f;
+
+#if AD5940_SIMD
+		{
+			/* Two independent chains per sample hide the add latency */
+			vf4 c0 = VF4_LD(coef), c1 = VF4_LD(coef + 4);
+			vf4 a1 = VF4_SET1(0.0f), a2 = a1, b1 = a1, b2 = a1;
+
+			for (n = 0; n < L; n++)
+			{
+				vf4 x = VF4_SET1(pX[n]);
+				vf4 a0 = VF4_ADD(x, VF4_SUB(VF4_MUL(c0, a1), a2));
+				vf4 b0 = VF4_ADD(x, VF4_SUB(VF4_MUL(c1, b1), b2));
+
+				a2 = a1;
+				a1 = a0;
+				b2 = b1;
+				b1 = b0;
+			}
+			VF4_ST(s1, a1);
+			VF4_ST(s1 + 4, b1);
+			VF4_ST(s2, a2);
+			VF4_ST(s2 + 4, b2);
+		}
+#else
+		memset(s1, 0, sizeof(s1));
+		memset(s2, 0, sizeof(s2));
+		for (n = 0; n < L; n++)
+		{
+			for (j = 0; j < GOERTZEL_BLOCK; j++)
+			{
+				float s0 = pX[n] + coef[j] * s1[j] - s2[j];
+
+				s2[j] = s1[j];
+				s1[j] = s0;
+			}
+		}
+#endif
+
+		for (j = 0; j < cnt; j++)
+		{
+			double w = pOmega[t0 + j];
+			double yr = s1[j] - cos(w) * s2[j];
+			double yi = sin(w) * s2[j];
+			double ph = -w * (L - 1);
+
+			pOut[t0 + j].Real = (float)(yr * cos(ph) - yi * sin(ph));
+			pOut[t0 + j].Image = (float)(yr * sin(ph) + yi * cos(ph));
+		}
+	}
+}
+
+/**
+ * @brief Evaluate all tones of a current and a voltage capture. Both records
+ *        must come from ad5940_CaptureWaveformSync with the same settings.
+ *        The analysed part is the last whole number of trapezoid periods
+ *        after Skip, Hann windowed. Window and time origin are the same for
+ *        both channels, so they cancel in the ratio Volt / Curr.
+ * @param pCfg Excitation and capture settings.
+ * @param pCurr N samples of the current channel.
+ * @param pVolt N samples of the voltage channel.
+ * @param pResult ToneCnt results.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_MultiToneAnalyze(const MultiToneCfg_Type *pCfg, const float *pCurr,
+			    const float *pVolt, MultiToneResult_Type *pResult)
+{
+	float *pWin = NULL, *pBuf = NULL, *pOmega = NULL;
+	fImpCar_Type *pOut = NULL;
+	float period, spp, gain, amp, amp_max = 0;
+	uint32_t periods, L, start, k;
+	int ret = 0;
+
+	if (!pCfg || !pCurr || !pVolt || !pResult || !pCfg->pHarmonics ||
+	    !pCfg->ToneCnt || pCfg->SampleRate <= 0 || pCfg->Skip >= pCfg->N)
+		return -EINVAL;
+
+	period = ad5940_TrapzPeriod(&pCfg->Trapz, pCfg->SysClkFreq, pCfg->HsDacUpdateRate);
+	spp = period * pCfg->SampleRate;
+	periods = spp > 0 ? (uint32_t)((pCfg->N - pCfg->Skip) / spp) : 0;
+	if (periods == 0)
+	{
+		log_error("multitone: %u samples hold no full period of %.1f samples",
+			  pCfg->N - pCfg->Skip, spp);
+		return -EINVAL;
+	}
+	L = (uint32_t)lroundf(periods * spp);
+	if (L > pCfg->N - pCfg->Skip)
+		L = pCfg->N - pCfg->Skip;
+	if (L < 2)
+		return -EINVAL;
+	start = pCfg->N - L;
+
+	pWin = malloc(L * sizeof(float));
+	pBuf = malloc(L * sizeof(float));
+	pOmega = malloc(pCfg->ToneCnt * sizeof(float));
+	pOut = malloc(2 * pCfg->ToneCnt * sizeof(fImpCar_Type));
+	if (!pWin || !pBuf || !pOmega || !pOut)
+	{
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/* Periodic Hann over the analysed periods; 2 / sum(w) scales to amplitude */
+	for (k = 0; k < L; k++)
+		pWin[k] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * k / L));
+	gain = 4.0f / L;
+
+	for (k = 0; k < pCfg->ToneCnt; k++)
+	{
+		pResult[k].Freq = pCfg->pHarmonics[k] / period;
+		pOmega[k] = (float)(2.0 * M_PI * pResult[k].Freq / pCfg->SampleRate);
+		pResult[k].Valid = pOmega[k] > 0 && pOmega[k] < (float)M_PI;
+		if (!pResult[k].Valid)
+			pOmega[k] = 0;
+	}
+
+	for (k = 0; k < L; k++)
+		pBuf[k] = pCurr[start + k] * pWin[k];
+	ad5940_GoertzelBank(pBuf, L, pOmega, pCfg->ToneCnt, pOut);
+	for (k = 0; k < L; k++)
+		pBuf[k] = pVolt[start + k] * pWin[k];
+	ad5940_GoertzelBank(pBuf, L, pOmega, pCfg->ToneCnt, pOut + pCfg->ToneCnt);
+
+	for (k = 0; k < pCfg->ToneCnt; k++)
+	{
+		pResult[k].Curr.Real = pOut[k].Real * gain;
+		pResult[k].Curr.Image = pOut[k].Image * gain;
+		pResult[k].Volt.Real = pOut[pCfg->ToneCnt + k].Real * gain;
+		pResult[k].Volt.Image = pOut[pCfg->ToneCnt + k].Image * gain;
+		amp = ad5940_ComplexMagFloat(&pResult[k].Curr);
+		if (pResult[k].Valid && amp > amp_max)
+			amp_max = amp;
+	}
+	for (k = 0; k < pCfg->ToneCnt; k++)
+	{
+		if (ad5940_ComplexMagFloat(&pResult[k].Curr) < pCfg->MinRelAmp * amp_max)
+			pResult[k].Valid = false;
+	}
+
+	log_debug("multitone: f0 %.2fHz, %u periods, %u of %u samples, %u tones",
+		  1.0f / period, periods, L, pCfg->N, pCfg->ToneCnt);
+
+out:
+	free(pWin);
+	free(pBuf);
+	free(pOmega);
+	free(pOut);
+	return ret;
+}
@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "ad5940.h"
+#include "ad5940_pingpong.h"
+#include "ulog.h"
+
+#define PP_END_INT(slot) ((slot) == PINGPONG_SLOT_A ? AFEINTSRC_CUSTOMINT0 : AFEINTSRC_CUSTOMINT1)
+#define PP_END_CMD(slot) ((slot) == PINGPONG_SLOT_A ? SEQ_INT0() : SEQ_INT1())
+#define PP_INTS (AFEINTSRC_CUSTOMINT0 | AFEINTSRC_CUSTOMINT1)
+#define PP_LFOSC_HZ 32000 /* wakeup timer ticks, nominal */
+
+/**
+ * @brief Initialize the ping-pong manager and route the slot end interrupts.
+ * @param dev The device structure.
+ * @param pp Manager state.
+ * @param pCfg Slot layout and trigger mode.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_PingPongInit(struct ad5940_dev *dev, struct ad5940_pingpong *pp,
+			const PingPongCfg_Type *pCfg)
+{
+	uint32_t a, b;
+	int ret;
+
+	if (!pp || !pCfg || pCfg->SlotSize < 2)
+		return -EINVAL;
+	a = pCfg->SlotAddr[PINGPONG_SLOT_A];
+	b = pCfg->SlotAddr[PINGPONG_SLOT_B];
+	if ((a < b ? b - a : a - b) < pCfg->SlotSize)
+		return -EINVAL; /* slots overlap */
+
+	memset(pp, 0, sizeof(*pp));
+	pp->Cfg = *pCfg;
+
+	ret = ad5940_INTCCfg(dev, AFEINTC_1, PP_INTS, true);
+	if (ret < 0)
+		return ret;
+	return ad5940_INTCClrFlag(dev, PP_INTS | AFEINTSRC_ENDSEQ);
+}
+
+/**
+ * @brief Upload a block of commands into a slot and point its SEQxINFO at it.
+ *        SeqLen may be 0, the slot then only holds the end marker.
+ * @param dev The device structure.
+ * @param pp Manager state.
+ * @param Slot PINGPONG_SLOT_A or PINGPONG_SLOT_B.
+ * @param pSeqCmd Commands, without SEQ_STOP().
+ * @param SeqLen Number of commands, at most SlotSize - 1.
+ * @return 0 on success, -EBUSY if the slot is running, negative error code otherwise.
+ */
+int ad5940_PingPongLoad(struct ad5940_dev *dev, struct ad5940_pingpong *pp,
+			uint32_t Slot, const uint32_t *pSeqCmd, uint32_t SeqLen)
+{
+	SEQInfo_Type info;
+	uint32_t *pBuff;
+	int ret;
+
+	if (Slot > PINGPONG_SLOT_B || SeqLen + 1 > pp->Cfg.SlotSize || (SeqLen && !pSeqCmd))
+		return -EINVAL;
+	if (pp->Running && Slot == pp->Active)
+		return -EBUSY;
+
+	pBuff = malloc((SeqLen + 1) * sizeof(uint32_t));
+	if (!pBuff)
+		return -ENOMEM;
+	if (SeqLen)
+		memcpy(pBuff, pSeqCmd, SeqLen * sizeof(uint32_t));
+	pBuff[SeqLen] = PP_END_CMD(Slot);
+
+	info.SeqId = Slot == PINGPONG_SLOT_A ? SEQID_0 : SEQID_1;
+	info.SeqRamAddr = pp->Cfg.SlotAddr[Slot];
+	info.SeqLen = SeqLen + 1;
+	info.WriteSRAM = true;
+	info.pSeqCmd = pBuff;
+	ret = ad5940_SEQInfoCfg(dev, &info);
+	free(pBuff);
+	if (ret < 0)
+		return ret;
+
+	pp->Loaded[Slot] = SeqLen != 0;
+	pp->Empty[Slot] = SeqLen == 0;
+	return 0;
+}
+
+/**
+ * @brief Start with slot A. In wakeup timer mode both slots must be loaded.
+ * @param dev The device structure.
+ * @param pp Manager state.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_PingPongStart(struct ad5940_dev *dev, struct ad5940_pingpong *pp)
+{
+	WUPTCfg_Type wupt_cfg;
+	int ret;
+
+	if (!pp->Loaded[PINGPONG_SLOT_A])
+		return -EINVAL;
+	if (pp->Cfg.UseWupt && !pp->Loaded[PINGPONG_SLOT_B] && !pp->Empty[PINGPONG_SLOT_B])
+		return -EINVAL;
+
+	ret = ad5940_INTCClrFlag(dev, PP_INTS | AFEINTSRC_ENDSEQ);
+	if (ret < 0)
+		return ret;
+	ret = ad5940_SEQCtrlS(dev, true);
+	if (ret < 0)
+		return ret;
+
+	pp->Active = PINGPONG_SLOT_A;
+	if (pp->Cfg.UseWupt)
+	{
+		memset(&wupt_cfg, 0, sizeof(wupt_cfg));
+		wupt_cfg.WuptEndSeq = WUPTENDSEQ_B;
+		wupt_cfg.WuptOrder[0] = SEQID_0;
+		wupt_cfg.WuptOrder[1] = SEQID_1;
+		wupt_cfg.SeqxSleepTime[SEQID_0] = pp->Cfg.WuptSleepTime[PINGPONG_SLOT_A];
+		wupt_cfg.SeqxWakeupTime[SEQID_0] = pp->Cfg.WuptWakeupTime[PINGPONG_SLOT_A];
+		wupt_cfg.SeqxSleepTime[SEQID_1] = pp->Cfg.WuptSleepTime[PINGPONG_SLOT_B];
+		wupt_cfg.SeqxWakeupTime[SEQID_1] = pp->Cfg.WuptWakeupTime[PINGPONG_SLOT_B];
+		wupt_cfg.WuptEn = true;
+		ret = ad5940_WUPTCfg(dev, &wupt_cfg);
+	}
+	else
+	{
+		ret = ad5940_SEQMmrTrig(dev, SEQID_0);
+	}
+	if (ret < 0)
+		return ret;
+
+	pp->Running = true;
+	return 0;
+}
+
+/**
+ * @brief Check whether the running slot finished. In host trigger mode the
+ *        other slot is started right away if it holds a block.
+ * @param dev The device structure.
+ * @param pp Manager state.
+ * @param pDoneSlot Returns the slot that finished.
+ * @return 1 if a slot finished, 0 if not, negative error code otherwise.
+ */
+int ad5940_PingPongPoll(struct ad5940_dev *dev, struct ad5940_pingpong *pp,
+			uint32_t *pDoneSlot)
+{
+	uint32_t flag, slot, next;
+	int ret;
+
+	if (!pp->Running)
+		return 0;
+
+	ret = ad5940_INTCGetFlag(dev, AFEINTC_1, &flag);
+	if (ret < 0)
+		return ret;
+	if (!(flag & PP_INTS))
+		return 0;
+
+	/* Slots finish in order; if both flags are up, the active one came first */
+	slot = (flag & PP_END_INT(pp->Active)) ? pp->Active : pp->Active ^ 1;
+	next = slot ^ 1;
+
+	/* Host mode: start the other slot before anything else to keep the gap short */
+	if (!pp->Cfg.UseWupt)
+	{
+		if (pp->Loaded[next])
+		{
+			ret = ad5940_SEQMmrTrig(dev, next == PINGPONG_SLOT_A ? SEQID_0 : SEQID_1);
+			if (ret < 0)
+				return ret;
+		}
+		else
+		{
+			pp->Running = false;
+		}
+	}
+
+	ret = ad5940_INTCClrFlag(dev, PP_END_INT(slot) | AFEINTSRC_ENDSEQ);
+	if (ret < 0)
+		return ret;
+
+	if (!pp->Loaded[slot] && !pp->Empty[slot])
+	{
+		pp->Overruns++;
+		log_warn("pingpong: slot %c ran again before it was reloaded", 'A' + slot);
+	}
+	pp->Loaded[slot] = false;
+	pp->Active = next;
+	pp->BlocksDone++;
+	*pDoneSlot = slot;
+
+	return 1;
+}
+
+/**
+ * @brief Stop the wakeup timer and mark the manager idle.
+ * @param dev The device structure.
+ * @param pp Manager state.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_PingPongStop(struct ad5940_dev *dev, struct ad5940_pingpong *pp)
+{
+	int ret = 0;
+
+	if (pp->Cfg.UseWupt)
+		ret = ad5940_WUPTCtrl(dev, false);
+	pp->Running = false;
+	return ret;
+}
+
+/* Refill a slot from fill(). Once fill() is dry, a timer driven slot gets an
+   empty block so that its next (unavoidable) run does nothing. */
+static int pp_refill(struct ad5940_dev *dev, struct ad5940_pingpong *pp,
+		     ad5940_pp_fill_fn fill, void *ctx, uint32_t slot,
+		     uint32_t *pBuff, bool *more, bool *real)
+{
+	uint32_t len = 0;
+	int ret;
+
+	if (*more)
+	{
+		ret = fill(ctx, slot, pBuff, pp->Cfg.SlotSize - 1, &len);
+		if (ret < 0)
+			return ret;
+		*more = len != 0;
+	}
+	real[slot] = len != 0;
+	if (len || (pp->Cfg.UseWupt && !pp->Empty[slot]))
+		return ad5940_PingPongLoad(dev, pp, slot, pBuff, len);
+	return 0;
+}
+
+/* Deadline for the next block to finish, from now */
+static void pp_deadline(const struct ad5940_pingpong *pp, struct timespec *pDeadline)
+{
+	uint64_t ms = pp->Cfg.TimeoutMs ? pp->Cfg.TimeoutMs : PINGPONG_TIMEOUT_MS;
+	uint32_t slot;
+
+	/* Timer mode: a slot only starts after its sleep and wakeup time */
+	if (pp->Cfg.UseWupt)
+	{
+		for (slot = PINGPONG_SLOT_A; slot <= PINGPONG_SLOT_B; slot++)
+			ms += ((uint64_t)pp->Cfg.WuptSleepTime[slot] + pp->Cfg.WuptWakeupTime[slot] + 2) *
+			      1000 / PP_LFOSC_HZ;
+	}
+	clock_gettime(CLOCK_MONOTONIC, pDeadline);
+	pDeadline->tv_sec += ms / 1000;
+	pDeadline->tv_nsec += (long)(ms % 1000) * 1000000L;
+	if (pDeadline->tv_nsec >= 1000000000L)
+	{
+		pDeadline->tv_sec++;
+		pDeadline->tv_nsec -= 1000000000L;
+	}
+}
+
+static bool pp_expired(const struct timespec *pDeadline)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > pDeadline->tv_sec ||
+	       (now.tv_sec == pDeadline->tv_sec && now.tv_nsec > pDeadline->tv_nsec);
+}
+
+/**
+ * @brief Run blocks from fill() through both slots until fill() runs dry and
+ *        every loaded block has finished. done() is called for each block.
+ * @param dev The device structure.
+ * @param pp Manager state, initialized with ad5940_PingPongInit.
+ * @param fill Supplies the next block.
+ * @param done Consumes the results of a finished block, can be NULL.
+ * @param ctx Passed through to the callbacks.
+ * @return 0 on success, -ETIMEDOUT if no block finished within the timeout,
+ *         negative error code otherwise.
+ */
+int ad5940_PingPongRun(struct ad5940_dev *dev, struct ad5940_pingpong *pp,
+		       ad5940_pp_fill_fn fill, ad5940_pp_done_fn done,
+		       void *ctx)
+{
+	const struct timespec poll = {0, PINGPONG_POLL_US * 1000L};
+	struct timespec deadline;
+	uint32_t *pBuff;
+	uint32_t slot, outstanding = 0;
+	bool more = true;
+	bool real[2] = {false, false};
+	int ret = 0;
+
+	if (!fill)
+		return -EINVAL;
+	pBuff = malloc(pp->Cfg.SlotSize * sizeof(uint32_t));
+	if (!pBuff)
+		return -ENOMEM;
+
+	for (slot = PINGPONG_SLOT_A; slot <= PINGPONG_SLOT_B; slot++)
+	{
+		ret = pp_refill(dev, pp, fill, ctx, slot, pBuff, &more, real);
+		if (ret < 0)
+			goto out;
+		outstanding += real[slot];
+	}
+	if (outstanding == 0)
+		goto out;
+
+	ret = ad5940_PingPongStart(dev, pp);
+	if (ret < 0)
+		goto out;
+	pp_deadline(pp, &deadline);
+
+	while (outstanding)
+	{
+		ret = ad5940_PingPongPoll(dev, pp, &slot);
+		if (ret < 0)
+			goto out;
+		if (ret == 0)
+		{
+			if (pp_expired(&deadline))
+			{
+				log_error("pingpong: slot %c did not finish, %u blocks outstanding",
+					  'A' + pp->Active, outstanding);
+				ret = -ETIMEDOUT;
+				goto out;
+			}
+			nanosleep(&poll, NULL);
+			continue;
+		}
+		pp_deadline(pp, &deadline);
+
+		if (real[slot])
+		{
+			outstanding--;
+			if (done)
+			{
+				ret = done(ctx, slot);
+				if (ret < 0)
+					goto out;
+			}
+		}
+		ret = pp_refill(dev, pp, fill, ctx, slot, pBuff, &more, real);
+		if (ret < 0)
+			goto out;
+		outstanding += real[slot];
+
+		/* Host mode: the other slot was empty, so nothing is running now */
+		if (!pp->Cfg.UseWupt && !pp->Running && pp->Loaded[slot])
+		{
+			ret = ad5940_SEQMmrTrig(dev, slot == PINGPONG_SLOT_A ? SEQID_0 : SEQID_1);
+			if (ret < 0)
+				goto out;
+			pp->Active = slot;
+			pp->Running = true;
+		}
+	}
+	ret = 0;
+
+out:
+	ad5940_PingPongStop(dev, pp);
+	free(pBuff);
+	if (pp->Overruns)
+		log_warn("pingpong: %u overruns in %u blocks", pp->Overruns, pp->BlocksDone);
+	return ret;
+}
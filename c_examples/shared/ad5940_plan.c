@@ -0,0 +1,321 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "ad5940.h"
+#include "ad5940_plan.h"
+#include "ad5940_seqcache.h"
+#include "ad5940_settle.h"
+#include "ulog.h"
+
+#define PLAN_GEN_WORDS 1024 /* Generator workspace: commands plus the register table */
+#define PLAN_SEQ_ID SEQID_3  /* Default sequence and SRAM area of the blocks */
+#define PLAN_SEQ_ADDR 0
+#define PLAN_SEQ_WORDS 512   /* 2kB of sequencer SRAM next to a 4kB data FIFO */
+#define PLAN_TIMEOUT_MS 100  /* Allowed on top of the waits of a block */
+
+/**
+ * @brief Start an empty plan.
+ * @param pPlan Plan to initialize.
+ * @param SysClkFreq System clock the plan runs with, in Hz.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_PlanInit(struct ad5940_plan *pPlan, float SysClkFreq)
+{
+	if (!pPlan || SysClkFreq <= 0)
+		return -EINVAL;
+
+	memset(pPlan, 0, sizeof(*pPlan));
+	pPlan->SysClkFreq = SysClkFreq;
+	pPlan->SeqId = PLAN_SEQ_ID;
+	pPlan->SeqRamAddr = PLAN_SEQ_ADDR;
+	pPlan->SeqRamWords = PLAN_SEQ_WORDS;
+	pPlan->TimeoutMs = PLAN_TIMEOUT_MS;
+	pPlan->PointCap = 8;
+	pPlan->pStart = malloc((pPlan->PointCap + 1) * sizeof(uint32_t));
+	if (!pPlan->pStart)
+		return -ENOMEM;
+	pPlan->pStart[0] = 0;
+	return 0;
+}
+
+/* ad5940_plan_fn called through ad5940_seqgen_fn */
+struct plan_gen_ctx
+{
+	ad5940_plan_fn gen;
+	void *ctx;
+	uint32_t point;
+};
+
+static int plan_gen(struct ad5940_dev *dev, void *ctx)
+{
+	struct plan_gen_ctx *g = ctx;
+
+	return g->gen(dev, g->ctx, g->point);
+}
+
+static int plan_add(struct ad5940_dev *dev, struct ad5940_plan *pPlan, const char *CacheDir,
+		    const uint64_t *pKey, ad5940_plan_fn gen, void *ctx)
+{
+	struct plan_gen_ctx g;
+	SEQOptInfo_Type opt;
+	const uint32_t *pSeq;
+	uint32_t *pBuffer, *p;
+	uint32_t len, i, point;
+	int ret;
+
+	if (!dev || !pPlan || !pPlan->pStart || !gen)
+		return -EINVAL;
+	pBuffer = malloc(PLAN_GEN_WORDS * sizeof(uint32_t));
+	if (!pBuffer)
+		return -ENOMEM;
+
+	point = pPlan->PointCnt;
+	g.gen = gen;
+	g.ctx = ctx;
+	g.point = point;
+	if (pKey)
+	{
+		ret = ad5940_SEQCacheGet(dev, CacheDir, *pKey, plan_gen, &g, pBuffer, PLAN_GEN_WORDS,
+					 &pSeq, &len);
+		if (ret < 0)
+			goto out;
+	}
+	else
+	{
+		ret = ad5940_SEQGenInit(dev, pBuffer, PLAN_GEN_WORDS);
+		if (ret < 0)
+			goto out;
+		ad5940_SEQGenCtrl(dev, true);
+		ret = plan_gen(dev, &g);
+		ad5940_SEQGenCtrl(dev, false);
+		if (ret < 0)
+			goto out;
+		ret = ad5940_SEQGenFetchSeq(dev, &pSeq, &len);
+		if (ret < 0)
+			goto out;
+	}
+	ret = ad5940_SEQOptimize(pBuffer, &len, &opt);
+	if (ret < 0)
+		goto out;
+
+	/* Only writes and waits, and room for the SEQ_STOP ad5940_PlanApply appends */
+	for (i = 0; i < len; i++)
+	{
+		if (!SEQ_CMD_IS_WR(pBuffer[i]) && !SEQ_CMD_IS_WAIT(pBuffer[i]))
+		{
+			log_error("plan: point %u, command %u (0x%08x) is not a write or a wait", point, i, pBuffer[i]);
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+	if (len + 1 > pPlan->SeqRamWords)
+	{
+		log_error("plan: point %u, %u commands do not fit %u words of SRAM", point, len, pPlan->SeqRamWords);
+		ret = -E2BIG;
+		goto out;
+	}
+
+	if (pPlan->pStart[point] + len > pPlan->CmdCap)
+	{
+		uint32_t cap = pPlan->CmdCap ? pPlan->CmdCap : 256;
+		while (cap < pPlan->pStart[point] + len)
+			cap *= 2;
+		p = realloc(pPlan->pCmd, cap * sizeof(uint32_t));
+		if (!p)
+		{
+			ret = -ENOMEM;
+			goto out;
+		}
+		pPlan->pCmd = p;
+		pPlan->CmdCap = cap;
+	}
+	if (point + 1 > pPlan->PointCap)
+	{
+		p = realloc(pPlan->pStart, (2 * pPlan->PointCap + 1) * sizeof(uint32_t));
+		if (!p)
+		{
+			ret = -ENOMEM;
+			goto out;
+		}
+		pPlan->pStart = p;
+		pPlan->PointCap *= 2;
+	}
+
+	memcpy(&pPlan->pCmd[pPlan->pStart[point]], pBuffer, len * sizeof(uint32_t));
+	pPlan->pStart[point + 1] = pPlan->pStart[point] + len;
+	pPlan->PointCnt++;
+	log_debug("plan: point %u, %u commands (%u before optimizing)", point, len, opt.OrigLen);
+	ret = (int)point;
+
+out:
+	free(pBuffer);
+	return ret;
+}
+
+/**
+ * @brief Record the register writes gen() makes for the next point.
+ *        Register reads during recording come from the device, so it must be
+ *        in the state the plan will be applied from.
+ * @param dev The device structure.
+ * @param pPlan Plan from ad5940_PlanInit.
+ * @param gen Issues the driver calls for the point.
+ * @param ctx Passed through to gen.
+ * @return Index of the new point, negative error code otherwise.
+ */
+int ad5940_PlanAddPoint(struct ad5940_dev *dev, struct ad5940_plan *pPlan,
+			ad5940_plan_fn gen, void *ctx)
+{
+	return plan_add(dev, pPlan, NULL, NULL, gen, ctx);
+}
+
+/**
+ * @brief ad5940_PlanAddPoint() through the sequence cache: on a hit the block
+ *        is loaded from CacheDir and gen() is not called, so neither are the
+ *        register reads, and the generator's register shadow is left
+ *        untouched. On a miss the generated block is stored.
+ * @param dev The device structure.
+ * @param pPlan Plan from ad5940_PlanInit.
+ * @param CacheDir Cache directory, NULL for the current directory.
+ * @param Key Cache key covering every input of gen and the chip
+ *        (ad5940_SEQCacheKeyChip(), see ad5940_seqcache.h).
+ * @param gen Issues the driver calls for the point.
+ * @param ctx Passed through to gen.
+ * @return Index of the new point, negative error code otherwise.
+ */
+int ad5940_PlanAddPointCached(struct ad5940_dev *dev, struct ad5940_plan *pPlan,
+			      const char *CacheDir, uint64_t Key, ad5940_plan_fn gen, void *ctx)
+{
+	return plan_add(dev, pPlan, CacheDir, &Key, gen, ctx);
+}
+
+/* Poll for the end of the sequence until the deadline */
+static int plan_wait_end(struct ad5940_dev *dev, const struct timespec *pDeadline)
+{
+	struct timespec now;
+	uint32_t flag;
+	int ret;
+
+	for (;;)
+	{
+		ret = ad5940_INTCGetFlag(dev, AFEINTC_1, &flag);
+		if (ret < 0)
+			return ret;
+		if (flag & AFEINTSRC_ENDSEQ)
+			return 0;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > pDeadline->tv_sec ||
+		    (now.tv_sec == pDeadline->tv_sec && now.tv_nsec > pDeadline->tv_nsec))
+			return -ETIMEDOUT;
+	}
+}
+
+/**
+ * @brief Run the block of one point in the sequencer: the block and a
+ *        SEQ_STOP are written to SRAM in one transfer, the sequence is
+ *        triggered, and the function returns at AFEINTSRC_ENDSEQ. Waits in
+ *        the block are spent by the sequencer.
+ * @param dev The device structure.
+ * @param pPlan Compiled plan.
+ * @param Point Point index.
+ * @return 0 on success, -ETIMEDOUT if the sequence did not end TimeoutMs
+ *         after its waits, negative error code otherwise.
+ */
+int ad5940_PlanApply(struct ad5940_dev *dev, const struct ad5940_plan *pPlan,
+		     uint32_t Point)
+{
+	struct timespec deadline;
+	SEQInfo_Type info;
+	uint32_t *pBuff, len, i;
+	uint64_t clks = 0;
+	int ret;
+
+	if (!dev || !pPlan || Point >= pPlan->PointCnt)
+		return -EINVAL;
+	len = ad5940_PlanBlockLen(pPlan, Point);
+	if (len + 1 > pPlan->SeqRamWords)
+		return -E2BIG;
+
+	pBuff = malloc((len + 1) * sizeof(uint32_t));
+	if (!pBuff)
+		return -ENOMEM;
+	memcpy(pBuff, &pPlan->pCmd[pPlan->pStart[Point]], len * sizeof(uint32_t));
+	pBuff[len] = SEQ_STOP(); /* Raises AFEINTSRC_ENDSEQ */
+	for (i = 0; i < len; i++)
+	{
+		/* SEQ_WAIT(n) takes n + 1 clocks */
+		if (SEQ_CMD_IS_WAIT(pBuff[i]))
+			clks += SEQ_CMD_WAIT_CLKS(pBuff[i]) + 1ull;
+	}
+
+	info.SeqId = pPlan->SeqId;
+	info.SeqRamAddr = pPlan->SeqRamAddr;
+	info.SeqLen = len + 1;
+	info.WriteSRAM = true;
+	info.pSeqCmd = pBuff;
+	ret = ad5940_SEQInfoCfg(dev, &info);
+	free(pBuff);
+	if (ret < 0)
+		return ret;
+
+	ret = ad5940_INTCClrFlag(dev, AFEINTSRC_ENDSEQ);
+	if (ret < 0)
+		return ret;
+	ret = ad5940_SEQCtrlS(dev, true);
+	if (ret < 0)
+		return ret;
+	ret = ad5940_SEQMmrTrig(dev, pPlan->SeqId);
+	if (ret < 0)
+		return ret;
+
+	/* The block cannot end before its waits, so sleep through them first.
+	   ad5940_SettleWait() yields to the browser in the wasm build. */
+	if (clks)
+	{
+		ad5940_SettleStart(&deadline, (float)(clks / pPlan->SysClkFreq));
+		ad5940_SettleWait(&deadline);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += pPlan->TimeoutMs / 1000;
+	deadline.tv_nsec += (long)(pPlan->TimeoutMs % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	ret = plan_wait_end(dev, &deadline);
+	if (ret == -ETIMEDOUT)
+	{
+		log_error("plan: point %u did not end %ums after its waits", Point, pPlan->TimeoutMs);
+		ad5940_SEQCtrlS(dev, false);
+	}
+	return ret;
+}
+
+/**
+ * @brief Number of commands in the block of a point.
+ * @param pPlan Compiled plan.
+ * @param Point Point index.
+ * @return Commands, 0 for an invalid point.
+ */
+uint32_t ad5940_PlanBlockLen(const struct ad5940_plan *pPlan, uint32_t Point)
+{
+	if (!pPlan || Point >= pPlan->PointCnt)
+		return 0;
+	return pPlan->pStart[Point + 1] - pPlan->pStart[Point];
+}
+
+/**
+ * @brief Release the memory of a plan.
+ * @param pPlan Plan to free.
+ */
+void ad5940_PlanFree(struct ad5940_plan *pPlan)
+{
+	if (!pPlan)
+		return;
+	free(pPlan->pCmd);
+	free(pPlan->pStart);
+	memset(pPlan, 0, sizeof(*pPlan));
+}
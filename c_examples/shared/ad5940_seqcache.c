@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "ad5940.h"
+#include "ad5940_seqcache.h"
+#include "ulog.h"
+
+#define FNV64_OFFSET 0xcbf29ce484222325ULL
+#define FNV64_PRIME 0x100000001b3ULL
+
+/* File header, followed by SeqLen little-endian command words */
+typedef struct
+{
+	uint32_t magic;
+	uint32_t format;
+	uint64_t key;
+	uint32_t seq_len;
+	uint32_t reserved;
+	uint64_t checksum; /* FNV-1a over the command words */
+} seqcache_hdr_t;
+
+static uint64_t fnv1a(uint64_t h, const void *pData, size_t len)
+{
+	const uint8_t *p = pData;
+
+	while (len--)
+	{
+		h ^= *p++;
+		h *= FNV64_PRIME;
+	}
+	return h;
+}
+
+static int cache_path(char *buf, size_t size, const char *dir, uint64_t key, const char *suffix)
+{
+	int n = snprintf(buf, size, "%s/%016llx.seq%s", dir ? dir : ".", (unsigned long long)key, suffix);
+	if (n < 0 || (size_t)n >= size)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+/**
+ * @brief Start a cache key. The driver version and silicon version are mixed in
+ *        so a driver change invalidates every cached sequence.
+ * @return Initial key value.
+ */
+uint64_t ad5940_SEQCacheKeyInit(void)
+{
+	uint32_t ver[3] = {AD5940_SEQCACHE_FORMAT, AD5940_DRIVER_VERSION, SILICON_VER};
+
+	return fnv1a(FNV64_OFFSET, ver, sizeof(ver));
+}
+
+/**
+ * @brief Mix the chip identity (ADIID and CHIPID, which holds the silicon
+ *        revision) read from the device into the key. The register defaults
+ *        the generator reads back differ between revisions, so a key used
+ *        with more than one part must include this.
+ * @param dev The device structure.
+ * @param pKey Key to update.
+ * @return 0 on success, negative error code otherwise (pKey is unchanged).
+ */
+int ad5940_SEQCacheKeyChip(struct ad5940_dev *dev, uint64_t *pKey)
+{
+	static const uint16_t addr[2] = {REG_AFECON_ADIID, REG_AFECON_CHIPID};
+	uint32_t id[2];
+	int ret;
+
+	if (!pKey)
+		return -EINVAL;
+	ret = ad5940_ReadRegs(dev, addr, 2, id);
+	if (ret < 0)
+		return ret;
+	*pKey = ad5940_SEQCacheKeyAdd(*pKey, id, sizeof(id));
+	return 0;
+}
+
+/**
+ * @brief Mix one configuration structure (or any other input) into the key.
+ * @param key Key returned by ad5940_SEQCacheKeyInit or a previous call.
+ * @param pData Pointer to the input.
+ * @param len Size of the input in bytes.
+ * @return Updated key.
+ */
+uint64_t ad5940_SEQCacheKeyAdd(uint64_t key, const void *pData, size_t len)
+{
+	uint64_t l = len;
+
+	/* Length first so that adjacent inputs cannot alias each other */
+	key = fnv1a(key, &l, sizeof(l));
+	return fnv1a(key, pData, len);
+}
+
+/**
+ * @brief Store a generated sequence. The file is written next to its final
+ *        name and renamed, so readers never see a partial file.
+ * @param dir Cache directory, NULL for the current directory.
+ * @param key Cache key.
+ * @param pSeqCmd Sequencer commands.
+ * @param SeqLen Number of commands.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_SEQCacheStore(const char *dir, uint64_t key,
+			 const uint32_t *pSeqCmd, uint32_t SeqLen)
+{
+	char path[512], tmp[512 + 16];
+	seqcache_hdr_t hdr;
+	FILE *fp;
+	int ret;
+
+	if (!pSeqCmd || SeqLen == 0)
+		return -EINVAL;
+
+	ret = cache_path(path, sizeof(path), dir, key, "");
+	if (ret < 0)
+		return ret;
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = AD5940_SEQCACHE_MAGIC;
+	hdr.format = AD5940_SEQCACHE_FORMAT;
+	hdr.key = key;
+	hdr.seq_len = SeqLen;
+	hdr.checksum = fnv1a(FNV64_OFFSET, pSeqCmd, SeqLen * sizeof(uint32_t));
+
+	errno = 0;
+	fp = fopen(tmp, "wb");
+	if (!fp)
+	{
+		ret = -errno; /* log_warn() may change errno */
+		log_warn("seqcache: cannot create %s: %s", tmp, strerror(-ret));
+		return ret;
+	}
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    fwrite(pSeqCmd, sizeof(uint32_t), SeqLen, fp) != SeqLen ||
+	    fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+	{
+		ret = errno ? -errno : -EIO;
+		fclose(fp);
+		remove(tmp);
+		return ret;
+	}
+	fclose(fp);
+
+	if (rename(tmp, path) != 0)
+	{
+		ret = -errno;
+		remove(tmp);
+		return ret;
+	}
+
+	log_debug("seqcache: stored %s (%u commands)", path, SeqLen);
+	return 0;
+}
+
+/**
+ * @brief Load a cached sequence.
+ * @param dir Cache directory, NULL for the current directory.
+ * @param key Cache key.
+ * @param pBuffer Destination buffer.
+ * @param BufferSize Buffer size in words.
+ * @param pSeqLen Number of commands loaded.
+ * @return 0 on hit, -ENOENT on miss, other negative error code if the file is
+ *         unusable (it is then treated as a miss by ad5940_SEQCacheGet).
+ */
+int ad5940_SEQCacheLoad(const char *dir, uint64_t key, uint32_t *pBuffer,
+			uint32_t BufferSize, uint32_t *pSeqLen)
+{
+	char path[512];
+	seqcache_hdr_t hdr;
+	FILE *fp;
+	int ret;
+
+	if (!pBuffer || !pSeqLen)
+		return -EINVAL;
+
+	ret = cache_path(path, sizeof(path), dir, key, "");
+	if (ret < 0)
+		return ret;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return -ENOENT;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    hdr.magic != AD5940_SEQCACHE_MAGIC ||
+	    hdr.format != AD5940_SEQCACHE_FORMAT || hdr.key != key)
+	{
+		ret = -EILSEQ;
+		goto out;
+	}
+	if (hdr.seq_len == 0 || hdr.seq_len > BufferSize)
+	{
+		ret = -ENOMEM;
+		goto out;
+	}
+	if (fread(pBuffer, sizeof(uint32_t), hdr.seq_len, fp) != hdr.seq_len ||
+	    fnv1a(FNV64_OFFSET, pBuffer, hdr.seq_len * sizeof(uint32_t)) != hdr.checksum)
+	{
+		ret = -EILSEQ;
+		goto out;
+	}
+
+	*pSeqLen = hdr.seq_len;
+	ret = 0;
+out:
+	fclose(fp);
+	if (ret == -EILSEQ)
+		log_warn("seqcache: %s is corrupt, ignoring", path);
+	return ret;
+}
+
+/**
+ * @brief Get a sequence from the cache, generating and storing it on a miss.
+ *        On a hit gen() is not called: no register is read and the
+ *        generator's register shadow (SEQGenRegInfo_Type) is left as it was,
+ *        so a sequence generated afterwards must start with its own
+ *        ad5940_SEQGenInit().
+ * @param dev The device structure.
+ * @param dir Cache directory, NULL for the current directory.
+ * @param key Cache key covering every input of gen().
+ * @param gen Generator callback, run with the sequencer generator enabled.
+ * @param ctx Passed through to gen().
+ * @param pBuffer Workspace for the generator, also receives the sequence.
+ * @param BufferSize Buffer size in words.
+ * @param ppSeqCmd Returns pointer to the commands (inside pBuffer).
+ * @param pSeqLen Returns number of commands.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_SEQCacheGet(struct ad5940_dev *dev, const char *dir, uint64_t key,
+		       ad5940_seqgen_fn gen, void *ctx, uint32_t *pBuffer,
+		       uint32_t BufferSize, const uint32_t **ppSeqCmd,
+		       uint32_t *pSeqLen)
+{
+	int ret;
+
+	if (!gen || !ppSeqCmd || !pSeqLen)
+		return -EINVAL;
+
+	if (ad5940_SEQCacheLoad(dir, key, pBuffer, BufferSize, pSeqLen) == 0)
+	{
+		log_debug("seqcache: hit %016llx", (unsigned long long)key);
+		*ppSeqCmd = pBuffer;
+		return 0;
+	}
+
+	ret = ad5940_SEQGenInit(dev, pBuffer, BufferSize);
+	if (ret < 0)
+		return ret;
+	ad5940_SEQGenCtrl(dev, true);
+	ret = gen(dev, ctx);
+	ad5940_SEQGenCtrl(dev, false);
+	if (ret < 0)
+		return ret;
+
+	ret = ad5940_SEQGenFetchSeq(dev, ppSeqCmd, pSeqLen);
+	if (ret < 0)
+		return ret;
+
+	/* A failed store only costs the next run a regeneration */
+	if (ad5940_SEQCacheStore(dir, key, *ppSeqCmd, *pSeqLen) < 0)
+		log_warn("seqcache: could not store %016llx", (unsigned long long)key);
+
+	return 0;
+}
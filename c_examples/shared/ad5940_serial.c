@@ -11,16 +11,22 @@
 #include <time.h>
 
 #include "ad5940.h"
+#include "ad5940_serial.h"
+#include "ad5940_serial_link.h"
+#include "ad5940_log.h"
 #include "ulog.h"
 
 #define BAUDRATE B115200
 #define READ_BUFFER_SIZE (1024 * 8)
 #define READ_BUFFER_FIFO_SIZE (1024 * 64)
 #define READ_TIMEOUT 100
+#define SEQ_WR_CHUNK 128 /* words per "wr_seq" request, keeps the request under 2kB */
+#define REG_RD_CHUNK 64	 /* registers per "rd_regs" request */
+#define JSONRPC_METHOD_NOT_FOUND -32601
 
 static int id = 0;
 
-int open_serial_port(const char *device)
+int serial_open_port(const char *device)
 {
 	int fd = open(device, O_RDWR | O_NOCTTY | O_SYNC | O_NONBLOCK);
 	if (fd < 0)
@@ -63,7 +69,7 @@ int open_serial_port(const char *device)
 	return fd;
 }
 
-int flush_serial_port(int fd)
+int serial_flush_port(int fd)
 {
 	if (tcflush(fd, TCIOFLUSH) == -1)
 	{
@@ -73,7 +79,7 @@ int flush_serial_port(int fd)
 	return 0;
 }
 
-void close_serial_port(int fd)
+void serial_close_port(int fd)
 {
 	if (fd >= 0)
 	{
@@ -99,7 +105,7 @@ int send_request(int fd, const char *json_str)
 	size_t len = strlen(json_str);
 	write(fd, json_str, len);
 	// write(fd, "\n", 1); // newline to indicate end of message
-	log_trace("Sent: %s", json_str);
+	AD5940_LOG_TRACE("Sent: %s", json_str);
 	return 0;
 }
 
@@ -161,6 +167,24 @@ int parse_json_rpc_response(const char *json_str, int expected_id, uint32_t *val
 	return -1;
 }
 
+/* True if the response is a JSON-RPC "method not found" error, i.e. an older bridge firmware */
+static int is_method_not_found(const char *json_str)
+{
+	int ret = 0;
+	cJSON *root = cJSON_Parse(json_str);
+	if (!root)
+		return 0;
+
+	cJSON *error = cJSON_GetObjectItem(root, "error");
+	if (error)
+	{
+		cJSON *code = cJSON_GetObjectItem(error, "code");
+		ret = code && cJSON_IsNumber(code) && code->valueint == JSONRPC_METHOD_NOT_FOUND;
+	}
+	cJSON_Delete(root);
+	return ret;
+}
+
 int receive_response(int fd, char *buffer, size_t max_len, int timeout_ms)
 {
 	int total = 0;
@@ -228,7 +252,7 @@ int receive_response(int fd, char *buffer, size_t max_len, int timeout_ms)
 	return total;
 }
 
-int ad5940_reset_hardware(int fd)
+int serial_reset_hardware(int fd)
 {
 	// Build request
 	char *json_request = build_json_rpc_request("reset", NULL, ++id);
@@ -241,7 +265,7 @@ int ad5940_reset_hardware(int fd)
 	char recv_buf[READ_BUFFER_SIZE];
 	if (receive_response(fd, recv_buf, sizeof(recv_buf), READ_TIMEOUT) > 0)
 	{
-		log_trace("Received: %s", recv_buf);
+		AD5940_LOG_TRACE("Received: %s", recv_buf);
 		return parse_json_rpc_response(recv_buf, id, NULL, "done");
 	}
 	else
@@ -251,7 +275,7 @@ int ad5940_reset_hardware(int fd)
 	return -1;
 }
 
-int ad5940_write_register(int fd, uint16_t address, uint32_t value)
+int serial_write_register(int fd, uint16_t address, uint32_t value)
 {
 	cJSON *params = cJSON_CreateObject();
 	cJSON_AddNumberToObject(params, "address", address);
@@ -268,7 +292,7 @@ int ad5940_write_register(int fd, uint16_t address, uint32_t value)
 	char recv_buf[READ_BUFFER_SIZE];
 	if (receive_response(fd, recv_buf, sizeof(recv_buf), READ_TIMEOUT) > 0)
 	{
-		log_trace("Received: %s", recv_buf);
+		AD5940_LOG_TRACE("Received: %s", recv_buf);
 		return parse_json_rpc_response(recv_buf, id, NULL, "done");
 	}
 	else
@@ -285,7 +309,7 @@ int ad5940_write_register(int fd, uint16_t address, uint32_t value)
  * @param value Pointer to store the read value.
  * @return 0 on success, -1 on error.
  */
-int ad5940_read_register(int fd, uint16_t address, uint32_t *value)
+int serial_read_register(int fd, uint16_t address, uint32_t *value)
 {
 	cJSON *params = cJSON_CreateObject();
 	cJSON_AddNumberToObject(params, "address", address);
@@ -301,7 +325,7 @@ int ad5940_read_register(int fd, uint16_t address, uint32_t *value)
 	char recv_buf[READ_BUFFER_SIZE];
 	if (receive_response(fd, recv_buf, sizeof(recv_buf), READ_TIMEOUT) > 0)
 	{
-		log_trace("Received: %s", recv_buf);
+		AD5940_LOG_TRACE("Received: %s", recv_buf);
 		return parse_json_rpc_response(recv_buf, id, value, NULL);
 	}
 	else
@@ -318,7 +342,7 @@ int ad5940_read_register(int fd, uint16_t address, uint32_t *value)
  * @param value mask value
  * @return 0 on success, -1 on error.
  */
-int ad5940_set_bits_register(int fd, uint16_t address, uint32_t value)
+int serial_set_bits_register(int fd, uint16_t address, uint32_t value)
 {
 	cJSON *params = cJSON_CreateObject();
 	cJSON_AddNumberToObject(params, "address", address);
@@ -335,7 +359,7 @@ int ad5940_set_bits_register(int fd, uint16_t address, uint32_t value)
 	char recv_buf[READ_BUFFER_SIZE];
 	if (receive_response(fd, recv_buf, sizeof(recv_buf), READ_TIMEOUT) > 0)
 	{
-		log_trace("Received: %s", recv_buf);
+		AD5940_LOG_TRACE("Received: %s", recv_buf);
 		return parse_json_rpc_response(recv_buf, id, NULL, "done");
 	}
 	else
@@ -352,7 +376,7 @@ int ad5940_set_bits_register(int fd, uint16_t address, uint32_t value)
  * @param value mask value
  * @return 0 on success, -1 on error.
  */
-int ad5940_clr_bits_register(int fd, uint16_t address, uint32_t value)
+int serial_clr_bits_register(int fd, uint16_t address, uint32_t value)
 {
 	cJSON *params = cJSON_CreateObject();
 	cJSON_AddNumberToObject(params, "address", address);
@@ -369,7 +393,7 @@ int ad5940_clr_bits_register(int fd, uint16_t address, uint32_t value)
 	char recv_buf[READ_BUFFER_SIZE];
 	if (receive_response(fd, recv_buf, sizeof(recv_buf), READ_TIMEOUT) > 0)
 	{
-		log_trace("Received: %s", recv_buf);
+		AD5940_LOG_TRACE("Received: %s", recv_buf);
 		return parse_json_rpc_response(recv_buf, id, NULL, "done");
 	}
 	else
@@ -387,7 +411,7 @@ int ad5940_clr_bits_register(int fd, uint16_t address, uint32_t value)
  * @param value Value to write (masked).
  * @return 0 on success, -1 on error.
  */
-int ad5940_wr_mask_register(int fd, uint16_t address, uint32_t mask, uint32_t value)
+int serial_wr_mask_register(int fd, uint16_t address, uint32_t mask, uint32_t value)
 {
 	cJSON *params = cJSON_CreateObject();
 	cJSON_AddNumberToObject(params, "address", address);
@@ -405,7 +429,7 @@ int ad5940_wr_mask_register(int fd, uint16_t address, uint32_t mask, uint32_t va
 	char recv_buf[READ_BUFFER_SIZE];
 	if (receive_response(fd, recv_buf, sizeof(recv_buf), READ_TIMEOUT) > 0)
 	{
-		log_trace("Received: %s", recv_buf);
+		AD5940_LOG_TRACE("Received: %s", recv_buf);
 		return parse_json_rpc_response(recv_buf, id, NULL, "done");
 	}
 	else
@@ -422,7 +446,7 @@ int ad5940_wr_mask_register(int fd, uint16_t address, uint32_t mask, uint32_t va
  * @param buffer Pointer to buffer to store the read values (must be at least readcount elements).
  * @return Number of values read on success, -1 on error.
  */
-int ad5940_rd_fifo(int fd, uint32_t readcount, uint32_t *buffer)
+int serial_rd_fifo(int fd, uint32_t readcount, uint32_t *buffer)
 {
 	cJSON *params = cJSON_CreateObject();
 	cJSON_AddNumberToObject(params, "readcount", readcount);
@@ -438,7 +462,7 @@ int ad5940_rd_fifo(int fd, uint32_t readcount, uint32_t *buffer)
 	char recv_buf[READ_BUFFER_FIFO_SIZE];
 	if (receive_response(fd, recv_buf, sizeof(recv_buf), READ_TIMEOUT) > 0)
 	{
-		log_trace("Received: %s", recv_buf);
+		AD5940_LOG_TRACE("Received: %s", recv_buf);
 
 		cJSON *root = cJSON_Parse(recv_buf);
 		if (!root)
@@ -492,4 +516,125 @@ int ad5940_rd_fifo(int fd, uint32_t readcount, uint32_t *buffer)
 		log_warn("No response or timeout.");
 		return -1;
 	}
-}
\ No newline at end of file
+}
+/**
+ * @brief Write a block of sequencer commands to SRAM via JSON-RPC over serial.
+ *        The bridge writes CMDFIFOWADDR/CMDFIFOWRITE for every word locally, so
+ *        the link carries one request per SEQ_WR_CHUNK words instead of two
+ *        register writes per word.
+ * @param fd Serial port file descriptor.
+ * @param start_addr SRAM address of the first command.
+ * @param words Sequencer commands.
+ * @param count Number of commands.
+ * @return 0 on success, -ENOSYS if the bridge does not know "wr_seq", -1 on error.
+ */
+int serial_wr_seq(int fd, uint32_t start_addr, const uint32_t *words, uint32_t count)
+{
+	while (count)
+	{
+		uint32_t n = count > SEQ_WR_CHUNK ? SEQ_WR_CHUNK : count;
+		cJSON *params = cJSON_CreateObject();
+		cJSON *data = cJSON_CreateArray();
+		for (uint32_t i = 0; i < n; i++)
+			cJSON_AddItemToArray(data, cJSON_CreateNumber(words[i]));
+		cJSON_AddNumberToObject(params, "address", start_addr);
+		cJSON_AddItemToObject(params, "data", data);
+
+		// Build request
+		char *json_request = build_json_rpc_request("wr_seq", params, ++id);
+
+		// Send
+		send_request(fd, json_request);
+		free(json_request);
+
+		// Receive response
+		char recv_buf[READ_BUFFER_SIZE];
+		if (receive_response(fd, recv_buf, sizeof(recv_buf), READ_TIMEOUT) <= 0)
+		{
+			log_warn("No response or timeout.");
+			return -1;
+		}
+		AD5940_LOG_TRACE("Received: %s", recv_buf);
+
+		if (is_method_not_found(recv_buf))
+			return -ENOSYS;
+		if (parse_json_rpc_response(recv_buf, id, NULL, "done") < 0)
+			return -1;
+
+		start_addr += n;
+		words += n;
+		count -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Read a list of registers via JSON-RPC over serial, REG_RD_CHUNK
+ *        registers per request. The bridge reads them back to back, the link
+ *        carries one request and one response instead of one per register.
+ * @param fd Serial port file descriptor.
+ * @param addresses Register addresses.
+ * @param count Number of registers.
+ * @param values Destination, count elements.
+ * @return 0 on success, -ENOSYS if the bridge does not know "rd_regs", -1 on error.
+ */
+int serial_rd_regs(int fd, const uint16_t *addresses, uint32_t count, uint32_t *values)
+{
+	while (count)
+	{
+		uint32_t n = count > REG_RD_CHUNK ? REG_RD_CHUNK : count;
+		cJSON *params = cJSON_CreateObject();
+		cJSON *list = cJSON_CreateArray();
+		for (uint32_t i = 0; i < n; i++)
+			cJSON_AddItemToArray(list, cJSON_CreateNumber(addresses[i]));
+		cJSON_AddItemToObject(params, "address", list);
+
+		// Build request
+		char *json_request = build_json_rpc_request("rd_regs", params, ++id);
+
+		// Send
+		send_request(fd, json_request);
+		free(json_request);
+
+		// Receive response
+		char recv_buf[READ_BUFFER_SIZE];
+		if (receive_response(fd, recv_buf, sizeof(recv_buf), READ_TIMEOUT) <= 0)
+		{
+			log_warn("No response or timeout.");
+			return -1;
+		}
+		AD5940_LOG_TRACE("Received: %s", recv_buf);
+
+		if (is_method_not_found(recv_buf))
+			return -ENOSYS;
+
+		cJSON *root = cJSON_Parse(recv_buf);
+		if (!root)
+		{
+			log_warn("Invalid JSON received");
+			return -1;
+		}
+		cJSON *id_item = cJSON_GetObjectItem(root, "id");
+		cJSON *result = cJSON_GetObjectItem(root, "result");
+		if (!id_item || !cJSON_IsNumber(id_item) || id_item->valueint != id ||
+		    !cJSON_IsArray(result) || (uint32_t)cJSON_GetArraySize(result) != n)
+		{
+			log_warn("Invalid rd_regs response");
+			cJSON_Delete(root);
+			return -1;
+		}
+		for (uint32_t i = 0; i < n; i++)
+		{
+			cJSON *item = cJSON_GetArrayItem(result, i);
+			values[i] = cJSON_IsNumber(item) ? (uint32_t)item->valuedouble : 0;
+		}
+		cJSON_Delete(root);
+
+		addresses += n;
+		values += n;
+		count -= n;
+	}
+
+	return 0;
+}
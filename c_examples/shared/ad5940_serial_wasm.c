@@ -0,0 +1,231 @@
+#include <stdint.h>
+#include <errno.h>
+
+#include <emscripten.h>
+
+#include "ad5940.h"
+#include "ad5940_serial.h"
+#include "ulog.h"
+
+/*
+ * Transport of the WebAssembly build. Every request goes to the JavaScript
+ * function Module.ad5940Transport(method, params), which returns a promise of
+ * the JSON-RPC "result" (js_example/ad5940_wasm.js hands it to the Web Serial
+ * SerialPortManager). ASYNCIFY suspends the C stack while the promise is
+ * pending, so the driver above keeps its blocking calls.
+ */
+
+#define SEQ_WR_CHUNK 128 /* words per "wr_seq" request, same as ad5940_serial.c */
+#define REG_RD_CHUNK 64	 /* registers per "rd_regs" request, same as ad5940_serial.c */
+#define TRANSPORT_FD 1   /* there is only one port, the handle is a token */
+
+/* Shape of the request parameters */
+#define RPC_NONE 0
+#define RPC_ADDR 1		/* {address}, result: one word */
+#define RPC_ADDR_DATA 2		/* {address, data} */
+#define RPC_ADDR_MASK_DATA 3	/* {address, mask, data} */
+#define RPC_FIFO 4		/* {readcount}, result: array of words */
+#define RPC_SEQ 5		/* {address, data: [words]} */
+#define RPC_REGS 6		/* {address: [addresses]}, result: array of words */
+
+#define RPC_NOT_FOUND -2
+
+/* Runtime functions the JavaScript below calls, newer Emscripten links them
+   only on request */
+#ifdef EM_JS_DEPS
+EM_JS_DEPS(ad5940_serial_wasm, "$UTF8ToString");
+#endif
+
+/* RPC_REGS passes the address array pointer as address. Returns 0 (RPC_FIFO,
+   RPC_REGS: number of words), RPC_NOT_FOUND if the bridge does not
+   know the method, -1 on any other error. */
+EM_ASYNC_JS(int, rpc_call, (const char *method, int kind, uint32_t address, uint32_t mask,
+			    uint32_t data, uint32_t *pWords, uint32_t count), {
+	const transport = Module["ad5940Transport"];
+	if (!transport)
+		return -1;
+	const name = UTF8ToString(method);
+	const params = {};
+	if (kind == 1 || kind == 2 || kind == 3 || kind == 5)
+		params.address = address >>> 0;
+	if (kind == 2 || kind == 3)
+		params.data = data >>> 0;
+	if (kind == 3)
+		params.mask = mask >>> 0;
+	if (kind == 4)
+		params.readcount = count >>> 0;
+	if (kind == 5)
+		params.data = Array.from(HEAPU32.subarray(pWords >> 2, (pWords >> 2) + count));
+	if (kind == 6)
+		params.address = Array.from(HEAPU16.subarray(address >> 1, (address >> 1) + count));
+	try {
+		const result = await transport(name, params);
+		/* the heap may have grown while suspended, index it only now */
+		if (kind == 1) {
+			HEAPU32[pWords >> 2] = result >>> 0;
+			return 0;
+		}
+		if (kind == 6 && result.length != count)
+			return -1;
+		if (kind == 4 || kind == 6) {
+			const n = Math.min(result.length, count);
+			for (let i = 0; i < n; i++)
+				HEAPU32[(pWords >> 2) + i] = result[i] >>> 0;
+			return n;
+		}
+		return result === "done" ? 0 : -1;
+	} catch (e) {
+		if (e.rpcError && e.rpcError.code === -32601)
+			return -2;
+		console.error("ad5940 " + name + ": " + e.message);
+		return -1;
+	}
+});
+
+EM_JS(int, transport_ready, (void), {
+	return typeof Module["ad5940Transport"] === "function" ? 1 : 0;
+});
+
+int open_serial_port(const char *device)
+{
+	if (!transport_ready())
+	{
+		log_error("no transport, set Module.ad5940Transport before ad5940_init");
+		return -1;
+	}
+	log_debug("wasm transport %s", device ? device : "");
+	return TRANSPORT_FD;
+}
+
+int flush_serial_port(int fd)
+{
+	(void)fd;
+	/* SerialPortManager drops late frames by id, nothing to flush */
+	return 0;
+}
+
+void close_serial_port(int fd)
+{
+	(void)fd;
+}
+
+int ad5940_reset_hardware(int fd)
+{
+	(void)fd;
+	return rpc_call("reset", RPC_NONE, 0, 0, 0, NULL, 0) < 0 ? -1 : 0;
+}
+
+int ad5940_write_register(int fd, uint16_t address, uint32_t value)
+{
+	(void)fd;
+	return rpc_call("wr", RPC_ADDR_DATA, address, 0, value, NULL, 0) < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Read a value from a register through the JavaScript transport.
+ * @param fd Token from open_serial_port.
+ * @param address Register address.
+ * @param value Pointer to store the read value.
+ * @return 0 on success, -1 on error.
+ */
+int ad5940_read_register(int fd, uint16_t address, uint32_t *value)
+{
+	(void)fd;
+	return rpc_call("rd", RPC_ADDR, address, 0, 0, value, 1) < 0 ? -1 : 0;
+}
+
+int ad5940_set_bits_register(int fd, uint16_t address, uint32_t value)
+{
+	(void)fd;
+	return rpc_call("set_bits", RPC_ADDR_DATA, address, 0, value, NULL, 0) < 0 ? -1 : 0;
+}
+
+int ad5940_clr_bits_register(int fd, uint16_t address, uint32_t value)
+{
+	(void)fd;
+	return rpc_call("clr_bits", RPC_ADDR_DATA, address, 0, value, NULL, 0) < 0 ? -1 : 0;
+}
+
+int ad5940_wr_mask_register(int fd, uint16_t address, uint32_t mask, uint32_t value)
+{
+	(void)fd;
+	return rpc_call("wr_mask", RPC_ADDR_MASK_DATA, address, mask, value, NULL, 0) < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Read data FIFO words through the JavaScript transport.
+ * @param fd Token from open_serial_port.
+ * @param readcount Number of FIFO values to read.
+ * @param buffer Destination, at least readcount elements.
+ * @return Number of values read on success, -1 on error.
+ */
+int ad5940_rd_fifo(int fd, uint32_t readcount, uint32_t *buffer)
+{
+	int n;
+
+	(void)fd;
+	n = rpc_call("rd_fifo", RPC_FIFO, 0, 0, 0, buffer, readcount);
+	return n < 0 ? -1 : n;
+}
+
+/**
+ * @brief Write a block of sequencer commands to SRAM, SEQ_WR_CHUNK words per request.
+ * @param fd Token from open_serial_port.
+ * @param start_addr SRAM address of the first command.
+ * @param words Sequencer commands.
+ * @param count Number of commands.
+ * @return 0 on success, -ENOSYS if the bridge does not know "wr_seq", -1 on error.
+ */
+int ad5940_wr_seq(int fd, uint32_t start_addr, const uint32_t *words, uint32_t count)
+{
+	int ret;
+
+	(void)fd;
+	while (count)
+	{
+		uint32_t n = count > SEQ_WR_CHUNK ? SEQ_WR_CHUNK : count;
+
+		ret = rpc_call("wr_seq", RPC_SEQ, start_addr, 0, 0, (uint32_t *)words, n);
+		if (ret == RPC_NOT_FOUND)
+			return -ENOSYS;
+		if (ret < 0)
+			return -1;
+
+		start_addr += n;
+		words += n;
+		count -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Read a list of registers, REG_RD_CHUNK registers per request.
+ * @param fd Token from open_serial_port.
+ * @param addresses Register addresses.
+ * @param count Number of registers.
+ * @param values Destination, count elements.
+ * @return 0 on success, -ENOSYS if the bridge does not know "rd_regs", -1 on error.
+ */
+int ad5940_rd_regs(int fd, const uint16_t *addresses, uint32_t count, uint32_t *values)
+{
+	int ret;
+
+	(void)fd;
+	while (count)
+	{
+		uint32_t n = count > REG_RD_CHUNK ? REG_RD_CHUNK : count;
+
+		ret = rpc_call("rd_regs", RPC_REGS, (uint32_t)(uintptr_t)addresses, 0, 0, values, n);
+		if (ret == RPC_NOT_FOUND)
+			return -ENOSYS;
+		if (ret < 0)
+			return -1;
+
+		addresses += n;
+		values += n;
+		count -= n;
+	}
+
+	return 0;
+}
@@ -0,0 +1,128 @@
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#endif
+
+#include "ad5940.h"
+#include "ad5940_settle.h"
+#include "ad5940_spectrum.h"
+#include "ulog.h"
+
+#define SETTLE_DEF_REL_ERR 1e-4f
+#define SETTLE_SEQ_WAIT_MAX 0x3fffffffu /* Clock field of SEQ_WAIT */
+
+/**
+ * @brief Settling times of the analog path and of the filters in front of the DFT.
+ * @param pCfg Signal path.
+ * @param pTime Analog and filter settling time in seconds.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_SettleTime(const SettleCfg_Type *pCfg, SettleTime_Type *pTime)
+{
+	float err, tau, sinc3, sinc2, t;
+
+	if (!pCfg || !pTime || pCfg->Rtia < 0 || pCfg->CtiaPf < 0 || pCfg->LoadTau < 0)
+		return -EINVAL;
+	sinc3 = ad5940_ADCSampleRate(pCfg->ADCRate, pCfg->ADCSinc3Osr, pCfg->ADCSinc2Osr, false);
+	sinc2 = ad5940_ADCSampleRate(pCfg->ADCRate, pCfg->ADCSinc3Osr, pCfg->ADCSinc2Osr, true);
+	if (sinc3 <= 0 || sinc2 <= 0)
+		return -EINVAL;
+
+	/* Time constants in series add up to a good estimate of the slower one */
+	err = pCfg->TargetRelErr > 0 && pCfg->TargetRelErr < 1 ? pCfg->TargetRelErr : SETTLE_DEF_REL_ERR;
+	tau = pCfg->Rtia * pCfg->CtiaPf * 1e-12f + pCfg->LoadTau;
+	t = tau * logf(1.0f / err);
+	if (pCfg->MinCycles > 0 && pCfg->Freq > 0 && t < pCfg->MinCycles / pCfg->Freq)
+		t = pCfg->MinCycles / pCfg->Freq;
+	pTime->Analog = t;
+
+	switch (pCfg->DftSrc)
+	{
+	case DFTSRC_ADCRAW:
+		t = 0;
+		break;
+	case DFTSRC_SINC3:
+		t = 3.0f / sinc3;
+		break;
+	case DFTSRC_AVG:
+		t = (3.0f + (2u << pCfg->ADCAvgNum)) / sinc3;
+		break;
+	case DFTSRC_SINC2NOTCH:
+		t = 3.0f / sinc3 + (pCfg->Sinc2NotchEn ? 3.0f : 2.0f) / sinc2;
+		break;
+	default:
+		return -EINVAL;
+	}
+	pTime->Filter = t;
+
+	return 0;
+}
+
+/**
+ * @brief Sequencer commands that wait for a number of seconds.
+ * @param Seconds Time to wait.
+ * @param SysClkFreq Sequencer clock in Hz.
+ * @param pSeqCmd Destination for the SEQ_WAIT commands.
+ * @param MaxCmd Room in pSeqCmd.
+ * @return Number of commands written, 0 if nothing to wait or no room.
+ */
+uint32_t ad5940_SettleSeqWait(float Seconds, float SysClkFreq,
+			      uint32_t *pSeqCmd, uint32_t MaxCmd)
+{
+	uint64_t clks;
+	uint32_t n = 0, step;
+
+	if (Seconds <= 0 || SysClkFreq <= 0)
+		return 0;
+
+	/* SEQ_WAIT(n) takes n + 1 clocks */
+	clks = (uint64_t)ceil((double)Seconds * SysClkFreq);
+	while (clks && n < MaxCmd)
+	{
+		step = clks > SETTLE_SEQ_WAIT_MAX + 1ull ? SETTLE_SEQ_WAIT_MAX : (uint32_t)(clks - 1);
+		pSeqCmd[n++] = SEQ_WAIT(step);
+		clks -= step + 1ull;
+	}
+	if (clks)
+		log_warn("settle: %u commands are not enough for %.3fs", MaxCmd, Seconds);
+	return n;
+}
+
+/**
+ * @brief Set a host deadline Seconds from now.
+ * @param pDeadline Deadline to set.
+ * @param Seconds Settling time.
+ */
+void ad5940_SettleStart(struct timespec *pDeadline, float Seconds)
+{
+	long ns;
+
+	clock_gettime(CLOCK_MONOTONIC, pDeadline);
+	if (Seconds <= 0)
+		return;
+	ns = pDeadline->tv_nsec + (long)((Seconds - (time_t)Seconds) * 1e9f);
+	pDeadline->tv_sec += (time_t)Seconds + ns / 1000000000L;
+	pDeadline->tv_nsec = ns % 1000000000L;
+}
+
+/**
+ * @brief Sleep until the deadline, returns at once if it has passed.
+ * @param pDeadline Deadline from ad5940_SettleStart.
+ */
+void ad5940_SettleWait(const struct timespec *pDeadline)
+{
+#ifdef __EMSCRIPTEN__
+	/* Yield to the browser instead of spinning, the transport needs its event loop */
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double ms = (pDeadline->tv_sec - now.tv_sec) * 1e3 + (pDeadline->tv_nsec - now.tv_nsec) / 1e6;
+	if (ms > 0)
+		emscripten_sleep((unsigned int)ceil(ms));
+#else
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, pDeadline, NULL) == EINTR)
+		;
+#endif
+}
@@ -0,0 +1,68 @@
+#ifndef _AD5940_SIMD_H_
+#define _AD5940_SIMD_H_
+
+#include <stdint.h>
+
+/* 4-lane float vectors for the host DSP code: SSE2 on x86, NEON on ARM.
+   AD5940_SIMD is 0 when neither is available and callers use scalar loops.
+   vm4 is a lane mask from a compare, VF4_SEL(m, a, b) takes a where m is set.
+   VF4_DIV and VF4_SQRT need AArch64 on ARM, AD5940_SIMD_DIV says if they exist. */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+typedef __m128 vf4;
+typedef __m128 vm4;
+#define VF4_LD _mm_loadu_ps
+#define VF4_ST _mm_storeu_ps
+#define VF4_SET1 _mm_set1_ps
+#define VF4_ADD _mm_add_ps
+#define VF4_SUB _mm_sub_ps
+#define VF4_MUL _mm_mul_ps
+#define VF4_DIV _mm_div_ps
+#define VF4_SQRT _mm_sqrt_ps
+#define VF4_MIN _mm_min_ps
+#define VF4_MAX _mm_max_ps
+#define VF4_GT _mm_cmpgt_ps
+#define VF4_LT _mm_cmplt_ps
+#define VF4_ABS(a) _mm_andnot_ps(_mm_set1_ps(-0.0f), a)
+#define VF4_SEL(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+/* a with the sign of s, a must not be negative */
+#define VF4_SETSIGN(a, s) _mm_or_ps(a, _mm_and_ps(_mm_set1_ps(-0.0f), s))
+/* 4 words sign extended from bit 17 (DFT and ADC results) to float */
+#define VF4_LD_S18(p) \
+   _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(_mm_loadu_si128((const __m128i *)(p)), 14), 14))
+#define AD5940_SIMD 1
+#define AD5940_SIMD_DIV 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+typedef float32x4_t vf4;
+typedef uint32x4_t vm4;
+#define VF4_LD vld1q_f32
+#define VF4_ST vst1q_f32
+#define VF4_SET1 vdupq_n_f32
+#define VF4_ADD vaddq_f32
+#define VF4_SUB vsubq_f32
+#define VF4_MUL vmulq_f32
+#define VF4_MIN vminq_f32
+#define VF4_MAX vmaxq_f32
+#define VF4_GT vcgtq_f32
+#define VF4_LT vcltq_f32
+#define VF4_ABS vabsq_f32
+#define VF4_SEL vbslq_f32
+#define VF4_SETSIGN(a, s) vbslq_f32(vdupq_n_u32(0x80000000u), s, a)
+#define VF4_LD_S18(p) \
+   vcvtq_f32_s32(vshrq_n_s32(vshlq_n_s32(vreinterpretq_s32_u32(vld1q_u32(p)), 14), 14))
+#define AD5940_SIMD 1
+#if defined(__aarch64__)
+#define VF4_DIV vdivq_f32
+#define VF4_SQRT vsqrtq_f32
+#define AD5940_SIMD_DIV 1
+#else
+#define AD5940_SIMD_DIV 0
+#endif
+#else
+#define AD5940_SIMD 0
+#define AD5940_SIMD_DIV 0
+#endif
+
+#endif // _AD5940_SIMD_H_
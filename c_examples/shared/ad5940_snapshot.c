@@ -0,0 +1,1172 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ad5940.h"
+#include "ad5940_snapshot.h"
+#include "ulog.h"
+
+#define SNAPSHOT_HEADER "# ad5940 snapshot"
+#define NAME_WIDTH 18
+#define OSC_READY_POLLS 1000 /* OSCCON reads before an oscillator counts as failed */
+#define OSC_EN_MASK (BITM_ALLON_OSCCON_HFXTALEN | BITM_ALLON_OSCCON_HFOSCEN | BITM_ALLON_OSCCON_LFOSCEN)
+/* The OK status bit of each enable bit */
+#define OSC_OK(en) ((((en) & BITM_ALLON_OSCCON_HFXTALEN) ? BITM_ALLON_OSCCON_HFXTALOK : 0) | \
+		    (((en) & BITM_ALLON_OSCCON_HFOSCEN) ? BITM_ALLON_OSCCON_HFOSCOK : 0) |   \
+		    (((en) & BITM_ALLON_OSCCON_LFOSCEN) ? BITM_ALLON_OSCCON_LFOSCOK : 0))
+
+/* ad5940_SnapshotRestore() order: a register is only written once what it
+   depends on is in place, and whatever starts the AFE comes last */
+enum
+{
+	RESTORE_OSC,   /* power mode and oscillators */
+	RESTORE_CLK,   /* clock dividers, sources and gates */
+	RESTORE_BLOCK, /* waveform generator, ADC, switches, ... */
+	RESTORE_CTRL,  /* block enables, sequencer, FIFO and wakeup timer */
+	RESTORE_PHASES
+};
+
+#define FIELD(reg, name) {#name, BITM_##reg##_##name, BITP_##reg##_##name}
+#define REG_F(block, reg, flags)                           \
+	{                                                      \
+		#reg, REG_##block##_##reg, flags,                  \
+		sizeof(f_##block##_##reg) / sizeof(RegField_Type), \
+		f_##block##_##reg                                  \
+	}
+#define REG(block, reg) REG_F(block, reg, 0)
+#define REG_STATUS(block, reg) REG_F(block, reg, SNAPSHOT_F_STATUS)
+#define REG_KEY(block, reg) REG_F(block, reg, SNAPSHOT_F_KEY)
+
+/* Bitfields, in the order of ad5940.h */
+static const RegField_Type f_AFECON_ADIID[] = {
+	FIELD(AFECON_ADIID, ADIID),
+};
+
+static const RegField_Type f_AFECON_CHIPID[] = {
+	FIELD(AFECON_CHIPID, PARTID),
+	FIELD(AFECON_CHIPID, REVISION),
+};
+
+static const RegField_Type f_AFECON_CLKCON0[] = {
+	FIELD(AFECON_CLKCON0, SFFTCLKDIVCNT),
+	FIELD(AFECON_CLKCON0, ADCCLKDIV),
+	FIELD(AFECON_CLKCON0, SYSCLKDIV),
+};
+
+static const RegField_Type f_AFECON_CLKEN1[] = {
+	FIELD(AFECON_CLKEN1, GPT1DIS),
+	FIELD(AFECON_CLKEN1, GPT0DIS),
+	FIELD(AFECON_CLKEN1, ACLKDIS),
+};
+
+static const RegField_Type f_AFECON_CLKSEL[] = {
+	FIELD(AFECON_CLKSEL, ADCCLKSEL),
+	FIELD(AFECON_CLKSEL, SYSCLKSEL),
+};
+
+static const RegField_Type f_ALLON_PWRMOD[] = {
+	FIELD(ALLON_PWRMOD, RAMRETEN),
+	FIELD(ALLON_PWRMOD, ADCRETEN),
+	FIELD(ALLON_PWRMOD, SEQSLPEN),
+	FIELD(ALLON_PWRMOD, TMRSLPEN),
+	FIELD(ALLON_PWRMOD, PWRMOD),
+};
+
+static const RegField_Type f_ALLON_OSCCON[] = {
+	FIELD(ALLON_OSCCON, HFXTALOK),
+	FIELD(ALLON_OSCCON, HFOSCOK),
+	FIELD(ALLON_OSCCON, LFOSCOK),
+	FIELD(ALLON_OSCCON, HFXTALEN),
+	FIELD(ALLON_OSCCON, HFOSCEN),
+	FIELD(ALLON_OSCCON, LFOSCEN),
+};
+
+static const RegField_Type f_ALLON_TMRCON[] = {
+	FIELD(ALLON_TMRCON, TMRINTEN),
+};
+
+static const RegField_Type f_ALLON_EI0CON[] = {
+	FIELD(ALLON_EI0CON, IRQ3EN),
+	FIELD(ALLON_EI0CON, IRQ3MDE),
+	FIELD(ALLON_EI0CON, IRQ2EN),
+	FIELD(ALLON_EI0CON, IRQ2MDE),
+	FIELD(ALLON_EI0CON, IRQ1EN),
+	FIELD(ALLON_EI0CON, IRQ1MDE),
+	FIELD(ALLON_EI0CON, IRQOEN),
+	FIELD(ALLON_EI0CON, IRQ0MDE),
+};
+
+static const RegField_Type f_ALLON_EI1CON[] = {
+	FIELD(ALLON_EI1CON, IRQ7EN),
+	FIELD(ALLON_EI1CON, IRQ7MDE),
+	FIELD(ALLON_EI1CON, IRQ6EN),
+	FIELD(ALLON_EI1CON, IRQ6MDE),
+	FIELD(ALLON_EI1CON, IRQ5EN),
+	FIELD(ALLON_EI1CON, IRQ5MDE),
+	FIELD(ALLON_EI1CON, IRQ4EN),
+	FIELD(ALLON_EI1CON, IRQ4MDE),
+};
+
+static const RegField_Type f_ALLON_EI2CON[] = {
+	FIELD(ALLON_EI2CON, BUSINTEN),
+	FIELD(ALLON_EI2CON, BUSINTMDE),
+};
+
+static const RegField_Type f_ALLON_RSTSTA[] = {
+	FIELD(ALLON_RSTSTA, PINSWRST),
+	FIELD(ALLON_RSTSTA, MMRSWRST),
+	FIELD(ALLON_RSTSTA, WDRST),
+	FIELD(ALLON_RSTSTA, EXTRST),
+	FIELD(ALLON_RSTSTA, POR),
+};
+
+static const RegField_Type f_ALLON_CLKEN0[] = {
+	FIELD(ALLON_CLKEN0, TIACHPDIS),
+	FIELD(ALLON_CLKEN0, SLPWUTDIS),
+	FIELD(ALLON_CLKEN0, WDTDIS),
+};
+
+static const RegField_Type f_AFE_AFECON[] = {
+	FIELD(AFE_AFECON, DACBUFEN),
+	FIELD(AFE_AFECON, DACREFEN),
+	FIELD(AFE_AFECON, ALDOILIMITEN),
+	FIELD(AFE_AFECON, SINC2EN),
+	FIELD(AFE_AFECON, DFTEN),
+	FIELD(AFE_AFECON, WAVEGENEN),
+	FIELD(AFE_AFECON, TEMPCONVEN),
+	FIELD(AFE_AFECON, TEMPSENSEN),
+	FIELD(AFE_AFECON, TIAEN),
+	FIELD(AFE_AFECON, INAMPEN),
+	FIELD(AFE_AFECON, EXBUFEN),
+	FIELD(AFE_AFECON, ADCCONVEN),
+	FIELD(AFE_AFECON, ADCEN),
+	FIELD(AFE_AFECON, DACEN),
+	FIELD(AFE_AFECON, HPREFDIS),
+};
+
+static const RegField_Type f_AFE_PMBW[] = {
+	FIELD(AFE_PMBW, SYSBW),
+	FIELD(AFE_PMBW, SYSHP),
+};
+
+static const RegField_Type f_AFE_SEQCON[] = {
+	FIELD(AFE_SEQCON, SEQWRTMR),
+	FIELD(AFE_SEQCON, SEQHALT),
+	FIELD(AFE_SEQCON, SEQHALTFIFOEMPTY),
+	FIELD(AFE_SEQCON, SEQEN),
+};
+
+static const RegField_Type f_AFE_FIFOCON[] = {
+	FIELD(AFE_FIFOCON, DATAFIFOSRCSEL),
+	FIELD(AFE_FIFOCON, DATAFIFOEN),
+};
+
+static const RegField_Type f_AFE_DATAFIFOTHRES[] = {
+	FIELD(AFE_DATAFIFOTHRES, HIGHTHRES),
+};
+
+static const RegField_Type f_AFE_FIFOCNTSTA[] = {
+	FIELD(AFE_FIFOCNTSTA, DATAFIFOCNTSTA),
+};
+
+static const RegField_Type f_AFE_CMDDATACON[] = {
+	FIELD(AFE_CMDDATACON, DATAMEMMDE),
+	FIELD(AFE_CMDDATACON, DATA_MEM_SEL),
+	FIELD(AFE_CMDDATACON, CMDMEMMDE),
+	FIELD(AFE_CMDDATACON, CMD_MEM_SEL),
+};
+
+static const RegField_Type f_AFE_SEQ0INFO[] = {
+	FIELD(AFE_SEQ0INFO, LEN),
+	FIELD(AFE_SEQ0INFO, ADDR),
+};
+
+static const RegField_Type f_AFE_SEQ1INFO[] = {
+	FIELD(AFE_SEQ1INFO, LEN),
+	FIELD(AFE_SEQ1INFO, ADDR),
+};
+
+static const RegField_Type f_AFE_SEQ2INFO[] = {
+	FIELD(AFE_SEQ2INFO, LEN),
+	FIELD(AFE_SEQ2INFO, ADDR),
+};
+
+static const RegField_Type f_AFE_SEQ3INFO[] = {
+	FIELD(AFE_SEQ3INFO, LEN),
+	FIELD(AFE_SEQ3INFO, ADDR),
+};
+
+static const RegField_Type f_AFE_SEQCRC[] = {
+	FIELD(AFE_SEQCRC, CRC),
+};
+
+static const RegField_Type f_AFE_SEQCNT[] = {
+	FIELD(AFE_SEQCNT, COUNT),
+};
+
+static const RegField_Type f_AFE_SEQTIMEOUT[] = {
+	FIELD(AFE_SEQTIMEOUT, TIMEOUT),
+};
+
+static const RegField_Type f_AFE_SEQSLPLOCK[] = {
+	FIELD(AFE_SEQSLPLOCK, SEQ_SLP_PW),
+};
+
+static const RegField_Type f_AFE_SEQTRGSLP[] = {
+	FIELD(AFE_SEQTRGSLP, TRGSLP),
+};
+
+static const RegField_Type f_AFE_SYNCEXTDEVICE[] = {
+	FIELD(AFE_SYNCEXTDEVICE, SYNC),
+};
+
+static const RegField_Type f_AFE_WGCON[] = {
+	FIELD(AFE_WGCON, DACGAINCAL),
+	FIELD(AFE_WGCON, DACOFFSETCAL),
+	FIELD(AFE_WGCON, TYPESEL),
+	FIELD(AFE_WGCON, TRAPRSTEN),
+};
+
+static const RegField_Type f_AFE_WGFCW[] = {
+	FIELD(AFE_WGFCW, SINEFCW),
+};
+
+static const RegField_Type f_AFE_WGPHASE[] = {
+	FIELD(AFE_WGPHASE, SINEOFFSET),
+};
+
+static const RegField_Type f_AFE_WGOFFSET[] = {
+	FIELD(AFE_WGOFFSET, SINEOFFSET),
+};
+
+static const RegField_Type f_AFE_WGAMPLITUDE[] = {
+	FIELD(AFE_WGAMPLITUDE, SINEAMPLITUDE),
+};
+
+static const RegField_Type f_AFE_WGDCLEVEL1[] = {
+	FIELD(AFE_WGDCLEVEL1, TRAPDCLEVEL1),
+};
+
+static const RegField_Type f_AFE_WGDCLEVEL2[] = {
+	FIELD(AFE_WGDCLEVEL2, TRAPDCLEVEL2),
+};
+
+static const RegField_Type f_AFE_WGDELAY1[] = {
+	FIELD(AFE_WGDELAY1, DELAY1),
+};
+
+static const RegField_Type f_AFE_WGSLOPE1[] = {
+	FIELD(AFE_WGSLOPE1, SLOPE1),
+};
+
+static const RegField_Type f_AFE_WGDELAY2[] = {
+	FIELD(AFE_WGDELAY2, DELAY2),
+};
+
+static const RegField_Type f_AFE_WGSLOPE2[] = {
+	FIELD(AFE_WGSLOPE2, SLOPE2),
+};
+
+static const RegField_Type f_AFE_HSDACCON[] = {
+	FIELD(AFE_HSDACCON, INAMPGNMDE),
+	FIELD(AFE_HSDACCON, RATE),
+	FIELD(AFE_HSDACCON, ATTENEN),
+};
+
+static const RegField_Type f_AFE_HSDACDAT[] = {
+	FIELD(AFE_HSDACDAT, DACDAT),
+};
+
+static const RegField_Type f_AFE_HSRTIACON[] = {
+	FIELD(AFE_HSRTIACON, CTIACON),
+	FIELD(AFE_HSRTIACON, TIASW6CON),
+	FIELD(AFE_HSRTIACON, RTIACON),
+};
+
+static const RegField_Type f_AFE_HSTIACON[] = {
+	FIELD(AFE_HSTIACON, VBIASSEL),
+};
+
+static const RegField_Type f_AFE_DE0RESCON[] = {
+	FIELD(AFE_DE0RESCON, DE0RCON),
+};
+
+static const RegField_Type f_AFE_BUFSENCON[] = {
+	FIELD(AFE_BUFSENCON, V1P8THERMSTEN),
+	FIELD(AFE_BUFSENCON, V1P1LPADCCHGDIS),
+	FIELD(AFE_BUFSENCON, V1P1LPADCEN),
+	FIELD(AFE_BUFSENCON, V1P1HPADCEN),
+	FIELD(AFE_BUFSENCON, V1P8HPADCCHGDIS),
+	FIELD(AFE_BUFSENCON, V1P8LPADCEN),
+	FIELD(AFE_BUFSENCON, V1P8HPADCILIMITEN),
+	FIELD(AFE_BUFSENCON, V1P8HPADCEN),
+};
+
+static const RegField_Type f_AFE_LPREFBUFCON[] = {
+	FIELD(AFE_LPREFBUFCON, BOOSTCURRENT),
+	FIELD(AFE_LPREFBUFCON, LPBUF2P5DIS),
+	FIELD(AFE_LPREFBUFCON, LPREFDIS),
+};
+
+static const RegField_Type f_AFE_LPDACCON0[] = {
+	FIELD(AFE_LPDACCON0, WAVETYPE),
+	FIELD(AFE_LPDACCON0, DACMDE),
+	FIELD(AFE_LPDACCON0, VZEROMUX),
+	FIELD(AFE_LPDACCON0, VBIASMUX),
+	FIELD(AFE_LPDACCON0, REFSEL),
+	FIELD(AFE_LPDACCON0, PWDEN),
+	FIELD(AFE_LPDACCON0, RSTEN),
+};
+
+static const RegField_Type f_AFE_LPDACSW0[] = {
+	FIELD(AFE_LPDACSW0, LPMODEDIS),
+	FIELD(AFE_LPDACSW0, LPDACSW),
+};
+
+static const RegField_Type f_AFE_LPDACDAT0[] = {
+	FIELD(AFE_LPDACDAT0, DACIN6),
+	FIELD(AFE_LPDACDAT0, DACIN12),
+};
+
+static const RegField_Type f_AFE_LPTIACON0[] = {
+	FIELD(AFE_LPTIACON0, CHOPEN),
+	FIELD(AFE_LPTIACON0, TIARF),
+	FIELD(AFE_LPTIACON0, TIARL),
+	FIELD(AFE_LPTIACON0, TIAGAIN),
+	FIELD(AFE_LPTIACON0, IBOOST),
+	FIELD(AFE_LPTIACON0, HALFPWR),
+	FIELD(AFE_LPTIACON0, PAPDEN),
+	FIELD(AFE_LPTIACON0, TIAPDEN),
+};
+
+static const RegField_Type f_AFE_LPTIASW0[] = {
+	FIELD(AFE_LPTIASW0, RECAL),
+	FIELD(AFE_LPTIASW0, VZEROSHARE),
+	FIELD(AFE_LPTIASW0, TIABIASSEL),
+	FIELD(AFE_LPTIASW0, PABIASSEL),
+	FIELD(AFE_LPTIASW0, TIASWCON),
+};
+
+static const RegField_Type f_AFE_LPMODECLKSEL[] = {
+	FIELD(AFE_LPMODECLKSEL, LFSYSCLKEN),
+};
+
+static const RegField_Type f_AFE_LPMODECON[] = {
+	FIELD(AFE_LPMODECON, ALDOEN),
+	FIELD(AFE_LPMODECON, V1P1HPADCEN),
+	FIELD(AFE_LPMODECON, V1P8HPADCEN),
+	FIELD(AFE_LPMODECON, PTATEN),
+	FIELD(AFE_LPMODECON, ZTATEN),
+	FIELD(AFE_LPMODECON, REPEATADCCNVEN_P),
+	FIELD(AFE_LPMODECON, ADCCONVEN),
+	FIELD(AFE_LPMODECON, HPREFDIS),
+	FIELD(AFE_LPMODECON, HFOSCPD),
+};
+
+static const RegField_Type f_AFE_HPOSCCON[] = {
+	FIELD(AFE_HPOSCCON, CLK32MHZEN),
+};
+
+static const RegField_Type f_AFE_SWCON[] = {
+	FIELD(AFE_SWCON, T11CON),
+	FIELD(AFE_SWCON, T10CON),
+	FIELD(AFE_SWCON, T9CON),
+	FIELD(AFE_SWCON, SWSOURCESEL),
+	FIELD(AFE_SWCON, TMUXCON),
+	FIELD(AFE_SWCON, NMUXCON),
+	FIELD(AFE_SWCON, PMUXCON),
+	FIELD(AFE_SWCON, DMUXCON),
+};
+
+static const RegField_Type f_AFE_DSWFULLCON[] = {
+	FIELD(AFE_DSWFULLCON, D8),
+	FIELD(AFE_DSWFULLCON, D7),
+	FIELD(AFE_DSWFULLCON, D6),
+	FIELD(AFE_DSWFULLCON, D5),
+	FIELD(AFE_DSWFULLCON, D4),
+	FIELD(AFE_DSWFULLCON, D3),
+	FIELD(AFE_DSWFULLCON, D2),
+	FIELD(AFE_DSWFULLCON, DR0),
+};
+
+static const RegField_Type f_AFE_NSWFULLCON[] = {
+	FIELD(AFE_NSWFULLCON, NL2),
+	FIELD(AFE_NSWFULLCON, NL),
+	FIELD(AFE_NSWFULLCON, NR1),
+	FIELD(AFE_NSWFULLCON, N9),
+	FIELD(AFE_NSWFULLCON, N8),
+	FIELD(AFE_NSWFULLCON, N7),
+	FIELD(AFE_NSWFULLCON, N6),
+	FIELD(AFE_NSWFULLCON, N5),
+	FIELD(AFE_NSWFULLCON, N4),
+	FIELD(AFE_NSWFULLCON, N3),
+	FIELD(AFE_NSWFULLCON, N2),
+	FIELD(AFE_NSWFULLCON, N1),
+};
+
+static const RegField_Type f_AFE_PSWFULLCON[] = {
+	FIELD(AFE_PSWFULLCON, PL2),
+	FIELD(AFE_PSWFULLCON, PL),
+	FIELD(AFE_PSWFULLCON, P12),
+	FIELD(AFE_PSWFULLCON, P11),
+	FIELD(AFE_PSWFULLCON, P10),
+	FIELD(AFE_PSWFULLCON, P9),
+	FIELD(AFE_PSWFULLCON, P8),
+	FIELD(AFE_PSWFULLCON, P7),
+	FIELD(AFE_PSWFULLCON, P6),
+	FIELD(AFE_PSWFULLCON, P5),
+	FIELD(AFE_PSWFULLCON, P4),
+	FIELD(AFE_PSWFULLCON, P3),
+	FIELD(AFE_PSWFULLCON, P2),
+	FIELD(AFE_PSWFULLCON, PR0),
+};
+
+static const RegField_Type f_AFE_TSWFULLCON[] = {
+	FIELD(AFE_TSWFULLCON, TR1),
+	FIELD(AFE_TSWFULLCON, T11),
+	FIELD(AFE_TSWFULLCON, T10),
+	FIELD(AFE_TSWFULLCON, T9),
+	FIELD(AFE_TSWFULLCON, T7),
+	FIELD(AFE_TSWFULLCON, T5),
+	FIELD(AFE_TSWFULLCON, T4),
+	FIELD(AFE_TSWFULLCON, T3),
+	FIELD(AFE_TSWFULLCON, T2),
+	FIELD(AFE_TSWFULLCON, T1),
+};
+
+static const RegField_Type f_AFE_DSWSTA[] = {
+	FIELD(AFE_DSWSTA, D8STA),
+	FIELD(AFE_DSWSTA, D7STA),
+	FIELD(AFE_DSWSTA, D6STA),
+	FIELD(AFE_DSWSTA, D5STA),
+	FIELD(AFE_DSWSTA, D4STA),
+	FIELD(AFE_DSWSTA, D3STA),
+	FIELD(AFE_DSWSTA, D2STA),
+	FIELD(AFE_DSWSTA, D1STA),
+};
+
+static const RegField_Type f_AFE_NSWSTA[] = {
+	FIELD(AFE_NSWSTA, NL2STA),
+	FIELD(AFE_NSWSTA, NLSTA),
+	FIELD(AFE_NSWSTA, NR1STA),
+	FIELD(AFE_NSWSTA, N9STA),
+	FIELD(AFE_NSWSTA, N8STA),
+	FIELD(AFE_NSWSTA, N7STA),
+	FIELD(AFE_NSWSTA, N6STA),
+	FIELD(AFE_NSWSTA, N5STA),
+	FIELD(AFE_NSWSTA, N4STA),
+	FIELD(AFE_NSWSTA, N3STA),
+	FIELD(AFE_NSWSTA, N2STA),
+	FIELD(AFE_NSWSTA, N1STA),
+};
+
+static const RegField_Type f_AFE_PSWSTA[] = {
+	FIELD(AFE_PSWSTA, PL2STA),
+	FIELD(AFE_PSWSTA, PLSTA),
+	FIELD(AFE_PSWSTA, P13STA),
+	FIELD(AFE_PSWSTA, P12STA),
+	FIELD(AFE_PSWSTA, P11STA),
+	FIELD(AFE_PSWSTA, P10STA),
+	FIELD(AFE_PSWSTA, P9STA),
+	FIELD(AFE_PSWSTA, P8STA),
+	FIELD(AFE_PSWSTA, P7STA),
+	FIELD(AFE_PSWSTA, P6STA),
+	FIELD(AFE_PSWSTA, P5STA),
+	FIELD(AFE_PSWSTA, P4STA),
+	FIELD(AFE_PSWSTA, P3STA),
+	FIELD(AFE_PSWSTA, P2STA),
+	FIELD(AFE_PSWSTA, PR0STA),
+};
+
+static const RegField_Type f_AFE_TSWSTA[] = {
+	FIELD(AFE_TSWSTA, TR1STA),
+	FIELD(AFE_TSWSTA, T11STA),
+	FIELD(AFE_TSWSTA, T10STA),
+	FIELD(AFE_TSWSTA, T9STA),
+	FIELD(AFE_TSWSTA, T8STA),
+	FIELD(AFE_TSWSTA, T7STA),
+	FIELD(AFE_TSWSTA, T6STA),
+	FIELD(AFE_TSWSTA, T5STA),
+	FIELD(AFE_TSWSTA, T4STA),
+	FIELD(AFE_TSWSTA, T3STA),
+	FIELD(AFE_TSWSTA, T2STA),
+	FIELD(AFE_TSWSTA, T1STA),
+};
+
+static const RegField_Type f_AFE_SWMUX[] = {
+	FIELD(AFE_SWMUX, CMMUX),
+};
+
+static const RegField_Type f_AFE_ADCCON[] = {
+	FIELD(AFE_ADCCON, GNPGA),
+	FIELD(AFE_ADCCON, GNOFSELPGA),
+	FIELD(AFE_ADCCON, GNOFFSEL),
+	FIELD(AFE_ADCCON, MUXSELN),
+	FIELD(AFE_ADCCON, MUXSELP),
+};
+
+static const RegField_Type f_AFE_ADCFILTERCON[] = {
+	FIELD(AFE_ADCFILTERCON, DFTCLKENB),
+	FIELD(AFE_ADCFILTERCON, DACWAVECLKENB),
+	FIELD(AFE_ADCFILTERCON, SINC2CLKENB),
+	FIELD(AFE_ADCFILTERCON, AVRGNUM),
+	FIELD(AFE_ADCFILTERCON, SINC3OSR),
+	FIELD(AFE_ADCFILTERCON, SINC2OSR),
+	FIELD(AFE_ADCFILTERCON, AVRGEN),
+	FIELD(AFE_ADCFILTERCON, SINC3BYP),
+	FIELD(AFE_ADCFILTERCON, LPFBYPEN),
+	FIELD(AFE_ADCFILTERCON, ADCCLK),
+};
+
+static const RegField_Type f_AFE_ADCBUFCON[] = {
+	FIELD(AFE_ADCBUFCON, AMPDIS),
+	FIELD(AFE_ADCBUFCON, CHOPDIS),
+};
+
+static const RegField_Type f_AFE_DFTCON[] = {
+	FIELD(AFE_DFTCON, DFTINSEL),
+	FIELD(AFE_DFTCON, DFTNUM),
+	FIELD(AFE_DFTCON, HANNINGEN),
+};
+
+static const RegField_Type f_AFE_STATSCON[] = {
+	FIELD(AFE_STATSCON, STDDEV),
+	FIELD(AFE_STATSCON, SAMPLENUM),
+	FIELD(AFE_STATSCON, RESRVED),
+	FIELD(AFE_STATSCON, STATSEN),
+};
+
+static const RegField_Type f_AFE_REPEATADCCNV[] = {
+	FIELD(AFE_REPEATADCCNV, NUM),
+	FIELD(AFE_REPEATADCCNV, EN),
+};
+
+static const RegField_Type f_AFE_ADCMIN[] = {
+	FIELD(AFE_ADCMIN, MINVAL),
+};
+
+static const RegField_Type f_AFE_ADCMINSM[] = {
+	FIELD(AFE_ADCMINSM, MINCLRVAL),
+};
+
+static const RegField_Type f_AFE_ADCMAX[] = {
+	FIELD(AFE_ADCMAX, MAXVAL),
+};
+
+static const RegField_Type f_AFE_ADCMAXSMEN[] = {
+	FIELD(AFE_ADCMAXSMEN, MAXSWEN),
+};
+
+static const RegField_Type f_AFE_ADCDELTA[] = {
+	FIELD(AFE_ADCDELTA, DELTAVAL),
+};
+
+static const RegField_Type f_AFE_AFEGENINTSTA[] = {
+	FIELD(AFE_AFEGENINTSTA, CUSTOMIRQ3),
+	FIELD(AFE_AFEGENINTSTA, CUSTOMIRQ2),
+	FIELD(AFE_AFEGENINTSTA, CUSTOMIRQ1),
+	FIELD(AFE_AFEGENINTSTA, CUSTOMIRQ0),
+};
+
+static const RegField_Type f_AFE_TEMPSENS[] = {
+	FIELD(AFE_TEMPSENS, CHOPFRESEL),
+	FIELD(AFE_TEMPSENS, CHOPCON),
+	FIELD(AFE_TEMPSENS, ENABLE),
+};
+
+static const RegField_Type f_INTC_INTCPOL[] = {
+	FIELD(INTC_INTCPOL, INTPOL),
+};
+
+static const RegField_Type f_INTC_INTCSEL0[] = {
+	FIELD(INTC_INTCSEL0, INTSEL31),
+	FIELD(INTC_INTCSEL0, INTSEL30),
+	FIELD(INTC_INTCSEL0, INTSEL29),
+	FIELD(INTC_INTCSEL0, INTSEL28),
+	FIELD(INTC_INTCSEL0, INTSEL27),
+	FIELD(INTC_INTCSEL0, INTSEL26),
+	FIELD(INTC_INTCSEL0, INTSEL25),
+	FIELD(INTC_INTCSEL0, INTSEL24),
+	FIELD(INTC_INTCSEL0, INTSEL23),
+	FIELD(INTC_INTCSEL0, INTSEL22),
+	FIELD(INTC_INTCSEL0, INTSEL21),
+	FIELD(INTC_INTCSEL0, INTSEL20),
+	FIELD(INTC_INTCSEL0, INTSEL19),
+	FIELD(INTC_INTCSEL0, INTSEL18),
+	FIELD(INTC_INTCSEL0, INTSEL17),
+	FIELD(INTC_INTCSEL0, INTSEL16),
+	FIELD(INTC_INTCSEL0, INTSEL15),
+	FIELD(INTC_INTCSEL0, INTSEL14),
+	FIELD(INTC_INTCSEL0, INTSEL13),
+	FIELD(INTC_INTCSEL0, INTSEL12),
+	FIELD(INTC_INTCSEL0, INTSEL11),
+	FIELD(INTC_INTCSEL0, INTSEL10),
+	FIELD(INTC_INTCSEL0, INTSEL9),
+	FIELD(INTC_INTCSEL0, INTSEL8),
+	FIELD(INTC_INTCSEL0, INTSEL7),
+	FIELD(INTC_INTCSEL0, INTSEL6),
+	FIELD(INTC_INTCSEL0, INTSEL5),
+	FIELD(INTC_INTCSEL0, INTSEL4),
+	FIELD(INTC_INTCSEL0, INTSEL3),
+	FIELD(INTC_INTCSEL0, INTSEL2),
+	FIELD(INTC_INTCSEL0, INTSEL1),
+	FIELD(INTC_INTCSEL0, INTSEL0),
+};
+
+static const RegField_Type f_INTC_INTCSEL1[] = {
+	FIELD(INTC_INTCSEL1, INTSEL31),
+	FIELD(INTC_INTCSEL1, INTSEL30),
+	FIELD(INTC_INTCSEL1, INTSEL29),
+	FIELD(INTC_INTCSEL1, INTSEL28),
+	FIELD(INTC_INTCSEL1, INTSEL27),
+	FIELD(INTC_INTCSEL1, INTSEL26),
+	FIELD(INTC_INTCSEL1, INTSEL25),
+	FIELD(INTC_INTCSEL1, INTSEL24),
+	FIELD(INTC_INTCSEL1, INTSEL23),
+	FIELD(INTC_INTCSEL1, INTSEL22),
+	FIELD(INTC_INTCSEL1, INTSEL21),
+	FIELD(INTC_INTCSEL1, INTSEL20),
+	FIELD(INTC_INTCSEL1, INTSEL19),
+	FIELD(INTC_INTCSEL1, INTSEL18),
+	FIELD(INTC_INTCSEL1, INTSEL17),
+	FIELD(INTC_INTCSEL1, INTSEL16),
+	FIELD(INTC_INTCSEL1, INTSEL15),
+	FIELD(INTC_INTCSEL1, INTSEL14),
+	FIELD(INTC_INTCSEL1, INTSEL13),
+	FIELD(INTC_INTCSEL1, INTSEL12),
+	FIELD(INTC_INTCSEL1, INTSEL11),
+	FIELD(INTC_INTCSEL1, INTSEL10),
+	FIELD(INTC_INTCSEL1, INTSEL9),
+	FIELD(INTC_INTCSEL1, INTSEL8),
+	FIELD(INTC_INTCSEL1, INTSEL7),
+	FIELD(INTC_INTCSEL1, INTSEL6),
+	FIELD(INTC_INTCSEL1, INTSEL5),
+	FIELD(INTC_INTCSEL1, INTSEL4),
+	FIELD(INTC_INTCSEL1, INTSEL3),
+	FIELD(INTC_INTCSEL1, INTSEL2),
+	FIELD(INTC_INTCSEL1, INTSEL1),
+	FIELD(INTC_INTCSEL1, INTSEL0),
+};
+
+static const RegField_Type f_INTC_INTCFLAG0[] = {
+	FIELD(INTC_INTCFLAG0, FLAG31),
+	FIELD(INTC_INTCFLAG0, FLAG30),
+	FIELD(INTC_INTCFLAG0, FLAG29),
+	FIELD(INTC_INTCFLAG0, FLAG28),
+	FIELD(INTC_INTCFLAG0, FLAG27),
+	FIELD(INTC_INTCFLAG0, FLAG26),
+	FIELD(INTC_INTCFLAG0, FLAG25),
+	FIELD(INTC_INTCFLAG0, FLAG24),
+	FIELD(INTC_INTCFLAG0, FLAG23),
+	FIELD(INTC_INTCFLAG0, FLAG22),
+	FIELD(INTC_INTCFLAG0, FLAG21),
+	FIELD(INTC_INTCFLAG0, FLAG20),
+	FIELD(INTC_INTCFLAG0, FLAG19),
+	FIELD(INTC_INTCFLAG0, FLAG18),
+	FIELD(INTC_INTCFLAG0, FLAG17),
+	FIELD(INTC_INTCFLAG0, FLAG16),
+	FIELD(INTC_INTCFLAG0, FLAG15),
+	FIELD(INTC_INTCFLAG0, FLAG14),
+	FIELD(INTC_INTCFLAG0, FLAG13),
+	FIELD(INTC_INTCFLAG0, FLAG12),
+	FIELD(INTC_INTCFLAG0, FLAG11),
+	FIELD(INTC_INTCFLAG0, FLAG10),
+	FIELD(INTC_INTCFLAG0, FLAG9),
+	FIELD(INTC_INTCFLAG0, FLAG8),
+	FIELD(INTC_INTCFLAG0, FLAG7),
+	FIELD(INTC_INTCFLAG0, FLAG6),
+	FIELD(INTC_INTCFLAG0, FLAG5),
+	FIELD(INTC_INTCFLAG0, FLAG4),
+	FIELD(INTC_INTCFLAG0, FLAG3),
+	FIELD(INTC_INTCFLAG0, FLAG2),
+	FIELD(INTC_INTCFLAG0, FLAG1),
+	FIELD(INTC_INTCFLAG0, FLAG0),
+};
+
+static const RegField_Type f_INTC_INTCFLAG1[] = {
+	FIELD(INTC_INTCFLAG1, FLAG31),
+	FIELD(INTC_INTCFLAG1, FLAG30),
+	FIELD(INTC_INTCFLAG1, FLAG29),
+	FIELD(INTC_INTCFLAG1, FLAG28),
+	FIELD(INTC_INTCFLAG1, FLAG27),
+	FIELD(INTC_INTCFLAG1, FLAG26),
+	FIELD(INTC_INTCFLAG1, FLAG25),
+	FIELD(INTC_INTCFLAG1, FLAG24),
+	FIELD(INTC_INTCFLAG1, FLAG23),
+	FIELD(INTC_INTCFLAG1, FLAG22),
+	FIELD(INTC_INTCFLAG1, FLAG21),
+	FIELD(INTC_INTCFLAG1, FLAG20),
+	FIELD(INTC_INTCFLAG1, FLAG19),
+	FIELD(INTC_INTCFLAG1, FLAG18),
+	FIELD(INTC_INTCFLAG1, FLAG17),
+	FIELD(INTC_INTCFLAG1, FLAG16),
+	FIELD(INTC_INTCFLAG1, FLAG15),
+	FIELD(INTC_INTCFLAG1, FLAG14),
+	FIELD(INTC_INTCFLAG1, FLAG13),
+	FIELD(INTC_INTCFLAG1, FLAG12),
+	FIELD(INTC_INTCFLAG1, FLAG11),
+	FIELD(INTC_INTCFLAG1, FLAG10),
+	FIELD(INTC_INTCFLAG1, FLAG9),
+	FIELD(INTC_INTCFLAG1, FLAG8),
+	FIELD(INTC_INTCFLAG1, FLAG7),
+	FIELD(INTC_INTCFLAG1, FLAG6),
+	FIELD(INTC_INTCFLAG1, FLAG5),
+	FIELD(INTC_INTCFLAG1, FLAG4),
+	FIELD(INTC_INTCFLAG1, FLAG3),
+	FIELD(INTC_INTCFLAG1, FLAG2),
+	FIELD(INTC_INTCFLAG1, FLAG1),
+	FIELD(INTC_INTCFLAG1, FLAG0),
+};
+
+static const RegField_Type f_AGPIO_GP0CON[] = {
+	FIELD(AGPIO_GP0CON, PIN7CFG),
+	FIELD(AGPIO_GP0CON, PIN6CFG),
+	FIELD(AGPIO_GP0CON, PIN5CFG),
+	FIELD(AGPIO_GP0CON, PIN4CFG),
+	FIELD(AGPIO_GP0CON, PIN3CFG),
+	FIELD(AGPIO_GP0CON, PIN2CFG),
+	FIELD(AGPIO_GP0CON, PIN1CFG),
+	FIELD(AGPIO_GP0CON, PIN0CFG),
+};
+
+static const RegField_Type f_AGPIO_GP0OEN[] = {
+	FIELD(AGPIO_GP0OEN, OEN),
+};
+
+static const RegField_Type f_AGPIO_GP0PE[] = {
+	FIELD(AGPIO_GP0PE, PE),
+};
+
+static const RegField_Type f_AGPIO_GP0IEN[] = {
+	FIELD(AGPIO_GP0IEN, IEN),
+};
+
+static const RegField_Type f_AGPIO_GP0IN[] = {
+	FIELD(AGPIO_GP0IN, IN),
+};
+
+static const RegField_Type f_AGPIO_GP0OUT[] = {
+	FIELD(AGPIO_GP0OUT, OUT),
+};
+
+static const RegField_Type f_WUPTMR_CON[] = {
+	FIELD(WUPTMR_CON, MSKTRG),
+	FIELD(WUPTMR_CON, CLKSEL),
+	FIELD(WUPTMR_CON, ENDSEQ),
+	FIELD(WUPTMR_CON, EN),
+};
+
+static const RegField_Type f_WUPTMR_SEQORDER[] = {
+	FIELD(WUPTMR_SEQORDER, SEQH),
+	FIELD(WUPTMR_SEQORDER, SEQG),
+	FIELD(WUPTMR_SEQORDER, SEQF),
+	FIELD(WUPTMR_SEQORDER, SEQE),
+	FIELD(WUPTMR_SEQORDER, SEQD),
+	FIELD(WUPTMR_SEQORDER, SEQC),
+	FIELD(WUPTMR_SEQORDER, SEQB),
+	FIELD(WUPTMR_SEQORDER, SEQA),
+};
+
+const RegInfo_Type ad5940_SnapshotRegs[SNAPSHOT_REG_COUNT] = {
+	REG_STATUS(AFECON, ADIID),
+	REG_STATUS(AFECON, CHIPID),
+	REG(AFECON, CLKCON0),
+	REG(AFECON, CLKEN1),
+	REG(AFECON, CLKSEL),
+	REG_KEY(ALLON, PWRMOD),
+	REG_KEY(ALLON, OSCCON),
+	REG(ALLON, TMRCON),
+	REG(ALLON, EI0CON),
+	REG(ALLON, EI1CON),
+	REG(ALLON, EI2CON),
+	REG_STATUS(ALLON, RSTSTA),
+	REG(ALLON, CLKEN0),
+	REG(AFE, AFECON),
+	REG(AFE, PMBW),
+	REG(AFE, SEQCON),
+	REG(AFE, FIFOCON),
+	REG(AFE, DATAFIFOTHRES),
+	REG_STATUS(AFE, FIFOCNTSTA),
+	REG(AFE, CMDDATACON),
+	REG(AFE, SEQ0INFO),
+	REG(AFE, SEQ1INFO),
+	REG(AFE, SEQ2INFO),
+	REG(AFE, SEQ3INFO),
+	REG_STATUS(AFE, SEQCRC),
+	REG_STATUS(AFE, SEQCNT),
+	REG_STATUS(AFE, SEQTIMEOUT),
+	REG_STATUS(AFE, SEQSLPLOCK),
+	REG_STATUS(AFE, SEQTRGSLP),
+	REG(AFE, SYNCEXTDEVICE),
+	REG(AFE, WGCON),
+	REG(AFE, WGFCW),
+	REG(AFE, WGPHASE),
+	REG(AFE, WGOFFSET),
+	REG(AFE, WGAMPLITUDE),
+	REG(AFE, WGDCLEVEL1),
+	REG(AFE, WGDCLEVEL2),
+	REG(AFE, WGDELAY1),
+	REG(AFE, WGSLOPE1),
+	REG(AFE, WGDELAY2),
+	REG(AFE, WGSLOPE2),
+	REG(AFE, HSDACCON),
+	REG(AFE, HSDACDAT),
+	REG(AFE, HSRTIACON),
+	REG(AFE, HSTIACON),
+	REG(AFE, DE0RESCON),
+	REG(AFE, BUFSENCON),
+	REG(AFE, LPREFBUFCON),
+	REG(AFE, LPDACCON0),
+	REG(AFE, LPDACSW0),
+	REG(AFE, LPDACDAT0),
+	REG(AFE, LPTIACON0),
+	REG(AFE, LPTIASW0),
+	REG(AFE, LPMODECLKSEL),
+	REG(AFE, LPMODECON),
+	REG(AFE, HPOSCCON),
+	REG(AFE, SWCON),
+	REG(AFE, DSWFULLCON),
+	REG(AFE, NSWFULLCON),
+	REG(AFE, PSWFULLCON),
+	REG(AFE, TSWFULLCON),
+	REG_STATUS(AFE, DSWSTA),
+	REG_STATUS(AFE, NSWSTA),
+	REG_STATUS(AFE, PSWSTA),
+	REG_STATUS(AFE, TSWSTA),
+	REG(AFE, SWMUX),
+	REG(AFE, ADCCON),
+	REG(AFE, ADCFILTERCON),
+	REG(AFE, ADCBUFCON),
+	REG(AFE, DFTCON),
+	REG(AFE, STATSCON),
+	REG(AFE, REPEATADCCNV),
+	REG(AFE, ADCMIN),
+	REG(AFE, ADCMINSM),
+	REG(AFE, ADCMAX),
+	REG(AFE, ADCMAXSMEN),
+	REG(AFE, ADCDELTA),
+	REG_STATUS(AFE, AFEGENINTSTA),
+	REG(AFE, TEMPSENS),
+	REG(INTC, INTCPOL),
+	REG(INTC, INTCSEL0),
+	REG(INTC, INTCSEL1),
+	REG_STATUS(INTC, INTCFLAG0),
+	REG_STATUS(INTC, INTCFLAG1),
+	REG(AGPIO, GP0CON),
+	REG(AGPIO, GP0OEN),
+	REG(AGPIO, GP0PE),
+	REG(AGPIO, GP0IEN),
+	REG_STATUS(AGPIO, GP0IN),
+	REG(AGPIO, GP0OUT),
+	REG(WUPTMR, CON),
+	REG(WUPTMR, SEQORDER),
+};
+
+/**
+ * @brief Position of a register in ad5940_SnapshotRegs[].
+ * @return Index, -ENOENT if the register is not part of the snapshot.
+ */
+int ad5940_SnapshotIndex(uint16_t Address)
+{
+	for (int i = 0; i < SNAPSHOT_REG_COUNT; i++)
+		if (ad5940_SnapshotRegs[i].Address == Address)
+			return i;
+	return -ENOENT;
+}
+
+/**
+ * @brief Value of one register from a snapshot.
+ * @return false if the register is not in the snapshot.
+ */
+bool ad5940_SnapshotGet(const Snapshot_Type *pSnap, uint16_t Address, uint32_t *pValue)
+{
+	int i = ad5940_SnapshotIndex(Address);
+
+	if (i < 0 || !pSnap->Valid[i])
+		return false;
+	*pValue = pSnap->Value[i];
+	return true;
+}
+
+/**
+ * @brief Read all snapshot registers in one batched transfer.
+ * @param dev Device, the AFE has to be awake.
+ * @param pSnap Snapshot.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_SnapshotRead(struct ad5940_dev *dev, Snapshot_Type *pSnap)
+{
+	uint16_t addr[SNAPSHOT_REG_COUNT];
+	int ret;
+
+	memset(pSnap, 0, sizeof(*pSnap));
+	for (int i = 0; i < SNAPSHOT_REG_COUNT; i++)
+		addr[i] = ad5940_SnapshotRegs[i].Address;
+
+	ret = ad5940_ReadRegs(dev, addr, SNAPSHOT_REG_COUNT, pSnap->Value);
+	if (ret < 0)
+	{
+		log_error("snapshot: register read failed %d", ret);
+		return ret;
+	}
+	for (int i = 0; i < SNAPSHOT_REG_COUNT; i++)
+		pSnap->Valid[i] = true;
+	return 0;
+}
+
+/**
+ * @brief Write a snapshot as text, one "NAME ADDRESS VALUE" line per register.
+ * @return 0 on success, -EIO if the stream failed.
+ */
+int ad5940_SnapshotWrite(FILE *fp, const Snapshot_Type *pSnap)
+{
+	fprintf(fp, "%s %d\n", SNAPSHOT_HEADER, SNAPSHOT_VERSION);
+	for (int i = 0; i < SNAPSHOT_REG_COUNT; i++)
+	{
+		if (!pSnap->Valid[i])
+			continue;
+		fprintf(fp, "%-*s 0x%04x 0x%08x\n", NAME_WIDTH, ad5940_SnapshotRegs[i].Name,
+			ad5940_SnapshotRegs[i].Address, pSnap->Value[i]);
+	}
+	return ferror(fp) ? -EIO : 0;
+}
+
+/**
+ * @brief Read a snapshot written by ad5940_SnapshotWrite(). Registers are
+ *        matched by address, unknown ones are skipped, missing ones stay invalid.
+ * @return Number of registers loaded, -EINVAL if the text is not a snapshot.
+ */
+int ad5940_SnapshotLoad(FILE *fp, Snapshot_Type *pSnap)
+{
+	char line[128], name[64];
+	unsigned int address, value;
+	int version = 0, count = 0, i;
+
+	memset(pSnap, 0, sizeof(*pSnap));
+	if (!fgets(line, sizeof(line), fp) ||
+	    sscanf(line, SNAPSHOT_HEADER " %d", &version) != 1 || version != SNAPSHOT_VERSION)
+	{
+		log_error("snapshot: not a version %d snapshot", SNAPSHOT_VERSION);
+		return -EINVAL;
+	}
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%63s %x %x", name, &address, &value) != 3)
+		{
+			log_warn("snapshot: skipping '%s'", strtok(line, "\n"));
+			continue;
+		}
+		i = ad5940_SnapshotIndex((uint16_t)address);
+		if (i < 0)
+		{
+			log_warn("snapshot: unknown register %s 0x%04x", name, address);
+			continue;
+		}
+		pSnap->Value[i] = value;
+		if (!pSnap->Valid[i])
+			count++;
+		pSnap->Valid[i] = true;
+	}
+	return count;
+}
+
+static void print_field(FILE *fp, const RegField_Type *f, uint32_t value)
+{
+	uint32_t v = (value & f->Mask) >> f->Pos;
+
+	if ((f->Mask >> f->Pos) == 1)
+		fprintf(fp, "   %-*s %u\n", NAME_WIDTH, f->Name, v);
+	else
+		fprintf(fp, "   %-*s 0x%x (%u)\n", NAME_WIDTH, f->Name, v, v);
+}
+
+static int write_key(struct ad5940_dev *dev, uint16_t Address)
+{
+	int ret;
+
+	switch (Address)
+	{
+	case REG_ALLON_OSCCON:
+		return ad5940_WriteReg(dev, REG_ALLON_OSCKEY, KEY_OSCCON);
+	case REG_ALLON_PWRMOD:
+		/* Same sequence as AD5940_Initialize */
+		ret = ad5940_WriteReg(dev, REG_ALLON_PWRKEY, 0x4859);
+		if (ret < 0)
+			return ret;
+		return ad5940_WriteReg(dev, REG_ALLON_PWRKEY, 0xF27B);
+	default:
+		return -EINVAL;
+	}
+}
+
+static int restore_phase(uint16_t Address)
+{
+	switch (Address)
+	{
+	case REG_ALLON_PWRMOD:
+	case REG_ALLON_OSCCON:
+	case REG_AFE_HPOSCCON:
+		return RESTORE_OSC;
+	case REG_AFECON_CLKCON0:
+	case REG_AFECON_CLKSEL:
+	case REG_AFECON_CLKEN1:
+	case REG_ALLON_CLKEN0:
+	case REG_AFE_LPMODECLKSEL:
+		return RESTORE_CLK;
+	case REG_AFE_AFECON:
+	case REG_AFE_SEQCON:
+	case REG_AFE_FIFOCON:
+	case REG_WUPTMR_CON:
+		return RESTORE_CTRL;
+	default:
+		return RESTORE_BLOCK;
+	}
+}
+
+static int restore_reg(struct ad5940_dev *dev, int i, uint32_t Value)
+{
+	const RegInfo_Type *r = &ad5940_SnapshotRegs[i];
+	int ret;
+
+	if (r->Flags & SNAPSHOT_F_KEY)
+	{
+		ret = write_key(dev, r->Address);
+		if (ret < 0)
+			return ret;
+	}
+	return ad5940_WriteReg(dev, r->Address, Value);
+}
+
+/* Wait for the OK bits of the oscillators enabled in OscCon */
+static int osc_wait_ready(struct ad5940_dev *dev, uint32_t OscCon)
+{
+	uint32_t ok = OSC_OK(OscCon), reg = 0;
+	int ret;
+
+	for (int n = 0; n < OSC_READY_POLLS; n++)
+	{
+		ret = ad5940_ReadReg(dev, REG_ALLON_OSCCON, &reg);
+		if (ret < 0)
+			return ret;
+		if ((reg & ok) == ok)
+			return 0;
+	}
+	log_error("snapshot: oscillators not ready, OSCCON 0x%08x", reg);
+	return -ETIMEDOUT;
+}
+
+/**
+ * @brief Write back the registers that differ from a reference snapshot,
+ *        e.g. the state before hibernate. Status registers are skipped.
+ *        Registers are written in phases: the oscillators first, then the
+ *        clock selection, then the configuration of the blocks and at last
+ *        the control registers that enable them (AFECON, SEQCON, FIFOCON,
+ *        the wakeup timer). An oscillator that only the current state uses
+ *        is switched off after the clocks have moved away from it.
+ * @param dev Device.
+ * @param pRef State to restore.
+ * @param pNow Current state, read with ad5940_SnapshotRead().
+ * @return Number of registers written, negative error code otherwise.
+ */
+int ad5940_SnapshotRestore(struct ad5940_dev *dev, const Snapshot_Type *pRef, const Snapshot_Type *pNow)
+{
+	int count = 0, ret, osc = ad5940_SnapshotIndex(REG_ALLON_OSCCON);
+	uint32_t osc_on = 0;
+
+	for (int phase = 0; phase < RESTORE_PHASES; phase++)
+	{
+		for (int i = 0; i < SNAPSHOT_REG_COUNT; i++)
+		{
+			const RegInfo_Type *r = &ad5940_SnapshotRegs[i];
+			uint32_t value = pRef->Value[i];
+
+			if ((r->Flags & SNAPSHOT_F_STATUS) || restore_phase(r->Address) != phase ||
+			    !pRef->Valid[i] || !pNow->Valid[i] || value == pNow->Value[i])
+				continue;
+			if (i == osc)
+			{
+				/* Keep what runs now until the clocks are switched */
+				osc_on = (value | pNow->Value[i]) & OSC_EN_MASK;
+				value = (value & ~OSC_EN_MASK) | osc_on;
+			}
+			log_debug("snapshot: restoring %s 0x%08x -> 0x%08x", r->Name, pNow->Value[i], value);
+			ret = restore_reg(dev, i, value);
+			if (ret < 0)
+				return ret;
+			if (i == osc)
+			{
+				ret = osc_wait_ready(dev, osc_on);
+				if (ret < 0)
+					return ret;
+			}
+			count++;
+		}
+
+		if (phase == RESTORE_CLK && osc_on && osc_on != (pRef->Value[osc] & OSC_EN_MASK))
+		{
+			log_debug("snapshot: restoring %s 0x%08x", ad5940_SnapshotRegs[osc].Name, pRef->Value[osc]);
+			ret = restore_reg(dev, osc, pRef->Value[osc]);
+			if (ret < 0)
+				return ret;
+		}
+	}
+	return count;
+}
+
+/**
+ * @brief Print every register of a snapshot with all its bitfields.
+ */
+void ad5940_SnapshotDecode(FILE *fp, const Snapshot_Type *pSnap)
+{
+	for (int i = 0; i < SNAPSHOT_REG_COUNT; i++)
+	{
+		const RegInfo_Type *r = &ad5940_SnapshotRegs[i];
+
+		if (!pSnap->Valid[i])
+			continue;
+		fprintf(fp, "%-*s 0x%04x 0x%08x\n", NAME_WIDTH, r->Name, r->Address, pSnap->Value[i]);
+		for (int k = 0; k < r->FieldCount; k++)
+			print_field(fp, &r->pFields[k], pSnap->Value[i]);
+	}
+}
+
+/**
+ * @brief Print the registers that differ between two snapshots and, for each,
+ *        the bitfields that changed.
+ * @return Number of registers that differ or are only in one snapshot.
+ */
+int ad5940_SnapshotDiff(FILE *fp, const Snapshot_Type *pA, const Snapshot_Type *pB)
+{
+	int count = 0;
+
+	for (int i = 0; i < SNAPSHOT_REG_COUNT; i++)
+	{
+		const RegInfo_Type *r = &ad5940_SnapshotRegs[i];
+		uint32_t a = pA->Value[i], b = pB->Value[i];
+
+		if (!pA->Valid[i] && !pB->Valid[i])
+			continue;
+		if (pA->Valid[i] != pB->Valid[i])
+		{
+			fprintf(fp, "%-*s 0x%04x only in %s\n", NAME_WIDTH, r->Name, r->Address,
+				pA->Valid[i] ? "first" : "second");
+			count++;
+			continue;
+		}
+		if (a == b)
+			continue;
+		fprintf(fp, "%-*s 0x%04x 0x%08x -> 0x%08x\n", NAME_WIDTH, r->Name, r->Address, a, b);
+		for (int k = 0; k < r->FieldCount; k++)
+		{
+			const RegField_Type *f = &r->pFields[k];
+
+			if ((a ^ b) & f->Mask)
+				fprintf(fp, "   %-*s 0x%x -> 0x%x\n", NAME_WIDTH, f->Name,
+					(a & f->Mask) >> f->Pos, (b & f->Mask) >> f->Pos);
+		}
+		count++;
+	}
+	return count;
+}
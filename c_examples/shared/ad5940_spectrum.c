@@ -0,0 +1,357 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "ad5940.h"
+#include "ad5940_spectrum.h"
+#include "ulog.h"
+
+#include "ad5940_simd.h"
+
+#define FFT_N_MAX (1u << 16)
+#define CAPTURE_LOOP_MAX 1000 /* FIFO count polls before giving up */
+#define ADC_CODE_MID 32768	  /* SINC3/SINC2 results are offset binary */
+
+static const uint32_t sinc3_osr[] = {[ADCSINC3OSR_5] = 5, [ADCSINC3OSR_4] = 4, [ADCSINC3OSR_2] = 2};
+static const uint32_t sinc2_osr[] = {22, 44, 89, 178, 267, 533, 640, 667, 800, 889, 1067, 1333};
+
+/**
+ * @brief Prepare tables for a real FFT of length N.
+ * @param pPlan Plan to fill.
+ * @param N Power of two, 4 to 65536.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_FFTInit(FFTPlan_Type *pPlan, uint32_t N)
+{
+	uint32_t M, h, j, k, bits, r, x;
+
+	if (!pPlan || N < 4 || N > FFT_N_MAX || (N & (N - 1)))
+		return -EINVAL;
+
+	memset(pPlan, 0, sizeof(*pPlan));
+	M = N / 2;
+	pPlan->N = N;
+	pPlan->M = M;
+	pPlan->pTwRe = malloc(M * sizeof(float));
+	pPlan->pTwIm = malloc(M * sizeof(float));
+	pPlan->pSplitRe = malloc(M * sizeof(float));
+	pPlan->pSplitIm = malloc(M * sizeof(float));
+	pPlan->pBitRev = malloc(M * sizeof(uint32_t));
+	pPlan->pWorkRe = malloc(M * sizeof(float));
+	pPlan->pWorkIm = malloc(M * sizeof(float));
+	pPlan->pWindow = malloc(N * sizeof(float));
+	if (!pPlan->pTwRe || !pPlan->pTwIm || !pPlan->pSplitRe || !pPlan->pSplitIm ||
+	    !pPlan->pBitRev || !pPlan->pWorkRe || !pPlan->pWorkIm || !pPlan->pWindow)
+	{
+		ad5940_FFTFree(pPlan);
+		return -ENOMEM;
+	}
+
+	/* Stage with half size h uses exp(-i*pi*j/h), j < h, stored at offset h - 1
+	   so that each stage reads its twiddles contiguously */
+	for (h = 1; h < M; h <<= 1)
+		for (j = 0; j < h; j++)
+		{
+			pPlan->pTwRe[h - 1 + j] = (float)cos(M_PI * j / h);
+			pPlan->pTwIm[h - 1 + j] = (float)-sin(M_PI * j / h);
+		}
+
+	for (k = 0; k < M; k++)
+	{
+		pPlan->pSplitRe[k] = (float)cos(2.0 * M_PI * k / N);
+		pPlan->pSplitIm[k] = (float)-sin(2.0 * M_PI * k / N);
+	}
+
+	for (bits = 0; (1u << bits) < M; bits++)
+		;
+	for (k = 0; k < M; k++)
+	{
+		for (r = 0, x = k, j = 0; j < bits; j++, x >>= 1)
+			r = (r << 1) | (x & 1);
+		pPlan->pBitRev[k] = r;
+	}
+
+	/* Periodic Hann, the form used for spectral analysis (DFT-even) */
+	for (k = 0; k < N; k++)
+		pPlan->pWindow[k] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * k / N));
+
+	return 0;
+}
+
+void ad5940_FFTFree(FFTPlan_Type *pPlan)
+{
+	if (!pPlan)
+		return;
+	free(pPlan->pTwRe);
+	free(pPlan->pTwIm);
+	free(pPlan->pSplitRe);
+	free(pPlan->pSplitIm);
+	free(pPlan->pBitRev);
+	free(pPlan->pWorkRe);
+	free(pPlan->pWorkIm);
+	free(pPlan->pWindow);
+	memset(pPlan, 0, sizeof(*pPlan));
+}
+
+/**
+ * @brief Apply the Hann window, the host counterpart of DFTCfg_Type.HanWinEn.
+ * @param pPlan FFT plan.
+ * @param pIn N input samples.
+ * @param pOut N output samples, may equal pIn.
+ */
+void ad5940_FFTWindow(const FFTPlan_Type *pPlan, const float *pIn, float *pOut)
+{
+	uint32_t k;
+
+	for (k = 0; k < pPlan->N; k++)
+		pOut[k] = pIn[k] * pPlan->pWindow[k];
+}
+
+/* In place radix-2 decimation in time on split arrays, input in bit reversed order */
+static void fft_radix2(const FFTPlan_Type *pPlan, float *re, float *im)
+{
+	uint32_t M = pPlan->M;
+	uint32_t h, j, k;
+
+	for (h = 1; h < M; h <<= 1)
+	{
+		const float *wr = pPlan->pTwRe + h - 1;
+		const float *wi = pPlan->pTwIm + h - 1;
+
+		for (k = 0; k < M; k += 2 * h)
+		{
+			float *ar = re + k, *ai = im + k;
+			float *br = re + k + h, *bi = im + k + h;
+
+			j = 0;
+#if AD5940_SIMD
+			for (; j + 4 <= h; j += 4)
+			{
+				vf4 xr = VF4_LD(br + j), xi = VF4_LD(bi + j);
+				vf4 c = VF4_LD(wr + j), s = VF4_LD(wi + j);
+				vf4 tr = VF4_SUB(VF4_MUL(xr, c), VF4_MUL(xi, s));
+				vf4 ti = VF4_ADD(VF4_MUL(xr, s), VF4_MUL(xi, c));
+				vf4 ur = VF4_LD(ar + j), ui = VF4_LD(ai + j);
+
+				VF4_ST(ar + j, VF4_ADD(ur, tr));
+				VF4_ST(ai + j, VF4_ADD(ui, ti));
+				VF4_ST(br + j, VF4_SUB(ur, tr));
+				VF4_ST(bi + j, VF4_SUB(ui, ti));
+			}
+#endif
+			for (; j < h; j++)
+			{
+				float tr = br[j] * wr[j] - bi[j] * wi[j];
+				float ti = br[j] * wi[j] + bi[j] * wr[j];
+
+				br[j] = ar[j] - tr;
+				bi[j] = ai[j] - ti;
+				ar[j] += tr;
+				ai[j] += ti;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Real FFT. The N real samples are packed as N/2 complex values, put
+ *        through an N/2 point complex FFT and split into the N/2 + 1 bins of
+ *        the real spectrum.
+ * @param pPlan FFT plan.
+ * @param pIn N real samples.
+ * @param pRe Real parts of bins 0..N/2 (N/2 + 1 values).
+ * @param pIm Imaginary parts of bins 0..N/2 (N/2 + 1 values).
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_FFTReal(FFTPlan_Type *pPlan, const float *pIn, float *pRe, float *pIm)
+{
+	uint32_t M, k;
+	float *zr, *zi;
+
+	if (!pPlan || !pPlan->N || !pIn || !pRe || !pIm)
+		return -EINVAL;
+	M = pPlan->M;
+	zr = pPlan->pWorkRe;
+	zi = pPlan->pWorkIm;
+
+	for (k = 0; k < M; k++)
+	{
+		uint32_t r = pPlan->pBitRev[k];
+		zr[r] = pIn[2 * k];
+		zi[r] = pIn[2 * k + 1];
+	}
+	fft_radix2(pPlan, zr, zi);
+
+	/* X[k] = Fe[k] + W^k * Fo[k], Fe = (Z[k] + Z*[M-k]) / 2, Fo = (Z[k] - Z*[M-k]) / 2i */
+	pRe[0] = zr[0] + zi[0];
+	pIm[0] = 0;
+	pRe[M] = zr[0] - zi[0];
+	pIm[M] = 0;
+	for (k = 1; k < M; k++)
+	{
+		float a = zr[k], b = zi[k], c = zr[M - k], d = zi[M - k];
+		float fer = 0.5f * (a + c), fei = 0.5f * (b - d);
+		float for_ = 0.5f * (b + d), foi = -0.5f * (a - c);
+		float wr = pPlan->pSplitRe[k], wi = pPlan->pSplitIm[k];
+
+		pRe[k] = fer + wr * for_ - wi * foi;
+		pIm[k] = fei + wr * foi + wi * for_;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Amplitude spectrum of a Hann windowed input: a sine of amplitude A
+ *        centred on bin k gives A at pMag[k] (window coherent gain removed).
+ * @param pPlan FFT plan.
+ * @param pRe Real parts from ad5940_FFTReal.
+ * @param pIm Imaginary parts from ad5940_FFTReal.
+ * @param pMag N/2 + 1 magnitudes.
+ */
+void ad5940_FFTMagnitude(const FFTPlan_Type *pPlan, const float *pRe,
+			 const float *pIm, float *pMag)
+{
+	/* Sum of the periodic Hann window is N/2; one sided spectrum doubles bins 1..M-1 */
+	float scale = 2.0f / (pPlan->N / 2);
+	uint32_t k;
+
+	for (k = 0; k <= pPlan->M; k++)
+		pMag[k] = sqrtf(pRe[k] * pRe[k] + pIm[k] * pIm[k]) * scale;
+	pMag[0] *= 0.5f;
+	pMag[pPlan->M] *= 0.5f;
+}
+
+/**
+ * @brief Output rate of the SINC3 or SINC2 filter.
+ * @param ADCRate ADCRATE_800KHZ or ADCRATE_1P6MHZ.
+ * @param Sinc3Osr ADCSINC3OSR_2/4/5.
+ * @param Sinc2Osr ADCSINC2OSR_xxx, used if Sinc2 is set.
+ * @param Sinc2 Rate after SINC2 instead of SINC3.
+ * @return Samples per second.
+ */
+float ad5940_ADCSampleRate(uint32_t ADCRate, uint32_t Sinc3Osr,
+			   uint32_t Sinc2Osr, bool Sinc2)
+{
+	float rate = ADCRate == ADCRATE_1P6MHZ ? 1.6e6f : 800e3f;
+
+	if (Sinc3Osr > ADCSINC3OSR_2 || Sinc2Osr > ADCSINC2OSR_1333)
+		return 0;
+	rate /= sinc3_osr[Sinc3Osr];
+	if (Sinc2)
+		rate /= sinc2_osr[Sinc2Osr];
+	return rate;
+}
+
+/**
+ * @brief Capture N consecutive ADC filter samples through the data FIFO. The
+ *        signal path (mux, PGA, filters, waveform generator) must already be
+ *        set up; this only runs the ADC and restores the FIFO configuration.
+ * @param dev The device structure.
+ * @param FifoSrc FIFOSRC_SINC3 or FIFOSRC_SINC2NOTCH.
+ * @param N Number of samples, at most the current data FIFO depth.
+ * @param pSamples N samples as signed ADC codes.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_CaptureWaveform(struct ad5940_dev *dev, uint32_t FifoSrc,
+			   uint32_t N, float *pSamples)
+{
+	return ad5940_CaptureWaveformSync(dev, FifoSrc, N, 0, pSamples);
+}
+
+/**
+ * @brief Like ad5940_CaptureWaveform, but the AFECTRL_xxx blocks in SyncCtrl
+ *        are started and stopped in the same AFECON write as the conversion.
+ *        With AFECTRL_WG the waveform generator and the first sample share a
+ *        time origin, so captures taken one after the other can be compared
+ *        in phase.
+ * @param dev The device structure.
+ * @param FifoSrc FIFOSRC_SINC3 or FIFOSRC_SINC2NOTCH.
+ * @param N Number of samples, at most the current data FIFO depth.
+ * @param SyncCtrl AFECTRL_xxx blocks to run with the ADC, e.g. AFECTRL_WG.
+ * @param pSamples N samples as signed ADC codes.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_CaptureWaveformSync(struct ad5940_dev *dev, uint32_t FifoSrc,
+			       uint32_t N, uint32_t SyncCtrl, float *pSamples)
+{
+	FIFOCfg_Type old_cfg, fifo_cfg;
+	uint32_t *pRaw, cnt = 0, loop, k;
+	uint32_t ctrl = AFECTRL_ADCPWR;
+	int ret, ret2;
+
+	if (!pSamples || (FifoSrc != FIFOSRC_SINC3 && FifoSrc != FIFOSRC_SINC2NOTCH))
+		return -EINVAL;
+	if (FifoSrc == FIFOSRC_SINC2NOTCH)
+		ctrl |= AFECTRL_SINC2NOTCH;
+
+	ret = ad5940_FIFOGetCfg(dev, &old_cfg);
+	if (ret < 0)
+		return ret;
+	if (N == 0 || N > FIFOSIZE_WORDS(old_cfg.FIFOSize))
+		return -EINVAL;
+
+	pRaw = malloc(N * sizeof(uint32_t));
+	if (!pRaw)
+		return -ENOMEM;
+
+	/* Standard FIFO mode stops accepting data when full, so the first N
+	   samples stay contiguous even if the host is slow to stop the ADC */
+	fifo_cfg = old_cfg;
+	fifo_cfg.FIFOEn = false;
+	fifo_cfg.FIFOMode = FIFOMODE_FIFO;
+	fifo_cfg.FIFOSrc = FifoSrc;
+	fifo_cfg.FIFOThresh = N;
+	ret = ad5940_FIFOCfg(dev, &fifo_cfg);
+	if (ret < 0)
+		goto out;
+	fifo_cfg.FIFOEn = true;
+	ret = ad5940_FIFOCfg(dev, &fifo_cfg);
+	if (ret < 0)
+		goto out;
+
+	ret = ad5940_AFECtrlS(dev, ctrl, true);
+	if (ret < 0)
+		goto out;
+	if (SyncCtrl)
+	{
+		ret = ad5940_AFECtrlS(dev, SyncCtrl, false);
+		if (ret < 0)
+			goto out;
+	}
+	ret = ad5940_AFECtrlS(dev, AFECTRL_ADCCNV | SyncCtrl, true);
+	if (ret < 0)
+		goto out;
+	for (loop = 0; loop < CAPTURE_LOOP_MAX; loop++)
+	{
+		ret = ad5940_FIFOGetCnt(dev, &cnt);
+		if (ret < 0 || cnt >= N)
+			break;
+	}
+	ret2 = ad5940_AFECtrlS(dev, AFECTRL_ADCCNV | SyncCtrl, false);
+	if (ret < 0 || (ret = ret2) < 0)
+		goto out;
+	if (cnt < N)
+	{
+		log_warn("capture: only %u of %u samples", cnt, N);
+		ret = -ETIMEDOUT;
+		goto out;
+	}
+
+	ret = ad5940_FIFORd(dev, pRaw, N);
+	if (ret < 0)
+		goto out;
+	for (k = 0; k < N; k++)
+		pSamples[k] = (float)((int32_t)(pRaw[k] & 0xffff) - ADC_CODE_MID);
+
+out:
+	/* Flush what is left and put the FIFO back as it was */
+	fifo_cfg = old_cfg;
+	fifo_cfg.FIFOEn = false;
+	ret2 = ad5940_FIFOCfg(dev, &fifo_cfg);
+	if (ret2 == 0)
+		ret2 = ad5940_FIFOCfg(dev, &old_cfg);
+	free(pRaw);
+	return ret < 0 ? ret : ret2;
+}
@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ad5940.h"
+#include "ad5940_stat.h"
+#include "ad5940_spectrum.h"
+#include "ulog.h"
+
+#define STAT_LOOP_MAX 1000 /* Flag polls per window before giving up */
+#define STAT_CODE_MID 32768 /* STATSMEAN is offset binary like the filter results */
+#define STAT_RDY (AFEINTSRC_MEANRDY | AFEINTSRC_VARRDY)
+#define STAT_WINDOW_MIN 32  /* Smaller windows cost more requests than they save */
+#define STAT_WINDOW_RPC 6   /* Flag poll, ADC stop, mean, variance, flag clear and ADC start per window */
+#define STAT_RAW_RPC 8      /* FIFO setup, start, poll, stop and restore of a raw capture */
+#define STAT_RAW_CHUNK 512  /* Words per FIFO read request (FIFORD_CHUNK in ad5940.c) */
+
+static const uint32_t stat_window[] = {
+	[STATSAMPLE_128] = 128,
+	[STATSAMPLE_64] = 64,
+	[STATSAMPLE_32] = 32,
+	[STATSAMPLE_16] = 16,
+	[STATSAMPLE_8] = 8,
+};
+
+/**
+ * @brief Single pass mean and variance (Welford).
+ * @param pData Count samples.
+ * @param Count Number of samples.
+ * @param pResult Result, OnChip false.
+ */
+void ad5940_StatWelford(const float *pData, uint32_t Count, StatResult_Type *pResult)
+{
+	double mean = 0, m2 = 0, d;
+	uint32_t k;
+
+	for (k = 0; k < Count; k++)
+	{
+		d = pData[k] - mean;
+		mean += d / (k + 1);
+		m2 += d * (pData[k] - mean);
+	}
+	pResult->Mean = (float)mean;
+	pResult->Variance = Count ? (float)(m2 / Count) : 0;
+	pResult->Samples = Count;
+	pResult->OnChip = false;
+}
+
+static int stat_raw(struct ad5940_dev *dev, uint32_t Samples, StatResult_Type *pResult)
+{
+	float *pBuf = malloc(Samples * sizeof(float));
+	int ret;
+
+	if (!pBuf)
+		return -ENOMEM;
+	ret = ad5940_CaptureWaveform(dev, FIFOSRC_SINC2NOTCH, Samples, pBuf);
+	if (ret == 0)
+		ad5940_StatWelford(pBuf, Samples, pResult);
+	free(pBuf);
+	return ret;
+}
+
+/* A raw capture is cheaper than Windows windows of Win samples, and fits the FIFO */
+static bool stat_prefer_raw(struct ad5940_dev *dev, uint32_t Samples, uint32_t Win, uint32_t Windows)
+{
+	uint32_t raw_rpc = STAT_RAW_RPC + (Samples + STAT_RAW_CHUNK - 1) / STAT_RAW_CHUNK;
+	FIFOCfg_Type fifo_cfg;
+
+	if (Win >= STAT_WINDOW_MIN && Windows * STAT_WINDOW_RPC <= raw_rpc)
+		return false;
+	return ad5940_FIFOGetCfg(dev, &fifo_cfg) == 0 && Samples <= FIFOSIZE_WORDS(fifo_cfg.FIFOSize);
+}
+
+/**
+ * @brief Mean and variance of the current ADC input after SINC2+notch. The
+ *        mux, PGA and filters must already be set up. Conversions stop while
+ *        a finished window is read and start again for the next one, so
+ *        every window is counted and the result covers exactly Samples
+ *        samples, taken in bursts of one window.
+ * @param dev The device structure.
+ * @param Samples Number of samples.
+ * @param StatDev STATDEV_xxx outlier threshold of the statistics block.
+ * @param pResult Result.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_StatMeasure(struct ad5940_dev *dev, uint32_t Samples, uint32_t StatDev,
+		       StatResult_Type *pResult)
+{
+	StatCfg_Type stat_cfg;
+	uint32_t sel, win, windows, done = 0, loop, flag = 0, mean_code, var_code;
+	double mean = 0, m2 = 0, d;
+	int ret, ret2;
+
+	if (!pResult || Samples == 0)
+		return -EINVAL;
+
+	/* Largest window that divides the request */
+	for (sel = STATSAMPLE_128; sel <= STATSAMPLE_8; sel++)
+		if (Samples % stat_window[sel] == 0)
+			break;
+	if (sel > STATSAMPLE_8)
+	{
+		log_debug("stat: %u samples fit no window, raw capture", Samples);
+		return stat_raw(dev, Samples, pResult);
+	}
+	win = stat_window[sel];
+	windows = Samples / win;
+	if (stat_prefer_raw(dev, Samples, win, windows))
+	{
+		log_debug("stat: %u windows of %u cost more than a raw capture", windows, win);
+		return stat_raw(dev, Samples, pResult);
+	}
+
+	stat_cfg.StatEnable = true;
+	stat_cfg.StatSample = sel;
+	stat_cfg.StatDev = StatDev;
+	ret = ad5940_StatisticCfgS(dev, &stat_cfg);
+	if (ret < 0)
+		return ret;
+	ret = ad5940_INTCClrFlag(dev, STAT_RDY);
+	if (ret < 0)
+		goto out;
+	ret = ad5940_AFECtrlS(dev, AFECTRL_ADCPWR | AFECTRL_SINC2NOTCH, true);
+	if (ret < 0)
+		goto out;
+	ret = ad5940_AFECtrlS(dev, AFECTRL_ADCCNV, true);
+	if (ret < 0)
+		goto out;
+
+	while (done < windows)
+	{
+		for (loop = 0; loop < STAT_LOOP_MAX; loop++)
+		{
+			ret = ad5940_INTCGetFlag(dev, AFEINTC_1, &flag);
+			if (ret < 0 || (flag & STAT_RDY) == STAT_RDY)
+				break;
+		}
+		if (ret < 0)
+			break;
+		if (loop == STAT_LOOP_MAX)
+		{
+			ret = -ETIMEDOUT;
+			break;
+		}
+		/* No window may finish unread while the host talks to the chip */
+		ret = ad5940_AFECtrlS(dev, AFECTRL_ADCCNV, false);
+		if (ret < 0)
+			break;
+		ret = ad5940_ReadAfeResult(dev, AFERESULT_STATSMEAN, &mean_code);
+		if (ret < 0)
+			break;
+		ret = ad5940_ReadAfeResult(dev, AFERESULT_STATSVAR, &var_code);
+		if (ret < 0)
+			break;
+		ret = ad5940_INTCClrFlag(dev, STAT_RDY);
+		if (ret < 0)
+			break;
+		if (done + 1 < windows)
+		{
+			ret = ad5940_AFECtrlS(dev, AFECTRL_ADCCNV, true);
+			if (ret < 0)
+				break;
+		}
+
+		/* Pool equal sized windows: M2 += n*var + n*k/(k+1) * (m - mean)^2 */
+		d = (double)(int32_t)((mean_code & BITM_AFE_STATSMEAN_MEAN) - STAT_CODE_MID) - mean;
+		mean += d / (done + 1);
+		m2 += (double)win * (var_code & BITM_AFE_STATSVAR_VARIANCE) +
+		      (double)win * done / (done + 1) * d * d;
+		done++;
+	}
+
+	ret2 = ad5940_AFECtrlS(dev, AFECTRL_ADCCNV, false);
+	if (ret == 0)
+		ret = ret2;
+	if (ret == 0)
+	{
+		pResult->Mean = (float)mean;
+		pResult->Variance = (float)(m2 / Samples);
+		pResult->Samples = Samples;
+		pResult->OnChip = true;
+	}
+
+out:
+	stat_cfg.StatEnable = false;
+	ret2 = ad5940_StatisticCfgS(dev, &stat_cfg);
+	return ret < 0 ? ret : ret2;
+}
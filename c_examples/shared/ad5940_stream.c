@@ -0,0 +1,500 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "ad5940.h"
+#include "ad5940_stream.h"
+#include "ulog.h"
+
+/* Defaults for the serial bridge at 115200 baud: a register read request and
+   its reply are ~90 characters, a FIFO word is ~10 characters of JSON. */
+#define STREAM_DEF_LATENCY 0.008f
+#define STREAM_DEF_WORD_TIME (10.0f / 11520.0f)
+#define STREAM_DEF_RING_WORDS (1u << 20)
+#define STREAM_MARGIN 1.5f	   /* Threshold head room over the break-even batch */
+#define STREAM_MAX_SLEEP_S 0.05f /* Upper bound for one wait in ad5940_StreamPump */
+#define STREAM_IDLE_NS 1000000L	   /* Consumer back-off when the ring is empty */
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleep_s(float sec)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)sec;
+	ts.tv_nsec = (long)((sec - ts.tv_sec) * 1e9f);
+	nanosleep(&ts, NULL);
+}
+
+/* Producer side. Never blocks: what does not fit is dropped and counted. */
+static uint32_t ring_push(struct ad5940_stream *s, const uint32_t *pData, uint32_t Count)
+{
+	size_t head = atomic_load_explicit(&s->Head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&s->Tail, memory_order_acquire);
+	size_t space = s->RingMask + 1 - (head - tail);
+	uint32_t i, n = Count > space ? (uint32_t)space : Count;
+
+	for (i = 0; i < n; i++)
+		s->pRing[(head + i) & s->RingMask] = pData[i];
+	atomic_store_explicit(&s->Head, head + n, memory_order_release);
+
+	return n;
+}
+
+/* Weighted least squares of Time over Index, a narrow bracket counts more */
+static void ts_fit(struct ad5940_stream *s)
+{
+	uint32_t i, n = s->Points < STREAM_TS_POINTS ? s->Points : STREAM_TS_POINTS;
+	const struct ad5940_stream_point *p;
+	double w, sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, mx, my, d, bound = 0;
+	double period = s->FitPeriod;
+
+	for (i = 0; i < n; i++)
+	{
+		p = &s->Point[i];
+		w = 1.0 / (p->Half * p->Half + 1e-12);
+		sw += w;
+		sx += w * p->Index;
+		sy += w * p->Time;
+	}
+	mx = sx / sw;
+	my = sy / sw;
+	for (i = 0; i < n; i++)
+	{
+		p = &s->Point[i];
+		w = 1.0 / (p->Half * p->Half + 1e-12);
+		sxx += w * (p->Index - mx) * (p->Index - mx);
+		sxy += w * (p->Index - mx) * (p->Time - my);
+	}
+	/* Too few reads, or all at the same word: keep the period so far */
+	if (n >= STREAM_TS_MIN_POINTS && sxx > 0 && sxy > 0)
+		period = sxy / sxx;
+
+	s->FitPeriod = period;
+	s->FitTime = my - period * mx;
+	for (i = 0; i < n; i++)
+	{
+		p = &s->Point[i];
+		d = fabs(p->Time - (s->FitTime + period * p->Index)) + p->Half;
+		if (d > bound)
+			bound = d;
+	}
+	s->Stat.Period = period;
+	s->Stat.ErrBound = (float)bound;
+}
+
+/* FIFO count read between host times t0 and t1 */
+static void ts_add(struct ad5940_stream *s, double t0, double t1, uint32_t Cnt)
+{
+	struct ad5940_stream_point *p;
+	double lo, hi;
+
+	if (Cnt == 0)
+		return;
+	if (s->Points == 0)
+		s->TimeBase = t0;
+
+	/* The newest word arrived before the reply, and the next one after the request */
+	lo = t0 - s->FitPeriod - s->TimeBase;
+	hi = t1 - s->TimeBase;
+	p = &s->Point[s->Points % STREAM_TS_POINTS];
+	p->Index = (double)(s->Index + Cnt - 1);
+	p->Time = (lo + hi) / 2;
+	p->Half = (hi - lo) / 2;
+	s->Points++;
+	ts_fit(s);
+}
+
+/* The overflowed FIFO holds the newest words, the fit tells how many came
+   before them. In stream mode the FIFO keeps dropping its oldest words until
+   it is read, so t0 and t1 bracket the FIFO read. The count is only known to
+   the width of that bracket: the fit starts over from the reads that follow,
+   which all share the same index offset, so their times stay right. */
+static void ts_lost(struct ad5940_stream *s, double t0, double t1, uint32_t Cnt)
+{
+	double newest;
+	uint64_t lost;
+
+	if (s->Points < STREAM_TS_MIN_POINTS)
+		return;
+	/* Last word that has arrived by the middle of the read */
+	newest = floor(((t0 + t1) / 2 - s->TimeBase - s->FitTime) / s->FitPeriod);
+	if (newest > (double)(s->Index + Cnt - 1))
+	{
+		lost = (uint64_t)newest - (s->Index + Cnt - 1);
+		s->Index += lost;
+		s->Stat.WordsLost += lost;
+	}
+	s->Points = 0;
+}
+
+/* Producer side of ConsumeTime: the words and the record of their batch */
+static uint32_t batch_push(struct ad5940_stream *s, const uint32_t *pData, uint32_t Count,
+			   uint64_t Index)
+{
+	size_t bhead = atomic_load_explicit(&s->BatchHead, memory_order_relaxed);
+	size_t btail = atomic_load_explicit(&s->BatchTail, memory_order_acquire);
+	struct ad5940_stream_batch *b;
+	size_t pos;
+	uint32_t n;
+
+	if (bhead - btail >= STREAM_BATCH_RECORDS)
+		return 0;
+
+	pos = atomic_load_explicit(&s->Head, memory_order_relaxed);
+	n = ring_push(s, pData, Count);
+	if (n == 0)
+		return 0;
+
+	b = &s->pBatch[bhead % STREAM_BATCH_RECORDS];
+	b->RingPos = pos;
+	b->Count = n;
+	b->Time.Index = Index;
+	b->Time.Period = s->FitPeriod;
+	b->Time.Time = s->TimeBase + s->FitTime + s->FitPeriod * (double)Index;
+	b->Time.ErrBound = s->Stat.ErrBound;
+	atomic_store_explicit(&s->BatchHead, bhead + 1, memory_order_release);
+	return n;
+}
+
+static void *stream_consumer_time(void *arg)
+{
+	struct ad5940_stream *s = arg;
+	struct timespec idle = {0, STREAM_IDLE_NS};
+	const struct ad5940_stream_batch *b;
+	StreamTime_Type tm;
+	size_t btail, idx;
+	uint32_t off, n;
+
+	btail = atomic_load_explicit(&s->BatchTail, memory_order_relaxed);
+	for (;;)
+	{
+		if (atomic_load_explicit(&s->BatchHead, memory_order_acquire) == btail)
+		{
+			if (!atomic_load(&s->Running))
+			{
+				if (atomic_load_explicit(&s->BatchHead, memory_order_acquire) == btail)
+					break;
+				continue;
+			}
+			nanosleep(&idle, NULL);
+			continue;
+		}
+
+		/* A batch that wraps around the ring is handed out in two parts */
+		b = &s->pBatch[btail % STREAM_BATCH_RECORDS];
+		for (off = 0; off < b->Count; off += n)
+		{
+			idx = (b->RingPos + off) & s->RingMask;
+			n = b->Count - off;
+			if (idx + n > s->RingMask + 1)
+				n = (uint32_t)(s->RingMask + 1 - idx);
+			tm = b->Time;
+			tm.Index += off;
+			tm.Time += off * tm.Period;
+			s->Cfg.ConsumeTime(s->Cfg.ctx, &s->pRing[idx], n, &tm);
+		}
+
+		atomic_store_explicit(&s->Tail, b->RingPos + b->Count, memory_order_release);
+		btail++;
+		atomic_store_explicit(&s->BatchTail, btail, memory_order_release);
+	}
+
+	return NULL;
+}
+
+static void *stream_consumer(void *arg)
+{
+	struct ad5940_stream *s = arg;
+	struct timespec idle = {0, STREAM_IDLE_NS};
+	size_t head, tail, idx, n;
+
+	tail = atomic_load_explicit(&s->Tail, memory_order_relaxed);
+	for (;;)
+	{
+		head = atomic_load_explicit(&s->Head, memory_order_acquire);
+		if (head == tail)
+		{
+			if (!atomic_load(&s->Running))
+			{
+				/* Producer has stopped, take whatever it pushed last */
+				if (atomic_load_explicit(&s->Head, memory_order_acquire) == tail)
+					break;
+				continue;
+			}
+			nanosleep(&idle, NULL);
+			continue;
+		}
+
+		/* Hand out the contiguous part, the wrapped rest comes next round */
+		idx = tail & s->RingMask;
+		n = head - tail;
+		if (idx + n > s->RingMask + 1)
+			n = s->RingMask + 1 - idx;
+		s->Cfg.Consume(s->Cfg.ctx, &s->pRing[idx], (uint32_t)n);
+
+		tail += n;
+		atomic_store_explicit(&s->Tail, tail, memory_order_release);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief FIFO threshold for a link. One drain cycle costs two requests (FIFO
+ *        count, FIFO read) plus the per-word transfer time, T(n) = 2L + c*n.
+ *        The FIFO keeps up when a batch of n words takes no longer than the
+ *        source needs to produce it, n >= r*T(n), i.e. n >= 2*L*r / (1 - c*r).
+ * @param WordRate Words per second produced by the FIFO source.
+ * @param LinkLatency Seconds per request round trip.
+ * @param LinkWordTime Seconds per transferred word.
+ * @param FifoDepth FIFO depth in words.
+ * @return Threshold in words, limited to [1, FifoDepth / 2]. FifoDepth / 2 is
+ *         also returned if the link cannot sustain the rate at all.
+ */
+uint32_t ad5940_StreamThreshold(float WordRate, float LinkLatency,
+				float LinkWordTime, uint32_t FifoDepth)
+{
+	float load = LinkWordTime * WordRate;
+	float n;
+	uint32_t max = FifoDepth / 2 ? FifoDepth / 2 : 1;
+
+	if (load >= 1.0f)
+		return max;
+
+	n = ceilf(STREAM_MARGIN * 2.0f * LinkLatency * WordRate / (1.0f - load));
+	if (n < 1.0f)
+		return 1;
+	if (n > max)
+		return max;
+	return (uint32_t)n;
+}
+
+/**
+ * @brief Put the data FIFO into stream mode and start the processing thread.
+ * @param dev The device structure.
+ * @param s Stream state.
+ * @param pCfg Stream configuration.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_StreamStart(struct ad5940_dev *dev, struct ad5940_stream *s,
+		       const StreamCfg_Type *pCfg)
+{
+	FIFOCfg_Type fifo_cfg;
+	size_t ring_words = 1;
+	int ret;
+
+	if (!s || !pCfg || !(pCfg->Consume || pCfg->ConsumeTime) || pCfg->WordRate <= 0 ||
+	    pCfg->FIFOSize > FIFOSIZE_6KB)
+		return -EINVAL;
+
+	memset(s, 0, sizeof(*s));
+	s->Cfg = *pCfg;
+	if (s->Cfg.LinkLatency <= 0)
+		s->Cfg.LinkLatency = STREAM_DEF_LATENCY;
+	if (s->Cfg.LinkWordTime <= 0)
+		s->Cfg.LinkWordTime = STREAM_DEF_WORD_TIME;
+	if (s->Cfg.RingWords == 0)
+		s->Cfg.RingWords = STREAM_DEF_RING_WORDS;
+
+	s->FifoDepth = FIFOSIZE_WORDS(s->Cfg.FIFOSize);
+	s->Threshold = ad5940_StreamThreshold(s->Cfg.WordRate, s->Cfg.LinkLatency,
+					      s->Cfg.LinkWordTime, s->FifoDepth);
+	s->Stat.Threshold = s->Threshold;
+	if (s->Cfg.LinkWordTime * s->Cfg.WordRate >= 1.0f)
+		log_warn("stream: %.0f words/s exceeds the link (%.0f words/s), samples will be lost",
+			 s->Cfg.WordRate, 1.0f / s->Cfg.LinkWordTime);
+
+	while (ring_words < s->Cfg.RingWords)
+		ring_words <<= 1;
+	s->RingMask = ring_words - 1;
+	s->pRing = malloc(ring_words * sizeof(uint32_t));
+	s->pDrainBuf = malloc(s->FifoDepth * sizeof(uint32_t));
+	if (s->Cfg.ConsumeTime)
+		s->pBatch = malloc(STREAM_BATCH_RECORDS * sizeof(*s->pBatch));
+	if (!s->pRing || !s->pDrainBuf || (s->Cfg.ConsumeTime && !s->pBatch))
+	{
+		ret = -ENOMEM;
+		goto error;
+	}
+	atomic_init(&s->Head, 0);
+	atomic_init(&s->Tail, 0);
+	atomic_init(&s->BatchHead, 0);
+	atomic_init(&s->BatchTail, 0);
+	s->FitPeriod = 1.0 / s->Cfg.WordRate;
+	s->Stat.Period = s->FitPeriod;
+
+	/* Disable to reset the FIFO, then enable in stream mode */
+	fifo_cfg.FIFOEn = false;
+	fifo_cfg.FIFOMode = FIFOMODE_STREAM;
+	fifo_cfg.FIFOSize = s->Cfg.FIFOSize;
+	fifo_cfg.FIFOSrc = s->Cfg.FIFOSrc;
+	fifo_cfg.FIFOThresh = s->Threshold;
+	ret = ad5940_FIFOCfg(dev, &fifo_cfg);
+	if (ret < 0)
+		goto error;
+	fifo_cfg.FIFOEn = true;
+	ret = ad5940_FIFOCfg(dev, &fifo_cfg);
+	if (ret < 0)
+		goto error;
+	ret = ad5940_INTCClrFlag(dev, AFEINTSRC_DATAFIFOFULL | AFEINTSRC_DATAFIFOOF);
+	if (ret < 0)
+		goto error;
+
+	atomic_store(&s->Running, true);
+	ret = pthread_create(&s->Consumer, NULL,
+			     s->Cfg.ConsumeTime ? stream_consumer_time : stream_consumer, s);
+	if (ret != 0)
+	{
+		atomic_store(&s->Running, false);
+		ret = -ret;
+		goto error;
+	}
+
+	log_debug("stream: FIFO %u words, threshold %u, ring %zu words",
+		  s->FifoDepth, s->Threshold, ring_words);
+	return 0;
+
+error:
+	free(s->pRing);
+	free(s->pDrainBuf);
+	free(s->pBatch);
+	s->pRing = NULL;
+	s->pDrainBuf = NULL;
+	s->pBatch = NULL;
+	return ret;
+}
+
+/**
+ * @brief One drain cycle. Sleeps while the FIFO is below the threshold,
+ *        otherwise reads everything it holds into the ring.
+ * @param dev The device structure.
+ * @param s Stream state.
+ * @return Number of words drained (0 if it only waited), negative error code otherwise.
+ */
+int ad5940_StreamPump(struct ad5940_dev *dev, struct ad5940_stream *s)
+{
+	uint32_t cnt, flag, pushed;
+	uint64_t first;
+	double t0, t1;
+	bool overflow = false;
+	float wait;
+	int ret;
+
+	t0 = now_s();
+	ret = ad5940_FIFOGetCnt(dev, &cnt);
+	if (ret < 0)
+		return ret;
+	t1 = now_s();
+	if (cnt > s->Stat.MaxFifoCnt)
+		s->Stat.MaxFifoCnt = cnt;
+
+	/* Stream mode discards the oldest word once full; only then look at the flags.
+	   A full count does not tell which word is the newest and stays out of the time fit. */
+	if (cnt >= s->FifoDepth)
+	{
+		ret = ad5940_INTCGetFlag(dev, AFEINTC_1, &flag);
+		if (ret < 0)
+			return ret;
+		if (flag & (AFEINTSRC_DATAFIFOFULL | AFEINTSRC_DATAFIFOOF))
+		{
+			s->Stat.FifoOverflows++;
+			log_warn("stream: data FIFO overflow (%u)", s->Stat.FifoOverflows);
+			ret = ad5940_INTCClrFlag(dev, AFEINTSRC_DATAFIFOFULL | AFEINTSRC_DATAFIFOOF);
+			if (ret < 0)
+				return ret;
+			overflow = true;
+		}
+		cnt = s->FifoDepth;
+	}
+	else
+	{
+		ts_add(s, t0, t1, cnt);
+	}
+
+	if (cnt < s->Threshold)
+	{
+		wait = (s->Threshold - cnt) / s->Cfg.WordRate;
+		sleep_s(wait < STREAM_MAX_SLEEP_S ? wait : STREAM_MAX_SLEEP_S);
+		return 0;
+	}
+
+	t0 = now_s();
+	ret = ad5940_FIFORd(dev, s->pDrainBuf, cnt);
+	if (ret < 0)
+		return ret;
+	t1 = now_s();
+	if (overflow)
+		ts_lost(s, t0, t1, cnt);
+	s->Stat.WordsRead += cnt;
+	first = s->Index;
+	s->Index += cnt;
+
+	if (s->Cfg.ConsumeTime)
+		pushed = batch_push(s, s->pDrainBuf, cnt, first);
+	else
+		pushed = ring_push(s, s->pDrainBuf, cnt);
+	if (pushed < cnt)
+	{
+		if (s->Stat.WordsDropped == 0)
+			log_warn("stream: consumer too slow, ring full");
+		s->Stat.WordsDropped += cnt - pushed;
+	}
+
+	return (int)cnt;
+}
+
+/**
+ * @brief Stop streaming: disable the data FIFO so the source stops filling it,
+ *        let the processing thread empty the ring and join it. Words still in
+ *        the FIFO are discarded.
+ * @param dev The device structure.
+ * @param s Stream state.
+ * @return 0 on success, negative error code otherwise. The thread is joined
+ *         and the buffers are freed either way.
+ */
+int ad5940_StreamStop(struct ad5940_dev *dev, struct ad5940_stream *s)
+{
+	int ret;
+
+	if (!s || !s->pRing)
+		return -EINVAL;
+
+	ret = ad5940_FIFOCtrlS(dev, s->Cfg.FIFOSrc, false);
+	if (ret < 0)
+		log_warn("stream: cannot disable the data FIFO (%d)", ret);
+
+	atomic_store(&s->Running, false);
+	pthread_join(s->Consumer, NULL);
+
+	free(s->pRing);
+	free(s->pDrainBuf);
+	free(s->pBatch);
+	s->pRing = NULL;
+	s->pDrainBuf = NULL;
+	s->pBatch = NULL;
+
+	log_debug("stream: read %llu words, dropped %llu, FIFO overflows %u (%llu words lost), max FIFO count %u",
+		  (unsigned long long)s->Stat.WordsRead, (unsigned long long)s->Stat.WordsDropped,
+		  s->Stat.FifoOverflows, (unsigned long long)s->Stat.WordsLost, s->Stat.MaxFifoCnt);
+	log_debug("stream: word period %.9fs, time error bound %.6fs", s->Stat.Period, s->Stat.ErrBound);
+	return ret < 0 ? ret : 0;
+}
+
+/**
+ * @brief Copy the stream counters. Call from the thread that runs ad5940_StreamPump.
+ * @param s Stream state.
+ * @param pStat Destination.
+ */
+void ad5940_StreamGetStat(struct ad5940_stream *s, StreamStat_Type *pStat)
+{
+	*pStat = s->Stat;
+}
@@ -0,0 +1,197 @@
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "ad5940.h"
+#include "ad5940_timing.h"
+#include "ulog.h"
+
+static void due_after(struct timespec *ts, float Seconds)
+{
+	long ns;
+
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	ns = ts->tv_nsec + (long)((Seconds - (time_t)Seconds) * 1e9f);
+	ts->tv_sec += (time_t)Seconds + ns / 1000000000L;
+	ts->tv_nsec = ns % 1000000000L;
+}
+
+static bool is_due(const struct timespec *ts)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > ts->tv_sec || (now.tv_sec == ts->tv_sec && now.tv_nsec >= ts->tv_nsec);
+}
+
+/* One ad5940_LFOSCMeasure(), -ERANGE and counted if the result is not plausible */
+static int timing_measure(struct ad5940_dev *dev, struct ad5940_timing *t, float *pFreq)
+{
+	LFOSCMeasure_Type cfg;
+	int ret;
+
+	cfg.CalSeqAddr = t->Cfg.CalSeqAddr;
+	cfg.CalDuration = t->Cfg.CalDuration;
+	cfg.SystemClkFreq = t->Cfg.SystemClkFreq;
+	ret = ad5940_LFOSCMeasure(dev, &cfg, pFreq);
+	if (ret < 0)
+		return ret;
+
+	if (!(*pFreq >= TIMING_LFOSC_MIN && *pFreq <= TIMING_LFOSC_MAX))
+	{
+		t->Rejected++;
+		log_warn("timing: LFOSC measured %.1fHz, rejected", *pFreq);
+		return -ERANGE;
+	}
+	t->LastFreq = *pFreq;
+	t->Measured++;
+	return 0;
+}
+
+/**
+ * @brief Measure the LFOSC frequency. The sequencer and wakeup timer
+ *        configuration is changed, configure them after this call.
+ * @param dev Device.
+ * @param t Timing state.
+ * @param pCfg Measurement and recalibration settings.
+ * @return 0 on success, -ERANGE if no measurement was plausible, negative
+ *         error code otherwise.
+ */
+int ad5940_TimingInit(struct ad5940_dev *dev, struct ad5940_timing *t,
+		      const TimingCfg_Type *pCfg)
+{
+	uint32_t count, accepted = 0;
+	float freq, sum = 0;
+	int ret = 0;
+
+	if (!t || !pCfg || pCfg->SystemClkFreq <= 0 || pCfg->CalDuration < 0 || pCfg->Alpha < 0 ||
+	    pCfg->Alpha > 1)
+		return -EINVAL;
+
+	memset(t, 0, sizeof(*t));
+	t->Cfg = *pCfg;
+	if (t->Cfg.CalDuration == 0)
+		t->Cfg.CalDuration = TIMING_CAL_MS;
+	if (t->Cfg.Alpha == 0)
+		t->Cfg.Alpha = TIMING_ALPHA;
+	count = t->Cfg.InitCount ? t->Cfg.InitCount : 1;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		ret = timing_measure(dev, t, &freq);
+		if (ret == -ERANGE)
+			continue;
+		if (ret < 0)
+			return ret;
+		sum += freq;
+		accepted++;
+	}
+	if (accepted == 0)
+		return -ERANGE;
+
+	t->LFOSCFreq = sum / accepted;
+	due_after(&t->Due, t->Cfg.RecalInterval);
+	log_info("timing: LFOSC %.1fHz (%+.0fppm from nominal), %u of %u measurements",
+		 t->LFOSCFreq, (t->LFOSCFreq / TIMING_LFOSC_NOMINAL - 1) * 1e6f, accepted, count);
+	return 0;
+}
+
+/**
+ * @brief Measure the LFOSC frequency again if RecalInterval has passed, and
+ *        move the estimate towards it by Alpha. Must not be called while the
+ *        wakeup timer paces a sequence.
+ * @param dev Device.
+ * @param t Timing state.
+ * @param Force Measure now, whether RecalInterval has passed or not.
+ * @return 1 if the estimate was updated, 0 if no measurement was due or it was
+ *         rejected, negative error code otherwise.
+ */
+int ad5940_TimingUpdate(struct ad5940_dev *dev, struct ad5940_timing *t, bool Force)
+{
+	float freq, prev;
+	int ret;
+
+	if (!t || t->LFOSCFreq <= 0)
+		return -EINVAL;
+	if (!Force && (t->Cfg.RecalInterval <= 0 || !is_due(&t->Due)))
+		return 0;
+
+	ret = timing_measure(dev, t, &freq);
+	due_after(&t->Due, t->Cfg.RecalInterval);
+	if (ret == -ERANGE)
+		return 0;
+	if (ret < 0)
+		return ret;
+
+	prev = t->LFOSCFreq;
+	t->LFOSCFreq += t->Cfg.Alpha * (freq - prev);
+	log_debug("timing: LFOSC measured %.1fHz, estimate %.1fHz (%+.0fppm)", freq, t->LFOSCFreq,
+		  (t->LFOSCFreq / prev - 1) * 1e6f);
+	return 1;
+}
+
+/**
+ * @brief Whole LFOSC ticks closest to Seconds, at the nominal 32kHz before
+ *        ad5940_TimingInit().
+ */
+uint32_t ad5940_TimingTicks(const struct ad5940_timing *t, float Seconds)
+{
+	float freq = t && t->LFOSCFreq > 0 ? t->LFOSCFreq : TIMING_LFOSC_NOMINAL;
+	double ticks = (double)Seconds * freq;
+
+	if (!(ticks > 0))
+		return 0;
+	return ticks >= UINT32_MAX ? UINT32_MAX : (uint32_t)lround(ticks);
+}
+
+/**
+ * @brief Wakeup timer register values for a sequence triggered every Period.
+ * @param t Timing state.
+ * @param Period Seconds from one trigger to the next.
+ * @param WakeupTicks Ticks between wakeup and the trigger (0: TIMING_WAKEUP_TICKS).
+ * @param pSleepTime Returns the SeqxSleepTime value.
+ * @param pWakeupTime Returns the SeqxWakeupTime value.
+ * @param pActual Returns the period in seconds that runs, can be NULL.
+ * @return 0 on success, -ERANGE if the period does not fit the timer.
+ */
+int ad5940_TimingWupt(const struct ad5940_timing *t, float Period, uint32_t WakeupTicks,
+		      uint32_t *pSleepTime, uint32_t *pWakeupTime, float *pActual)
+{
+	uint32_t ticks;
+
+	if (!pSleepTime || !pWakeupTime)
+		return -EINVAL;
+	if (WakeupTicks == 0)
+		WakeupTicks = TIMING_WAKEUP_TICKS;
+
+	ticks = ad5940_TimingTicks(t, Period);
+	/* At least one tick of sleep */
+	if (WakeupTicks > TIMING_WUPT_MAX + 1 || ticks < WakeupTicks + 1 ||
+	    ticks - WakeupTicks - 1 > TIMING_WUPT_MAX)
+		return -ERANGE;
+
+	*pWakeupTime = WakeupTicks - 1;
+	*pSleepTime = ticks - WakeupTicks - 1;
+	if (pActual)
+		*pActual = ticks / (t && t->LFOSCFreq > 0 ? t->LFOSCFreq : TIMING_LFOSC_NOMINAL);
+	return 0;
+}
+
+/**
+ * @brief ad5940_TimingWupt() written to the wakeup timer registers of SeqId.
+ *        With the current estimate after ad5940_TimingUpdate() this corrects
+ *        the period for the drift of LFOSC.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_TimingApply(struct ad5940_dev *dev, const struct ad5940_timing *t, uint32_t SeqId,
+		       float Period, uint32_t WakeupTicks, float *pActual)
+{
+	uint32_t sleep_time, wakeup_time;
+	int ret;
+
+	ret = ad5940_TimingWupt(t, Period, WakeupTicks, &sleep_time, &wakeup_time, pActual);
+	if (ret < 0)
+		return ret;
+	return ad5940_WUPTTime(dev, SeqId, sleep_time, wakeup_time);
+}
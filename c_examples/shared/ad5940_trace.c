@@ -0,0 +1,428 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ad5940.h"
+#include "ad5940_trace.h"
+#include "ulog.h"
+
+#define TRACE_MAGIC "AD5940TR"
+#define TRACE_HDR_SIZE 16
+
+static const char *op_name[] = {"reset", "rd", "wr", "set_bits", "clr_bits", "wr_mask", "rd_fifo", "wr_seq", "rd_regs"};
+
+#define OP_NAME(op) ((op) < sizeof(op_name) / sizeof(op_name[0]) ? op_name[op] : "?")
+
+/* Recorder, rec_lock serializes the records of concurrent requests such as
+   those of a stream producer thread */
+static pthread_mutex_t rec_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *rec_fp;
+static uint64_t rec_t0;
+static uint32_t rec_count;
+
+/* Replay, replay_lock takes the requests in turn */
+static pthread_mutex_t replay_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ad5940_trace_reader replay;
+static bool replay_active;
+static bool replay_rt;
+static uint32_t *replay_buf;
+static uint32_t replay_buf_cap;
+static uint64_t replay_t0;
+static ReplayStat_Type replay_stat;
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/**
+ * @brief Monotonic clock in ns.
+ */
+uint64_t ad5940_TraceNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief Start recording every transport request into a new trace file.
+ * @param path File to create, an existing file is overwritten.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_TraceRecordStart(const char *path)
+{
+	uint8_t hdr[TRACE_HDR_SIZE];
+	int ret;
+
+	if (!path)
+		return -EINVAL;
+	ad5940_TraceRecordStop();
+
+	pthread_mutex_lock(&rec_lock);
+	rec_fp = fopen(path, "wb");
+	if (!rec_fp)
+	{
+		ret = -errno;
+		pthread_mutex_unlock(&rec_lock);
+		log_error("trace: cannot create %s", path);
+		return ret;
+	}
+	memcpy(hdr, TRACE_MAGIC, 8);
+	put_u32(hdr + 8, TRACE_VERSION);
+	put_u32(hdr + 12, TRACE_REC_SIZE);
+	fwrite(hdr, 1, sizeof(hdr), rec_fp);
+
+	rec_t0 = ad5940_TraceNow();
+	rec_count = 0;
+	pthread_mutex_unlock(&rec_lock);
+	log_info("trace: recording to %s", path);
+	return 0;
+}
+
+/**
+ * @brief Flush and close the trace file, if one is being recorded.
+ */
+void ad5940_TraceRecordStop(void)
+{
+	uint32_t count;
+
+	pthread_mutex_lock(&rec_lock);
+	if (!rec_fp)
+	{
+		pthread_mutex_unlock(&rec_lock);
+		return;
+	}
+	fclose(rec_fp);
+	rec_fp = NULL;
+	count = rec_count;
+	pthread_mutex_unlock(&rec_lock);
+	log_info("trace: %u requests recorded", count);
+}
+
+bool ad5940_TraceRecording(void)
+{
+	return rec_fp != NULL;
+}
+
+/**
+ * @brief Append one record, safe to call from several threads. Time is
+ *        absolute (ad5940_TraceNow) and is stored relative to the start of the
+ *        recording.
+ * @param pRec Record.
+ * @param pPayload pRec->Count words, can be NULL if Count is 0.
+ */
+void ad5940_TraceAdd(const TraceRec_Type *pRec, const uint32_t *pPayload)
+{
+	uint8_t buf[TRACE_REC_SIZE] = {0};
+	uint8_t word[4];
+	uint64_t t;
+	uint32_t i;
+
+	pthread_mutex_lock(&rec_lock);
+	if (!rec_fp)
+	{
+		pthread_mutex_unlock(&rec_lock);
+		return;
+	}
+
+	t = pRec->Time - rec_t0;
+	put_u32(buf, (uint32_t)t);
+	put_u32(buf + 4, (uint32_t)(t >> 32));
+	put_u32(buf + 8, pRec->Duration);
+	buf[12] = pRec->Op;
+	buf[13] = (uint8_t)pRec->Ret;
+	put_u32(buf + 16, pRec->Address);
+	put_u32(buf + 20, pRec->Mask);
+	put_u32(buf + 24, pRec->Data);
+	put_u32(buf + 28, pRec->Count);
+	fwrite(buf, 1, sizeof(buf), rec_fp);
+
+	for (i = 0; i < pRec->Count; i++)
+	{
+		put_u32(word, pPayload[i]);
+		fwrite(word, 1, sizeof(word), rec_fp);
+	}
+	rec_count++;
+	pthread_mutex_unlock(&rec_lock);
+}
+
+/**
+ * @brief Open a trace file for reading and check its header.
+ * @param r Reader state.
+ * @param path Trace file.
+ * @return 0 on success, -EINVAL if it is not a trace, negative error code otherwise.
+ */
+int ad5940_TraceOpen(struct ad5940_trace_reader *r, const char *path)
+{
+	uint8_t hdr[TRACE_HDR_SIZE];
+
+	memset(r, 0, sizeof(*r));
+	r->fp = fopen(path, "rb");
+	if (!r->fp)
+	{
+		log_error("trace: cannot open %s", path);
+		return -errno;
+	}
+	if (fread(hdr, 1, sizeof(hdr), r->fp) != sizeof(hdr) || memcmp(hdr, TRACE_MAGIC, 8) != 0 ||
+	    get_u32(hdr + 8) != TRACE_VERSION || get_u32(hdr + 12) != TRACE_REC_SIZE)
+	{
+		log_error("trace: %s is not a version %u trace", path, TRACE_VERSION);
+		ad5940_TraceClose(r);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/**
+ * @brief Read the next record and its payload.
+ * @param r Reader state.
+ * @param pRec Record, Time relative to the start of the recording.
+ * @param pPayload Destination for the payload words.
+ * @param PayloadCap Size of pPayload in words.
+ * @return 1 if a record was read, 0 at the end of the trace, -EMSGSIZE if the
+ *         payload does not fit (the record is skipped), -EIO if the file is truncated.
+ */
+int ad5940_TraceNext(struct ad5940_trace_reader *r, TraceRec_Type *pRec,
+		     uint32_t *pPayload, uint32_t PayloadCap)
+{
+	uint8_t buf[TRACE_REC_SIZE];
+	uint8_t word[4];
+	size_t n;
+	uint32_t i;
+
+	n = fread(buf, 1, sizeof(buf), r->fp);
+	if (n == 0)
+		return 0;
+	if (n != sizeof(buf))
+		return -EIO;
+
+	pRec->Time = get_u32(buf) | (uint64_t)get_u32(buf + 4) << 32;
+	pRec->Duration = get_u32(buf + 8);
+	pRec->Op = buf[12];
+	pRec->Ret = (int8_t)buf[13];
+	pRec->Address = get_u32(buf + 16);
+	pRec->Mask = get_u32(buf + 20);
+	pRec->Data = get_u32(buf + 24);
+	pRec->Count = get_u32(buf + 28);
+	r->Index++;
+
+	if (pRec->Count > PayloadCap)
+	{
+		if (fseek(r->fp, (long)pRec->Count * 4, SEEK_CUR) != 0)
+			return -EIO;
+		return -EMSGSIZE;
+	}
+	for (i = 0; i < pRec->Count; i++)
+	{
+		if (fread(word, 1, sizeof(word), r->fp) != sizeof(word))
+			return -EIO;
+		pPayload[i] = get_u32(word);
+	}
+	return 1;
+}
+
+void ad5940_TraceClose(struct ad5940_trace_reader *r)
+{
+	if (r->fp)
+		fclose(r->fp);
+	r->fp = NULL;
+}
+
+/**
+ * @brief Answer transport requests from a trace instead of the bridge.
+ * @param path Trace file.
+ * @param RealTime Answer every request at the time its response came in the
+ *        recording, counted from the open.
+ * @return 0 on success, negative error code otherwise.
+ */
+int ad5940_ReplayOpen(const char *path, bool RealTime)
+{
+	int ret;
+
+	ad5940_ReplayClose();
+	pthread_mutex_lock(&replay_lock);
+	ret = ad5940_TraceOpen(&replay, path);
+	if (ret < 0)
+	{
+		pthread_mutex_unlock(&replay_lock);
+		return ret;
+	}
+
+	replay_active = true;
+	replay_rt = RealTime;
+	memset(&replay_stat, 0, sizeof(replay_stat));
+	replay_t0 = ad5940_TraceNow();
+	pthread_mutex_unlock(&replay_lock);
+	log_info("trace: replaying %s%s", path, RealTime ? " in real time" : "");
+	return 0;
+}
+
+bool ad5940_ReplayActive(void)
+{
+	return replay_active;
+}
+
+static int replay_next(TraceRec_Type *pRec)
+{
+	uint32_t *buf;
+	long pos;
+	int ret;
+
+	for (;;)
+	{
+		pos = ftell(replay.fp);
+		ret = ad5940_TraceNext(&replay, pRec, replay_buf, replay_buf_cap);
+		if (ret != -EMSGSIZE)
+			return ret;
+
+		/* Grow the payload buffer and read the record again */
+		buf = realloc(replay_buf, pRec->Count * sizeof(uint32_t));
+		if (!buf)
+			return -ENOMEM;
+		replay_buf = buf;
+		replay_buf_cap = pRec->Count;
+		fseek(replay.fp, pos, SEEK_SET);
+		replay.Index--;
+	}
+}
+
+/* Sleep until Offset ns after the replay was opened */
+static void replay_wait(uint64_t Offset)
+{
+	uint64_t t = replay_t0 + Offset;
+	struct timespec ts = {(time_t)(t / 1000000000u), (long)(t % 1000000000u)};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static bool replay_match(const TraceRec_Type *pReq, const uint32_t *pPayload, const TraceRec_Type *pRec)
+{
+	if (pReq->Op != pRec->Op || pReq->Address != pRec->Address || pReq->Mask != pRec->Mask)
+		return false;
+	if (pReq->Op != TRACE_OP_RD && pReq->Data != pRec->Data)
+		return false;
+	if (pReq->Op == TRACE_OP_WR_SEQ)
+		return pReq->Count == pRec->Count &&
+		       (pReq->Count == 0 || memcmp(pPayload, replay_buf, pReq->Count * sizeof(uint32_t)) == 0);
+	if (pReq->Op == TRACE_OP_RD_REGS)
+		return pRec->Count == 2 * pReq->Data &&
+		       (pReq->Data == 0 || memcmp(pPayload, replay_buf, pReq->Data * sizeof(uint32_t)) == 0);
+	return true;
+}
+
+/* ad5940_ReplayOp() with replay_lock held */
+static int replay_op(const TraceRec_Type *pReq, const uint32_t *pPayload,
+		     uint32_t *pValue, uint32_t *pWords, uint32_t WordsCap)
+{
+	TraceRec_Type rec;
+	uint32_t n;
+	int ret;
+
+	if (!replay_active)
+		return -EIO;
+
+	ret = replay_next(&rec);
+	if (ret <= 0)
+	{
+		log_error("trace: replay ended after %u requests, driver asked for %s 0x%04x",
+			  replay_stat.Requests, OP_NAME(pReq->Op), pReq->Address);
+		replay_stat.Mismatches++;
+		return -EIO;
+	}
+	if (!replay_match(pReq, pPayload, &rec))
+	{
+		log_error("trace: request %u diverged, recorded %s 0x%04x data 0x%08x, driver asked for %s 0x%04x data 0x%08x",
+			  replay.Index, OP_NAME(rec.Op), rec.Address, rec.Data,
+			  OP_NAME(pReq->Op), pReq->Address, pReq->Data);
+		replay_stat.Mismatches++;
+		return -EIO;
+	}
+
+	if (replay_rt)
+		replay_wait(rec.Time + rec.Duration);
+	replay_stat.Requests++;
+	replay_stat.RecordedNs += rec.Duration;
+	replay_stat.ElapsedNs = ad5940_TraceNow() - replay_t0;
+
+	if (rec.Ret < 0)
+		return rec.Ret;
+	switch (rec.Op)
+	{
+	case TRACE_OP_RD:
+		if (pValue)
+			*pValue = rec.Data;
+		return 0;
+	case TRACE_OP_RD_FIFO:
+	case TRACE_OP_RD_REGS:
+		n = rec.Count < WordsCap ? rec.Count : WordsCap;
+		if (n)
+			memcpy(pWords, replay_buf, n * sizeof(uint32_t));
+		return (int)n;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @brief Answer one request from the trace.
+ * @param pReq The request: Op, Address, Mask, Data (not for RD), WR_SEQ: Count.
+ * @param pPayload WR_SEQ: the words to write, RD_REGS: the Data addresses.
+ * @param pValue RD: returns the value read.
+ * @param pWords RD_FIFO: returns the words read, RD_REGS: the recorded payload.
+ * @param WordsCap RD_FIFO, RD_REGS: size of pWords.
+ * @return What the transport call returned in the recording, -EIO once the
+ *         requests diverge from the recording or the trace ends.
+ * @note Requests from several threads are answered one after the other.
+ */
+int ad5940_ReplayOp(const TraceRec_Type *pReq, const uint32_t *pPayload,
+		    uint32_t *pValue, uint32_t *pWords, uint32_t WordsCap)
+{
+	int ret;
+
+	pthread_mutex_lock(&replay_lock);
+	ret = replay_op(pReq, pPayload, pValue, pWords, WordsCap);
+	pthread_mutex_unlock(&replay_lock);
+	return ret;
+}
+
+void ad5940_ReplayGetStat(ReplayStat_Type *pStat)
+{
+	pthread_mutex_lock(&replay_lock);
+	*pStat = replay_stat;
+	pthread_mutex_unlock(&replay_lock);
+}
+
+/**
+ * @brief Stop replaying and log how the replay compares with the recording.
+ */
+void ad5940_ReplayClose(void)
+{
+	pthread_mutex_lock(&replay_lock);
+	if (!replay_active)
+	{
+		pthread_mutex_unlock(&replay_lock);
+		return;
+	}
+	log_info("trace: replayed %u requests, %u mismatches, recorded link time %.1fms, replay %.1fms",
+		 replay_stat.Requests, replay_stat.Mismatches,
+		 replay_stat.RecordedNs / 1e6, replay_stat.ElapsedNs / 1e6);
+	ad5940_TraceClose(&replay);
+	free(replay_buf);
+	replay_buf = NULL;
+	replay_buf_cap = 0;
+	replay_active = false;
+	pthread_mutex_unlock(&replay_lock);
+}
@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ad5940.h"
+#include "ad5940_serial.h"
+#include "ad5940_serial_link.h"
+#include "ad5940_trace.h"
+#include "ulog.h"
+
+#define REPLAY_PREFIX "replay:"
+#define REPLAY_RT_PREFIX "replay-rt:"
+#define REPLAY_FD 0x7fff /* handle of a replayed port, never passed to the OS */
+#define TRACE_ENV "AD5940_TRACE"
+
+int open_serial_port(const char *device)
+{
+	const char *trace = getenv(TRACE_ENV);
+
+	if (strncmp(device, REPLAY_PREFIX, strlen(REPLAY_PREFIX)) == 0)
+		return ad5940_ReplayOpen(device + strlen(REPLAY_PREFIX), false) < 0 ? -1 : REPLAY_FD;
+	if (strncmp(device, REPLAY_RT_PREFIX, strlen(REPLAY_RT_PREFIX)) == 0)
+		return ad5940_ReplayOpen(device + strlen(REPLAY_RT_PREFIX), true) < 0 ? -1 : REPLAY_FD;
+	if (trace && *trace)
+		ad5940_TraceRecordStart(trace);
+	return serial_open_port(device);
+}
+
+int flush_serial_port(int fd)
+{
+	if (ad5940_ReplayActive())
+		return 0;
+	return serial_flush_port(fd);
+}
+
+void close_serial_port(int fd)
+{
+	if (ad5940_ReplayActive())
+	{
+		ad5940_ReplayClose();
+		return;
+	}
+	ad5940_TraceRecordStop();
+	serial_close_port(fd);
+}
+
+/* Public transport: each request goes to the bridge and into the trace, or is
+   answered from the trace when replaying */
+
+static void trace_add(TraceRec_Type *rec, int ret, const uint32_t *pPayload)
+{
+	if (!ad5940_TraceRecording())
+		return;
+	rec->Duration = (uint32_t)(ad5940_TraceNow() - rec->Time);
+	rec->Ret = ret >= 0 ? 0 : ret < -128 ? -128 : ret;
+	ad5940_TraceAdd(rec, pPayload);
+}
+
+int ad5940_reset_hardware(int fd)
+{
+	TraceRec_Type rec = {.Op = TRACE_OP_RESET};
+	int ret;
+
+	if (ad5940_ReplayActive())
+		return ad5940_ReplayOp(&rec, NULL, NULL, NULL, 0);
+	rec.Time = ad5940_TraceNow();
+	ret = serial_reset_hardware(fd);
+	trace_add(&rec, ret, NULL);
+	return ret;
+}
+
+int ad5940_write_register(int fd, uint16_t address, uint32_t value)
+{
+	TraceRec_Type rec = {.Op = TRACE_OP_WR, .Address = address, .Data = value};
+	int ret;
+
+	if (ad5940_ReplayActive())
+		return ad5940_ReplayOp(&rec, NULL, NULL, NULL, 0);
+	rec.Time = ad5940_TraceNow();
+	ret = serial_write_register(fd, address, value);
+	trace_add(&rec, ret, NULL);
+	return ret;
+}
+
+int ad5940_read_register(int fd, uint16_t address, uint32_t *value)
+{
+	TraceRec_Type rec = {.Op = TRACE_OP_RD, .Address = address};
+	int ret;
+
+	if (ad5940_ReplayActive())
+		return ad5940_ReplayOp(&rec, NULL, value, NULL, 0);
+	rec.Time = ad5940_TraceNow();
+	ret = serial_read_register(fd, address, value);
+	if (ret == 0)
+		rec.Data = *value;
+	trace_add(&rec, ret, NULL);
+	return ret;
+}
+
+int ad5940_set_bits_register(int fd, uint16_t address, uint32_t value)
+{
+	TraceRec_Type rec = {.Op = TRACE_OP_SET_BITS, .Address = address, .Data = value};
+	int ret;
+
+	if (ad5940_ReplayActive())
+		return ad5940_ReplayOp(&rec, NULL, NULL, NULL, 0);
+	rec.Time = ad5940_TraceNow();
+	ret = serial_set_bits_register(fd, address, value);
+	trace_add(&rec, ret, NULL);
+	return ret;
+}
+
+int ad5940_clr_bits_register(int fd, uint16_t address, uint32_t value)
+{
+	TraceRec_Type rec = {.Op = TRACE_OP_CLR_BITS, .Address = address, .Data = value};
+	int ret;
+
+	if (ad5940_ReplayActive())
+		return ad5940_ReplayOp(&rec, NULL, NULL, NULL, 0);
+	rec.Time = ad5940_TraceNow();
+	ret = serial_clr_bits_register(fd, address, value);
+	trace_add(&rec, ret, NULL);
+	return ret;
+}
+
+int ad5940_wr_mask_register(int fd, uint16_t address, uint32_t mask, uint32_t value)
+{
+	TraceRec_Type rec = {.Op = TRACE_OP_WR_MASK, .Address = address, .Mask = mask, .Data = value};
+	int ret;
+
+	if (ad5940_ReplayActive())
+		return ad5940_ReplayOp(&rec, NULL, NULL, NULL, 0);
+	rec.Time = ad5940_TraceNow();
+	ret = serial_wr_mask_register(fd, address, mask, value);
+	trace_add(&rec, ret, NULL);
+	return ret;
+}
+
+int ad5940_rd_fifo(int fd, uint32_t readcount, uint32_t *buffer)
+{
+	TraceRec_Type rec = {.Op = TRACE_OP_RD_FIFO, .Data = readcount};
+	int ret;
+
+	if (ad5940_ReplayActive())
+		return ad5940_ReplayOp(&rec, NULL, NULL, buffer, readcount);
+	rec.Time = ad5940_TraceNow();
+	ret = serial_rd_fifo(fd, readcount, buffer);
+	rec.Count = ret > 0 ? ret : 0;
+	trace_add(&rec, ret, buffer);
+	return ret;
+}
+
+int ad5940_wr_seq(int fd, uint32_t start_addr, const uint32_t *words, uint32_t count)
+{
+	TraceRec_Type rec = {.Op = TRACE_OP_WR_SEQ, .Address = start_addr, .Count = count};
+	int ret;
+
+	if (ad5940_ReplayActive())
+		return ad5940_ReplayOp(&rec, words, NULL, NULL, 0);
+	rec.Time = ad5940_TraceNow();
+	ret = serial_wr_seq(fd, start_addr, words, count);
+	trace_add(&rec, ret, words);
+	return ret;
+}
+
+int ad5940_rd_regs(int fd, const uint16_t *addresses, uint32_t count, uint32_t *values)
+{
+	TraceRec_Type rec = {.Op = TRACE_OP_RD_REGS, .Data = count};
+	uint32_t *payload;
+	int ret;
+
+	if (ad5940_ReplayActive())
+	{
+		/* The payload holds the addresses, then the values read */
+		payload = malloc(2 * count * sizeof(uint32_t));
+		if (!payload)
+			return -ENOMEM;
+		for (uint32_t i = 0; i < count; i++)
+			payload[i] = addresses[i];
+		ret = ad5940_ReplayOp(&rec, payload, NULL, payload, 2 * count);
+		if (ret == (int)(2 * count))
+		{
+			memcpy(values, payload + count, count * sizeof(uint32_t));
+			ret = 0;
+		}
+		else if (ret >= 0)
+			ret = -EIO;
+		free(payload);
+		return ret;
+	}
+	rec.Time = ad5940_TraceNow();
+	ret = serial_rd_regs(fd, addresses, count, values);
+	if (ad5940_TraceRecording())
+	{
+		payload = malloc(2 * count * sizeof(uint32_t));
+		if (payload)
+		{
+			for (uint32_t i = 0; i < count; i++)
+			{
+				payload[i] = addresses[i];
+				payload[count + i] = ret == 0 ? values[i] : 0;
+			}
+			rec.Count = 2 * count;
+			trace_add(&rec, ret, payload);
+			free(payload);
+		}
+	}
+	return ret;
+}
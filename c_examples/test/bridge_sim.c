@@ -0,0 +1,383 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ad5940.h"
+#include "ad5940_serial_link.h"
+#include "bridge_sim.h"
+
+/* Link of ad5940_serial_link.h answered from a register file in memory, for
+   host checks that need no bridge; the trace and the replay of
+   ad5940_transport.c run on top of it as on the serial link. The data FIFO
+   holds what the check pushes while FIFOCON enables it. A sequence triggered
+   through TRIGSEQ runs to its end at once: its writes land in the register
+   file, SEQ_INT0/1 and SEQ_STOP raise their interrupt flags, waits take no
+   time.
+   With bridge_sim_fifo_source() the FIFO is fed by a clock instead: word n
+   (its value is n) enters at the source start plus (n + 1) / Rate while the
+   FIFO is enabled, a full FIFO drops words like the chip in the mode and size
+   CMDDATACON selects, and FIFO count reads and FIFO reads take time like a
+   real link. The register file lives on across opens, like a chip that stays
+   powered between two processes; a reset through the link clears it. */
+
+#define SIM_FD 3
+#define SIM_REGS 0x4000 /* 16 bit addresses, 32 bit registers */
+#define SIM_SRAM 0x800  /* sequencer SRAM words */
+#define SIM_FIFO 0x800  /* data FIFO words, FIFOSIZE_6KB at most */
+#define SIM_WRITES 256  /* register writes remembered for bridge_sim_writes() */
+#define SIM_WORD_TIME 2e-6 /* s per FIFO word on the link, with a FIFO source */
+#define SIM_SEQ_CHUNK 128  /* words per "wr_seq" request, as ad5940_serial.c splits them */
+#define SIM_REG_CHUNK 64   /* registers per "rd_regs" request */
+
+static uint32_t regs[SIM_REGS];
+static uint32_t sram[SIM_SRAM];
+static bool seq_hang;
+static uint32_t fifo[SIM_FIFO];
+static uint32_t fifo_head, fifo_cnt;
+static uint16_t writes[SIM_WRITES];
+static uint32_t write_cnt;
+static uint32_t requests; /* since the start, a reset keeps counting */
+static uint16_t stuck_addr;
+static uint32_t stuck_mask;
+
+/* Time based FIFO source */
+static double src_rate, src_start;
+static uint64_t src_next; /* next word the source produces */
+static float src_lat_min, src_lat_max;
+
+static uint32_t *reg(uint16_t address)
+{
+	return &regs[(address >> 2) % SIM_REGS];
+}
+
+static void sim_flag(uint32_t flags)
+{
+	*reg(REG_INTC_INTCFLAG0) |= flags;
+	*reg(REG_INTC_INTCFLAG1) |= flags;
+}
+
+static void sim_write(uint16_t address, uint32_t value);
+
+static double sim_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sim_sleep(double Seconds)
+{
+	struct timespec ts = {(time_t)Seconds, (long)((Seconds - (time_t)Seconds) * 1e9)};
+
+	nanosleep(&ts, NULL);
+}
+
+/* One link leg, LatencyMin..LatencyMax */
+static void sim_latency(void)
+{
+	sim_sleep(src_lat_min + (src_lat_max - src_lat_min) * (double)rand() / RAND_MAX);
+}
+
+/* Words the source produced until now go into the FIFO. A full FIFO drops the
+   oldest words in stream mode and the new ones in FIFO mode, as CMDDATACON
+   selects. */
+static void src_update(void)
+{
+	uint32_t con = *reg(REG_AFE_CMDDATACON);
+	uint32_t depth = FIFOSIZE_WORDS((con & BITM_AFE_CMDDATACON_DATA_MEM_SEL) >> BITP_AFE_CMDDATACON_DATA_MEM_SEL);
+	bool stream = ((con & BITM_AFE_CMDDATACON_DATAMEMMDE) >> BITP_AFE_CMDDATACON_DATAMEMMDE) == FIFOMODE_STREAM;
+	uint64_t produced, over;
+
+	if (src_rate <= 0 || !(*reg(REG_AFE_FIFOCON) & BITM_AFE_FIFOCON_DATAFIFOEN))
+		return;
+	depth = depth < SIM_FIFO ? depth : SIM_FIFO;
+	produced = (uint64_t)((sim_now() - src_start) * src_rate);
+	over = produced - src_next + fifo_cnt > depth ? produced - src_next + fifo_cnt - depth : 0;
+	if (over && stream)
+	{
+		sim_flag(AFEINTSRC_DATAFIFOFULL);
+		if (over >= fifo_cnt)
+		{
+			src_next += over - fifo_cnt;
+			fifo_cnt = 0;
+		}
+		else
+		{
+			fifo_head = (fifo_head + over) % SIM_FIFO;
+			fifo_cnt -= over;
+		}
+	}
+	for (; src_next < produced && fifo_cnt < depth; src_next++, fifo_cnt++)
+		fifo[(fifo_head + fifo_cnt) % SIM_FIFO] = (uint32_t)src_next;
+	if (src_next < produced)
+	{
+		sim_flag(AFEINTSRC_DATAFIFOOF);
+		src_next = produced;
+	}
+}
+
+static void sim_run(uint32_t SeqId)
+{
+	static const uint16_t info_reg[4] = {REG_AFE_SEQ0INFO, REG_AFE_SEQ1INFO, REG_AFE_SEQ2INFO,
+					     REG_AFE_SEQ3INFO};
+	uint32_t info = *reg(info_reg[SeqId]);
+	uint32_t addr = info & 0x7ff, len = (info >> 16) & 0x7ff;
+
+	for (uint32_t i = 0; i < len && (*reg(REG_AFE_SEQCON) & BITM_AFE_SEQCON_SEQEN); i++)
+	{
+		uint32_t cmd = sram[(addr + i) % SIM_SRAM];
+
+		if (SEQ_CMD_IS_WR(cmd))
+			sim_write(SEQ_CMD_WR_REG(cmd), SEQ_CMD_WR_DATA(cmd));
+	}
+}
+
+static void sim_write(uint16_t address, uint32_t value)
+{
+	if (write_cnt < SIM_WRITES)
+		writes[write_cnt] = address;
+	write_cnt++;
+
+	switch (address)
+	{
+	case REG_INTC_INTCCLR:
+		*reg(REG_INTC_INTCFLAG0) &= ~value;
+		*reg(REG_INTC_INTCFLAG1) &= ~value;
+		return;
+	case REG_AFE_AFEGENINTSTA:
+		sim_flag((value & 1 ? AFEINTSRC_CUSTOMINT0 : 0) | (value & 2 ? AFEINTSRC_CUSTOMINT1 : 0));
+		return;
+	case REG_AFE_SEQCON:
+		if ((*reg(address) & BITM_AFE_SEQCON_SEQEN) && !(value & BITM_AFE_SEQCON_SEQEN))
+			sim_flag(AFEINTSRC_ENDSEQ);
+		break;
+	case REG_AFE_FIFOCON:
+		if (!(value & BITM_AFE_FIFOCON_DATAFIFOEN))
+			fifo_head = fifo_cnt = 0;
+		else if (!(*reg(address) & BITM_AFE_FIFOCON_DATAFIFOEN) && src_rate > 0)
+		{
+			/* The source runs from here */
+			src_start = sim_now();
+			src_next = 0;
+		}
+		break;
+	case REG_ALLON_OSCCON:
+		/* Oscillators are ready as soon as they are enabled */
+		value &= BITM_ALLON_OSCCON_HFXTALEN | BITM_ALLON_OSCCON_HFOSCEN | BITM_ALLON_OSCCON_LFOSCEN;
+		value |= (value & BITM_ALLON_OSCCON_HFXTALEN ? BITM_ALLON_OSCCON_HFXTALOK : 0) |
+			 (value & BITM_ALLON_OSCCON_HFOSCEN ? BITM_ALLON_OSCCON_HFOSCOK : 0) |
+			 (value & BITM_ALLON_OSCCON_LFOSCEN ? BITM_ALLON_OSCCON_LFOSCOK : 0);
+		break;
+	case REG_AFECON_TRIGSEQ:
+		for (uint32_t id = 0; id < 4 && !seq_hang; id++)
+		{
+			if (value & (1u << id))
+				sim_run(id);
+		}
+		return;
+	}
+	if (address == stuck_addr)
+		value = (value & ~stuck_mask) | (*reg(address) & stuck_mask);
+	*reg(address) = value;
+}
+
+void bridge_sim_reset(void)
+{
+	memset(regs, 0, sizeof(regs));
+	memset(sram, 0, sizeof(sram));
+	seq_hang = false;
+	fifo_head = fifo_cnt = 0;
+	write_cnt = 0;
+	src_rate = 0;
+	stuck_mask = 0;
+	*reg(REG_AFECON_ADIID) = AD5940_ADIID;
+	*reg(REG_AFECON_CHIPID) = AD5940_CHIPID;
+}
+
+void bridge_sim_poke(uint16_t address, uint32_t value)
+{
+	*reg(address) = value;
+}
+
+void bridge_sim_stuck(uint16_t address, uint32_t Mask)
+{
+	stuck_addr = address;
+	stuck_mask = Mask;
+}
+
+uint32_t bridge_sim_requests(void)
+{
+	return requests;
+}
+
+void bridge_sim_seq_hang(bool Hang)
+{
+	seq_hang = Hang;
+}
+
+uint32_t bridge_sim_fifo_push(const uint32_t *pData, uint32_t Count)
+{
+	uint32_t n = 0;
+
+	if (!(*reg(REG_AFE_FIFOCON) & BITM_AFE_FIFOCON_DATAFIFOEN))
+		return 0;
+	for (; n < Count && fifo_cnt < SIM_FIFO; n++, fifo_cnt++)
+		fifo[(fifo_head + fifo_cnt) % SIM_FIFO] = pData[n];
+	return n;
+}
+
+void bridge_sim_fifo_source(double Rate, float LatencyMin, float LatencyMax)
+{
+	src_rate = Rate;
+	src_lat_min = LatencyMin;
+	src_lat_max = LatencyMax;
+	src_start = sim_now();
+	src_next = 0;
+}
+
+double bridge_sim_fifo_time(uint64_t Index)
+{
+	return src_start + (Index + 1) / src_rate;
+}
+
+uint32_t bridge_sim_reg(uint16_t address)
+{
+	return *reg(address);
+}
+
+uint32_t bridge_sim_writes(uint16_t *pAddress, uint32_t Max)
+{
+	uint32_t n = write_cnt < SIM_WRITES ? write_cnt : SIM_WRITES;
+
+	n = n < Max ? n : Max;
+	memcpy(pAddress, writes, n * sizeof(uint16_t));
+	return write_cnt;
+}
+
+int serial_open_port(const char *device)
+{
+	(void)device;
+	return SIM_FD;
+}
+
+void serial_close_port(int fd)
+{
+	(void)fd;
+}
+
+int serial_flush_port(int fd)
+{
+	(void)fd;
+	return 0;
+}
+
+int serial_reset_hardware(int fd)
+{
+	(void)fd;
+	requests++;
+	bridge_sim_reset();
+	return 0;
+}
+
+static uint32_t sim_read(uint16_t address)
+{
+	uint32_t value;
+
+	if (address != REG_AFE_FIFOCNTSTA)
+	{
+		src_update();
+		return *reg(address);
+	}
+	/* The count is taken somewhere between request and reply */
+	if (src_rate > 0)
+		sim_latency();
+	src_update();
+	value = fifo_cnt << BITP_AFE_FIFOCNTSTA_DATAFIFOCNTSTA;
+	if (src_rate > 0)
+		sim_latency();
+	return value;
+}
+
+int serial_read_register(int fd, uint16_t address, uint32_t *value)
+{
+	(void)fd;
+	requests++;
+	*value = sim_read(address);
+	return 0;
+}
+
+int serial_write_register(int fd, uint16_t address, uint32_t value)
+{
+	(void)fd;
+	requests++;
+	sim_write(address, value);
+	return 0;
+}
+
+int serial_set_bits_register(int fd, uint16_t address, uint32_t value)
+{
+	(void)fd;
+	requests++;
+	sim_write(address, *reg(address) | value);
+	return 0;
+}
+
+int serial_clr_bits_register(int fd, uint16_t address, uint32_t value)
+{
+	(void)fd;
+	requests++;
+	sim_write(address, *reg(address) & ~value);
+	return 0;
+}
+
+int serial_wr_mask_register(int fd, uint16_t address, uint32_t mask, uint32_t value)
+{
+	(void)fd;
+	requests++;
+	sim_write(address, (*reg(address) & ~mask) | (value & mask));
+	return 0;
+}
+
+int serial_rd_fifo(int fd, uint32_t readcount, uint32_t *buffer)
+{
+	uint32_t n;
+
+	(void)fd;
+	requests++;
+	if (src_rate > 0)
+		sim_latency();
+	src_update();
+	for (n = 0; n < readcount && fifo_cnt; n++, fifo_cnt--)
+	{
+		buffer[n] = fifo[fifo_head];
+		fifo_head = (fifo_head + 1) % SIM_FIFO;
+	}
+	/* The words travel back with the reply */
+	if (src_rate > 0)
+	{
+		sim_sleep(readcount * SIM_WORD_TIME);
+		sim_latency();
+	}
+	return (int)n;
+}
+
+int serial_wr_seq(int fd, uint32_t start_addr, const uint32_t *words, uint32_t count)
+{
+	(void)fd;
+	requests += (count + SIM_SEQ_CHUNK - 1) / SIM_SEQ_CHUNK;
+	for (uint32_t i = 0; i < count; i++)
+		sram[(start_addr + i) % SIM_SRAM] = words[i];
+	return 0;
+}
+
+int serial_rd_regs(int fd, const uint16_t *addresses, uint32_t count, uint32_t *values)
+{
+	(void)fd;
+	requests += (count + SIM_REG_CHUNK - 1) / SIM_REG_CHUNK;
+	for (uint32_t i = 0; i < count; i++)
+		values[i] = sim_read(addresses[i]);
+	return 0;
+}
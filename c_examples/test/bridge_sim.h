@@ -0,0 +1,29 @@
+#ifndef _BRIDGE_SIM_H_
+#define _BRIDGE_SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Simulated bridge for the host checks: the link of ad5940_serial_link.h on a
+ * register file in memory, in place of ad5940_serial.c.
+ */
+
+void bridge_sim_reset(void);
+uint32_t bridge_sim_reg(uint16_t address);
+void bridge_sim_seq_hang(bool Hang); /* triggered sequences never run */
+uint32_t bridge_sim_fifo_push(const uint32_t *pData, uint32_t Count); /* words the FIFO took */
+/* FIFO fed by a clock at Rate words/s from when it is enabled; FIFO count and
+   FIFO reads take LatencyMin..LatencyMax per link leg. Rate 0: only
+   bridge_sim_fifo_push() */
+void bridge_sim_fifo_source(double Rate, float LatencyMin, float LatencyMax);
+double bridge_sim_fifo_time(uint64_t Index); /* CLOCK_MONOTONIC seconds word Index entered the FIFO */
+/* Addresses written since the reset in order, returns how many writes there were */
+uint32_t bridge_sim_writes(uint16_t *pAddress, uint32_t Max);
+/* Requests on the link since the start, counted as ad5940_serial.c would send
+   them; a reset does not clear the count */
+uint32_t bridge_sim_requests(void);
+void bridge_sim_poke(uint16_t address, uint32_t value); /* set a register, not a write */
+void bridge_sim_stuck(uint16_t address, uint32_t Mask); /* Mask bits ignore writes until the next reset */
+
+#endif // _BRIDGE_SIM_H_
@@ -0,0 +1,615 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ulog.h"
+#include "ad5940.h"
+#include "ad5940_log.h"
+#include "ad5940_pingpong.h"
+#include "ad5940_plan.h"
+#include "ad5940_snapshot.h"
+#include "ad5940_stream.h"
+#include "ad5940_trace.h"
+#include "bridge_sim.h"
+
+/* Checks that run without hardware, against the simulated bridge */
+
+#define PP_TEST_BLOCKS 7
+
+struct pp_test
+{
+	uint32_t Filled;
+	uint32_t Done;
+	int Errors;
+};
+
+static int pp_test_fill(void *ctx, uint32_t Slot, uint32_t *pBuffer, uint32_t MaxLen, uint32_t *pLen)
+{
+	struct pp_test *t = ctx;
+
+	(void)Slot;
+	*pLen = 0;
+	if (t->Filled == PP_TEST_BLOCKS || MaxLen < 2)
+		return 0;
+	pBuffer[0] = SEQ_WR(REG_AFE_WGFCW, t->Filled);
+	pBuffer[1] = SEQ_WAIT(100);
+	*pLen = 2;
+	t->Filled++;
+	return 0;
+}
+
+/* Blocks finish in the order they were filled, alternating A and B */
+static int pp_test_done(void *ctx, uint32_t Slot)
+{
+	struct pp_test *t = ctx;
+
+	if (Slot != t->Done % 2)
+		t->Errors++;
+	t->Done++;
+	return 0;
+}
+
+int ad5940_test_seq_optimize_toggles(void)
+{
+	/* WG and ADC off/on inside one wait-free segment, after a dead WGFCW write */
+	const uint32_t afecon[] = {
+		AFECTRL_WG | AFECTRL_ADCPWR, 0, AFECTRL_WG | AFECTRL_ADCPWR, AFECTRL_ADCPWR, 0,
+		AFECTRL_WG | AFECTRL_ADCPWR};
+	uint32_t seq[16], len = 0, n = 0;
+	SEQOptInfo_Type info;
+
+	seq[len++] = SEQ_WR(REG_AFE_WGFCW, 1);
+	seq[len++] = SEQ_WR(REG_AFE_WGFCW, 2);
+	for (uint32_t i = 0; i < sizeof(afecon) / sizeof(afecon[0]); i++)
+		seq[len++] = SEQ_WR(REG_AFE_AFECON, afecon[i]);
+	seq[len++] = SEQ_WAIT(16);
+
+	if (ad5940_SEQOptimize(seq, &len, &info) < 0)
+	{
+		log_error("SEQ optimize failed");
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < len; i++)
+	{
+		if (!SEQ_CMD_IS_WR(seq[i]) || SEQ_CMD_WR_REG(seq[i]) != REG_AFE_AFECON)
+			continue;
+		if (n >= sizeof(afecon) / sizeof(afecon[0]) || (seq[i] & 0xffffff) != afecon[n])
+		{
+			log_error("SEQ optimize: AFECON write %u is 0x%06x", n, seq[i] & 0xffffff);
+			return -1;
+		}
+		n++;
+	}
+	if (n != sizeof(afecon) / sizeof(afecon[0]) || info.DeadWrites != 1)
+	{
+		log_error("SEQ optimize: %u of %u AFECON writes kept, %u dead writes", n,
+			  (uint32_t)(sizeof(afecon) / sizeof(afecon[0])), info.DeadWrites);
+		return -1;
+	}
+	log_info("SEQ optimize keeps AFECON toggles pass");
+	return 0;
+}
+
+#define STREAM_TEST_RING 64  /* host ring words, wraps every couple of batches */
+#define STREAM_TEST_BATCH 40 /* words per drain, not a divisor of the ring */
+#define STREAM_TEST_ROUNDS 500
+
+struct stream_test
+{
+	uint32_t Next;   /* value of the next word, the FIFO gets a counter */
+	uint32_t Calls;
+	int Errors;
+};
+
+static void stream_test_consume(void *ctx, const uint32_t *pData, uint32_t Count)
+{
+	struct stream_test *t = ctx;
+
+	for (uint32_t i = 0; i < Count; i++)
+	{
+		if (pData[i] != t->Next + i)
+			t->Errors++;
+	}
+	t->Next += Count;
+	t->Calls++;
+}
+
+static void stream_test_consume_time(void *ctx, const uint32_t *pData, uint32_t Count,
+				     const StreamTime_Type *pTime)
+{
+	struct stream_test *t = ctx;
+
+	if (pTime->Index != t->Next)
+		t->Errors++;
+	stream_test_consume(ctx, pData, Count);
+}
+
+/* Counter words through a ring of STREAM_TEST_RING, both consumer flavours */
+static int stream_test_run(bool Timed)
+{
+	StreamCfg_Type cfg = {
+		.FIFOSrc = FIFOSRC_SINC3,
+		.FIFOSize = FIFOSIZE_2KB,
+		.WordRate = 1000,
+		.LinkLatency = 1e-5f,
+		.LinkWordTime = 1e-6f,
+		.RingWords = STREAM_TEST_RING,
+	};
+	struct ad5940_dev dev = {0};
+	struct ad5940_stream s;
+	struct stream_test t = {0};
+	StreamStat_Type stat;
+	uint32_t word[STREAM_TEST_BATCH], counter = 0;
+	int ret;
+
+	if (Timed)
+		cfg.ConsumeTime = stream_test_consume_time;
+	else
+		cfg.Consume = stream_test_consume;
+	cfg.ctx = &t;
+
+	bridge_sim_reset();
+	ret = ad5940_StreamStart(&dev, &s, &cfg);
+	for (uint32_t r = 0; r < STREAM_TEST_ROUNDS && ret >= 0; r++)
+	{
+		for (uint32_t i = 0; i < STREAM_TEST_BATCH; i++)
+			word[i] = counter++;
+		bridge_sim_fifo_push(word, STREAM_TEST_BATCH);
+		ret = ad5940_StreamPump(&dev, &s);
+		/* Let the consumer catch up, so the ring never drops */
+		while (atomic_load(&s.Tail) != atomic_load(&s.Head))
+			;
+	}
+	if (ret >= 0)
+		ret = ad5940_StreamStop(&dev, &s);
+	ad5940_StreamGetStat(&s, &stat);
+
+	if (ret < 0 || t.Errors || t.Next != counter || stat.WordsDropped ||
+	    t.Calls <= STREAM_TEST_ROUNDS || (bridge_sim_reg(REG_AFE_FIFOCON) & BITM_AFE_FIFOCON_DATAFIFOEN))
+	{
+		log_error("stream%s: ret %d, %u of %u words, %d errors, %u calls", Timed ? " (timed)" : "", ret,
+			  t.Next, counter, t.Errors, t.Calls);
+		return -1;
+	}
+	log_info("stream%s wraps a %u word ring %u times pass", Timed ? " (timed)" : "", STREAM_TEST_RING,
+		 counter / STREAM_TEST_RING);
+	return 0;
+}
+
+int ad5940_test_stream_wrap(void)
+{
+	return stream_test_run(false) < 0 || stream_test_run(true) < 0 ? -1 : 0;
+}
+
+int ad5940_test_pingpong(void)
+{
+	PingPongCfg_Type cfg = {.SlotAddr = {0, 32}, .SlotSize = 32, .TimeoutMs = 50};
+	struct ad5940_dev dev = {0};
+	struct ad5940_pingpong pp;
+	struct pp_test t = {0};
+	int ret;
+
+	bridge_sim_reset();
+	ret = ad5940_PingPongInit(&dev, &pp, &cfg);
+	if (ret >= 0)
+		ret = ad5940_PingPongRun(&dev, &pp, pp_test_fill, pp_test_done, &t);
+	if (ret < 0 || t.Done != PP_TEST_BLOCKS || t.Errors || pp.BlocksDone != PP_TEST_BLOCKS ||
+	    bridge_sim_reg(REG_AFE_WGFCW) != PP_TEST_BLOCKS - 1)
+	{
+		log_error("pingpong: ret %d, %u of %u blocks done, %d out of order", ret, t.Done,
+			  PP_TEST_BLOCKS, t.Errors);
+		return -1;
+	}
+	log_info("pingpong runs %u blocks pass", t.Done);
+
+	/* A sequencer that never ends a block must not hang the host */
+	memset(&t, 0, sizeof(t));
+	bridge_sim_seq_hang(true);
+	ret = ad5940_PingPongInit(&dev, &pp, &cfg);
+	if (ret >= 0)
+		ret = ad5940_PingPongRun(&dev, &pp, pp_test_fill, pp_test_done, &t);
+	bridge_sim_seq_hang(false);
+	if (ret != -ETIMEDOUT)
+	{
+		log_error("pingpong: hung sequencer returned %d", ret);
+		return -1;
+	}
+	log_info("pingpong times out pass");
+	return 0;
+}
+
+/* Point 0 sets WGFCW to 0x100, point 1 to 0x101, each with a wait */
+static int plan_test_gen(struct ad5940_dev *dev, void *ctx, uint32_t Point)
+{
+	(void)ctx;
+	ad5940_WriteReg(dev, REG_AFE_WGFCW, 0x100 + Point);
+	ad5940_WriteReg(dev, REG_AFE_WGAMPLITUDE, 0x200 + Point);
+	ad5940_SEQGenInsert(dev, SEQ_WAIT(160));
+	return 0;
+}
+
+int ad5940_test_plan_apply(void)
+{
+	struct ad5940_dev dev = {0};
+	struct ad5940_plan plan;
+	uint32_t p;
+	int ret;
+
+	bridge_sim_reset();
+	ret = ad5940_PlanInit(&plan, 16e6f);
+	plan.TimeoutMs = 20;
+	for (p = 0; p < 2 && ret >= 0; p++)
+		ret = ad5940_PlanAddPoint(&dev, &plan, plan_test_gen, NULL);
+	/* Apply in reverse order, every block writes whole registers */
+	for (p = plan.PointCnt; p-- > 0 && ret >= 0;)
+	{
+		ret = ad5940_PlanApply(&dev, &plan, p);
+		if (ret >= 0 && (bridge_sim_reg(REG_AFE_WGFCW) != 0x100 + p ||
+				 bridge_sim_reg(REG_AFE_WGAMPLITUDE) != 0x200 + p))
+			ret = -EIO;
+	}
+	if (ret < 0)
+	{
+		log_error("plan: apply returned %d, WGFCW 0x%x", ret, bridge_sim_reg(REG_AFE_WGFCW));
+		ad5940_PlanFree(&plan);
+		return -1;
+	}
+	log_info("plan applies %u points through the sequencer pass", plan.PointCnt);
+
+	/* A block that never ends must not hang the host */
+	bridge_sim_seq_hang(true);
+	ret = ad5940_PlanApply(&dev, &plan, 0);
+	bridge_sim_seq_hang(false);
+	ad5940_PlanFree(&plan);
+	if (ret != -ETIMEDOUT)
+	{
+		log_error("plan: hung sequencer returned %d", ret);
+		return -1;
+	}
+	log_info("plan times out pass");
+	return 0;
+}
+
+#define TRACE_TEST_PAYLOAD 256
+
+/* Cold init, then two plan points applied through the sequencer */
+static int trace_test_session(struct ad5940_dev *dev)
+{
+	struct ad5940_plan plan;
+	uint32_t p;
+	int ret;
+
+	ret = ad5940_init(dev);
+	if (ret < 0)
+		return ret;
+	ret = ad5940_PlanInit(&plan, 16e6f);
+	plan.TimeoutMs = 20;
+	for (p = 0; p < 2 && ret >= 0; p++)
+		ret = ad5940_PlanAddPoint(dev, &plan, plan_test_gen, NULL);
+	for (p = 0; p < plan.PointCnt && ret >= 0; p++)
+		ret = ad5940_PlanApply(dev, &plan, p);
+	ad5940_PlanFree(&plan);
+	ad5940_remove(dev);
+	return ret;
+}
+
+/* A session recorded on the simulated bridge replays through "replay:" with
+   every request matched, and the bridge sees none of them */
+int ad5940_test_trace_replay(void)
+{
+	char path[] = "/tmp/ad5940_trace_XXXXXX", port[64];
+	struct ad5940_dev dev = {.serial_port_name = "sim"};
+	struct ad5940_trace_reader r;
+	uint32_t payload[TRACE_TEST_PAYLOAD], recorded = 0;
+	ReplayStat_Type stat = {0};
+	TraceRec_Type rec;
+	uint16_t written[1];
+	int fd, ret;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+	{
+		log_error("trace: cannot create %s", path);
+		return -1;
+	}
+	close(fd);
+
+	setenv("AD5940_TRACE", path, 1);
+	ret = trace_test_session(&dev);
+	unsetenv("AD5940_TRACE");
+	if (ret >= 0 && (ret = ad5940_TraceOpen(&r, path)) >= 0)
+	{
+		while ((ret = ad5940_TraceNext(&r, &rec, payload, TRACE_TEST_PAYLOAD)) > 0)
+			recorded++;
+		ad5940_TraceClose(&r);
+	}
+
+	bridge_sim_reset();
+	snprintf(port, sizeof(port), "replay:%s", path);
+	dev.serial_port_name = port;
+	if (ret >= 0)
+		ret = trace_test_session(&dev);
+	ad5940_ReplayGetStat(&stat);
+	unlink(path);
+	if (ret < 0 || recorded == 0 || stat.Requests != recorded || stat.Mismatches ||
+	    bridge_sim_writes(written, 1) != 0)
+	{
+		log_error("trace: replay returned %d, %u of %u requests, %u mismatches", ret,
+			  stat.Requests, recorded, stat.Mismatches);
+		return -1;
+	}
+	log_info("trace replays %u requests pass", recorded);
+	return 0;
+}
+
+/* One ad5940_init() on the simulated bridge, returns the link requests it took */
+static int warm_test_init(struct ad5940_dev *dev, uint32_t *pRequests)
+{
+	uint32_t start = bridge_sim_requests();
+	int ret;
+
+	ret = ad5940_init(dev);
+	*pRequests = bridge_sim_requests() - start;
+	if (ret >= 0)
+		ad5940_remove(dev);
+	return ret;
+}
+
+/* Requests of a cold init, a warm init on the configured chip, a warm init
+   that reapplies one block, and a warm init whose signature a reapply cannot
+   fix, which falls back to the full init */
+int ad5940_test_warm_init(void)
+{
+	struct ad5940_dev dev = {.serial_port_name = "sim"};
+	uint32_t cold = 0, warm = 0, reapply = 0, stuck = 0, cold_writes;
+	uint16_t written[1];
+	int ret;
+
+	bridge_sim_reset();
+	ret = warm_test_init(&dev, &cold);
+	cold_writes = bridge_sim_writes(written, 1);
+
+	dev.warm_attach = true;
+	if (ret >= 0)
+		ret = warm_test_init(&dev, &warm);
+
+	/* A previous process changed the power mode: the platform block again */
+	bridge_sim_poke(REG_AFE_PMBW, BITM_AFE_PMBW_SYSHP);
+	if (ret >= 0)
+		ret = warm_test_init(&dev, &reapply);
+
+	/* The bit does not take until a reset */
+	bridge_sim_poke(REG_AFE_PMBW, BITM_AFE_PMBW_SYSHP);
+	bridge_sim_stuck(REG_AFE_PMBW, BITM_AFE_PMBW_SYSHP);
+	if (ret >= 0)
+		ret = warm_test_init(&dev, &stuck);
+
+	if (ret < 0 || warm * 4 > cold || reapply <= warm || reapply >= cold || stuck <= cold ||
+	    bridge_sim_writes(written, 1) != cold_writes || (bridge_sim_reg(REG_AFE_PMBW) & BITM_AFE_PMBW_SYSHP))
+	{
+		log_error("warm init: returned %d, requests cold %u, warm %u, reapply %u, stuck %u", ret, cold,
+			  warm, reapply, stuck);
+		return -1;
+	}
+	log_info("warm init takes %u requests, %u to reapply a block, %u to fall back, cold %u pass", warm,
+		 reapply, stuck, cold);
+	return 0;
+}
+
+#define LOG_TEST_STR 1000
+
+/* Strings longer than the record keep every character */
+int ad5940_test_log_long_str(void)
+{
+	LogCfg_Type cfg = {.Level = AD5940_LOG_LVL_TRACE};
+	char str[LOG_TEST_STR + 1], *out = NULL;
+	size_t size = 0;
+	int ret;
+
+	memset(str, 'x', LOG_TEST_STR);
+	str[LOG_TEST_STR - 1] = 'y';
+	str[LOG_TEST_STR] = '\0';
+	cfg.fp = open_memstream(&out, &size);
+	if (!cfg.fp)
+		return -1;
+	ret = ad5940_LogStart(&cfg);
+	if (ret >= 0)
+	{
+		AD5940_LOG_INFO("Sent: %s", str);
+		AD5940_LOG_INFO("short %s, long %s", "a", str);
+		ad5940_LogStop();
+	}
+	fclose(cfg.fp);
+
+	if (ret < 0 || !out || !strstr(out, "Sent: ") || strstr(strstr(out, "Sent: "), str) == NULL ||
+	    !strstr(out, "short a, long ") || strstr(strstr(out, "short a, long "), str) == NULL)
+	{
+		log_error("log: %d, a %u character string was cut off", ret, LOG_TEST_STR);
+		free(out);
+		return -1;
+	}
+	free(out);
+	log_info("log keeps a %u character string pass", LOG_TEST_STR);
+	return 0;
+}
+
+/* Oscillators, clocks, blocks and enables last. The oscillator only the
+   current state uses goes off once the clocks have moved away from it. */
+int ad5940_test_snapshot_restore_order(void)
+{
+	static const uint16_t order[] = {REG_ALLON_OSCCON, REG_AFECON_CLKSEL, REG_ALLON_OSCCON,
+					 REG_AFE_WGFCW, REG_AFE_AFECON, REG_AFE_SEQCON};
+	static const uint16_t ref_reg[] = {REG_ALLON_OSCCON, REG_AFECON_CLKSEL, REG_AFE_WGFCW,
+					   REG_AFE_AFECON, REG_AFE_SEQCON};
+	static const uint32_t ref_val[] = {BITM_ALLON_OSCCON_HFXTALEN | BITM_ALLON_OSCCON_LFOSCEN,
+					   SYSCLKSRC_XTAL, 0x1234, AFECTRL_WG | AFECTRL_ADCPWR,
+					   BITM_AFE_SEQCON_SEQEN};
+	Snapshot_Type ref = {0}, now = {0};
+	struct ad5940_dev dev = {0};
+	uint16_t written[64];
+	uint32_t n, k = 0;
+	int ret;
+
+	bridge_sim_reset();
+	for (int i = 0; i < SNAPSHOT_REG_COUNT; i++)
+		ref.Valid[i] = now.Valid[i] = true;
+	for (uint32_t i = 0; i < sizeof(ref_val) / sizeof(ref_val[0]); i++)
+		ref.Value[ad5940_SnapshotIndex(ref_reg[i])] = ref_val[i];
+	now.Value[ad5940_SnapshotIndex(REG_ALLON_OSCCON)] = BITM_ALLON_OSCCON_HFOSCEN | BITM_ALLON_OSCCON_LFOSCEN;
+
+	ret = ad5940_SnapshotRestore(&dev, &ref, &now);
+	n = bridge_sim_writes(written, 64);
+	for (uint32_t i = 0; i < n && i < 64 && k < sizeof(order) / sizeof(order[0]); i++)
+	{
+		if (written[i] == order[k])
+			k++;
+	}
+	if (ret != 5 || k != sizeof(order) / sizeof(order[0]) ||
+	    (bridge_sim_reg(REG_ALLON_OSCCON) & 0x7) != ref_val[0])
+	{
+		log_error("snapshot: restore returned %d, %u of %u writes in order, OSCCON 0x%x", ret, k,
+			  (unsigned)(sizeof(order) / sizeof(order[0])), bridge_sim_reg(REG_ALLON_OSCCON));
+		return -1;
+	}
+	log_info("snapshot restores in phases pass");
+	return 0;
+}
+
+#define STREAM_TS_RATE (2000 * 1.013) /* actual words/s, the nominal rate is 2000 */
+#define STREAM_TS_DEPTH 512           /* FIFOSIZE_2KB */
+#define STREAM_TS_LATENCY 2e-4f       /* plus up to 2ms per link leg */
+#define STREAM_TS_RUN 2.5             /* s */
+#define STREAM_TS_STALL_AT 1.2        /* s, the host stops pumping ... */
+#define STREAM_TS_STALL 0.5           /* ... for longer than the FIFO holds */
+#define STREAM_TS_PPM 1000            /* accepted period error, the nominal rate is 13000ppm off */
+/* The words lost in the overflow are known to the words that arrive during a
+   FIFO read, two link legs */
+#define STREAM_TS_INDEX_TOL ((int64_t)(2 * (STREAM_TS_LATENCY + 2e-3) * STREAM_TS_RATE) + 1)
+
+struct stream_ts_test
+{
+	uint64_t Words;
+	uint64_t IndexErrors; /* Index + i off by more than STREAM_TS_INDEX_TOL */
+	int64_t MaxIndexErr;
+	uint64_t OutOfBound;  /* time error above ErrBound */
+	double MaxErr;
+	float MaxBound;
+};
+
+static void stream_ts_consume(void *ctx, const uint32_t *pData, uint32_t Count, const StreamTime_Type *pTime)
+{
+	struct stream_ts_test *t = ctx;
+
+	for (uint32_t i = 0; i < Count; i++)
+	{
+		double err = fabs(pTime->Time + i * pTime->Period - bridge_sim_fifo_time(pData[i]));
+		int64_t diff = (int64_t)(pTime->Index + i) - (int64_t)pData[i];
+
+		if (diff < -STREAM_TS_INDEX_TOL || diff > STREAM_TS_INDEX_TOL)
+			t->IndexErrors++;
+		if (diff > t->MaxIndexErr || -diff > t->MaxIndexErr)
+			t->MaxIndexErr = diff < 0 ? -diff : diff;
+		if (err > pTime->ErrBound)
+			t->OutOfBound++;
+		if (err > t->MaxErr)
+			t->MaxErr = err;
+	}
+	if (pTime->ErrBound > t->MaxBound)
+		t->MaxBound = pTime->ErrBound;
+	t->Words += Count;
+}
+
+static double stream_ts_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Timestamps of a source 1.3% faster than nominal over a jittery link, with
+   a host stall that overflows the FIFO */
+int ad5940_test_stream_timestamps(void)
+{
+	StreamCfg_Type cfg = {
+		.FIFOSrc = FIFOSRC_SINC3,
+		.FIFOSize = FIFOSIZE_2KB,
+		.WordRate = 2000,
+		.ConsumeTime = stream_ts_consume,
+	};
+	struct ad5940_dev dev = {0};
+	struct ad5940_stream s;
+	struct stream_ts_test t = {0};
+	struct timespec stall = {0, (long)(STREAM_TS_STALL * 1e9)};
+	StreamStat_Type stat;
+	double start, ppm = 0;
+	bool stalled = false;
+	int ret;
+
+	bridge_sim_reset();
+	bridge_sim_fifo_source(STREAM_TS_RATE, STREAM_TS_LATENCY, STREAM_TS_LATENCY + 2e-3f);
+	cfg.ctx = &t;
+	start = stream_ts_now();
+	ret = ad5940_StreamStart(&dev, &s, &cfg);
+	while (ret >= 0 && stream_ts_now() - start < STREAM_TS_RUN)
+	{
+		if (!stalled && stream_ts_now() - start > STREAM_TS_STALL_AT)
+		{
+			/* The fit over the reads so far, the overflow starts it over */
+			ad5940_StreamGetStat(&s, &stat);
+			ppm = (stat.Period * STREAM_TS_RATE - 1) * 1e6;
+			nanosleep(&stall, NULL);
+			stalled = true;
+		}
+		ret = ad5940_StreamPump(&dev, &s);
+	}
+	ad5940_StreamGetStat(&s, &stat);
+	if (ret >= 0)
+		ret = ad5940_StreamStop(&dev, &s);
+	bridge_sim_fifo_source(0, 0, 0);
+	log_info("stream timestamps: %llu words, period %+.0fppm, time error up to %.2fms, bound up to %.2fms, "
+		 "%u overflows, %llu words lost, index off by up to %lld",
+		 (unsigned long long)t.Words, ppm, t.MaxErr * 1e3, t.MaxBound * 1e3, stat.FifoOverflows,
+		 (unsigned long long)stat.WordsLost, (long long)t.MaxIndexErr);
+	if (ret < 0 || s.FifoDepth != STREAM_TS_DEPTH || !stat.FifoOverflows || t.IndexErrors ||
+	    t.OutOfBound || fabs(ppm) > STREAM_TS_PPM)
+	{
+		log_error("stream timestamps: ret %d, %llu index errors, %llu words out of bound", ret,
+			  (unsigned long long)t.IndexErrors, (unsigned long long)t.OutOfBound);
+		return -1;
+	}
+	log_info("stream timestamps pass");
+	return 0;
+}
+
+int main(void)
+{
+	int failed = 0;
+
+	ulog_set_level(LOG_INFO);
+	bridge_sim_reset();
+
+	failed += ad5940_test_seq_optimize_toggles() < 0;
+	failed += ad5940_test_pingpong() < 0;
+	failed += ad5940_test_stream_wrap() < 0;
+	failed += ad5940_test_plan_apply() < 0;
+	failed += ad5940_test_trace_replay() < 0;
+	failed += ad5940_test_warm_init() < 0;
+	failed += ad5940_test_log_long_str() < 0;
+	failed += ad5940_test_snapshot_restore_order() < 0;
+	failed += ad5940_test_stream_timestamps() < 0;
+
+	if (failed)
+	{
+		log_error("%d host checks failed", failed);
+		return 1;
+	}
+	log_info("All host checks passed.");
+	return 0;
+}
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <emscripten.h>
+
+#include "ulog.h"
+
+#include "ad5940.h"
+#include "impedance.h"
+
+/*
+ * Entry points of the WebAssembly build, called from js_example/ad5940_wasm.js
+ * with ccall(..., {async: true}). They wrap the impedance example so that the
+ * browser runs the same driver and measurement code as the native build.
+ */
+
+static struct ad5940_dev ad594x = {0};
+
+static void structInit(void)
+{
+    app_impedance_t *p_cfg;
+
+    app_get_cfg(&p_cfg);
+
+    p_cfg->SinFreq = 1000;
+    p_cfg->HstiaRtiaSel = HSTIARTIA_5K;
+    p_cfg->RtiaCurrValue = (fImpCar_Type){5000, 0};
+    p_cfg->RcalVal = 10000.0;
+    p_cfg->TargetRelErr = 0; /* fixed DftNum, comparable with ad5940.js */
+    p_cfg->AutoRange = false;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int wasm_init(void)
+{
+    ulog_set_level(LOG_INFO);
+
+    ad594x.serial_port_name = "webserial";
+    int ret = ad5940_init(&ad594x);
+    if (ret < 0)
+    {
+        log_error("AD5940 init failed %d", ret);
+        return ret;
+    }
+
+    structInit();
+    return 0;
+}
+
+/* pRtia: {real, imag} */
+EMSCRIPTEN_KEEPALIVE
+int wasm_rtia_cal(float Freq, float *pRtia)
+{
+    app_impedance_t *p_cfg;
+
+    app_get_cfg(&p_cfg);
+    p_cfg->SinFreq = Freq;
+    int ret = app_RTIA_cal_cached(&ad594x);
+    if (ret < 0)
+        return ret;
+    pRtia[0] = p_cfg->RtiaCurrValue.Real;
+    pRtia[1] = p_cfg->RtiaCurrValue.Image;
+    return 0;
+}
+
+/* pResult: {magnitude, phase} */
+EMSCRIPTEN_KEEPALIVE
+int wasm_measure(float Freq, float *pResult)
+{
+    app_impedance_t *p_cfg;
+    fImpCar_Type impedance;
+    int ret = 0;
+
+    app_get_cfg(&p_cfg);
+    p_cfg->SinFreq = Freq;
+    ret |= app_RTIA_cal_cached(&ad594x);
+    ret |= app_ad_init(&ad594x);
+    ret |= app_measure(&ad594x, &impedance);
+    if (ret < 0)
+        return ret;
+
+    pResult[0] = ad5940_ComplexMagFloat(&impedance);
+    pResult[1] = ad5940_ComplexPhaseFloat(&impedance);
+    return 0;
+}
+
+/* Compiles and runs the sweep, pFreq, pMag and pPhase hold Points values.
+   Returns the number of points measured or a negative error code. */
+EMSCRIPTEN_KEEPALIVE
+int wasm_sweep(float Start, float Stop, uint32_t Points, int Log,
+               float *pFreq, float *pMag, float *pPhase)
+{
+    SoftSweepCfg_Type SweepCfg = {
+        .SweepEn = true,
+        .SweepIndex = 0,
+        .SweepLog = Log != 0,
+        .SweepPoints = Points,
+        .SweepStart = Start,
+        .SweepStop = Stop};
+    fImpPolArray_Type sweep = {pMag, pPhase};
+    app_plan_t plan;
+
+    int ret = app_plan_compile(&ad594x, &SweepCfg, &plan);
+    if (ret < 0)
+        return ret;
+    ret = app_plan_run(&ad594x, &plan, &sweep);
+    if (ret >= 0)
+    {
+        memcpy(pFreq, plan.pFreq, plan.Points * sizeof(float));
+        ret = (int)plan.Points;
+    }
+    app_plan_free(&plan);
+    return ret;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int wasm_remove(void)
+{
+    return ad5940_remove(&ad594x);
+}
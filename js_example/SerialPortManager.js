@@ -3,11 +3,36 @@ export class SerialPortManager {
     #encoder = new TextEncoder();
     #port = null;
     #id = 0;
-    #terminal = document.getElementById("terminal");
+    #requests = 0;        // requests sent, for benchmarks
+    #reader = null;
+    #writer = null;
+    #readLoopDone = null;
+    #pending = new Map(); // id -> { resolve, reject, timer }
+    #frames = [];         // frames without an id, for readJson
+    #waiters = [];        // readJson calls waiting for such a frame
+    #rx = "";             // received text not framed yet
+    #scan = 0;            // #rx up to here has been scanned
+    #start = 0;           // start of the frame being received
+    #depth = 0;
+    #inString = false;
+    #escape = false;
+    #terminal = globalThis.document ? document.getElementById("terminal") : null;
+    #log = null;
 
-    constructor() { }
+    // log(message, type) replaces the terminal, e.g. to forward from a worker
+    constructor(log = null) {
+        this.#log = log;
+    }
+
+    get requestCount() {
+        return this.#requests;
+    }
 
     logToTerminal(message, type = "default") {
+        if (this.#log) {
+            this.#log(message, type);
+            return;
+        }
         const logElement = document.createElement("div");
         logElement.textContent = message;
         logElement.className = `log-${type}`;
@@ -16,13 +41,20 @@ export class SerialPortManager {
     }
 
     clearTerminal() {
-        this.#terminal.innerHTML = "";
+        if (this.#terminal) {
+            this.#terminal.innerHTML = "";
+        }
     }
 
-    async openPort() {
+    // Without a port the user picks one, which needs a user gesture. A worker
+    // passes a port it got from navigator.serial.getPorts() instead.
+    async openPort(port = null) {
         try {
-            this.#port = await navigator.serial.requestPort();
+            this.#port = port ?? await navigator.serial.requestPort();
             await this.#port.open({ baudRate: 9600 });
+            this.#reader = this.#port.readable.getReader();
+            this.#writer = this.#port.writable.getWriter();
+            this.#readLoopDone = this.#readLoop(this.#reader);
             this.logToTerminal("Serial port opened.", "success");
         } catch (error) {
             console.error("Error opening serial port:", error);
@@ -35,6 +67,16 @@ export class SerialPortManager {
 
     async closePort() {
         try {
+            if (this.#reader) {
+                await this.#reader.cancel();
+                await this.#readLoopDone;
+                this.#reader = null;
+            }
+            if (this.#writer) {
+                this.#writer.releaseLock();
+                this.#writer = null;
+            }
+            this.#rejectAll(new Error("Serial port closed"));
             if (this.#port) {
                 await this.#port.close();
                 this.#port = null;
@@ -46,92 +88,150 @@ export class SerialPortManager {
         }
     }
 
-    async readJson(timeoutMs = 50) {
-        const reader = this.#port.readable.getReader();
+    // The only reader of the port for as long as it is open. Frames are handed
+    // to the request waiting for their id, frames without an id go to #frames.
+    async #readLoop(reader) {
         const decoder = new TextDecoder();
-        let buffer = "";
-        let jsonStarted = false;
-        let braceCount = 0;
-        const startTime = Date.now();
-
         try {
             while (true) {
-                const timeoutPromise = new Promise((_, reject) => setTimeout(() => reject(new Error("Timeout")), timeoutMs));
-
-                const { value, done } = await Promise.race([
-                    reader.read(),
-                    timeoutPromise,
-                ]);
-
-                if (done || !value) { break; };
-
-                const chunk = decoder.decode(value, { stream: true });
-
-                for (let char of chunk) {
-                    if (char === "{") {
-                        if (!jsonStarted) {
-                            jsonStarted = true;
-                            buffer = "";
-                            braceCount = 0;
-                        }
-                        braceCount++;
-                    }
-
-                    if (jsonStarted) {
-                        buffer += char;
-
-                        if (char === "}") {
-                            braceCount--;
-                            if (braceCount === 0) {
-                                try {
-                                    const json = JSON.parse(buffer);
-                                    reader.releaseLock();
-                                    return json;
-                                } catch (e) {
-                                    console.warn("Invalid JSON:", buffer);
-                                    jsonStarted = false;
-                                }
-                            }
-                        }
-                    }
-                }
-
-                if (Date.now() - startTime > timeoutMs) {
-                    throw new Error("Timeout waiting for complete JSON");
-                }
+                const { value, done } = await reader.read();
+                if (done) { break; }
+                this.#frame(decoder.decode(value, { stream: true }));
             }
-        } catch (err) {
-            console.error(err.message);
+        } catch (error) {
+            console.error("Serial read:", error);
+            this.#rejectAll(error);
         } finally {
             reader.releaseLock();
         }
+    }
+
+    // Cut complete {...} frames out of the stream. Braces inside strings do not
+    // count, bytes after a frame stay for the next one.
+    #frame(chunk) {
+        this.#rx += chunk;
+        let i = this.#scan;
+        for (; i < this.#rx.length; i++) {
+            const char = this.#rx[i];
+            if (this.#depth === 0) {
+                if (char === "{") {
+                    this.#start = i;
+                    this.#depth = 1;
+                }
+                continue;
+            }
+            if (this.#inString) {
+                if (this.#escape) {
+                    this.#escape = false;
+                } else if (char === "\\") {
+                    this.#escape = true;
+                } else if (char === "\"") {
+                    this.#inString = false;
+                }
+            } else if (char === "\"") {
+                this.#inString = true;
+            } else if (char === "{") {
+                this.#depth++;
+            } else if (char === "}" && --this.#depth === 0) {
+                this.#dispatch(this.#rx.slice(this.#start, i + 1));
+                this.#rx = this.#rx.slice(i + 1);
+                i = -1;
+            }
+        }
+        if (this.#depth === 0) {
+            // Nothing but noise between frames
+            this.#rx = "";
+            this.#scan = 0;
+        } else {
+            this.#rx = this.#rx.slice(this.#start);
+            this.#scan = this.#rx.length;
+            this.#start = 0;
+        }
+    }
+
+    #dispatch(text) {
+        let json;
+        try {
+            json = JSON.parse(text);
+        } catch (e) {
+            console.warn("Invalid JSON:", text);
+            return;
+        }
+        if (json.id !== undefined && json.id !== null) {
+            const pending = this.#pending.get(json.id);
+            if (!pending) {
+                // Its request timed out already, it must not pass for a later reply
+                console.warn(`Dropping response to request ${json.id}, nothing is waiting for it`);
+                return;
+            }
+            this.#pending.delete(json.id);
+            clearTimeout(pending.timer);
+            pending.resolve(json);
+        } else if (this.#waiters.length > 0) {
+            this.#waiters.shift()(json);
+        } else {
+            this.#frames.push(json);
+        }
+    }
+
+    #rejectAll(error) {
+        for (const pending of this.#pending.values()) {
+            clearTimeout(pending.timer);
+            pending.reject(error);
+        }
+        this.#pending.clear();
+        this.#rx = "";
+        this.#scan = 0;
+        this.#depth = 0;
+        this.#inString = false;
+        this.#escape = false;
+    }
 
-        return null;
+    // Next frame without an id (e.g. a greeting after reset), null if none
+    // arrives within timeoutMs. Late responses to timed out requests are
+    // dropped, never returned here.
+    async readJson(timeoutMs = 50) {
+        if (this.#frames.length > 0) {
+            return this.#frames.shift();
+        }
+        return new Promise((resolve) => {
+            const waiter = (json) => {
+                clearTimeout(timer);
+                resolve(json);
+            };
+            const timer = setTimeout(() => {
+                this.#waiters.splice(this.#waiters.indexOf(waiter), 1);
+                resolve(null);
+            }, timeoutMs);
+            this.#waiters.push(waiter);
+        });
     }
 
     async write(str) {
-        if (this.#port?.writable === null) {
+        if (!this.#writer) {
             console.warn("unable to find writable port");
             return;
         }
 
-        const writer = this.#port.writable.getWriter();
-        writer.write(this.#encoder.encode(str));
-        writer.releaseLock();
+        await this.#writer.write(this.#encoder.encode(str));
     }
 
-    async exchangeJsonRpc(method, params = {}, id = null, force_uint32 = true) {
+    // Requests can overlap: each one waits for the response with its own id.
+    async exchangeJsonRpc(method, params = {}, id = null, force_uint32 = true, timeoutMs = 1000) {
 
-        if (!id) {
+        if (id === null) {
             id = this.#id++;
         }
 
-
         if (!this.#port) {
             this.logToTerminal("Error: Serial Port not open.", "error");
             return null;
         }
 
+        if (this.#pending.has(id)) {
+            throw new Error(`Request ID ${id} already in flight`);
+        }
+
         const command = {
             method,
             id,
@@ -149,20 +249,39 @@ export class SerialPortManager {
             });
         }
 
+        const response = new Promise((resolve, reject) => {
+            const timer = setTimeout(() => {
+                this.#pending.delete(id);
+                reject(new Error(`No response to request ${id} (${method}) within ${timeoutMs}ms`));
+            }, timeoutMs);
+            this.#pending.set(id, { resolve, reject, timer });
+        });
+
         const commandString = JSON.stringify(command);
-        await this.write(commandString);
-        const jsonResponse = await this.readJson();
-        if (!jsonResponse) {
-            this.logToTerminal("Error: No valid JSON frame received", "error");
-            throw new Error("No valid JSON frame received");
+        this.#requests++;
+        try {
+            await this.write(commandString);
+        } catch (error) {
+            const pending = this.#pending.get(id);
+            if (pending) {
+                clearTimeout(pending.timer);
+                this.#pending.delete(id);
+            }
+            throw error;
         }
-        if (id !== jsonResponse.id) {
-            this.logToTerminal(`Error: Mismatched response ID: expected ${id}, got ${jsonResponse.id}`, "error");
-            throw new Error(`Mismatched response ID: expected ${id}, got ${jsonResponse.id}`);
+
+        let jsonResponse;
+        try {
+            jsonResponse = await response;
+        } catch (error) {
+            this.logToTerminal(`Error: ${error.message}`, "error");
+            throw error;
         }
         if (jsonResponse.error) {
             this.logToTerminal(`Error: ${JSON.stringify(jsonResponse.error)}`, "error");
-            throw new Error(`Error: ${JSON.stringify(jsonResponse.error)}`);
+            const error = new Error(`Error: ${JSON.stringify(jsonResponse.error)}`);
+            error.rpcError = jsonResponse.error;
+            throw error;
         }
         return jsonResponse;
     }
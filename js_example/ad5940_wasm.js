@@ -0,0 +1,90 @@
+// The C driver (c_examples) compiled to WebAssembly. Build it with emcmake,
+// see c_examples/README.md; the build copies ad5940_wasm.mjs and
+// ad5940_wasm.wasm next to this file. Every register access of the C code
+// comes back here and goes out through the SerialPortManager.
+
+export class AD5940Wasm {
+
+    #module = null;
+
+    static async load(serialManager) {
+        let createAD5940;
+        try {
+            ({ default: createAD5940 } = await import("./ad5940_wasm.mjs"));
+        } catch (e) {
+            throw new Error("ad5940_wasm.mjs not found, build c_examples with emcmake (see c_examples/README.md)");
+        }
+        const driver = new AD5940Wasm();
+        driver.#module = await createAD5940({
+            ad5940Transport: async (method, params) => {
+                // rpc_call() already sends unsigned words; the uint32 cast of
+                // exchangeJsonRpc would turn the wr_seq and rd_regs arrays into 0
+                const response = await serialManager.exchangeJsonRpc(method, params, null, false);
+                if (!response) {
+                    throw new Error("Serial Port not open");
+                }
+                return response.result;
+            },
+            print: (text) => serialManager.logToTerminal(text, "info"),
+            printErr: (text) => serialManager.logToTerminal(text, "info"),
+        });
+        return driver;
+    }
+
+    async #call(name, types = [], args = []) {
+        const ret = await this.#module.ccall(name, "number", types, args, { async: true });
+        if (ret < 0) {
+            throw new Error(`${name} failed (${ret})`);
+        }
+        return ret;
+    }
+
+    // Runs fn with a float buffer of count values on the wasm heap
+    async #withFloats(count, fn) {
+        const ptr = this.#module._malloc(count * 4);
+        try {
+            await fn(ptr);
+            return Array.from(this.#module.HEAPF32.subarray(ptr >> 2, (ptr >> 2) + count));
+        } finally {
+            this.#module._free(ptr);
+        }
+    }
+
+    async init() {
+        return await this.#call("wasm_init");
+    }
+
+    async rtiaCal(frequency) {
+        const [real, imag] = await this.#withFloats(2, (ptr) =>
+            this.#call("wasm_rtia_cal", ["number", "number"], [frequency, ptr]));
+        return { real, imag };
+    }
+
+    async measure(frequency) {
+        const [magnitude, phase] = await this.#withFloats(2, (ptr) =>
+            this.#call("wasm_measure", ["number", "number"], [frequency, ptr]));
+        return { magnitude, phase };
+    }
+
+    async sweep(start, stop, points, log = true) {
+        let n = 0;
+        const values = await this.#withFloats(3 * points, async (ptr) => {
+            n = await this.#call("wasm_sweep",
+                ["number", "number", "number", "number", "number", "number", "number"],
+                [start, stop, points, log ? 1 : 0, ptr, ptr + 4 * points, ptr + 8 * points]);
+        });
+        const result = [];
+        for (let i = 0; i < n; i++) {
+            result.push({
+                frequency: values[i],
+                magnitude: values[points + i],
+                phase: values[2 * points + i],
+            });
+        }
+        return result;
+    }
+
+    async remove() {
+        return await this.#call("wasm_remove");
+    }
+}
@@ -1,13 +1,7 @@
-import { AD5940 } from "./ad5940_reg.js";
-import {
-    ad5940_CLKCfg, ad5940_FIFOCfg, ad5940_INTCCfg, ad5940_INTCClrFlag, ad5940_REFCfgS,
-    ad5940_AFECtrlS, ad5940_HSDacCfgS, ad5940_HSTIACfgS, ad5940_SWMatrixCfgS, ad5940_WGCfgS,
-    ad5940_WGFreqWordCal, ad5940_ADCBaseCfgS, ad5940_ADCFilterCfgS, ad5940_DFTCfgS, convertDftToInt,
-    ad5940_ADCMuxCfgS, ad5940_HSRtiaCal, ad5940_Initialize, complexDiv, complexMag, complexPhase,
-    ad5940_SweepNext, ad5940_AFEPwrBW,
-} from "./ad5940.js";
+import { appCfg, initAD5940, app_RTIA_cal, measure_impedance } from "./impedance.js";
 import { test_bit_functions, testWriteReadRandom } from "./test.js";
 import { SerialPortManager } from "./SerialPortManager.js";
+import { AD5940Wasm } from "./ad5940_wasm.js";
 
 const serialManager = new SerialPortManager();
 
@@ -15,29 +9,24 @@ function delay(ms) {
     return new Promise(resolve => setTimeout(resolve, ms));
 }
 
-const appCfg = {
-    SysClkFreq: 16000000,
-    AdcClkFreq: 16000000,
-    RcalVal: 10000.0,
-    HstiaRtiaSel: AD5940.HSTIARTIA_5K,
-    CtiaSel: 16,
-    VoutPP: 800,
-    SinFreq: 1000,
-    ADCSinc3Osr: AD5940.ADCSINC3OSR_2,
-    ADCSinc2Osr: AD5940.ADCSINC2OSR_22,
-    DftNum: AD5940.DFTNUM_8192,
-    DftSrc: AD5940.DFTSRC_SINC3,
-    dft_loop_max: 10,
-};
+const BENCH_COUNT = 5;
+
+// The buttons run the C driver of c_examples, built to WebAssembly. ad5940.js
+// is only the baseline of the benchmark.
+async function initWasm(serialManager) {
+    const driver = await AD5940Wasm.load(serialManager);
+    await driver.init();
+    return driver;
+}
+
 
 document.getElementById("rtia-cal").addEventListener("click", async () => {
     try {
         let open = await serialManager.openPort();
         if (!open) { return; }
         await delay(50);
-        await initAD5940(serialManager);
-        let rtiaResult = {};
-        await app_RTIA_cal(serialManager, rtiaResult, appCfg.SinFreq);
+        const driver = await initWasm(serialManager);
+        const rtiaResult = await driver.rtiaCal(appCfg.SinFreq);
         serialManager.logToTerminal(`RTIA calibrated: ${JSON.stringify(rtiaResult)}`, "success");
     } catch (e) {
         console.error("Error:", e);
@@ -51,12 +40,8 @@ document.getElementById("mes-impedance").addEventListener("click", async () => {
         let open = await serialManager.openPort();
         if (!open) { return; }
         await delay(50);
-        await initAD5940(serialManager);
-        let rtiaResult = {};
-        await app_RTIA_cal(serialManager, rtiaResult, appCfg.SinFreq);
-        serialManager.logToTerminal(`RTIA calibrated: ${JSON.stringify(rtiaResult)}`, "success");
-        let impedance = {};
-        await measure_impedance(impedance, appCfg.SinFreq, rtiaResult);
+        const driver = await initWasm(serialManager);
+        const impedance = await driver.measure(appCfg.SinFreq);
         serialManager.logToTerminal(`Impedance: ${JSON.stringify(impedance)}`, "success");
     } catch (e) {
         console.error("Error:", e);
@@ -65,40 +50,109 @@ document.getElementById("mes-impedance").addEventListener("click", async () => {
     await serialManager.closePort();
 });
 
+// The sweep runs in sweep_worker.js; points arrive in batches and extend the
+// plot while the page stays responsive
+let sweepWorker = null;
+
 document.getElementById("mes-impedance-ext").addEventListener("click", async () => {
-    let data_body_plot = [];
+    if (sweepWorker) { return; }
+    let port;
+    try {
+        port = await navigator.serial.requestPort();
+    } catch (e) {
+        serialManager.logToTerminal("Error: " + e.message, "error");
+        return;
+    }
+    const sweep = {
+        sweep_start: 1000,
+        sweep_stop: 150000,
+        sweep_points: 10,
+        sweep_log: true,
+    };
+    const plot = createBodePlot();
+    const progress = document.getElementById("sweep-progress");
+    const stop = document.getElementById("stop-sweep");
+    progress.max = sweep.sweep_points;
+    progress.value = 0;
+    stop.disabled = false;
+
+    const worker = new Worker(new URL("./sweep_worker.js", import.meta.url), { type: "module" });
+    sweepWorker = worker;
+    const finish = () => {
+        worker.terminate();
+        sweepWorker = null;
+        stop.disabled = true;
+    };
+    worker.onmessage = ({ data }) => {
+        switch (data.type) {
+            case "log":
+                serialManager.logToTerminal(data.message, data.level);
+                break;
+            case "points":
+                plot.extend(data.frequency, data.magnitude, data.phase);
+                progress.value = data.index + data.frequency.length;
+                for (let i = 0; i < data.frequency.length; i++) {
+                    serialManager.logToTerminal(`Frequency: ${data.frequency[i]} magnitude: ${data.magnitude[i]} phase: ${data.phase[i]}`, "success");
+                }
+                break;
+            case "done":
+                serialManager.logToTerminal(`Sweep ${data.cancelled ? "stopped" : "done"}, ${data.count} points`, "success");
+                finish();
+                break;
+            case "error":
+                serialManager.logToTerminal("Error: " + data.message, "error");
+                finish();
+                break;
+        }
+    };
+    worker.onerror = (e) => {
+        serialManager.logToTerminal("Error: " + e.message, "error");
+        finish();
+    };
+    worker.postMessage({ type: "sweep", portInfo: port.getInfo(), sweep });
+});
+
+document.getElementById("stop-sweep").addEventListener("click", () => {
+    if (sweepWorker) {
+        sweepWorker.postMessage({ type: "cancel" });
+    }
+});
+
+// Same measurement, N times, on the ad5940.js baseline and on the wasm driver. Both pay for
+// one RTIA calibration up front; the serial link dominates either way, so the
+// request count is printed next to the time.
+document.getElementById("bench-wasm").addEventListener("click", async () => {
     try {
         let open = await serialManager.openPort();
         if (!open) { return; }
         await delay(50);
+
         await initAD5940(serialManager);
-        let sweep = {
-            sweep_start: 1000,
-            sweep_stop: 150000,
-            sweep_points: 10,
-            sweep_log: true,
-            sweep_index: 0,
-        };
-        let frequency = 0;
-        while (frequency < sweep.sweep_stop) {
-            frequency = ad5940_SweepNext(sweep);
-            serialManager.logToTerminal(`Frequency: ${frequency}`, "success");
-            let rtiaResult = {};
-            await app_RTIA_cal(serialManager, rtiaResult, frequency);
-            serialManager.logToTerminal(`RTIA calibrated: ${JSON.stringify(rtiaResult)}`, "success");
-            let impedance = {};
-            await measure_impedance(impedance, frequency, rtiaResult);
-            impedance.frequency = frequency;
-            serialManager.logToTerminal(`Impedance: ${JSON.stringify(impedance)}`, "success");
-            data_body_plot.push(impedance);
+        let rtiaResult = {};
+        await app_RTIA_cal(serialManager, rtiaResult, appCfg.SinFreq);
+        let requests = serialManager.requestCount;
+        let start = performance.now();
+        let impedance = {};
+        for (let i = 0; i < BENCH_COUNT; i++) {
+            await measure_impedance(serialManager, impedance, appCfg.SinFreq, rtiaResult);
+        }
+        let ms = (performance.now() - start) / BENCH_COUNT;
+        serialManager.logToTerminal(`ad5940.js: ${ms.toFixed(1)}ms, ${(serialManager.requestCount - requests) / BENCH_COUNT} requests per measurement, ${JSON.stringify(impedance)}`, "success");
+
+        const driver = await initWasm(serialManager);
+        await driver.rtiaCal(appCfg.SinFreq);
+        requests = serialManager.requestCount;
+        start = performance.now();
+        for (let i = 0; i < BENCH_COUNT; i++) {
+            impedance = await driver.measure(appCfg.SinFreq);
         }
+        ms = (performance.now() - start) / BENCH_COUNT;
+        serialManager.logToTerminal(`wasm: ${ms.toFixed(1)}ms, ${(serialManager.requestCount - requests) / BENCH_COUNT} requests per measurement, ${JSON.stringify(impedance)}`, "success");
     } catch (e) {
         console.error("Error:", e);
         serialManager.logToTerminal("Error: " + e.message, "error");
     }
     await serialManager.closePort();
-    console.log(data_body_plot);
-    show_Bode_Plot(data_body_plot);
 });
 
 document.getElementById("clear-terminal").addEventListener("click", () => {
@@ -122,205 +176,8 @@ document.getElementById("run-test").addEventListener("click", async () => {
     await serialManager.closePort();
 });
 
-async function appReadDft(serialManager) {
-    await ad5940_AFECtrlS(serialManager, AD5940.AFECTRL_ADCPWR | AD5940.AFECTRL_WG, true);
-    await serialManager.exchangeJsonRpc("wr", { address: AD5940.DFTREAL.address, data: 0 });
-    await serialManager.exchangeJsonRpc("wr", { address: AD5940.DFTIMAG.address, data: 0 });
-    await ad5940_AFECtrlS(serialManager, AD5940.AFECTRL_ADCCNV | AD5940.AFECTRL_DFT, true);
-    let loopCnt = 0;
-    let regDataReal = 0, regDataImag = 0;
-    do {
-        let realResp = await serialManager.exchangeJsonRpc("rd", { address: AD5940.DFTREAL.address });
-        let imagResp = await serialManager.exchangeJsonRpc("rd", { address: AD5940.DFTIMAG.address });
-        regDataReal = realResp.result;
-        regDataImag = imagResp.result;
-        loopCnt++;
-    } while ((regDataReal === 0 || regDataImag === 0) && loopCnt < appCfg.dft_loop_max);
-    await ad5940_AFECtrlS(
-        serialManager,
-        AD5940.AFECTRL_ADCCNV | AD5940.AFECTRL_DFT | AD5940.AFECTRL_WG | AD5940.AFECTRL_ADCPWR, false);
-    if (loopCnt < appCfg.dft_loop_max) {
-        const real = convertDftToInt(regDataReal);
-        const imag = convertDftToInt(regDataImag);
-        serialManager.logToTerminal(`DFT results Real: ${real}, Imag: ${imag}, loop cnt: ${loopCnt}`, "info");
-        return { real, imag, loopCnt };
-    }
-    const real = 0;
-    const imag = 0;
-    return { real, imag, loopCnt };
-}
-
-async function initAD5940(serialManager) {
-    await serialManager.readJson();
-    await serialManager.exchangeJsonRpc("reset", {});
-    let adiid = await serialManager.exchangeJsonRpc("rd", { address: AD5940.ADIID.address });
-    let ad_ok = (adiid.result === AD5940.ADIID.reset);
-    let chipid = await serialManager.exchangeJsonRpc("rd", { address: AD5940.CHIPID.address });
-    let chip_ok = (chipid.result & AD5940.CHIPID.BITM_PARTID) === AD5940.CHIPID.reset;
-    let chip_revision = chipid.result & AD5940.CHIPID.BITM_REVISION;
-    if (ad_ok && chip_ok) {
-        serialManager.logToTerminal("AD5940 chip detected.", "success");
-        serialManager.logToTerminal(`Chip Revision: ${chip_revision}`, "info");
-    } else {
-        serialManager.logToTerminal("AD5940 chip not detected.", "error");
-        await serialManager.closePort();
-        return;
-    }
-    await ad5940_Initialize(serialManager);
-    const clkCfg = {
-        HFXTALEn: false,
-        HFOSCEn: true,
-        LFOSCEn: true,
-        HfOSC32MHzMode: false,
-        SysClkSrc: AD5940.ADCCLKSRC_HFOSC,
-        SysClkDiv: AD5940.SYSCLKDIV_1,
-        ADCCLkSrc: AD5940.ADCCLKSRC_HFOSC,
-        ADCClkDiv: AD5940.ADCCLKDIV_1,
-    };
-    await ad5940_CLKCfg(serialManager, clkCfg);
-    let fifo_cfg = {
-        FIFOEn: false,
-        FIFOMode: AD5940.FIFOMODE_FIFO,
-        FIFOSize: AD5940.FIFOSIZE_4KB,
-        FIFOSrc: AD5940.FIFOSRC_DFT,
-        FIFOThresh: 2,
-    };
-    await ad5940_FIFOCfg(serialManager, fifo_cfg);
-    fifo_cfg.FIFOEn = true;
-    await ad5940_FIFOCfg(serialManager, fifo_cfg);
-    await ad5940_INTCCfg(serialManager, AD5940.AFEINTC_1, AD5940.AFEINTSRC_ALLINT, true);
-    await ad5940_INTCCfg(serialManager, AD5940.AFEINTC_0, AD5940.AFEINTSRC_DATAFIFOTHRESH, true);
-    await ad5940_INTCClrFlag(serialManager, AD5940.AFEINTSRC_ALLINT);
-    await ad5940_AFECtrlS(serialManager, AD5940.AFECTRL_HPREFPWR | AD5940.AFECTRL_HSTIAPWR |
-        AD5940.AFECTRL_INAMPPWR | AD5940.AFECTRL_EXTBUFPWR | AD5940.AFECTRL_DACREFPWR |
-        AD5940.AFECTRL_HSDACPWR | AD5940.AFECTRL_SINC2NOTCH, true);
-    await ad5940_AFEPwrBW(serialManager, AD5940.AFEPWR_HP, AD5940.AFEBW_250KHZ);
-}
-
-async function app_RTIA_cal(serialManager, rtiaResult, frequency) {
-    const hsrtia_cal = {
-        fFreq: frequency,
-        fRcal: appCfg.RcalVal,
-        SysClkFreq: appCfg.SysClkFreq,
-        AdcClkFreq: appCfg.AdcClkFreq,
-        ADCSinc2Osr: appCfg.ADCSinc2Osr,
-        ADCSinc3Osr: appCfg.ADCSinc3Osr,
-        bPolarResult: false,
-        DftCfg: {
-            DftNum: appCfg.DftNum,
-            DftSrc: appCfg.DftSrc,
-            HanWinEn: true,
-        },
-        HsTiaCfg: {
-            DiodeClose: false,
-            HstiaBias: AD5940.HSTIABIAS_1P1,
-            HstiaCtia: 16,
-            HstiaDeRload: AD5940.HSTIADERLOAD_OPEN,
-            HstiaDeRtia: AD5940.HSTIADERTIA_OPEN,
-            HstiaRtiaSel: appCfg.HstiaRtiaSel,
-        },
-    };
-    hsrtia_cal.bPolarResult = false;
-    return await ad5940_HSRtiaCal(serialManager, hsrtia_cal, rtiaResult);
-}
-
-async function measure_impedance(impedance_result, frequency, rtia) {
-    const bufCfg = {
-        HpBandgapEn: true,
-        Hp1V1BuffEn: true,
-        Hp1V8BuffEn: true,
-        Disc1V1Cap: false,
-        Disc1V8Cap: false,
-        Hp1V8ThemBuff: false,
-        Hp1V8Ilimit: false,
-        Lp1V1BuffEn: false,
-        Lp1V8BuffEn: false,
-        LpBandgapEn: false,
-        LpRefBufEn: false,
-        LpRefBoostEn: false,
-    };
-    await ad5940_REFCfgS(serialManager, bufCfg);
-    const hsDacCfg = {
-        ExcitBufGain: AD5940.EXCITBUFGAIN_2,
-        HsDacGain: AD5940.HSDACGAIN_1,
-        HsDacUpdateRate: 7,
-    };
-    await ad5940_HSDacCfgS(serialManager, hsDacCfg);
-    const hsTiaCfg = {
-        HstiaBias: AD5940.HSTIABIAS_1P1,
-        HstiaCtia: appCfg.CtiaSel,
-        HstiaRtiaSel: appCfg.HstiaRtiaSel,
-        DiodeClose: false,
-        HstiaDeRtia: AD5940.HSTIADERTIA_OPEN,
-        HstiaDeRload: AD5940.HSTIADERLOAD_OPEN,
-    };
-    await ad5940_HSTIACfgS(serialManager, hsTiaCfg);
-    const swMatrixCfg = {
-        Dswitch: AD5940.SWD_CE0,
-        Pswitch: AD5940.SWP_RE0,
-        Nswitch: AD5940.SWN_SE0,
-        Tswitch: (AD5940.SWT_SE0LOAD | AD5940.SWT_TRTIA),
-    };
-    await ad5940_SWMatrixCfgS(serialManager, swMatrixCfg);
-    const wgCfg = {
-        WgType: AD5940.WGTYPE_SIN,
-        SinCfg: {
-            SinFreqWord: ad5940_WGFreqWordCal(frequency, appCfg.SysClkFreq),
-            SinAmplitudeWord: (appCfg.VoutPP / (2 * 800) * 2047 + 0.5) >>> 0,
-            SinOffsetWord: 0,
-            SinPhaseWord: 0,
-        },
-        GainCalEn: false,
-        OffsetCalEn: false,
-    };
-    await ad5940_WGCfgS(serialManager, wgCfg);
-    const adcConfig = {
-        ADCMuxN: AD5940.ADCMUXP_HSTIA_N,
-        ADCMuxP: AD5940.ADCMUXP_HSTIA_P,
-        ADCPga: AD5940.ADCPGA_1,
-    };
-    await ad5940_ADCBaseCfgS(serialManager, adcConfig);
-    const filtCfg = {
-        ADCSinc3Osr: AD5940.ADCSINC3OSR_2,
-        ADCSinc2Osr: AD5940.ADCSINC2OSR_22,
-        ADCAvgNum: AD5940.ADCAVGNUM_16,
-        ADCRate: AD5940.ADCRATE_800KHZ,
-        BpNotch: true,
-        BpSinc3: false,
-        Sinc2NotchEnable: true,
-        DFTClkEnable: true,
-        Sinc2NotchClkEnable: true,
-        WGClkEnable: true,
-    };
-    await ad5940_ADCFilterCfgS(serialManager, filtCfg);
-    const dftCfg = {
-        DftNum: appCfg.DftNum,
-        DftSrc: appCfg.DftSrc,
-        HanWinEn: true,
-    };
-    await ad5940_DFTCfgS(serialManager, dftCfg);
-    await ad5940_AFECtrlS(serialManager, AD5940.AFECTRL_HSTIAPWR |
-        AD5940.AFECTRL_INAMPPWR | AD5940.AFECTRL_EXTBUFPWR | AD5940.AFECTRL_DACREFPWR |
-        AD5940.AFECTRL_HSDACPWR | AD5940.AFECTRL_SINC2NOTCH, true);
-    let dftCurr = await appReadDft(serialManager);
-    await ad5940_ADCMuxCfgS(serialManager, AD5940.ADCMUXP_VCE0, AD5940.ADCMUXN_N_NODE);
-    let dftVolt = await appReadDft(serialManager);
-    dftCurr.real *= -1;
-    dftCurr.imag *= -1;
-    let res = complexDiv(dftCurr, rtia);
-    res = complexDiv(dftVolt, res);
-    let bPolarResult = false;
-    if (bPolarResult) {
-        impedance_result.real = res.real;
-        impedance_result.imag = res.imag;
-    } else {
-        impedance_result.magnitude = complexMag(res.real, res.imag);
-        impedance_result.phase = complexPhase(res.real, -res.imag);
-    }
-    return 0;
-}
-
-function show_Bode_Plot(impedance_data) {
+// Opens the plot window with empty traces; extend() appends a batch of points
+function createBodePlot() {
     const chartWindow = new WinBox({
         title: "Bode Plot",
         width: "1000px",
@@ -354,12 +211,9 @@ function show_Bode_Plot(impedance_data) {
     chartDiv.style.width = "100%";
     chartDiv.style.height = "100%";
     chartContainer.appendChild(chartDiv);
-    const frequencies = impedance_data.map(item => item.frequency);
-    const magnitudes = impedance_data.map(item => item.magnitude);
-    const phases = impedance_data.map(item => item.phase * 180 / Math.PI);
     const magnitudeTrace = {
-        x: frequencies,
-        y: magnitudes,
+        x: [],
+        y: [],
         type: "scatter",
         mode: "lines+markers",
         name: "Magnitude",
@@ -369,8 +223,8 @@ function show_Bode_Plot(impedance_data) {
         line: { width: 2, color: "blue" },
     };
     const phaseTrace = {
-        x: frequencies,
-        y: phases,
+        x: [],
+        y: [],
         type: "scatter",
         mode: "lines+markers",
         name: "Phase",
@@ -416,4 +270,11 @@ function show_Bode_Plot(impedance_data) {
         },
     };
     Plotly.newPlot(chartDiv, data, layout);
+    return {
+        extend(frequency, magnitude, phase) {
+            const x = Array.from(frequency);
+            const degrees = Array.from(phase, (p) => p * 180 / Math.PI);
+            Plotly.extendTraces(chartDiv, { x: [x, x], y: [Array.from(magnitude), degrees] }, [0, 1]);
+        },
+    };
 }
\ No newline at end of file
@@ -0,0 +1,115 @@
+// Sweep acquisition off the UI thread. The page picks the port (requestPort
+// needs a user gesture) and sends its USB ids; the worker finds the same port
+// with getPorts(), runs the sweep on the wasm C driver and posts the results
+// as typed arrays.
+//
+// page -> worker: { type: "sweep", portInfo, sweep }, { type: "cancel" }
+// worker -> page: { type: "log", message, level }
+//                 { type: "points", index, frequency, magnitude, phase }
+//                 { type: "done", count, cancelled } or { type: "error", message }
+import { SerialPortManager } from "./SerialPortManager.js";
+import { AD5940Wasm } from "./ad5940_wasm.js";
+
+const BATCH_MS = 100; // post at most this often, one point usually takes longer
+
+const serialManager = new SerialPortManager((message, level) =>
+    postMessage({ type: "log", message, level }));
+
+let cancelled = false;
+
+// Collects points and posts them as one message with transferred buffers
+class PointBatch {
+    #index = 0;
+    #frequency = [];
+    #magnitude = [];
+    #phase = [];
+    #last = -Infinity;
+
+    push(frequency, magnitude, phase) {
+        this.#frequency.push(frequency);
+        this.#magnitude.push(magnitude);
+        this.#phase.push(phase);
+        if (performance.now() - this.#last >= BATCH_MS) {
+            this.flush();
+        }
+    }
+
+    flush() {
+        const count = this.#frequency.length;
+        if (count === 0) { return; }
+        const frequency = Float64Array.from(this.#frequency);
+        const magnitude = Float64Array.from(this.#magnitude);
+        const phase = Float64Array.from(this.#phase);
+        postMessage({ type: "points", index: this.#index, frequency, magnitude, phase },
+            [frequency.buffer, magnitude.buffer, phase.buffer]);
+        this.#index += count;
+        this.#frequency = [];
+        this.#magnitude = [];
+        this.#phase = [];
+        this.#last = performance.now();
+    }
+
+    get count() {
+        return this.#index + this.#frequency.length;
+    }
+}
+
+// Frequency of point index, in the steps of SweepNext in the C driver
+function sweepFrequency(sweep, index) {
+    const t = sweep.sweep_points > 1 ? index / (sweep.sweep_points - 1) : 0;
+    if (sweep.sweep_log) {
+        return sweep.sweep_start * Math.pow(sweep.sweep_stop / sweep.sweep_start, t);
+    }
+    return sweep.sweep_start + (sweep.sweep_stop - sweep.sweep_start) * t;
+}
+
+async function findPort(portInfo) {
+    const ports = await navigator.serial.getPorts();
+    return ports.find((port) => {
+        const info = port.getInfo();
+        return info.usbVendorId === portInfo.usbVendorId &&
+            info.usbProductId === portInfo.usbProductId;
+    }) ?? null;
+}
+
+async function runSweep({ portInfo, sweep }) {
+    const port = await findPort(portInfo);
+    if (!port) {
+        throw new Error("Serial port not granted to the worker");
+    }
+    if (!await serialManager.openPort(port)) {
+        throw new Error("Serial port could not be opened");
+    }
+    await new Promise((resolve) => setTimeout(resolve, 50));
+
+    const batch = new PointBatch();
+    try {
+        const driver = await AD5940Wasm.load(serialManager);
+        await driver.init();
+        for (let i = 0; i < sweep.sweep_points && !cancelled; i++) {
+            const frequency = sweepFrequency(sweep, i);
+            const impedance = await driver.measure(frequency);
+            batch.push(frequency, impedance.magnitude, impedance.phase);
+        }
+    } finally {
+        batch.flush();
+        await serialManager.closePort();
+    }
+    return batch.count;
+}
+
+self.onmessage = async ({ data }) => {
+    if (data.type === "cancel") {
+        cancelled = true;
+        return;
+    }
+    if (data.type !== "sweep") { return; }
+    cancelled = false;
+    try {
+        const count = await runSweep(data);
+        postMessage({ type: "done", count, cancelled });
+    } catch (e) {
+        console.error("Error:", e);
+        postMessage({ type: "error", message: e.message });
+    }
+};